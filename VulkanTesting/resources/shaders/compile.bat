@@ -1,3 +1,14 @@
 rm *.spv
 C:\VulkanSDK\1.3.216.0\Bin\glslc.exe shader.vert -o vert.spv
-C:\VulkanSDK\1.3.216.0\Bin\glslc.exe shader.frag -o frag.spv
\ No newline at end of file
+C:\VulkanSDK\1.3.216.0\Bin\glslc.exe -DOBJECT_PUSH_CONSTANTS shader.vert -o vert_objectpush.spv
+C:\VulkanSDK\1.3.216.0\Bin\glslc.exe -DOBJECT_RING_BUFFER shader.vert -o vert_objectring.spv
+C:\VulkanSDK\1.3.216.0\Bin\glslc.exe shader.frag -o frag.spv
+C:\VulkanSDK\1.3.216.0\Bin\glslc.exe --target-env=vulkan1.2 raytrace.rgen -o rgen.spv
+C:\VulkanSDK\1.3.216.0\Bin\glslc.exe --target-env=vulkan1.2 raytrace.rmiss -o rmiss.spv
+C:\VulkanSDK\1.3.216.0\Bin\glslc.exe --target-env=vulkan1.2 raytrace.rchit -o rchit.spv
+C:\VulkanSDK\1.3.216.0\Bin\glslc.exe cull.comp -o cull.spv
+C:\VulkanSDK\1.3.216.0\Bin\glslc.exe depthreduce.comp -o depthreduce.spv
+C:\VulkanSDK\1.3.216.0\Bin\glslc.exe -DMULTISAMPLED depthreduce.comp -o depthreduce_ms.spv
+C:\VulkanSDK\1.3.216.0\Bin\glslc.exe meshletcull.comp -o meshletcull.spv
+C:\VulkanSDK\1.3.216.0\Bin\glslc.exe --target-env=vulkan1.2 meshlet.task -o task.spv
+C:\VulkanSDK\1.3.216.0\Bin\glslc.exe --target-env=vulkan1.2 meshlet.mesh -o mesh.spv
\ No newline at end of file
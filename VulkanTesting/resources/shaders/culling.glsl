@@ -0,0 +1,156 @@
+// Scene layouts and visibility tests shared by the culling shaders. Includers define DepthPyramidFetch(texel, level),
+// DepthPyramidSize(level) and DepthPyramidLevels() for the max depth pyramid built from the previous frame
+
+struct InstanceData
+{
+	mat4 transform;
+	uint meshIndex;
+	uint textureIndex;
+	uint samplerIndex;
+	uint padding;
+};
+
+const uint MAX_LODS = 8;
+
+struct MeshLod
+{
+	uint firstIndex;
+	uint indexCount;
+	float error;
+	uint padding;
+};
+
+struct MeshInfo
+{
+	uint firstIndex;
+	uint indexCount;
+	int vertexOffset;
+	uint vertexCount;
+	vec4 boundingSphere;
+	uint meshletOffset;
+	uint meshletCount;
+	uint lodCount;
+	uint padding;
+	MeshLod lods[MAX_LODS];
+};
+
+struct Meshlet
+{
+	uint vertexOffset;
+	uint triangleOffset;
+	uint vertexCount;
+	uint triangleCount;
+	uint firstIndex;
+	uint meshIndex;
+	uint padding0;
+	uint padding1;
+	vec4 boundingSphere;
+	vec4 cone;
+};
+
+struct DrawCommand
+{
+	uint indexCount;
+	uint instanceCount;
+	uint firstIndex;
+	int vertexOffset;
+	uint firstInstance;
+};
+
+// Meshlet work items are chunks of up to 32 meshlets of one instance
+const uint MESHLETS_PER_WORK_ITEM = 32;
+
+vec4 ProjectionRow(mat4 projection, int row)
+{
+	return vec4(projection[0][row], projection[1][row], projection[2][row], projection[3][row]);
+}
+
+bool IsInsidePlane(vec4 plane, vec3 center, float radius)
+{
+	return dot(plane.xyz, center) + plane.w > -radius * length(plane.xyz);
+}
+
+// View space frustum planes extracted from the projection matrix, with a 0 to 1 depth range
+bool IsInsideFrustum(mat4 projection, vec3 center, float radius)
+{
+	vec4 row0 = ProjectionRow(projection, 0);
+	vec4 row1 = ProjectionRow(projection, 1);
+	vec4 row2 = ProjectionRow(projection, 2);
+	vec4 row3 = ProjectionRow(projection, 3);
+	return IsInsidePlane(row3 + row0, center, radius)
+		&& IsInsidePlane(row3 - row0, center, radius)
+		&& IsInsidePlane(row3 + row1, center, radius)
+		&& IsInsidePlane(row3 - row1, center, radius)
+		&& IsInsidePlane(row2, center, radius)
+		&& IsInsidePlane(row3 - row2, center, radius);
+}
+
+bool IsOccluded(mat4 projection, vec3 center, float radius)
+{
+	float p00 = projection[0][0];
+	float p11 = projection[1][1];
+	float p22 = projection[2][2];
+	float p32 = projection[3][2];
+	float zNear = p32 / p22;
+
+	// Distance along the view direction, the camera looks down -Z
+	vec3 c = vec3(center.xy, -center.z);
+	if (c.z < radius + zNear)
+	{
+		return false; // Crosses the near plane, no usable screen bounds
+	}
+
+	// Screen space bounds of the projected sphere (Mara and McGuire, 2D Polyhedral Bounds of a Clipped, Perspective-Projected 3D Sphere)
+	vec3 cr = c * radius;
+	float czr2 = c.z * c.z - radius * radius;
+	float vx = sqrt(c.x * c.x + czr2);
+	float minX = (vx * c.x - cr.z) / (vx * c.z + cr.x);
+	float maxX = (vx * c.x + cr.z) / (vx * c.z - cr.x);
+	float vy = sqrt(c.y * c.y + czr2);
+	float minY = (vy * c.y - cr.z) / (vy * c.z + cr.y);
+	float maxY = (vy * c.y + cr.z) / (vy * c.z - cr.y);
+
+	// The projection may flip Y, so order the corners after projecting
+	vec4 ndc = vec4(minX * p00, minY * p11, maxX * p00, maxY * p11);
+	vec2 uvMin = clamp(min(ndc.xy, ndc.zw) * 0.5 + 0.5, 0.0, 1.0);
+	vec2 uvMax = clamp(max(ndc.xy, ndc.zw) * 0.5 + 0.5, 0.0, 1.0);
+
+	// Pick the level where the bounds cover at most 2x2 texels
+	vec2 sizeInTexels = (uvMax - uvMin) * vec2(DepthPyramidSize(0));
+	int level = int(ceil(log2(max(max(sizeInTexels.x, sizeInTexels.y), 1.0))));
+	level = min(level, DepthPyramidLevels() - 1);
+
+	ivec2 levelSize = DepthPyramidSize(level);
+	ivec2 minTexel = clamp(ivec2(uvMin * vec2(levelSize)), ivec2(0), levelSize - 1);
+	ivec2 maxTexel = clamp(ivec2(uvMax * vec2(levelSize)), ivec2(0), levelSize - 1);
+	float occluderDepth = max(
+		max(DepthPyramidFetch(minTexel, level), DepthPyramidFetch(ivec2(maxTexel.x, minTexel.y), level)),
+		max(DepthPyramidFetch(ivec2(minTexel.x, maxTexel.y), level), DepthPyramidFetch(maxTexel, level)));
+
+	// Depth of the sphere's closest point
+	float closest = c.z - radius;
+	float sphereDepth = (p22 * -closest + p32) / closest;
+	return sphereDepth > occluderDepth;
+}
+
+// Coarsest level whose error stays under maxErrorPixels on screen, same as Scene::SelectLod
+uint SelectLod(MeshInfo mesh, float distance, float scale, float pixelsPerUnit, float maxErrorPixels)
+{
+	distance = max(distance, 0.001);
+	uint lod = 0;
+	for (uint i = 1; i < mesh.lodCount; ++i)
+	{
+		if (mesh.lods[i].error * scale * pixelsPerUnit / distance > maxErrorPixels)
+		{
+			break;
+		}
+		lod = i;
+	}
+	return lod;
+}
+
+// View space normal cone test, the eye is at the origin
+bool IsConeBackfacing(vec3 center, float radius, vec3 axis, float cutoff)
+{
+	return dot(center, axis) >= cutoff * length(center) + radius;
+}
\ No newline at end of file
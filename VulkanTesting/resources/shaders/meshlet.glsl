@@ -0,0 +1,111 @@
+// Resources of the meshlet culling and drawing shaders, all reached through the bindless heap
+
+layout(set = 0, binding = 0) uniform UniformBufferObject
+{
+	mat4 model;
+	mat4 view;
+	mat4 projection;
+} ubo;
+
+layout(set = 1, binding = 0) uniform texture2D textures[];
+layout(set = 1, binding = 1) uniform sampler samplers[];
+
+layout(push_constant) uniform MeshletPushConstants
+{
+	uint instanceBufferIndex;
+	uint meshBufferIndex;
+	uint meshletBufferIndex;
+	uint meshletDataBufferIndex;
+	uint vertexBufferIndex;
+	uint workItemBufferIndex;
+	uint drawBufferIndex;
+	uint statsBufferIndex;
+	uint depthPyramidIndex;
+	uint depthPyramidSamplerIndex;
+	uint occlusionEnabled;
+	uint maxDrawCount;
+} meshletPush;
+
+float DepthPyramidFetch(ivec2 texel, int level)
+{
+	return texelFetch(sampler2D(textures[meshletPush.depthPyramidIndex], samplers[meshletPush.depthPyramidSamplerIndex]), texel, level).r;
+}
+
+ivec2 DepthPyramidSize(int level)
+{
+	return textureSize(sampler2D(textures[meshletPush.depthPyramidIndex], samplers[meshletPush.depthPyramidSamplerIndex]), level);
+}
+
+int DepthPyramidLevels()
+{
+	return textureQueryLevels(sampler2D(textures[meshletPush.depthPyramidIndex], samplers[meshletPush.depthPyramidSamplerIndex]));
+}
+
+#include "culling.glsl"
+
+layout(std430, set = 1, binding = 2) readonly buffer InstanceBuffer
+{
+	InstanceData instances[];
+} instanceBuffers[];
+
+layout(std430, set = 1, binding = 2) readonly buffer MeshBuffer
+{
+	MeshInfo meshes[];
+} meshBuffers[];
+
+layout(std430, set = 1, binding = 2) readonly buffer MeshletBuffer
+{
+	Meshlet meshlets[];
+} meshletBuffers[];
+
+// Mesh relative vertex indices and packed 8-bit triangle indices of every meshlet
+layout(std430, set = 1, binding = 2) readonly buffer MeshletDataBuffer
+{
+	uint meshletData[];
+} meshletDataBuffers[];
+
+// Vertex as eight floats: position, color and texture coordinates
+layout(std430, set = 1, binding = 2) readonly buffer VertexBuffer
+{
+	float vertexData[];
+} vertexBuffers[];
+
+// Instance index and first meshlet of each chunk of visible meshlets to test
+layout(std430, set = 1, binding = 2) readonly buffer WorkItemBuffer
+{
+	uvec2 workItems[];
+} workItemBuffers[];
+
+layout(std430, set = 1, binding = 2) writeonly buffer DrawBuffer
+{
+	DrawCommand draws[];
+} drawBuffers[];
+
+layout(std430, set = 1, binding = 2) buffer StatsBuffer
+{
+	uint drawCount;
+	uint visibleInstances;
+	uint frustumCulled;
+	uint occlusionCulled;
+	uint meshletsCulled;
+	uint triangleCount;
+	uint maxLodError; // Float bits, non-negative floats order like their bits
+	uint workItemCount;
+	uint dispatchX;
+	uint dispatchY;
+	uint dispatchZ;
+	uint taskCount;
+	uint firstTask;
+} statsBuffers[];
+
+bool IsMeshletVisible(mat4 modelView, Meshlet meshlet)
+{
+	vec3 center = (modelView * vec4(meshlet.boundingSphere.xyz, 1.0)).xyz;
+	float scale = max(length(modelView[0].xyz), max(length(modelView[1].xyz), length(modelView[2].xyz)));
+	float radius = meshlet.boundingSphere.w * scale;
+	vec3 axis = normalize(mat3(modelView) * meshlet.cone.xyz);
+
+	return !IsConeBackfacing(center, radius, axis, meshlet.cone.w)
+		&& IsInsideFrustum(ubo.projection, center, radius)
+		&& (meshletPush.occlusionEnabled == 0 || !IsOccluded(ubo.projection, center, radius));
+}
\ No newline at end of file
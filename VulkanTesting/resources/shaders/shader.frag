@@ -1,13 +1,63 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
+#extension GL_GOOGLE_include_directive : require
 
 layout(location = 0) in vec3 fragColor;
 layout(location = 1) in vec2 fragTexCoord;
+layout(location = 2) flat in uint fragTextureIndex;
+layout(location = 3) flat in uint fragSamplerIndex;
 
 layout(location = 0) out vec4 outColor;
 
-layout(binding = 1) uniform sampler2D textureSampler;
+// Bindless heap, indexed with the material indices of each instance
+layout(set = 1, binding = 0) uniform texture2D textures[];
+layout(set = 1, binding = 1) uniform sampler samplers[];
+
+#include "virtualtexture.glsl"
+
+layout(binding = 0) uniform UniformBufferObject
+{
+	mat4 model;
+	mat4 view;
+	mat4 projection;
+	VirtualTextureIndices virtualTexture;
+	uint materialFeatures;
+} ubo;
+
+// Material features. Specialized pipelines bake them in, so the paths a material does not use are compiled out, while
+// the generic pipeline drawn until those are ready reads them from the uniform buffer
+layout(constant_id = 0) const bool MATERIAL_SPECIALIZED = false;
+layout(constant_id = 1) const bool TEXTURED = true;
+layout(constant_id = 2) const bool ALPHA_TEST = false;
+layout(constant_id = 3) const bool VERTEX_COLOR = false;
+
+// Bits of materialFeatures, matching MaterialFeature in Application.h
+const uint MATERIAL_TEXTURED = 1;
+const uint MATERIAL_ALPHA_TEST = 2;
+const uint MATERIAL_VERTEX_COLOR = 4;
+const float ALPHA_CUTOFF = 0.5;
 
 void main()
 {
-	outColor = texture(textureSampler, fragTexCoord);
+	bool textured = MATERIAL_SPECIALIZED ? TEXTURED : (ubo.materialFeatures & MATERIAL_TEXTURED) != 0;
+	bool alphaTest = MATERIAL_SPECIALIZED ? ALPHA_TEST : (ubo.materialFeatures & MATERIAL_ALPHA_TEST) != 0;
+	bool vertexColor = MATERIAL_SPECIALIZED ? VERTEX_COLOR : (ubo.materialFeatures & MATERIAL_VERTEX_COLOR) != 0;
+
+	vec4 color = vec4(1.0);
+	if (textured)
+	{
+		// Indices may differ between instances covered by the same draw
+		color = ubo.virtualTexture.enabled != 0
+			? SampleVirtualTexture(ubo.virtualTexture, fragTexCoord)
+			: texture(sampler2D(textures[nonuniformEXT(fragTextureIndex)], samplers[nonuniformEXT(fragSamplerIndex)]), fragTexCoord);
+	}
+	if (vertexColor)
+	{
+		color.rgb *= fragColor;
+	}
+	if (alphaTest && color.a < ALPHA_CUTOFF)
+	{
+		discard;
+	}
+	outColor = color;
 }
\ No newline at end of file
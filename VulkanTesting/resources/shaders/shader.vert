@@ -1,4 +1,5 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
 
 layout(binding = 0) uniform UniformBufferObject
 {
@@ -7,16 +8,72 @@ layout(binding = 0) uniform UniformBufferObject
 	mat4 projection;
 } ubo;
 
+// Objects drawn one by one get their own data, the same for every vertex of the draw. Both blocks match ObjectData in
+// Application.h
+#if defined(OBJECT_PUSH_CONSTANTS)
+layout(push_constant) uniform ObjectPushConstants
+{
+	mat4 transform;
+	uint textureIndex;
+	uint samplerIndex;
+} object;
+#elif defined(OBJECT_RING_BUFFER)
+// Bound with a dynamic offset for every draw, pointing at the slot its data was written to
+layout(set = 2, binding = 0) uniform ObjectBuffer
+{
+	mat4 transform;
+	uint textureIndex;
+	uint samplerIndex;
+} object;
+#else
+// Otherwise a draw covers many instances, each reading its own from the scene's instance buffer
+struct InstanceData
+{
+	mat4 transform;
+	uint meshIndex;
+	uint textureIndex;
+	uint samplerIndex;
+	uint padding;
+};
+
+// Bindless heap storage buffers, one of which holds the scene's instances
+layout(std430, set = 1, binding = 2) readonly buffer InstanceBuffer
+{
+	InstanceData instances[];
+} instanceBuffers[];
+
+layout(push_constant) uniform DrawPushConstants
+{
+	uint instanceBufferIndex;
+} draw;
+#endif
+
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inColor;
 layout(location = 2) in vec2 inTexCoord;
 
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) flat out uint fragTextureIndex;
+layout(location = 3) flat out uint fragSamplerIndex;
 
 void main()
 {
-	gl_Position = ubo.projection * ubo.view * ubo.model * vec4(inPosition, 1.0);
+#if defined(OBJECT_PUSH_CONSTANTS) || defined(OBJECT_RING_BUFFER)
+	mat4 transform = object.transform;
+	uint textureIndex = object.textureIndex;
+	uint samplerIndex = object.samplerIndex;
+#else
+	// gl_InstanceIndex includes the draw's firstInstance, so it indexes the whole instance buffer
+	InstanceData instance = instanceBuffers[draw.instanceBufferIndex].instances[gl_InstanceIndex];
+	mat4 transform = instance.transform;
+	uint textureIndex = instance.textureIndex;
+	uint samplerIndex = instance.samplerIndex;
+#endif
+
+	gl_Position = ubo.projection * ubo.view * ubo.model * transform * vec4(inPosition, 1.0);
 	fragColor = inColor;
 	fragTexCoord = inTexCoord;
+	fragTextureIndex = textureIndex;
+	fragSamplerIndex = samplerIndex;
 }
\ No newline at end of file
@@ -0,0 +1,76 @@
+// Virtual texture sampling through the page tables and feedback buffers in the bindless heap, see VirtualTexture.h
+
+#define VT_PAGE_SIZE 128
+#define VT_PAGE_BORDER 4
+#define VT_PAGE_CONTENT (VT_PAGE_SIZE - 2 * VT_PAGE_BORDER)
+#define VT_MAX_LEVELS 16
+
+struct VirtualTextureIndices
+{
+	uint pageTableIndex;
+	uint feedbackIndex;
+	uint cacheTextureIndex;
+	uint cacheSamplerIndex;
+	uint enabled;
+	uint frameIndex;
+	uint padding0;
+	uint padding1;
+};
+
+// Entries pack the cache slot's x and y in 12 bits each and the level the slot holds in the top 8 bits
+layout(std430, set = 1, binding = 2) readonly buffer VirtualPageTable
+{
+	uint levelCount;
+	uint cachePagesX;
+	uint pageCount;
+	uint padding;
+	uvec4 levels[VT_MAX_LEVELS]; // Width, height, pages along x and first page of each level
+	uint entries[];
+} pageTables[];
+
+// One bit per virtual page
+layout(std430, set = 1, binding = 2) buffer VirtualFeedback
+{
+	uint requestedPages[];
+} feedbackBuffers[];
+
+vec4 SampleVirtualTexture(VirtualTextureIndices vt, vec2 uv)
+{
+	uint levelCount = pageTables[vt.pageTableIndex].levelCount;
+	uvec4 level0 = pageTables[vt.pageTableIndex].levels[0];
+
+	// Level from the screen-space footprint of a texel, like the hardware picks it
+	vec2 texel = uv * vec2(level0.xy);
+	vec2 dx = dFdx(texel);
+	vec2 dy = dFdy(texel);
+	float lod = 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1.0));
+	uint levelIndex = min(uint(lod), levelCount - 1);
+
+	vec2 wrapped = fract(uv);
+	uvec4 level = pageTables[vt.pageTableIndex].levels[levelIndex];
+	uvec2 pageCount = (level.xy + VT_PAGE_CONTENT - 1) / VT_PAGE_CONTENT;
+	uvec2 page = min(uvec2(wrapped * vec2(level.xy)) / VT_PAGE_CONTENT, pageCount - 1);
+	uint pageId = level.w + page.y * level.z + page.x;
+
+	// A rotating eighth of the pixels reports the page, skipping the atomic once it is already requested
+	uvec2 pixel = uvec2(gl_FragCoord.xy);
+	if (((pixel.x + pixel.y * 3 + vt.frameIndex) & 7) == 0)
+	{
+		uint word = pageId / 32;
+		uint bit = 1u << (pageId % 32);
+		if ((feedbackBuffers[vt.feedbackIndex].requestedPages[word] & bit) == 0)
+		{
+			atomicOr(feedbackBuffers[vt.feedbackIndex].requestedPages[word], bit);
+		}
+	}
+
+	// The entry holds the page itself or its closest resident ancestor
+	uint entry = pageTables[vt.pageTableIndex].entries[pageId];
+	uvec2 slot = uvec2(entry & 0xFFF, (entry >> 12) & 0xFFF);
+	uvec4 residentLevel = pageTables[vt.pageTableIndex].levels[entry >> 24];
+	vec2 residentTexel = wrapped * vec2(residentLevel.xy);
+	vec2 inPage = residentTexel - floor(residentTexel / VT_PAGE_CONTENT) * VT_PAGE_CONTENT;
+	vec2 cacheTexel = vec2(slot * VT_PAGE_SIZE + VT_PAGE_BORDER) + inPage;
+	float cacheSize = float(pageTables[vt.pageTableIndex].cachePagesX * VT_PAGE_SIZE);
+	return textureLod(sampler2D(textures[vt.cacheTextureIndex], samplers[vt.cacheSamplerIndex]), cacheTexel / cacheSize, 0.0);
+}
\ No newline at end of file
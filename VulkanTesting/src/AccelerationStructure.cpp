@@ -1,5 +1,9 @@
 #include "AccelerationStructure.h"
 
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
 void RaytracingBuilder::BuildBlas(
 	const std::vector<BlasInput>& input,
 	VkBuildAccelerationStructureFlagsKHR flags)
@@ -39,9 +43,279 @@ void RaytracingBuilder::BuildBlas(
 		nbCompactions += HasFlag(buildAs[idx].buildInfo.flags, VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR);
 
 	}
+
+	// A single scratch buffer, reused by every build since they are serialized with barriers
+	VkBuffer scratchBuffer;
+	VkDeviceMemory scratchBufferMemory;
+	CreateBuffer(
+		maxScratchSize,
+		VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		scratchBuffer,
+		scratchBufferMemory);
+	VkDeviceAddress scratchAddress = GetBufferDeviceAddress(scratchBuffer);
+
+	VkCommandBuffer commandBuffer = BeginCommands();
+	for (uint32_t idx = 0; idx < ndBlas; ++idx)
+	{
+		VkAccelerationStructureCreateInfoKHR createInfo{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR};
+		createInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+		createInfo.size = buildAs[idx].sizeInfo.accelerationStructureSize;
+		buildAs[idx].As = CreateAcceleration(createInfo);
+
+		buildAs[idx].buildInfo.dstAccelerationStructure = buildAs[idx].As.Accel;
+		buildAs[idx].buildInfo.scratchData.deviceAddress = scratchAddress;
+		vkCmdBuildAccelerationStructuresKHR(commandBuffer, 1, &buildAs[idx].buildInfo, &buildAs[idx].rangeInfo);
+
+		// The scratch buffer is reused, so the next build's scratch reads and writes wait for this one's
+		VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+		barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+		barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+		vkCmdPipelineBarrier(
+			commandBuffer,
+			VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+			VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+			0,
+			1,
+			&barrier,
+			0,
+			nullptr,
+			0,
+			nullptr);
+	}
+	SubmitCommands(commandBuffer);
+
+	for (auto& build : buildAs)
+	{
+		m_Blas.emplace_back(build.As);
+	}
+
+	vkDestroyBuffer(m_Device, scratchBuffer, nullptr);
+	m_MemoryBudget->Free(scratchBufferMemory);
 }
-void RaytracingBuilder::Setup(const VkDevice& device, uint32_t queueIndex)
+
+void RaytracingBuilder::BuildTlas(
+	const std::vector<VkAccelerationStructureInstanceKHR>& instances,
+	VkBuildAccelerationStructureFlagsKHR flags)
+{
+	uint32_t countInstance = static_cast<uint32_t>(instances.size());
+	VkDeviceSize instancesSize = sizeof(VkAccelerationStructureInstanceKHR) * instances.size();
+
+	// Upload the instances to a host visible buffer the build can read from
+	VkBuffer instancesBuffer;
+	VkDeviceMemory instancesBufferMemory;
+	CreateBuffer(
+		instancesSize,
+		VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		instancesBuffer,
+		instancesBufferMemory,
+		MemoryBudget::CategoryStaging);
+	void* data;
+	vkMapMemory(m_Device, instancesBufferMemory, 0, instancesSize, 0, &data);
+	memcpy(data, instances.data(), static_cast<size_t>(instancesSize));
+	vkUnmapMemory(m_Device, instancesBufferMemory);
+
+	VkAccelerationStructureGeometryInstancesDataKHR instancesData{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR};
+	instancesData.arrayOfPointers = VK_FALSE;
+	instancesData.data.deviceAddress = GetBufferDeviceAddress(instancesBuffer);
+
+	VkAccelerationStructureGeometryKHR topAsGeometry{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR};
+	topAsGeometry.geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR;
+	topAsGeometry.geometry.instances = instancesData;
+
+	VkAccelerationStructureBuildGeometryInfoKHR buildInfo{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR};
+	buildInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
+	buildInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+	buildInfo.flags = flags;
+	buildInfo.geometryCount = 1;
+	buildInfo.pGeometries = &topAsGeometry;
+
+	VkAccelerationStructureBuildSizesInfoKHR sizeInfo{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR};
+	vkGetAccelerationStructureBuildSizesKHR(m_Device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &buildInfo, &countInstance, &sizeInfo);
+
+	VkAccelerationStructureCreateInfoKHR createInfo{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR};
+	createInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
+	createInfo.size = sizeInfo.accelerationStructureSize;
+	m_Tlas = CreateAcceleration(createInfo);
+
+	VkBuffer scratchBuffer;
+	VkDeviceMemory scratchBufferMemory;
+	CreateBuffer(
+		sizeInfo.buildScratchSize,
+		VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		scratchBuffer,
+		scratchBufferMemory);
+
+	buildInfo.dstAccelerationStructure = m_Tlas.Accel;
+	buildInfo.scratchData.deviceAddress = GetBufferDeviceAddress(scratchBuffer);
+
+	VkAccelerationStructureBuildRangeInfoKHR buildOffsetInfo{countInstance, 0, 0, 0};
+	const VkAccelerationStructureBuildRangeInfoKHR* pBuildOffsetInfo = &buildOffsetInfo;
+
+	VkCommandBuffer commandBuffer = BeginCommands();
+	vkCmdBuildAccelerationStructuresKHR(commandBuffer, 1, &buildInfo, &pBuildOffsetInfo);
+	SubmitCommands(commandBuffer);
+
+	vkDestroyBuffer(m_Device, scratchBuffer, nullptr);
+	m_MemoryBudget->Free(scratchBufferMemory);
+	vkDestroyBuffer(m_Device, instancesBuffer, nullptr);
+	m_MemoryBudget->Free(instancesBufferMemory);
+}
+
+VkDeviceAddress RaytracingBuilder::GetBlasDeviceAddress(uint32_t blasId)
+{
+	VkAccelerationStructureDeviceAddressInfoKHR addressInfo{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR};
+	addressInfo.accelerationStructure = m_Blas[blasId].Accel;
+	return vkGetAccelerationStructureDeviceAddressKHR(m_Device, &addressInfo);
+}
+
+AccelKHR RaytracingBuilder::CreateAcceleration(VkAccelerationStructureCreateInfoKHR& createInfo)
+{
+	AccelKHR accel;
+	CreateBuffer(
+		createInfo.size,
+		VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		accel.Buffer,
+		accel.Memory);
+
+	createInfo.buffer = accel.Buffer;
+	if (vkCreateAccelerationStructureKHR(m_Device, &createInfo, nullptr, &accel.Accel) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create acceleration structure");
+	}
+	return accel;
+}
+
+void RaytracingBuilder::DestroyAcceleration(AccelKHR& accel)
+{
+	if (accel.Accel == VK_NULL_HANDLE)
+	{
+		return;
+	}
+
+	vkDestroyAccelerationStructureKHR(m_Device, accel.Accel, nullptr);
+	vkDestroyBuffer(m_Device, accel.Buffer, nullptr);
+	m_MemoryBudget->Free(accel.Memory);
+	accel.Accel = VK_NULL_HANDLE;
+}
+
+void RaytracingBuilder::CreateBuffer(
+	VkDeviceSize size,
+	VkBufferUsageFlags usage,
+	VkMemoryPropertyFlags properties,
+	VkBuffer& buffer,
+	VkDeviceMemory& bufferMemory,
+	MemoryBudget::Category category)
 {
-  m_Device     = device;
-  m_QueueIndex = queueIndex;
+	VkBufferCreateInfo bufferInfo{VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+	bufferInfo.size = size;
+	bufferInfo.usage = usage;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	if (vkCreateBuffer(m_Device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create acceleration structure buffer");
+	}
+
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(m_Device, buffer, &memRequirements);
+
+	// Every buffer used here is referenced through its device address
+	VkMemoryAllocateFlagsInfo flagsInfo{VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO};
+	flagsInfo.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT;
+
+	VkMemoryAllocateInfo allocInfo{VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
+	allocInfo.pNext = &flagsInfo;
+	allocInfo.allocationSize = memRequirements.size;
+	allocInfo.memoryTypeIndex = FindMemoryType(memRequirements.memoryTypeBits, properties);
+	bufferMemory = m_MemoryBudget->Allocate(allocInfo, category);
+
+	vkBindBufferMemory(m_Device, buffer, bufferMemory, 0);
+}
+
+VkDeviceAddress RaytracingBuilder::GetBufferDeviceAddress(VkBuffer buffer)
+{
+	VkBufferDeviceAddressInfo info = {VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO};
+	info.buffer = buffer;
+	return vkGetBufferDeviceAddress(m_Device, &info);
+}
+
+uint32_t RaytracingBuilder::FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties)
+{
+	VkPhysicalDeviceMemoryProperties memProperties;
+	vkGetPhysicalDeviceMemoryProperties(m_PhysicalDevice, &memProperties);
+	for (uint32_t i = 0; i < memProperties.memoryTypeCount; ++i)
+	{
+		if (typeFilter & (1 << i) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties)
+		{
+			return i;
+		}
+	}
+
+	throw std::runtime_error("Failed to find suitable memory type");
+}
+
+VkCommandBuffer RaytracingBuilder::BeginCommands()
+{
+	VkCommandBufferAllocateInfo allocInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandPool = m_CommandPool;
+	allocInfo.commandBufferCount = 1;
+
+	VkCommandBuffer commandBuffer;
+	vkAllocateCommandBuffers(m_Device, &allocInfo, &commandBuffer);
+
+	VkCommandBufferBeginInfo beginInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+	return commandBuffer;
+}
+
+void RaytracingBuilder::SubmitCommands(VkCommandBuffer commandBuffer)
+{
+	vkEndCommandBuffer(commandBuffer);
+
+	VkSubmitInfo submitInfo{VK_STRUCTURE_TYPE_SUBMIT_INFO};
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+	vkQueueSubmit(m_Queue, 1, &submitInfo, VK_NULL_HANDLE);
+	vkQueueWaitIdle(m_Queue);
+
+	vkFreeCommandBuffers(m_Device, m_CommandPool, 1, &commandBuffer);
+}
+
+void RaytracingBuilder::Setup(const VkDevice& device, VkPhysicalDevice physicalDevice, uint32_t queueIndex, MemoryBudget* memoryBudget)
+{
+	m_Device         = device;
+	m_PhysicalDevice = physicalDevice;
+	m_QueueIndex     = queueIndex;
+	m_MemoryBudget   = memoryBudget;
+	vkGetDeviceQueue(m_Device, m_QueueIndex, 0, &m_Queue);
+
+	VkCommandPoolCreateInfo poolInfo{VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO};
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	poolInfo.queueFamilyIndex = m_QueueIndex;
+	if (vkCreateCommandPool(m_Device, &poolInfo, nullptr, &m_CommandPool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create acceleration structure command pool");
+	}
+}
+
+void RaytracingBuilder::Destroy()
+{
+	for (auto& blas : m_Blas)
+	{
+		DestroyAcceleration(blas);
+	}
+	m_Blas.clear();
+	DestroyAcceleration(m_Tlas);
+
+	if (m_CommandPool != VK_NULL_HANDLE)
+	{
+		vkDestroyCommandPool(m_Device, m_CommandPool, nullptr);
+		m_CommandPool = VK_NULL_HANDLE;
+	}
 }
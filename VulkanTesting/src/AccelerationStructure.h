@@ -3,6 +3,8 @@
 #include <vector>
 #include <vulkan/vulkan.h>
 
+#include "MemoryBudget.h"
+
 struct BlasInput
 {
 	// Data used to build acceleration structure geometry
@@ -15,6 +17,7 @@ struct AccelKHR
 {
 	VkAccelerationStructureKHR Accel = VK_NULL_HANDLE;
 	VkBuffer Buffer;
+	VkDeviceMemory Memory;
 };
 
 struct BuildAccelerationStructure
@@ -29,13 +32,39 @@ struct BuildAccelerationStructure
 class RaytracingBuilder
 {
 public:
-	void Setup(const VkDevice& device, uint32_t queueIndex);
+	void Setup(const VkDevice& device, VkPhysicalDevice physicalDevice, uint32_t queueIndex, MemoryBudget* memoryBudget);
+	void Destroy();
 	void BuildBlas(
 		const std::vector<BlasInput>& input,
 		VkBuildAccelerationStructureFlagsKHR flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR);
+	void BuildTlas(
+		const std::vector<VkAccelerationStructureInstanceKHR>& instances,
+		VkBuildAccelerationStructureFlagsKHR flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR);
+	VkDeviceAddress GetBlasDeviceAddress(uint32_t blasId);
+	VkAccelerationStructureKHR GetAccelerationStructure() const { return m_Tlas.Accel; }
 private:
 	bool HasFlag(VkFlags item, VkFlags flag) { return (item & flag) == flag; }
+	AccelKHR CreateAcceleration(VkAccelerationStructureCreateInfoKHR& createInfo);
+	void DestroyAcceleration(AccelKHR& accel);
+	void CreateBuffer(
+		VkDeviceSize size,
+		VkBufferUsageFlags usage,
+		VkMemoryPropertyFlags properties,
+		VkBuffer& buffer,
+		VkDeviceMemory& bufferMemory,
+		MemoryBudget::Category category = MemoryBudget::CategoryAccelerationStructures);
+	VkDeviceAddress GetBufferDeviceAddress(VkBuffer buffer);
+	uint32_t FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
+	VkCommandBuffer BeginCommands();
+	void SubmitCommands(VkCommandBuffer commandBuffer);
 
 	VkDevice m_Device;
+	VkPhysicalDevice m_PhysicalDevice;
 	uint32_t m_QueueIndex;
+	MemoryBudget* m_MemoryBudget;
+	VkQueue m_Queue;
+	VkCommandPool m_CommandPool = VK_NULL_HANDLE;
+
+	std::vector<AccelKHR> m_Blas;
+	AccelKHR m_Tlas;
 };
@@ -7,25 +7,129 @@
 #include <tinyobjloader.h>
 
 #include "extensions_vk.hpp"
+#include "DeviceProbe.h"
 
 #include <cstring>
+#include <cmath>
 #include <set>
 #include <limits>
 #include <algorithm>
 #include <fstream>
 #include <unordered_map>
+#include <thread>
 
 void Application::FramebufferResizeCallback(GLFWwindow* window, int width, int height)
 {
 	auto app = reinterpret_cast<Application*>(glfwGetWindowUserPointer(window));
+	app->m_FramebufferWidth = static_cast<uint32_t>(width);
+	app->m_FramebufferHeight = static_cast<uint32_t>(height);
 	app->m_FramebufferResized = true;
 }
 
+void Application::KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+	// Settings belong to the render thread, which applies the key before its next frame
+	auto app = reinterpret_cast<Application*>(glfwGetWindowUserPointer(window));
+	if (action == GLFW_PRESS)
+	{
+		std::lock_guard<std::mutex> lock(app->m_InputMutex);
+		app->m_PendingKeys.push_back(key);
+	}
+}
+
+void Application::ApplyInput()
+{
+	std::vector<int> keys;
+	{
+		std::lock_guard<std::mutex> lock(m_InputMutex);
+		keys.swap(m_PendingKeys);
+	}
+	for (int key : keys)
+	{
+		HandleKey(key);
+	}
+}
+
+void Application::HandleKey(int key)
+{
+	if (key == GLFW_KEY_R)
+	{
+		m_UseRaytracing = !m_UseRaytracing;
+	}
+	if (key == GLFW_KEY_C)
+	{
+		m_UseGpuCulling = !m_UseGpuCulling;
+	}
+	if (key == GLFW_KEY_M)
+	{
+		m_UseMeshlets = !m_UseMeshlets;
+	}
+	if (key == GLFW_KEY_L)
+	{
+		m_UseLods = !m_UseLods;
+		m_SimulateLods = m_UseLods;
+	}
+	if (key == GLFW_KEY_V && m_VirtualTexturingSupported)
+	{
+		m_UseVirtualTexture = !m_UseVirtualTexture;
+	}
+	if (key == GLFW_KEY_D && m_DynamicRenderingSupported && m_BenchmarkFramesLeft == 0)
+	{
+		m_UseDynamicRendering = !m_UseDynamicRendering;
+	}
+	if (key == GLFW_KEY_B && m_DynamicRenderingSupported && m_BenchmarkFramesLeft == 0 && m_PerDrawFramesLeft == 0)
+	{
+		StartRecordingBenchmark();
+	}
+	if (key == GLFW_KEY_P && m_BenchmarkFramesLeft == 0 && m_PerDrawFramesLeft == 0)
+	{
+		StartPerDrawBenchmark();
+	}
+	// Material features, every combination not drawn before brings a new pipeline permutation
+	if (key == GLFW_KEY_1)
+	{
+		m_MaterialFeatures ^= MaterialTextured;
+	}
+	if (key == GLFW_KEY_2)
+	{
+		m_MaterialFeatures ^= MaterialAlphaTest;
+	}
+	if (key == GLFW_KEY_3)
+	{
+		m_MaterialFeatures ^= MaterialVertexColor;
+	}
+	if (key == GLFW_KEY_Q)
+	{
+		// Turned off, the render thread takes rendering back to full quality whatever it costs
+		m_UseQualityGovernor = !m_UseQualityGovernor;
+	}
+}
+
+static uint32_t AlignUp(uint32_t size, uint32_t alignment)
+{
+	return (size + (alignment - 1)) & ~(alignment - 1);
+}
+
+// A push constant block that no longer matches the struct filled on the CPU would have the shader read the wrong fields
+static void CheckPushConstantSize(const ShaderReflection& shader, uint32_t size, const std::string& name)
+{
+	if (shader.PushConstantSize != size)
+	{
+		throw std::runtime_error(name + " push constants are " + std::to_string(shader.PushConstantSize)
+			+ " bytes in the shader but " + std::to_string(size) + " bytes in the application");
+	}
+}
+
 void Application::Run()
 {
+	m_StartupBegin = std::chrono::high_resolution_clock::now();
 	InitWindow();
 	InitVulkan();
 	InitRaytracing();
+	// Pipelines rebuilt later compile their shaders again, from the cache when unchanged
+	m_PreloadedShaders.clear();
+	WatchShaders();
+	m_PipelineCompiler.Start(s_PipelineCompilerThreads);
 	MainLoop();
 	Cleanup();
 }
@@ -38,34 +142,130 @@ void Application::InitWindow()
 	m_Window = glfwCreateWindow(m_WindowWidth, m_WindowHeight, "Vulkan", nullptr, nullptr);
 	glfwSetWindowUserPointer(m_Window, this);
 	glfwSetFramebufferSizeCallback(m_Window, FramebufferResizeCallback);
+	glfwSetKeyCallback(m_Window, KeyCallback);
+
+	int width, height;
+	glfwGetFramebufferSize(m_Window, &width, &height);
+	m_FramebufferWidth = static_cast<uint32_t>(width);
+	m_FramebufferHeight = static_cast<uint32_t>(height);
+
+	// Frames are budgeted for 120 Hz on displays refreshing that fast, 60 Hz otherwise
+	const GLFWvidmode* videoMode = glfwGetVideoMode(glfwGetPrimaryMonitor());
+	m_TargetFrameMs = 1000.0 / (videoMode != nullptr && videoMode->refreshRate >= 120 ? 120.0 : 60.0);
 }
 
 void Application::InitVulkan()
 {
-	CreateInstance();
-	CreateSurface();
-	PickPhysicalDevice();
-	CreateLogicalDevice();
-	CreateSwapchain();
-	CreateImageViews();
-	CreateRenderPass();
-	CreateDescriptorSetLayout();
-	CreateGraphicsPipeline();
-	CreateColorResources();
-	CreateDepthResources();
-	CreateFramebuffers();
-	CreateCommandPool();
-	CreateTextureImage();
-	CreateTextureImageView();
-	CreateTextureSampler();
-	LoadModel();
-	CreateVertexBuffer();
-	CreateIndexBuffer();
-	CreateUniformBuffers();
-	CreateDescriptorPool();
-	CreateDescriptorSets();
-	CreateCommandBuffers();
-	CreateSyncObjects();
+	// File reads and decoding run on workers while the device and swapchain come up, and pipelines compile there too
+	using Affinity = StartupGraph::Affinity;
+	StartupGraph startup;
+	m_ShaderCompiler.Setup(m_ShaderCachePath);
+	auto compileShaders = [&](const std::string& name, const std::vector<const ShaderSource*>& sources)
+	{
+		for (const ShaderSource* source : sources)
+		{
+			m_PreloadedShaders[source->GetName()]; // Every stage then only writes to entries of its own
+		}
+		return startup.Add(name, Affinity::Worker, {}, [this, sources] { PreloadShaders(sources); });
+	};
+	auto graphicsShaders = compileShaders("Compile graphics shaders", {
+		&m_VertexShader, &m_ObjectPushVertexShader, &m_ObjectRingVertexShader, &m_FragmentShader, &m_TaskShader, &m_MeshShader });
+	auto cullingShaders = compileShaders("Compile culling shaders", { &m_CullShader, &m_MeshletCullShader, &m_DepthReduceShader, &m_DepthReduceMsShader });
+	compileShaders("Compile ray tracing shaders", { &m_RaygenShader, &m_MissShader, &m_ClosestHitShader });
+	auto cacheData = startup.Add("Read pipeline cache", Affinity::Worker, {}, [this] { LoadPipelineCacheData(); });
+	auto model = startup.Add("Load model", Affinity::Worker, {}, [this] { LoadModel(); });
+	startup.Add("Instance", Affinity::Main, {}, [this] { CreateInstance(); });
+	startup.Add("Surface", Affinity::Main, {}, [this] { CreateSurface(); });
+	startup.Add("Physical device", Affinity::Main, {}, [this] { PickPhysicalDevice(); });
+	auto device = startup.Add("Logical device", Affinity::Main, {}, [this]
+	{
+		CreateLogicalDevice();
+		// Extension entry points, needed from the first submission on
+		load_VK_EXTENSIONS(m_VkInstance, vkGetInstanceProcAddr, m_Device, vkGetDeviceProcAddr);
+		m_LayoutCache.Setup(m_Device);
+		m_MemoryBudget.Setup(m_Device, m_PhysicalDevice, m_MemoryBudgetSupported);
+	});
+	auto texture = startup.Add("Decode texture", Affinity::Worker, { device }, [this] { LoadVirtualTextureData(); });
+	auto pipelineCache = startup.Add("Pipeline cache", Affinity::Main, { cacheData }, [this] { CreatePipelineCache(); });
+	auto frameSetup = startup.Add("Frame setup", Affinity::Main, {}, [this]
+	{
+		m_Profiler.Setup(m_Device, m_PhysicalDevice, m_MaxFramesInFlight);
+		m_FrameScheduler.Setup(m_Device, { m_GraphicsQueue, m_ComputeQueue, m_TransferQueue }, m_MaxFramesInFlight, &m_Profiler);
+		m_BindlessHeap.Setup(m_Device, m_PhysicalDevice, m_MaxFramesInFlight);
+		m_DescriptorAllocator.Setup(m_Device, m_MaxFramesInFlight);
+		m_RenderGraph.Setup(m_Device, m_PhysicalDevice, m_QueueFamilyIndices.GraphicsFamily.value(), m_MaxFramesInFlight, &m_Profiler, &m_MemoryBudget);
+		m_UseDynamicRendering = m_DynamicRenderingSupported;
+		m_QualityGovernor.Setup(m_TargetFrameMs, m_MsaaSamples, m_QualitySampleCounts);
+		m_RenderScale = m_QualityGovernor.GetLevel().RenderScale;
+		m_MinSampleShading = m_QualityGovernor.GetLevel().MinSampleShading;
+		m_Profiler.SetCounter("Render scale", m_RenderScale);
+		m_Profiler.SetCounter("MSAA samples", m_MsaaSamples);
+	});
+	startup.Add("Swapchain", Affinity::Main, {}, [this]
+	{
+		CreateSwapchain();
+		CreateImageViews();
+	});
+	auto renderPass = startup.Add("Render pass", Affinity::Main, {}, [this] { CreateRenderPass(); });
+	auto setLayout = startup.Add("Descriptor set layout", Affinity::Main, { graphicsShaders }, [this] { CreateDescriptorSetLayout(); });
+	startup.Add("Graphics pipelines", Affinity::Worker, { graphicsShaders, pipelineCache, frameSetup, renderPass, setLayout }, [this]
+	{
+		CreateGraphicsPipeline(m_GraphicsPipelines);
+	});
+	auto cullingPipelines = startup.Add("Culling pipelines", Affinity::Worker, { cullingShaders, pipelineCache, frameSetup, setLayout }, [this]
+	{
+		CreateCullingPipelines();
+	});
+	startup.Add("Render targets", Affinity::Main, {}, [this]
+	{
+		CreateColorResources();
+		CreateDepthResources();
+		CreateRtOutputImage();
+		AllocateAttachmentMemory();
+	});
+	startup.Add("Command pool", Affinity::Main, {}, [this] { CreateCommandPool(); });
+	startup.Add("Texture streamer", Affinity::Main, {}, [this]
+	{
+		m_TextureStreamer.Setup(
+			m_Device,
+			m_PhysicalDevice,
+			&m_BindlessHeap,
+			&m_MemoryBudget,
+			&m_FrameScheduler,
+			m_QueueFamilyIndices.GraphicsFamily.value(),
+			m_QueueFamilyIndices.TransferFamily.value_or(m_QueueFamilyIndices.GraphicsFamily.value()),
+			m_MaxFramesInFlight);
+		CreateTextureSampler();
+	});
+	startup.Add("Virtual texture", Affinity::Main, { texture }, [this] { CreateVirtualTexture(); });
+	startup.Add("Bindless resources", Affinity::Main, {}, [this] { RegisterBindlessResources(); });
+	startup.Add("Scene", Affinity::Main, { model }, [this] { BuildScene(); });
+	startup.Add("Scene buffers", Affinity::Main, {}, [this]
+	{
+		CreateVertexBuffer();
+		CreateIndexBuffer();
+		CreateInstanceBuffer();
+		CreateIndirectBuffer();
+		CreateCullingBuffers();
+		CreateUniformBuffers();
+		CreateObjectRingBuffer();
+	});
+	startup.Add("Descriptor sets", Affinity::Main, {}, [this] { CreateDescriptorSets(); });
+	startup.Add("Command buffers", Affinity::Main, {}, [this]
+	{
+		CreateCommandBuffers();
+		CreateSyncObjects();
+	});
+	// The depth pyramid's reduce sets and the culling sets use the layouts made along with the culling pipelines
+	startup.Add("Depth pyramid", Affinity::Main, { cullingPipelines }, [this]
+	{
+		CreateDepthPyramidSampler();
+		CreateDepthPyramid();
+		CreateCullingDescriptorSets();
+		m_RenderTargetSetsStale.assign(m_MaxFramesInFlight, true);
+	});
+	startup.Run();
+	startup.PrintTimeline();
 }
 
 void Application::CreateInstance()
@@ -157,25 +357,207 @@ void Application::PickPhysicalDevice()
 
 	std::vector<VkPhysicalDevice> devices(deviceCount);
 	vkEnumeratePhysicalDevices(m_VkInstance, &deviceCount, devices.data());
-	for (const auto& device : devices)
+	if (!LoadDeviceCache(devices))
 	{
-		if (IsDeviceSuitable(device))
+		struct Candidate
 		{
-			m_PhysicalDevice = device;
-			m_MsaaSamples = GetMaxUsableSampleCount();
-			break;
+			VkPhysicalDevice Device;
+			QueueFamilyIndices Indices;
+			double Score;
+			VkPhysicalDeviceType Type;
+		};
+		std::vector<Candidate> candidates;
+		for (const auto& device : devices)
+		{
+			QueueFamilyIndices indices = FindQueueFamilies(device);
+			if (IsDeviceSuitable(device, indices))
+			{
+				VkPhysicalDeviceProperties properties;
+				vkGetPhysicalDeviceProperties(device, &properties);
+				candidates.push_back({ device, indices, RateDevice(device, indices), properties.deviceType });
+			}
+		}
+		if (candidates.empty())
+		{
+			throw std::runtime_error("Failed to find a suitable GPU");
+		}
+		std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) { return a.Score > b.Score; });
+
+		// Devices of the same type are hard to rank from their properties, so a short copy benchmark settles it
+		size_t alikeCount = std::count_if(candidates.begin(), candidates.end(), [&](const Candidate& candidate)
+		{
+			return candidate.Type == candidates[0].Type;
+		});
+		if (alikeCount > 1)
+		{
+			for (size_t i = 0; i < alikeCount; ++i)
+			{
+				double bandwidth = DeviceProbe::MeasureCopyBandwidth(candidates[i].Device, candidates[i].Indices.GraphicsFamily.value());
+				std::cout << "Device " << i << ": " << bandwidth << " GB/s copy bandwidth" << std::endl;
+				candidates[i].Score += bandwidth * s_BandwidthScore;
+			}
+			std::sort(candidates.begin(), candidates.begin() + alikeCount, [](const Candidate& a, const Candidate& b) { return a.Score > b.Score; });
+		}
+
+		m_PhysicalDevice = candidates[0].Device;
+		m_QueueFamilyIndices = candidates[0].Indices;
+		SaveDeviceCache(deviceCount);
+	}
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(m_PhysicalDevice, &properties);
+	std::cout << "Using " << properties.deviceName << std::endl;
+	m_MsaaSamples = GetMaxUsableSampleCount();
+	m_MinUniformBufferOffsetAlignment = static_cast<uint32_t>(properties.limits.minUniformBufferOffsetAlignment);
+
+	// Occlusion culling reads the (possibly multisampled) depth buffer from a compute shader
+	m_DepthSamplingSupported = (properties.limits.sampledImageDepthSampleCounts & m_MsaaSamples) != 0;
+
+	// Lower sample counts must keep the depth buffer sampleable when the highest one does
+	m_QualitySampleCounts = properties.limits.framebufferColorSampleCounts & properties.limits.framebufferDepthSampleCounts;
+	if (m_DepthSamplingSupported)
+	{
+		m_QualitySampleCounts &= properties.limits.sampledImageDepthSampleCounts;
+	}
+}
+
+double Application::RateDevice(VkPhysicalDevice device, const QueueFamilyIndices& indices)
+{
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(device, &properties);
+	VkPhysicalDeviceFeatures features;
+	vkGetPhysicalDeviceFeatures(device, &features);
+
+	// Discrete GPUs win over integrated ones whatever else the integrated one has
+	double score = 0.0;
+	switch (properties.deviceType)
+	{
+	case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+		score += 1000.0;
+		break;
+	case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+		score += 300.0;
+		break;
+	case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+		score += 100.0;
+		break;
+	default:
+		break;
+	}
+
+	// Integrated GPUs report system memory as device local, which the cap keeps from outweighing the type
+	VkPhysicalDeviceMemoryProperties memProperties;
+	vkGetPhysicalDeviceMemoryProperties(device, &memProperties);
+	VkDeviceSize deviceLocalSize = 0;
+	for (uint32_t i = 0; i < memProperties.memoryHeapCount; ++i)
+	{
+		if (memProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+		{
+			deviceLocalSize = std::max(deviceLocalSize, memProperties.memoryHeaps[i].size);
 		}
 	}
+	score += std::min(static_cast<double>(deviceLocalSize) / (1024.0 * 1024.0 * 1024.0), 16.0) * 10.0;
+
+	// Uploads overlap with graphics on a transfer queue of their own, and presenting from the graphics family avoids
+	// sharing swapchain images between families. Nothing runs on a compute queue yet, so it does not count
+	score += indices.TransferFamily.has_value() ? 25.0 : 0.0;
+	score += indices.GraphicsFamily == indices.PresentFamily ? 25.0 : 0.0;
+
+	// Optional features. Ray tracing is required, so it does not set devices apart
+	uint32_t extensionCount;
+	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+	std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+	auto hasExtension = [&](const char* name)
+	{
+		return std::any_of(availableExtensions.begin(), availableExtensions.end(), [&](const VkExtensionProperties& extension)
+		{
+			return strcmp(extension.extensionName, name) == 0;
+		});
+	};
+	score += hasExtension(VK_NV_MESH_SHADER_EXTENSION_NAME) ? 50.0 : 0.0;
+	score += hasExtension(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME) ? 25.0 : 0.0;
+	score += properties.limits.timestampComputeAndGraphics ? 25.0 : 0.0;
+	score += features.multiDrawIndirect ? 25.0 : 0.0;
+	score += features.fragmentStoresAndAtomics ? 10.0 : 0.0;
+
+	std::cout << "Device " << properties.deviceName << ": score " << score << std::endl;
+	return score;
+}
+
+bool Application::LoadDeviceCache(const std::vector<VkPhysicalDevice>& devices)
+{
+	DeviceCacheEntry entry{};
+	std::ifstream file(m_DeviceCachePath, std::ios::binary);
+	if (!file.read(reinterpret_cast<char*>(&entry), sizeof(entry)) || entry.Version != s_DeviceCacheVersion)
+	{
+		return false;
+	}
 
-	if (m_PhysicalDevice == VK_NULL_HANDLE)
+	// Any added or removed GPU, or a driver update, calls for a new decision
+	if (entry.DeviceCount != devices.size())
+	{
+		return false;
+	}
+	for (VkPhysicalDevice device : devices)
 	{
-		throw std::runtime_error("Failed to find a suitable GPU");
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(device, &properties);
+		if (properties.vendorID != entry.VendorId
+			|| properties.deviceID != entry.DeviceId
+			|| properties.driverVersion != entry.DriverVersion
+			|| memcmp(properties.pipelineCacheUUID, entry.PipelineCacheUuid, VK_UUID_SIZE) != 0)
+		{
+			continue;
+		}
+
+		// The surface is new every run and the required features may have changed since the cache was written, so the
+		// device is checked again. Only the ranking is skipped
+		QueueFamilyIndices indices = FindQueueFamilies(device);
+		if (!IsDeviceSuitable(device, indices))
+		{
+			return false;
+		}
+		int32_t computeFamily = indices.ComputeFamily.has_value() ? static_cast<int32_t>(indices.ComputeFamily.value()) : -1;
+		int32_t transferFamily = indices.TransferFamily.has_value() ? static_cast<int32_t>(indices.TransferFamily.value()) : -1;
+		if (indices.GraphicsFamily.value() != entry.GraphicsFamily
+			|| indices.PresentFamily.value() != entry.PresentFamily
+			|| computeFamily != entry.ComputeFamily
+			|| transferFamily != entry.TransferFamily)
+		{
+			return false;
+		}
+
+		m_PhysicalDevice = device;
+		m_QueueFamilyIndices = indices;
+		return true;
 	}
+	return false;
+}
+
+void Application::SaveDeviceCache(uint32_t deviceCount)
+{
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(m_PhysicalDevice, &properties);
+
+	DeviceCacheEntry entry{};
+	entry.Version = s_DeviceCacheVersion;
+	entry.DeviceCount = deviceCount;
+	entry.VendorId = properties.vendorID;
+	entry.DeviceId = properties.deviceID;
+	entry.DriverVersion = properties.driverVersion;
+	memcpy(entry.PipelineCacheUuid, properties.pipelineCacheUUID, VK_UUID_SIZE);
+	entry.GraphicsFamily = m_QueueFamilyIndices.GraphicsFamily.value();
+	entry.PresentFamily = m_QueueFamilyIndices.PresentFamily.value();
+	entry.ComputeFamily = m_QueueFamilyIndices.ComputeFamily.has_value() ? static_cast<int32_t>(m_QueueFamilyIndices.ComputeFamily.value()) : -1;
+	entry.TransferFamily = m_QueueFamilyIndices.TransferFamily.has_value() ? static_cast<int32_t>(m_QueueFamilyIndices.TransferFamily.value()) : -1;
+
+	std::ofstream file(m_DeviceCachePath, std::ios::binary);
+	file.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
 }
 
-bool Application::IsDeviceSuitable(VkPhysicalDevice device)
+bool Application::IsDeviceSuitable(VkPhysicalDevice device, const QueueFamilyIndices& indices)
 {
-	QueueFamilyIndices indices = FindQueueFamilies(device);
 	bool extensionsSupported = CheckDeviceExtensionSupport(device);
 	bool swapchainAdequate = false;
 	if (extensionsSupported)
@@ -187,7 +569,22 @@ bool Application::IsDeviceSuitable(VkPhysicalDevice device)
 	VkPhysicalDeviceFeatures supportedFeatures;
 	vkGetPhysicalDeviceFeatures(device, &supportedFeatures);
 
-	return indices.IsComplete() && extensionsSupported && swapchainAdequate && supportedFeatures.samplerAnisotropy;
+	// Descriptor indexing features required by the bindless heap
+	VkPhysicalDeviceDescriptorIndexingFeatures indexingFeatures{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES };
+	// Timeline semaphores order every submission
+	VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeatures{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR };
+	indexingFeatures.pNext = &timelineFeatures;
+	VkPhysicalDeviceFeatures2 supportedFeatures2{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+	supportedFeatures2.pNext = &indexingFeatures;
+	vkGetPhysicalDeviceFeatures2(device, &supportedFeatures2);
+	bool bindlessSupported = indexingFeatures.runtimeDescriptorArray
+		&& indexingFeatures.descriptorBindingPartiallyBound
+		&& indexingFeatures.shaderSampledImageArrayNonUniformIndexing
+		&& indexingFeatures.descriptorBindingSampledImageUpdateAfterBind
+		&& indexingFeatures.descriptorBindingStorageBufferUpdateAfterBind;
+
+	return indices.IsComplete() && extensionsSupported && swapchainAdequate && supportedFeatures.samplerAnisotropy && bindlessSupported
+		&& supportedFeatures.drawIndirectFirstInstance && timelineFeatures.timelineSemaphore;
 }
 
 QueueFamilyIndices Application::FindQueueFamilies(VkPhysicalDevice device)
@@ -198,28 +595,44 @@ QueueFamilyIndices Application::FindQueueFamilies(VkPhysicalDevice device)
 	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
 	vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
 	
-	int i = 0;
-	for (const auto& queueFamily : queueFamilies)
+	// A family that both draws and presents is preferred, otherwise the first of each
+	for (uint32_t family = 0; family < queueFamilyCount; ++family)
 	{
-		// Graphics
-		if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+		bool graphics = (queueFamilies[family].queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+		VkBool32 presentSupport = false;
+		vkGetPhysicalDeviceSurfaceSupportKHR(device, family, m_WindowSurface, &presentSupport);
+		if (graphics && presentSupport)
 		{
-			indices.GraphicsFamily = i;
+			indices.GraphicsFamily = family;
+			indices.PresentFamily = family;
+			break;
 		}
-
-		// Present support
-		VkBool32 presentSupport = false;
-		vkGetPhysicalDeviceSurfaceSupportKHR(device, i, m_WindowSurface, &presentSupport);
-		if (presentSupport)
+		if (graphics && !indices.GraphicsFamily.has_value())
+		{
+			indices.GraphicsFamily = family;
+		}
+		if (presentSupport && !indices.PresentFamily.has_value())
 		{
-			indices.PresentFamily = i;
+			indices.PresentFamily = family;
 		}
+	}
 
-		if (indices.IsComplete())
+	// Families that leave out graphics run next to it instead of sharing its hardware queue
+	for (uint32_t family = 0; family < queueFamilyCount; ++family)
+	{
+		VkQueueFlags flags = queueFamilies[family].queueFlags;
+		if ((flags & VK_QUEUE_GRAPHICS_BIT) || queueFamilies[family].queueCount == 0)
 		{
-			break;
+			continue;
+		}
+		if ((flags & VK_QUEUE_COMPUTE_BIT) && !indices.ComputeFamily.has_value())
+		{
+			indices.ComputeFamily = family;
+		}
+		else if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & VK_QUEUE_COMPUTE_BIT) && !indices.TransferFamily.has_value())
+		{
+			indices.TransferFamily = family;
 		}
-		++i;
 	}
 	return indices;
 }
@@ -250,10 +663,18 @@ bool Application::CheckDeviceExtensionSupport(VkPhysicalDevice device)
 
 void Application::CreateLogicalDevice()
 {
-	QueueFamilyIndices indices = FindQueueFamilies(m_PhysicalDevice);
+	const QueueFamilyIndices& indices = m_QueueFamilyIndices;
 
 	std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
 	std::set<uint32_t> uniqueQueueFamilies = { indices.GraphicsFamily.value(), indices.PresentFamily.value() };
+	if (indices.ComputeFamily.has_value())
+	{
+		uniqueQueueFamilies.insert(indices.ComputeFamily.value());
+	}
+	if (indices.TransferFamily.has_value())
+	{
+		uniqueQueueFamilies.insert(indices.TransferFamily.value());
+	}
 
 	float queuePriority = 1.0f;
 	for (uint32_t queueFamily : uniqueQueueFamilies)
@@ -265,21 +686,133 @@ void Application::CreateLogicalDevice()
 		queueCreateInfo.pQueuePriorities = &queuePriority;
 		queueCreateInfos.push_back(queueCreateInfo);
 	}
-	VkPhysicalDeviceFeatures2 deviceFeatures{};
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(m_PhysicalDevice, &supportedFeatures);
+	m_MultiDrawIndirectSupported = supportedFeatures.multiDrawIndirect == VK_TRUE;
+	m_VirtualTexturingSupported = supportedFeatures.fragmentStoresAndAtomics == VK_TRUE;
+
+	VkPhysicalDeviceFeatures2 deviceFeatures{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
 	deviceFeatures.features.samplerAnisotropy = VK_TRUE;
 	deviceFeatures.features.sampleRateShading = VK_TRUE; // Sample shading (smooth textures, worse performance)
+	deviceFeatures.features.drawIndirectFirstInstance = VK_TRUE; // Indirect draws select their instance range
+	deviceFeatures.features.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+	deviceFeatures.features.fragmentStoresAndAtomics = supportedFeatures.fragmentStoresAndAtomics; // Virtual texture feedback
+	VkPhysicalDeviceBufferDeviceAddressFeatures bufferDeviceAddressFeature{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_BUFFER_DEVICE_ADDRESS_FEATURES };
+	bufferDeviceAddressFeature.bufferDeviceAddress = VK_TRUE;
+	VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeature{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR };
+	timelineFeature.timelineSemaphore = VK_TRUE;
 	VkPhysicalDeviceAccelerationStructureFeaturesKHR accelFeature{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR };
+	accelFeature.accelerationStructure = VK_TRUE;
 	VkPhysicalDeviceRayTracingPipelineFeaturesKHR rtPipelineFeature{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_FEATURES_KHR };
+	rtPipelineFeature.rayTracingPipeline = VK_TRUE;
+	VkPhysicalDeviceDescriptorIndexingFeatures indexingFeature{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES };
+	indexingFeature.runtimeDescriptorArray = VK_TRUE;
+	indexingFeature.descriptorBindingPartiallyBound = VK_TRUE;
+	indexingFeature.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+	indexingFeature.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+	indexingFeature.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+	rtPipelineFeature.pNext = &indexingFeature;
 	accelFeature.pNext = &rtPipelineFeature;
-	deviceFeatures.pNext = &rtPipelineFeature;
+
+	// Mesh shading is optional, meshlets fall back to a compute culling pass and indirect draws without it
+	std::vector<const char*> extensions = m_DeviceExtensions;
+	uint32_t extensionCount;
+	vkEnumerateDeviceExtensionProperties(m_PhysicalDevice, nullptr, &extensionCount, nullptr);
+	std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+	vkEnumerateDeviceExtensionProperties(m_PhysicalDevice, nullptr, &extensionCount, availableExtensions.data());
+	VkPhysicalDeviceMeshShaderFeaturesNV meshShaderFeature{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_NV };
+	for (const auto& extension : availableExtensions)
+	{
+		if (strcmp(extension.extensionName, VK_NV_MESH_SHADER_EXTENSION_NAME) == 0)
+		{
+			VkPhysicalDeviceFeatures2 supportedFeatures2{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+			supportedFeatures2.pNext = &meshShaderFeature;
+			vkGetPhysicalDeviceFeatures2(m_PhysicalDevice, &supportedFeatures2);
+			m_MeshShadingSupported = meshShaderFeature.taskShader == VK_TRUE && meshShaderFeature.meshShader == VK_TRUE;
+		}
+	}
+	if (m_MeshShadingSupported)
+	{
+		meshShaderFeature.pNext = nullptr;
+		indexingFeature.pNext = &meshShaderFeature;
+		extensions.push_back(VK_NV_MESH_SHADER_EXTENSION_NAME);
+	}
+
+	// Dynamic rendering and synchronization2 are optional too, frames keep using the render pass and
+	// vkCmdPipelineBarrier without them. Dynamic rendering depends on the depth stencil resolve extension
+	std::array<const char*, 4> renderingExtensions = {
+		VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME,
+		VK_KHR_DEPTH_STENCIL_RESOLVE_EXTENSION_NAME,
+		VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME,
+		VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME };
+	bool renderingExtensionsSupported = std::all_of(renderingExtensions.begin(), renderingExtensions.end(), [&](const char* name)
+	{
+		return std::any_of(availableExtensions.begin(), availableExtensions.end(), [&](const VkExtensionProperties& extension)
+		{
+			return strcmp(extension.extensionName, name) == 0;
+		});
+	});
+	VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamicRenderingFeature{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR };
+	VkPhysicalDeviceSynchronization2FeaturesKHR synchronization2Feature{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR };
+	dynamicRenderingFeature.pNext = &synchronization2Feature;
+	if (renderingExtensionsSupported)
+	{
+		VkPhysicalDeviceFeatures2 supportedFeatures2{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+		supportedFeatures2.pNext = &dynamicRenderingFeature;
+		vkGetPhysicalDeviceFeatures2(m_PhysicalDevice, &supportedFeatures2);
+		m_DynamicRenderingSupported = dynamicRenderingFeature.dynamicRendering == VK_TRUE && synchronization2Feature.synchronization2 == VK_TRUE;
+	}
+	if (m_DynamicRenderingSupported)
+	{
+		synchronization2Feature.pNext = indexingFeature.pNext;
+		indexingFeature.pNext = &dynamicRenderingFeature;
+		extensions.insert(extensions.end(), renderingExtensions.begin(), renderingExtensions.end());
+	}
+
+	// Pipeline creation cache control lets material permutations be taken from the pipeline cache without ever
+	// compiling on the render thread. Without it every new permutation is compiled in the background
+	VkPhysicalDevicePipelineCreationCacheControlFeaturesEXT cacheControlFeature{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PIPELINE_CREATION_CACHE_CONTROL_FEATURES_EXT };
+	bool cacheControlExtensionSupported = std::any_of(availableExtensions.begin(), availableExtensions.end(), [](const VkExtensionProperties& extension)
+	{
+		return strcmp(extension.extensionName, VK_EXT_PIPELINE_CREATION_CACHE_CONTROL_EXTENSION_NAME) == 0;
+	});
+	if (cacheControlExtensionSupported)
+	{
+		VkPhysicalDeviceFeatures2 supportedFeatures2{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+		supportedFeatures2.pNext = &cacheControlFeature;
+		vkGetPhysicalDeviceFeatures2(m_PhysicalDevice, &supportedFeatures2);
+		m_PipelineCacheControlSupported = cacheControlFeature.pipelineCreationCacheControl == VK_TRUE;
+	}
+	if (m_PipelineCacheControlSupported)
+	{
+		cacheControlFeature.pNext = indexingFeature.pNext;
+		indexingFeature.pNext = &cacheControlFeature;
+		extensions.push_back(VK_EXT_PIPELINE_CREATION_CACHE_CONTROL_EXTENSION_NAME);
+	}
+
+	// Memory budget reports how much of each heap this process may use and already does, including the driver's own
+	// allocations. Without it the budget is guessed from the heap sizes
+	m_MemoryBudgetSupported = std::any_of(availableExtensions.begin(), availableExtensions.end(), [](const VkExtensionProperties& extension)
+	{
+		return strcmp(extension.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0;
+	});
+	if (m_MemoryBudgetSupported)
+	{
+		extensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+	}
+
+	timelineFeature.pNext = &accelFeature;
+	bufferDeviceAddressFeature.pNext = &timelineFeature;
+	deviceFeatures.pNext = &bufferDeviceAddressFeature;
 
 	VkDeviceCreateInfo createInfo{};
 	createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	createInfo.pNext = &deviceFeatures; // Features are passed through the chain instead of pEnabledFeatures
 	createInfo.pQueueCreateInfos = queueCreateInfos.data();
 	createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
-	createInfo.pEnabledFeatures = &deviceFeatures.features;
-	createInfo.enabledExtensionCount = static_cast<uint32_t>(m_DeviceExtensions.size());
-	createInfo.ppEnabledExtensionNames = m_DeviceExtensions.data();
+	createInfo.pEnabledFeatures = nullptr;
+	createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+	createInfo.ppEnabledExtensionNames = extensions.data();
 	if (m_EnableValidationLayers)
 	{
 		createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
@@ -297,6 +830,55 @@ void Application::CreateLogicalDevice()
 
 	vkGetDeviceQueue(m_Device, indices.GraphicsFamily.value(), 0, &m_GraphicsQueue);
 	vkGetDeviceQueue(m_Device, indices.PresentFamily.value(), 0, &m_PresentQueue);
+	m_ComputeQueue = m_GraphicsQueue;
+	if (indices.ComputeFamily.has_value())
+	{
+		vkGetDeviceQueue(m_Device, indices.ComputeFamily.value(), 0, &m_ComputeQueue);
+	}
+	m_TransferQueue = m_GraphicsQueue;
+	if (indices.TransferFamily.has_value())
+	{
+		vkGetDeviceQueue(m_Device, indices.TransferFamily.value(), 0, &m_TransferQueue);
+	}
+}
+
+void Application::LoadPipelineCacheData()
+{
+	// Data saved by the previous run, if any
+	std::ifstream file(m_PipelineCachePath, std::ios::ate | std::ios::binary);
+	if (file.is_open())
+	{
+		m_PipelineCacheData.resize(static_cast<size_t>(file.tellg()));
+		file.seekg(0);
+		file.read(m_PipelineCacheData.data(), m_PipelineCacheData.size());
+		file.close();
+	}
+}
+
+void Application::CreatePipelineCache()
+{
+	// Seeded with the data read ahead by LoadPipelineCacheData. Drivers ignore incompatible data
+	VkPipelineCacheCreateInfo cacheInfo{};
+	cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	cacheInfo.initialDataSize = m_PipelineCacheData.size();
+	cacheInfo.pInitialData = m_PipelineCacheData.empty() ? nullptr : m_PipelineCacheData.data();
+	if (vkCreatePipelineCache(m_Device, &cacheInfo, nullptr, &m_PipelineCache) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create pipeline cache");
+	}
+	m_PipelineCacheData.clear();
+	m_PipelineCacheData.shrink_to_fit();
+}
+
+void Application::SavePipelineCache()
+{
+	size_t cacheSize = 0;
+	vkGetPipelineCacheData(m_Device, m_PipelineCache, &cacheSize, nullptr);
+	std::vector<char> cacheData(cacheSize);
+	vkGetPipelineCacheData(m_Device, m_PipelineCache, &cacheSize, cacheData.data());
+
+	std::ofstream file(m_PipelineCachePath, std::ios::binary);
+	file.write(cacheData.data(), cacheSize);
 }
 
 void Application::CreateSurface()
@@ -352,11 +934,14 @@ void Application::CreateSwapchain()
 	createInfo.imageColorSpace = surfaceFormat.colorSpace;
 	createInfo.imageExtent = extent;
 	createInfo.imageArrayLayers = 1;
-	createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+	createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT; // Transfer for the ray traced image
 	m_SwapchainExtent = extent;
+	UpdateRenderExtent();
+	m_ViewportWidth = extent.width;
+	m_ViewportHeight = extent.height;
 	m_SwapchainImageFormat = surfaceFormat.format;
 
-	QueueFamilyIndices indices = FindQueueFamilies(m_PhysicalDevice);
+	const QueueFamilyIndices& indices = m_QueueFamilyIndices;
 	uint32_t queueFamilyIndices[] = { indices.GraphicsFamily.value(), indices.PresentFamily.value() };
 	if (indices.GraphicsFamily != indices.PresentFamily)
 	{
@@ -421,13 +1006,7 @@ VkExtent2D Application::ChooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabil
 	}
 	else
 	{
-		int width, height;
-		glfwGetFramebufferSize(m_Window, &width, &height);
-
-		VkExtent2D actualExtent = {
-			static_cast<uint32_t>(width),
-			static_cast<uint32_t>(height)
-		};
+		VkExtent2D actualExtent = { m_FramebufferWidth, m_FramebufferHeight };
 
 		actualExtent.width = std::clamp(actualExtent.width, capabilities.minImageExtent.width, capabilities.maxImageExtent.width);
 		actualExtent.height = std::clamp(actualExtent.height, capabilities.minImageExtent.height, capabilities.maxImageExtent.height);
@@ -436,14 +1015,39 @@ VkExtent2D Application::ChooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabil
 	}
 }
 
-void Application::InitRaytracing()
+void Application::UpdateRenderExtent()
 {
-	load_VK_EXTENSIONS(m_VkInstance, vkGetInstanceProcAddr, m_Device, vkGetDeviceProcAddr);
+	// At least a pixel along each side, and never rounded past the swapchain
+	m_RenderExtent.width = std::clamp(static_cast<uint32_t>(m_SwapchainExtent.width * m_RenderScale + 0.5f), 1u, m_SwapchainExtent.width);
+	m_RenderExtent.height = std::clamp(static_cast<uint32_t>(m_SwapchainExtent.height * m_RenderScale + 0.5f), 1u, m_SwapchainExtent.height);
+	m_Upscaling = m_RenderExtent.width != m_SwapchainExtent.width || m_RenderExtent.height != m_SwapchainExtent.height;
+}
 
+void Application::InitRaytracing()
+{
 	VkPhysicalDeviceProperties2 prop2{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2};
 	prop2.pNext = &m_RtProperties;
 	vkGetPhysicalDeviceProperties2(m_PhysicalDevice, &prop2);
-	m_RtBuilder.Setup(m_Device, FindQueueFamilies(m_PhysicalDevice).GraphicsFamily.value());
+	m_RtBuilder.Setup(m_Device, m_PhysicalDevice, m_QueueFamilyIndices.GraphicsFamily.value(), &m_MemoryBudget);
+
+	// One BLAS per scene mesh, all reading from the shared vertex and index buffers
+	for (const MeshInfo& mesh : m_Scene.GetMeshes())
+	{
+		ObjModel model;
+		model.nbIndices = mesh.IndexCount;
+		model.nbVertices = mesh.VertexCount;
+		model.firstIndex = mesh.FirstIndex;
+		model.vertexOffset = mesh.VertexOffset;
+		model.vertexBuffer = m_VertexBuffer;
+		model.indexBuffer = m_IndexBuffer;
+		m_ObjModel.emplace_back(model);
+	}
+
+	CreateBottomLevelAS();
+	CreateTopLevelAS();
+	CreateRtDescriptorSet();
+	CreateRtPipeline();
+	CreateRtShaderBindingTable();
 }
 
 BlasInput Application::ObjectToVkGeometryKHR(const ObjModel& model)
@@ -460,7 +1064,7 @@ BlasInput Application::ObjectToVkGeometryKHR(const ObjModel& model)
 	};
 	triangles.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
 	triangles.vertexData.deviceAddress = vertexAddress;
-	triangles.vertexStride = sizeof(VertexObj);
+	triangles.vertexStride = sizeof(Vertex);
 	
 	// Describe index data (32-bit uint)
 	triangles.indexType = VK_INDEX_TYPE_UINT32;
@@ -473,11 +1077,11 @@ BlasInput Application::ObjectToVkGeometryKHR(const ObjModel& model)
 	asGeom.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
 	asGeom.geometry.triangles = triangles;
 
-	// The entire array will be used to build the BLAS
+	// Only the model's range of the shared buffers is used to build the BLAS
 	VkAccelerationStructureBuildRangeInfoKHR offset;
-	offset.firstVertex = 0;
+	offset.firstVertex = static_cast<uint32_t>(model.vertexOffset);
 	offset.primitiveCount = maxPrimitiveCount;
-	offset.primitiveOffset = 0;
+	offset.primitiveOffset = model.firstIndex * sizeof(uint32_t);
 	offset.transformOffset = 0;
 
 	// Our BLAS is made from only one geometry, but could be made of many geometries
@@ -499,69 +1103,425 @@ void Application::CreateBottomLevelAS()
 		// We could add more geometry in each BLAS, but we add only one for now
 		allBlas.emplace_back(blas);
 	}
-	
+	m_RtBuilder.BuildBlas(allBlas, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR);
 }
 
-VkDeviceAddress Application::GetBufferDeviceAddress(VkBuffer buffer)
+void Application::CreateTopLevelAS()
 {
-	VkBufferDeviceAddressInfo info = {VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO};
-	info.buffer = buffer;
-	return vkGetBufferDeviceAddress(m_Device, &info);
-
+	const std::vector<InstanceData>& instances = m_Scene.GetInstances();
+	std::vector<VkAccelerationStructureInstanceKHR> tlas;
+	tlas.reserve(instances.size());
+	for (uint32_t i = 0; i < static_cast<uint32_t>(instances.size()); ++i)
+	{
+		// Instance transform only, the model matrix is applied to the rays instead
+		VkAccelerationStructureInstanceKHR rayInstance{};
+		for (int row = 0; row < 3; ++row)
+		{
+			for (int column = 0; column < 4; ++column)
+			{
+				rayInstance.transform.matrix[row][column] = instances[i].Transform[column][row];
+			}
+		}
+		rayInstance.instanceCustomIndex = i;
+		rayInstance.accelerationStructureReference = m_RtBuilder.GetBlasDeviceAddress(instances[i].MeshIndex);
+		rayInstance.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
+		rayInstance.mask = 0xFF;
+		rayInstance.instanceShaderBindingTableRecordOffset = 0; // Same hit group for all objects
+		tlas.emplace_back(rayInstance);
+	}
+	m_RtBuilder.BuildTlas(tlas, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR);
 }
 
-void Application::CreateRenderPass()
+void Application::CreateRtOutputImage()
 {
-	VkAttachmentDescription colorAttachment{};
-	colorAttachment.format = m_SwapchainImageFormat;
-	colorAttachment.samples = m_MsaaSamples;
-	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	m_RtOutputFormat = FindSupportedFormat(
+		{ VK_FORMAT_R8G8B8A8_UNORM },
+		VK_IMAGE_TILING_OPTIMAL,
+		VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT | VK_FORMAT_FEATURE_BLIT_SRC_BIT);
 
-	VkAttachmentReference colorAttachmentRef{};
-	colorAttachmentRef.attachment = 0;
-	colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	// Bound and moved to the general layout later, since its memory may be shared with the raster attachments
+	CreateImage(
+		m_RenderExtent.width,
+		m_RenderExtent.height,
+		1,
+		VK_SAMPLE_COUNT_1_BIT,
+		m_RtOutputFormat,
+		VK_IMAGE_TILING_OPTIMAL,
+		VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+		m_RtOutputImage);
+}
 
-	VkAttachmentDescription depthAttachment{};
-	depthAttachment.format = FindDepthFormat();
-	depthAttachment.samples = m_MsaaSamples;
-	depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE; // Data will not be used after drawing has finished
-	depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-	depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+void Application::CreateRtDescriptorSet()
+{
+	VkDescriptorSetLayoutBinding tlasLayoutBinding{};
+	tlasLayoutBinding.binding = 0;
+	tlasLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
+	tlasLayoutBinding.descriptorCount = 1;
+	tlasLayoutBinding.stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_KHR;
 
-	VkAttachmentReference depthAttachmentRef{};
-	depthAttachmentRef.attachment = 1;
-	depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	VkDescriptorSetLayoutBinding outputImageLayoutBinding{};
+	outputImageLayoutBinding.binding = 1;
+	outputImageLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	outputImageLayoutBinding.descriptorCount = 1;
+	outputImageLayoutBinding.stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_KHR;
 
-	// Attachment to resolve multisampled images to
-	VkAttachmentDescription colorAttachmentResolve{};
-	colorAttachmentResolve.format = m_SwapchainImageFormat;
-	colorAttachmentResolve.samples = VK_SAMPLE_COUNT_1_BIT;
-	colorAttachmentResolve.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-	colorAttachmentResolve.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	colorAttachmentResolve.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-	colorAttachmentResolve.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	colorAttachmentResolve.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	colorAttachmentResolve.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	std::array<VkDescriptorSetLayoutBinding, 2> bindings = { tlasLayoutBinding, outputImageLayoutBinding };
 
-	VkAttachmentReference colorAttachmentResolveRef{};
+	VkDescriptorSetLayoutCreateInfo layoutInfo{};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+	layoutInfo.pBindings = bindings.data();
+	if (vkCreateDescriptorSetLayout(m_Device, &layoutInfo, nullptr, &m_RtDescriptorSetLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create ray tracing descriptor set layout");
+	}
+
+	std::array<VkDescriptorPoolSize, 2> poolSizes{};
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
+	poolSizes[0].descriptorCount = m_MaxFramesInFlight;
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	poolSizes[1].descriptorCount = m_MaxFramesInFlight;
+
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	poolInfo.pPoolSizes = poolSizes.data();
+	poolInfo.maxSets = m_MaxFramesInFlight;
+	if (vkCreateDescriptorPool(m_Device, &poolInfo, nullptr, &m_RtDescriptorPool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create ray tracing descriptor pool");
+	}
+
+	// One set per frame slot, binding 1, the output image, is written by UpdateRtDescriptorSet
+	std::vector<VkDescriptorSetLayout> layouts(m_MaxFramesInFlight, m_RtDescriptorSetLayout);
+	VkDescriptorSetAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = m_RtDescriptorPool;
+	allocInfo.descriptorSetCount = m_MaxFramesInFlight;
+	allocInfo.pSetLayouts = layouts.data();
+	m_RtDescriptorSets.resize(m_MaxFramesInFlight);
+	if (vkAllocateDescriptorSets(m_Device, &allocInfo, m_RtDescriptorSets.data()) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate ray tracing descriptor sets");
+	}
+
+	VkAccelerationStructureKHR tlas = m_RtBuilder.GetAccelerationStructure();
+	VkWriteDescriptorSetAccelerationStructureKHR descriptorAsInfo{ VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR };
+	descriptorAsInfo.accelerationStructureCount = 1;
+	descriptorAsInfo.pAccelerationStructures = &tlas;
+
+	for (VkDescriptorSet set : m_RtDescriptorSets)
+	{
+		VkWriteDescriptorSet tlasWrite{};
+		tlasWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		tlasWrite.pNext = &descriptorAsInfo;
+		tlasWrite.dstSet = set;
+		tlasWrite.dstBinding = 0;
+		tlasWrite.dstArrayElement = 0;
+		tlasWrite.descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
+		tlasWrite.descriptorCount = 1;
+		vkUpdateDescriptorSets(m_Device, 1, &tlasWrite, 0, nullptr);
+	}
+}
+
+void Application::UpdateRtDescriptorSet(uint32_t frame)
+{
+	// The output image is recreated with the render targets, so its binding is written separately
+	VkDescriptorImageInfo imageInfo{};
+	imageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+	imageInfo.imageView = m_RtOutputImageView;
+	imageInfo.sampler = VK_NULL_HANDLE;
+
+	VkWriteDescriptorSet imageWrite{};
+	imageWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	imageWrite.dstSet = m_RtDescriptorSets[frame];
+	imageWrite.dstBinding = 1;
+	imageWrite.dstArrayElement = 0;
+	imageWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	imageWrite.descriptorCount = 1;
+	imageWrite.pImageInfo = &imageInfo;
+	vkUpdateDescriptorSets(m_Device, 1, &imageWrite, 0, nullptr);
+}
+
+void Application::CreateRtPipeline()
+{
+	enum StageIndices
+	{
+		eRaygen,
+		eMiss,
+		eClosestHit,
+		eShaderGroupCount
+	};
+
+	std::array<VkPipelineShaderStageCreateInfo, eShaderGroupCount> stages{};
+	stages[eRaygen].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	stages[eRaygen].stage = VK_SHADER_STAGE_RAYGEN_BIT_KHR;
+	stages[eRaygen].module = CreateShaderModule(GetShaderCode(m_RaygenShader));
+	stages[eRaygen].pName = "main";
+
+	stages[eMiss].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	stages[eMiss].stage = VK_SHADER_STAGE_MISS_BIT_KHR;
+	stages[eMiss].module = CreateShaderModule(GetShaderCode(m_MissShader));
+	stages[eMiss].pName = "main";
+
+	stages[eClosestHit].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	stages[eClosestHit].stage = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR;
+	stages[eClosestHit].module = CreateShaderModule(GetShaderCode(m_ClosestHitShader));
+	stages[eClosestHit].pName = "main";
+
+	// One group per shader: raygen and miss are general groups, closest hit is a triangle hit group
+	VkRayTracingShaderGroupCreateInfoKHR group{ VK_STRUCTURE_TYPE_RAY_TRACING_SHADER_GROUP_CREATE_INFO_KHR };
+	group.anyHitShader = VK_SHADER_UNUSED_KHR;
+	group.closestHitShader = VK_SHADER_UNUSED_KHR;
+	group.generalShader = VK_SHADER_UNUSED_KHR;
+	group.intersectionShader = VK_SHADER_UNUSED_KHR;
+
+	m_RtShaderGroups.clear();
+	group.type = VK_RAY_TRACING_SHADER_GROUP_TYPE_GENERAL_KHR;
+	group.generalShader = eRaygen;
+	m_RtShaderGroups.push_back(group);
+
+	group.generalShader = eMiss;
+	m_RtShaderGroups.push_back(group);
+
+	group.type = VK_RAY_TRACING_SHADER_GROUP_TYPE_TRIANGLES_HIT_GROUP_KHR;
+	group.generalShader = VK_SHADER_UNUSED_KHR;
+	group.closestHitShader = eClosestHit;
+	m_RtShaderGroups.push_back(group);
+
+	VkPushConstantRange pushConstant{};
+	pushConstant.stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_MISS_BIT_KHR;
+	pushConstant.offset = 0;
+	pushConstant.size = sizeof(RtPushConstants);
+
+	// Set 0 holds the ray tracing resources, set 1 the per frame camera shared with the raster pipeline
+	std::array<VkDescriptorSetLayout, 2> setLayouts = { m_RtDescriptorSetLayout, m_DescriptorSetLayout };
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+	pipelineLayoutInfo.pSetLayouts = setLayouts.data();
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstant;
+	if (vkCreatePipelineLayout(m_Device, &pipelineLayoutInfo, nullptr, &m_RtPipelineLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create ray tracing pipeline layout");
+	}
+
+	VkRayTracingPipelineCreateInfoKHR pipelineInfo{ VK_STRUCTURE_TYPE_RAY_TRACING_PIPELINE_CREATE_INFO_KHR };
+	pipelineInfo.stageCount = static_cast<uint32_t>(stages.size());
+	pipelineInfo.pStages = stages.data();
+	pipelineInfo.groupCount = static_cast<uint32_t>(m_RtShaderGroups.size());
+	pipelineInfo.pGroups = m_RtShaderGroups.data();
+	pipelineInfo.maxPipelineRayRecursionDepth = 1; // Primary rays only
+	pipelineInfo.layout = m_RtPipelineLayout;
+	if (vkCreateRayTracingPipelinesKHR(m_Device, VK_NULL_HANDLE, m_PipelineCache, 1, &pipelineInfo, nullptr, &m_RtPipeline) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create ray tracing pipeline");
+	}
+
+	for (auto& stage : stages)
+	{
+		vkDestroyShaderModule(m_Device, stage.module, nullptr);
+	}
+}
+
+void Application::CreateRtShaderBindingTable()
+{
+	uint32_t missCount = 1;
+	uint32_t hitCount = 1;
+	uint32_t handleCount = 1 + missCount + hitCount;
+	uint32_t handleSize = m_RtProperties.shaderGroupHandleSize;
+
+	// Handles are packed at the handle alignment, and each region starts at the base alignment
+	uint32_t handleSizeAligned = AlignUp(handleSize, m_RtProperties.shaderGroupHandleAlignment);
+
+	// The raygen region size must be equal to its stride
+	m_RgenRegion.stride = AlignUp(handleSizeAligned, m_RtProperties.shaderGroupBaseAlignment);
+	m_RgenRegion.size = m_RgenRegion.stride;
+	m_MissRegion.stride = handleSizeAligned;
+	m_MissRegion.size = AlignUp(missCount * handleSizeAligned, m_RtProperties.shaderGroupBaseAlignment);
+	m_HitRegion.stride = handleSizeAligned;
+	m_HitRegion.size = AlignUp(hitCount * handleSizeAligned, m_RtProperties.shaderGroupBaseAlignment);
+
+	uint32_t dataSize = handleCount * handleSize;
+	std::vector<uint8_t> handles(dataSize);
+	if (vkGetRayTracingShaderGroupHandlesKHR(m_Device, m_RtPipeline, 0, handleCount, dataSize, handles.data()) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to get ray tracing shader group handles");
+	}
+
+	// Buffer addresses are not guaranteed to meet the base alignment, so leave room to start the table further in
+	VkDeviceSize sbtSize = m_RgenRegion.size + m_MissRegion.size + m_HitRegion.size + m_CallRegion.size;
+	CreateBuffer(
+		sbtSize + m_RtProperties.shaderGroupBaseAlignment,
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_SHADER_BINDING_TABLE_BIT_KHR,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		MemoryBudget::CategoryOther,
+		m_RtSbtBuffer,
+		m_RtSbtBufferMemory,
+		VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT);
+
+	VkDeviceAddress bufferAddress = GetBufferDeviceAddress(m_RtSbtBuffer);
+	VkDeviceAddress alignment = m_RtProperties.shaderGroupBaseAlignment;
+	VkDeviceAddress sbtAddress = (bufferAddress + alignment - 1) / alignment * alignment;
+	VkDeviceSize sbtOffset = sbtAddress - bufferAddress;
+	m_RgenRegion.deviceAddress = sbtAddress;
+	m_MissRegion.deviceAddress = sbtAddress + m_RgenRegion.size;
+	m_HitRegion.deviceAddress = sbtAddress + m_RgenRegion.size + m_MissRegion.size;
+
+	// Copy each handle to its slot in the table
+	uint8_t* data;
+	vkMapMemory(m_Device, m_RtSbtBufferMemory, sbtOffset, sbtSize, 0, reinterpret_cast<void**>(&data));
+	uint32_t handleIndex = 0;
+
+	memcpy(data, handles.data() + (handleIndex++) * handleSize, handleSize);
+
+	uint8_t* missData = data + m_RgenRegion.size;
+	for (uint32_t i = 0; i < missCount; ++i)
+	{
+		memcpy(missData + i * m_MissRegion.stride, handles.data() + (handleIndex++) * handleSize, handleSize);
+	}
+
+	uint8_t* hitData = data + m_RgenRegion.size + m_MissRegion.size;
+	for (uint32_t i = 0; i < hitCount; ++i)
+	{
+		memcpy(hitData + i * m_HitRegion.stride, handles.data() + (handleIndex++) * handleSize, handleSize);
+	}
+	vkUnmapMemory(m_Device, m_RtSbtBufferMemory);
+}
+
+void Application::AddRaytracingPasses(uint32_t imageIndex)
+{
+	RenderGraph::ResourceHandle output = m_RenderGraph.ImportImage("Ray traced output", m_RtOutputImage, VK_IMAGE_ASPECT_COLOR_BIT);
+	RenderGraph::ResourceHandle swapchain = ImportSwapchainImage(imageIndex);
+
+	m_RenderGraph.AddPass(
+		"Trace",
+		[&](RenderGraph::PassBuilder& pass)
+		{
+			pass.Overwrite(output, { VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL });
+		},
+		[this](VkCommandBuffer commandBuffer) { Trace(commandBuffer); });
+
+	// Blit the traced image into the swapchain image, converting to its format and scaling it up to its extent
+	m_RenderGraph.AddPass(
+		"Composite",
+		[&](RenderGraph::PassBuilder& pass)
+		{
+			pass.Read(output, { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL });
+			pass.Overwrite(swapchain, { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL });
+		},
+		[this, imageIndex](VkCommandBuffer commandBuffer)
+		{
+			BlitToSwapchain(commandBuffer, m_RtOutputImage, VK_IMAGE_LAYOUT_GENERAL, imageIndex);
+		});
+}
+
+void Application::Trace(VkCommandBuffer commandBuffer)
+{
+	std::array<VkDescriptorSet, 2> descriptorSets = { m_RtDescriptorSets[m_CurrentFrame], m_DescriptorSets[m_CurrentFrame] };
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, m_RtPipeline);
+	vkCmdBindDescriptorSets(
+		commandBuffer,
+		VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR,
+		m_RtPipelineLayout,
+		0,
+		static_cast<uint32_t>(descriptorSets.size()),
+		descriptorSets.data(),
+		0,
+		nullptr);
+	vkCmdPushConstants(
+		commandBuffer,
+		m_RtPipelineLayout,
+		VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_MISS_BIT_KHR,
+		0,
+		sizeof(RtPushConstants),
+		&m_RtPushConstants);
+	vkCmdTraceRaysKHR(
+		commandBuffer,
+		&m_RgenRegion,
+		&m_MissRegion,
+		&m_HitRegion,
+		&m_CallRegion,
+		m_RenderExtent.width,
+		m_RenderExtent.height,
+		1);
+}
+
+VkDeviceAddress Application::GetBufferDeviceAddress(VkBuffer buffer)
+{
+	VkBufferDeviceAddressInfo info = {VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO};
+	info.buffer = buffer;
+	return vkGetBufferDeviceAddress(m_Device, &info);
+
+}
+
+void Application::CreateRenderPass()
+{
+	VkAttachmentDescription colorAttachment{};
+	colorAttachment.format = m_SwapchainImageFormat;
+	colorAttachment.samples = m_MsaaSamples;
+	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE; // Only the resolved image is kept
+	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+	VkAttachmentReference colorAttachmentRef{};
+	colorAttachmentRef.attachment = 0;
+	colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+	VkAttachmentDescription depthAttachment{};
+	depthAttachment.format = FindDepthFormat();
+	depthAttachment.samples = m_MsaaSamples;
+	depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	// Reduced into the depth pyramid for next frame's occlusion culling, otherwise it can stay in tile memory
+	depthAttachment.storeOp = m_DepthSamplingSupported ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+
+	VkAttachmentReference depthAttachmentRef{};
+	depthAttachmentRef.attachment = 1;
+	depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+	// Attachment to resolve multisampled images to, the swapchain image or the scene color image to scale up. The graph
+	// moves it on to whichever layout it is used in next
+	VkAttachmentDescription colorAttachmentResolve{};
+	colorAttachmentResolve.format = m_SwapchainImageFormat;
+	colorAttachmentResolve.samples = VK_SAMPLE_COUNT_1_BIT;
+	colorAttachmentResolve.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	colorAttachmentResolve.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	colorAttachmentResolve.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	colorAttachmentResolve.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	colorAttachmentResolve.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	colorAttachmentResolve.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+	VkAttachmentReference colorAttachmentResolveRef{};
 	colorAttachmentResolveRef.attachment = 2;
 	colorAttachmentResolveRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
-	VkSubpassDependency dependency{};
-	dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-	dependency.dstSubpass = 0;
-	dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-	dependency.srcAccessMask = 0;
-	dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-	dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	// The previous depth pyramid build must be done reading depth before it is cleared
+	std::array<VkSubpassDependency, 2> dependencies{};
+	dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[0].dstSubpass = 0;
+	dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT
+		| VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+	dependencies[0].srcAccessMask = 0;
+	dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+	dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+	// Depth writes are visible to the compute shader building the depth pyramid
+	dependencies[1].srcSubpass = 0;
+	dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[1].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	dependencies[1].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	dependencies[1].dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+	dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 
 	VkSubpassDescription subpass{};
 	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
@@ -577,8 +1537,8 @@ void Application::CreateRenderPass()
 	renderPassInfo.pAttachments = attachments.data();
 	renderPassInfo.subpassCount = 1;
 	renderPassInfo.pSubpasses = &subpass;
-	renderPassInfo.dependencyCount = 1;
-	renderPassInfo.pDependencies = &dependency;
+	renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+	renderPassInfo.pDependencies = dependencies.data();
 
 	if (vkCreateRenderPass(m_Device, &renderPassInfo, nullptr, &m_RenderPass) != VK_SUCCESS)
 	{
@@ -596,10 +1556,14 @@ void Application::CreateImageViews()
 	}
 }
 
-void Application::CreateGraphicsPipeline()
+bool Application::CreateGraphicsPipeline(GraphicsPipelineSet& pipelines, uint32_t materialFeatures, bool cachedOnly)
 {
-	auto vertexShaderCode = ReadFile("resources/shaders/vert.spv");
-	auto fragmentShaderCode = ReadFile("resources/shaders/frag.spv");
+	auto vertexShaderCode = GetShaderCode(m_VertexShader);
+	auto fragmentShaderCode = GetShaderCode(m_FragmentShader);
+
+	ShaderReflection vertexReflection = ShaderReflection::Reflect(vertexShaderCode);
+	ShaderReflection fragmentReflection = ShaderReflection::Reflect(fragmentShaderCode);
+	CheckPushConstantSize(vertexReflection, sizeof(DrawPushConstants), "Draw");
 
 	VkShaderModule vertexShaderModule = CreateShaderModule(vertexShaderCode);
 	VkShaderModule fragmentShaderModule = CreateShaderModule(fragmentShaderCode);
@@ -616,6 +1580,29 @@ void Application::CreateGraphicsPipeline()
 	fragmentShaderStageInfo.module = fragmentShaderModule;
 	fragmentShaderStageInfo.pName = "main";
 
+	// Specialized pipelines get the material features as constants, the generic ones keep the shader's defaults
+	std::array<VkBool32, 4> specializationData = {
+		VK_TRUE,
+		(materialFeatures & MaterialTextured) != 0 ? VK_TRUE : VK_FALSE,
+		(materialFeatures & MaterialAlphaTest) != 0 ? VK_TRUE : VK_FALSE,
+		(materialFeatures & MaterialVertexColor) != 0 ? VK_TRUE : VK_FALSE };
+	std::array<VkSpecializationMapEntry, 4> specializationEntries{};
+	for (uint32_t i = 0; i < specializationEntries.size(); ++i)
+	{
+		specializationEntries[i].constantID = i; // constant_id in shader.frag
+		specializationEntries[i].offset = i * sizeof(VkBool32);
+		specializationEntries[i].size = sizeof(VkBool32);
+	}
+	VkSpecializationInfo specializationInfo{};
+	specializationInfo.mapEntryCount = static_cast<uint32_t>(specializationEntries.size());
+	specializationInfo.pMapEntries = specializationEntries.data();
+	specializationInfo.dataSize = sizeof(specializationData);
+	specializationInfo.pData = specializationData.data();
+	if (materialFeatures != s_GenericMaterial)
+	{
+		fragmentShaderStageInfo.pSpecializationInfo = &specializationInfo;
+	}
+
 	VkPipelineShaderStageCreateInfo shaderStages[] = { vertexShaderStageInfo, fragmentShaderStageInfo };
 
 	VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
@@ -624,8 +1611,23 @@ void Application::CreateGraphicsPipeline()
 	vertexInputInfo.pVertexBindingDescriptions = nullptr;
 	vertexInputInfo.vertexAttributeDescriptionCount = 0;
 	vertexInputInfo.pVertexAttributeDescriptions = nullptr;
+	// One attribute per input the vertex shader reads, in the format it declares, at the offset Vertex keeps it at
 	auto bindingDescription = Vertex::GetBindingDescription();
-	auto attributeDescriptions = Vertex::GetAttributeDescriptions();
+	auto attributeOffsets = Vertex::GetAttributeOffsets();
+	std::vector<VkVertexInputAttributeDescription> attributeDescriptions;
+	for (const ReflectedVertexInput& input : vertexReflection.VertexInputs)
+	{
+		if (input.Location >= attributeOffsets.size())
+		{
+			throw std::runtime_error("Vertex shader reads location " + std::to_string(input.Location) + ", which vertices do not have");
+		}
+		VkVertexInputAttributeDescription attributeDescription{};
+		attributeDescription.binding = 0;
+		attributeDescription.location = input.Location;
+		attributeDescription.format = input.Format;
+		attributeDescription.offset = attributeOffsets[input.Location];
+		attributeDescriptions.push_back(attributeDescription);
+	}
 	vertexInputInfo.vertexBindingDescriptionCount = 1;
 	vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
 	vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
@@ -636,24 +1638,13 @@ void Application::CreateGraphicsPipeline()
 	inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
 	inputAssembly.primitiveRestartEnable = VK_FALSE;
 
-	VkViewport viewport;
-	viewport.x = 0.0f;
-	viewport.y = 0.0f;
-	viewport.width = (float)m_SwapchainExtent.width;
-	viewport.height = (float)m_SwapchainExtent.height;
-	viewport.minDepth = 0.0f;
-	viewport.maxDepth = 1.0f;
-
-	VkRect2D scissor{};
-	scissor.offset = { 0, 0 };
-	scissor.extent = m_SwapchainExtent;
-
+	// Viewport and scissor are set while drawing, so resizing the window does not invalidate the pipelines
 	VkPipelineViewportStateCreateInfo viewportState{};
 	viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
 	viewportState.viewportCount = 1;
-	viewportState.pViewports = &viewport;
+	viewportState.pViewports = nullptr;
 	viewportState.scissorCount = 1;
-	viewportState.pScissors = &scissor;
+	viewportState.pScissors = nullptr;
 
 	VkPipelineRasterizationStateCreateInfo rasterizer{};
 	rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
@@ -665,12 +1656,12 @@ void Application::CreateGraphicsPipeline()
 	rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
 	rasterizer.depthBiasEnable = VK_FALSE;
 
-	// Multisampling disabled for now
+	// Sample count and sample shading are picked by the quality governor, so changing them recreates the pipelines
 	VkPipelineMultisampleStateCreateInfo multisampling{};
 	multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-	multisampling.sampleShadingEnable = VK_TRUE; // Sample shading (smooth textures, worse performance)
+	multisampling.sampleShadingEnable = m_MinSampleShading > 0.0f ? VK_TRUE : VK_FALSE; // Sample shading (smooth textures, worse performance)
 	multisampling.rasterizationSamples = m_MsaaSamples;
-	multisampling.minSampleShading = 0.2f; // Min fraction for sample shading, closer to 1 is smoother
+	multisampling.minSampleShading = m_MinSampleShading; // Min fraction for sample shading, closer to 1 is smoother
 	multisampling.pSampleMask = nullptr; // Optional
 	multisampling.alphaToCoverageEnable = VK_FALSE; // Optional
 	multisampling.alphaToOneEnable = VK_FALSE; // Optional
@@ -711,7 +1702,7 @@ void Application::CreateGraphicsPipeline()
 
 	std::vector<VkDynamicState> dynamicStates = {
 		VK_DYNAMIC_STATE_VIEWPORT,
-		VK_DYNAMIC_STATE_LINE_WIDTH
+		VK_DYNAMIC_STATE_SCISSOR
 	};
 
 	VkPipelineDynamicStateCreateInfo dynamicState{};
@@ -719,20 +1710,34 @@ void Application::CreateGraphicsPipeline()
 	dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
 	dynamicState.pDynamicStates = dynamicStates.data();
 
-	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
-	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	pipelineLayoutInfo.setLayoutCount = 1;
-	pipelineLayoutInfo.pSetLayouts = &m_DescriptorSetLayout;
-	pipelineLayoutInfo.pushConstantRangeCount = 0;
-	pipelineLayoutInfo.pPushConstantRanges = nullptr;
+	// Set 0 is the per frame uniform buffer, set 1 the bindless heap holding the instance buffer and textures. Other
+	// pipelines bind the same sets, so they keep their layouts and the push constant range comes from the shaders
+	std::map<uint32_t, VkDescriptorSetLayout> sharedSets = { { 0, m_DescriptorSetLayout }, { 1, m_BindlessHeap.GetLayout() } };
+	pipelines.Layout = m_LayoutCache.GetPipelineLayout({ &vertexReflection, &fragmentReflection }, sharedSets);
 
-	if (vkCreatePipelineLayout(m_Device, &pipelineLayoutInfo, nullptr, &m_PipelineLayout) != VK_SUCCESS)
+	// Only taking pipelines from the pipeline cache, one that would need compiling is reported instead of created
+	bool compileRequired = false;
+	auto createPipeline = [&](const VkGraphicsPipelineCreateInfo& info, VkPipeline& pipeline, const char* error)
 	{
-		throw std::runtime_error("Failed to create pipeline layout");
-	}
+		if (compileRequired)
+		{
+			return;
+		}
+		VkResult result = vkCreateGraphicsPipelines(m_Device, m_PipelineCache, 1, &info, nullptr, &pipeline);
+		if (result == VK_PIPELINE_COMPILE_REQUIRED_EXT)
+		{
+			pipeline = VK_NULL_HANDLE;
+			compileRequired = true;
+		}
+		else if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error(error);
+		}
+	};
 
 	VkGraphicsPipelineCreateInfo pipelineInfo{};
 	pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	pipelineInfo.flags = cachedOnly ? VK_PIPELINE_CREATE_FAIL_ON_PIPELINE_COMPILE_REQUIRED_BIT_EXT : 0;
 	pipelineInfo.stageCount = 2;
 	pipelineInfo.pStages = shaderStages;
 	pipelineInfo.pVertexInputState = &vertexInputInfo;
@@ -742,38 +1747,271 @@ void Application::CreateGraphicsPipeline()
 	pipelineInfo.pMultisampleState = &multisampling;
 	pipelineInfo.pDepthStencilState = &depthStencil;
 	pipelineInfo.pColorBlendState = &colorBlending;
-	pipelineInfo.pDynamicState = nullptr;
-	pipelineInfo.layout = m_PipelineLayout;
+	pipelineInfo.pDynamicState = &dynamicState;
+	pipelineInfo.layout = pipelines.Layout;
 	pipelineInfo.renderPass = m_RenderPass;
 	pipelineInfo.subpass = 0;
 	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 	pipelineInfo.basePipelineIndex = -1;
-	if (vkCreateGraphicsPipelines(m_Device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_GraphicsPipeline) != VK_SUCCESS)
+	createPipeline(pipelineInfo, pipelines.Pipeline, "Failed to create graphics pipeline");
+
+	// The same pipelines for dynamic rendering describe the attachment formats instead of a render pass
+	VkPipelineRenderingCreateInfoKHR renderingInfo{};
+	renderingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR;
+	renderingInfo.colorAttachmentCount = 1;
+	renderingInfo.pColorAttachmentFormats = &m_SwapchainImageFormat;
+	renderingInfo.depthAttachmentFormat = FindDepthFormat();
+	VkGraphicsPipelineCreateInfo dynamicPipelineInfo = pipelineInfo;
+	dynamicPipelineInfo.pNext = &renderingInfo;
+	dynamicPipelineInfo.renderPass = VK_NULL_HANDLE;
+	if (m_DynamicRenderingSupported)
+	{
+		createPipeline(dynamicPipelineInfo, pipelines.DynamicPipeline, "Failed to create dynamic rendering graphics pipeline");
+	}
+
+	// Variants drawing one object per draw, which read the same vertex inputs and only replace the vertex shader
+	auto createObjectPipelines = [&](
+		const ShaderSource& source,
+		uint32_t pushConstantSize,
+		const std::map<uint32_t, VkDescriptorSetLayout>& sets,
+		VkPipelineLayout& layout,
+		VkPipeline& pipeline,
+		VkPipeline& dynamicPipeline)
+	{
+		auto objectShaderCode = GetShaderCode(source);
+		ShaderReflection objectReflection = ShaderReflection::Reflect(objectShaderCode);
+		CheckPushConstantSize(objectReflection, pushConstantSize, "Object");
+		layout = m_LayoutCache.GetPipelineLayout({ &objectReflection, &fragmentReflection }, sets);
+
+		VkShaderModule objectShaderModule = CreateShaderModule(objectShaderCode);
+		VkPipelineShaderStageCreateInfo objectStages[] = { vertexShaderStageInfo, fragmentShaderStageInfo };
+		objectStages[0].module = objectShaderModule;
+
+		VkGraphicsPipelineCreateInfo objectPipelineInfo = pipelineInfo;
+		objectPipelineInfo.pStages = objectStages;
+		objectPipelineInfo.layout = layout;
+		createPipeline(objectPipelineInfo, pipeline, "Failed to create object graphics pipeline");
+		if (m_DynamicRenderingSupported)
+		{
+			VkGraphicsPipelineCreateInfo dynamicObjectPipelineInfo = dynamicPipelineInfo;
+			dynamicObjectPipelineInfo.pStages = objectStages;
+			dynamicObjectPipelineInfo.layout = layout;
+			createPipeline(dynamicObjectPipelineInfo, dynamicPipeline, "Failed to create dynamic rendering object graphics pipeline");
+		}
+		vkDestroyShaderModule(m_Device, objectShaderModule, nullptr);
+	};
+	if (materialFeatures == s_GenericMaterial)
+	{
+		std::map<uint32_t, VkDescriptorSetLayout> ringSets = sharedSets;
+		ringSets[2] = m_ObjectSetLayout;
+		createObjectPipelines(
+			m_ObjectPushVertexShader,
+			sizeof(ObjectData),
+			sharedSets,
+			pipelines.ObjectPushLayout,
+			pipelines.ObjectPushPipeline,
+			pipelines.DynamicObjectPushPipeline);
+		createObjectPipelines(
+			m_ObjectRingVertexShader,
+			0,
+			ringSets,
+			pipelines.ObjectRingLayout,
+			pipelines.ObjectRingPipeline,
+			pipelines.DynamicObjectRingPipeline);
+	}
+
+	// Meshlet pipeline, the task and mesh shaders replace vertex input and the vertex shader
+	if (m_MeshShadingSupported)
 	{
-		throw std::runtime_error("Failed to create graphics pipeline");
+		auto taskShaderCode = GetShaderCode(m_TaskShader);
+		auto meshShaderCode = GetShaderCode(m_MeshShader);
+		ShaderReflection taskReflection = ShaderReflection::Reflect(taskShaderCode);
+		ShaderReflection meshReflection = ShaderReflection::Reflect(meshShaderCode);
+		CheckPushConstantSize(taskReflection, sizeof(MeshletPushConstants), "Meshlet");
+		CheckPushConstantSize(meshReflection, sizeof(MeshletPushConstants), "Meshlet");
+
+		VkShaderModule taskShaderModule = CreateShaderModule(taskShaderCode);
+		VkShaderModule meshShaderModule = CreateShaderModule(meshShaderCode);
+
+		std::array<VkPipelineShaderStageCreateInfo, 3> meshletStages{};
+		meshletStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		meshletStages[0].stage = VK_SHADER_STAGE_TASK_BIT_NV;
+		meshletStages[0].module = taskShaderModule;
+		meshletStages[0].pName = "main";
+		meshletStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		meshletStages[1].stage = VK_SHADER_STAGE_MESH_BIT_NV;
+		meshletStages[1].module = meshShaderModule;
+		meshletStages[1].pName = "main";
+		meshletStages[2] = fragmentShaderStageInfo;
+
+		pipelines.MeshletLayout = m_LayoutCache.GetPipelineLayout({ &taskReflection, &meshReflection, &fragmentReflection }, sharedSets);
+
+		pipelineInfo.stageCount = static_cast<uint32_t>(meshletStages.size());
+		pipelineInfo.pStages = meshletStages.data();
+		pipelineInfo.pVertexInputState = nullptr;
+		pipelineInfo.pInputAssemblyState = nullptr;
+		pipelineInfo.layout = pipelines.MeshletLayout;
+		createPipeline(pipelineInfo, pipelines.MeshletPipeline, "Failed to create meshlet pipeline");
+
+		dynamicPipelineInfo.stageCount = pipelineInfo.stageCount;
+		dynamicPipelineInfo.pStages = pipelineInfo.pStages;
+		dynamicPipelineInfo.pVertexInputState = nullptr;
+		dynamicPipelineInfo.pInputAssemblyState = nullptr;
+		dynamicPipelineInfo.layout = pipelines.MeshletLayout;
+		if (m_DynamicRenderingSupported)
+		{
+			createPipeline(dynamicPipelineInfo, pipelines.DynamicMeshletPipeline, "Failed to create dynamic rendering meshlet pipeline");
+		}
+
+		vkDestroyShaderModule(m_Device, taskShaderModule, nullptr);
+		vkDestroyShaderModule(m_Device, meshShaderModule, nullptr);
 	}
 
 	// Once the pipeline is created, we can destroy the shader modules
 	vkDestroyShaderModule(m_Device, vertexShaderModule, nullptr);
 	vkDestroyShaderModule(m_Device, fragmentShaderModule, nullptr);
+
+	if (compileRequired)
+	{
+		DestroyGraphicsPipeline(pipelines);
+		pipelines = {};
+		return false;
+	}
+	return true;
+}
+
+void Application::DestroyGraphicsPipeline(const GraphicsPipelineSet& pipelines)
+{
+	vkDestroyPipeline(m_Device, pipelines.Pipeline, nullptr);
+	vkDestroyPipeline(m_Device, pipelines.DynamicPipeline, nullptr);
+	vkDestroyPipeline(m_Device, pipelines.ObjectPushPipeline, nullptr);
+	vkDestroyPipeline(m_Device, pipelines.DynamicObjectPushPipeline, nullptr);
+	vkDestroyPipeline(m_Device, pipelines.ObjectRingPipeline, nullptr);
+	vkDestroyPipeline(m_Device, pipelines.DynamicObjectRingPipeline, nullptr);
+	if (m_MeshShadingSupported)
+	{
+		vkDestroyPipeline(m_Device, pipelines.MeshletPipeline, nullptr);
+		vkDestroyPipeline(m_Device, pipelines.DynamicMeshletPipeline, nullptr);
+	}
+}
+
+void Application::RetireGraphicsPipeline(const GraphicsPipelineSet& pipelines)
+{
+	// Layouts belong to the layout cache and outlive the pipelines
+	m_RetiredPipelines.push_back({
+		{
+			pipelines.Pipeline,
+			pipelines.DynamicPipeline,
+			pipelines.MeshletPipeline,
+			pipelines.DynamicMeshletPipeline,
+			pipelines.ObjectPushPipeline,
+			pipelines.DynamicObjectPushPipeline,
+			pipelines.ObjectRingPipeline,
+			pipelines.DynamicObjectRingPipeline },
+		m_MaxFramesInFlight });
+}
+
+const GraphicsPipelineSet& Application::GetMaterialPipelines(uint32_t materialFeatures)
+{
+	auto ready = m_MaterialPipelines.find(materialFeatures);
+	if (ready != m_MaterialPipelines.end())
+	{
+		return ready->second;
+	}
+	if (m_PendingMaterialPipelines.find(materialFeatures) == m_PendingMaterialPipelines.end())
+	{
+		RequestMaterialPipelines(materialFeatures);
+		ready = m_MaterialPipelines.find(materialFeatures);
+		if (ready != m_MaterialPipelines.end())
+		{
+			return ready->second;
+		}
+	}
+	return m_GraphicsPipelines;
+}
+
+void Application::RequestMaterialPipelines(uint32_t materialFeatures)
+{
+	// A pipeline cache from an earlier run may already hold the set, which then costs no more than a lookup
+	if (m_PipelineCacheControlSupported)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		GraphicsPipelineSet pipelines{};
+		if (CreateGraphicsPipeline(pipelines, materialFeatures, true))
+		{
+			m_MaterialPipelines[materialFeatures] = pipelines;
+			m_PipelineCompiler.RecordCacheHit(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+			return;
+		}
+	}
+
+	m_PendingMaterialPipelines.insert(materialFeatures);
+	uint64_t generation = m_MaterialPipelineGeneration;
+	m_PipelineCompiler.Submit(GetMaterialName(materialFeatures), [this, materialFeatures, generation]
+	{
+		std::shared_lock<std::shared_mutex> lock(m_GraphicsPipelineMutex);
+		GraphicsPipelineSet pipelines{};
+		CreateGraphicsPipeline(pipelines, materialFeatures);
+
+		std::lock_guard<std::mutex> swapLock(m_PipelineSwapMutex);
+		m_PipelineSwaps.push_back([this, pipelines, materialFeatures, generation]
+		{
+			// The render pass or the shaders changed since it was requested, a newer request builds it again
+			if (generation != m_MaterialPipelineGeneration)
+			{
+				RetireGraphicsPipeline(pipelines);
+				return;
+			}
+			m_PendingMaterialPipelines.erase(materialFeatures);
+			m_MaterialPipelines[materialFeatures] = pipelines;
+		});
+	});
+}
+
+void Application::ResetMaterialPipelines()
+{
+	// Requested again by the next frame drawing with them, which uses the generic set meanwhile
+	for (const auto& [materialFeatures, pipelines] : m_MaterialPipelines)
+	{
+		RetireGraphicsPipeline(pipelines);
+	}
+	m_MaterialPipelines.clear();
+	m_PendingMaterialPipelines.clear();
+	++m_MaterialPipelineGeneration;
+}
+
+std::string Application::GetMaterialName(uint32_t materialFeatures)
+{
+	std::string name = "material";
+	name += (materialFeatures & MaterialTextured) != 0 ? " textured" : " untextured";
+	if ((materialFeatures & MaterialAlphaTest) != 0)
+	{
+		name += ", alpha tested";
+	}
+	if ((materialFeatures & MaterialVertexColor) != 0)
+	{
+		name += ", vertex colored";
+	}
+	return name;
 }
 
 void Application::CreateFramebuffers()
 {
-	m_SwapchainFramebuffers.resize(m_SwapchainImageViews.size());
-	for (size_t i = 0; i < m_SwapchainImageViews.size(); ++i)
+	std::vector<VkImageView> resolveViews = m_Upscaling ? std::vector<VkImageView>{ m_SceneColorImageView } : m_SwapchainImageViews;
+	m_Framebuffers.resize(resolveViews.size());
+	for (size_t i = 0; i < resolveViews.size(); ++i)
 	{
-		std::array<VkImageView, 3> attachments = { m_ColorImageView, m_DepthImageView, m_SwapchainImageViews[i]};
+		std::array<VkImageView, 3> attachments = { m_ColorImageView, m_DepthImageView, resolveViews[i] };
 
 		VkFramebufferCreateInfo framebufferInfo{};
 		framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
 		framebufferInfo.renderPass = m_RenderPass;
 		framebufferInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
 		framebufferInfo.pAttachments = attachments.data();
-		framebufferInfo.width = m_SwapchainExtent.width;
-		framebufferInfo.height = m_SwapchainExtent.height;
+		framebufferInfo.width = m_RenderExtent.width;
+		framebufferInfo.height = m_RenderExtent.height;
 		framebufferInfo.layers = 1;
-		if (vkCreateFramebuffer(m_Device, &framebufferInfo, nullptr, &m_SwapchainFramebuffers[i]) != VK_SUCCESS)
+		if (vkCreateFramebuffer(m_Device, &framebufferInfo, nullptr, &m_Framebuffers[i]) != VK_SUCCESS)
 		{
 			throw std::runtime_error("Failed to create framebuffer");
 		}
@@ -782,7 +2020,7 @@ void Application::CreateFramebuffers()
 
 void Application::CreateCommandPool()
 {
-	QueueFamilyIndices queueFamilyIndices = FindQueueFamilies(m_PhysicalDevice);
+	const QueueFamilyIndices& queueFamilyIndices = m_QueueFamilyIndices;
 
 	VkCommandPoolCreateInfo poolInfo{};
 	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
@@ -792,40 +2030,71 @@ void Application::CreateCommandPool()
 	{
 		throw std::runtime_error("Failed to create command pool");
 	}
+
+	poolInfo.queueFamilyIndex = queueFamilyIndices.TransferFamily.value_or(queueFamilyIndices.GraphicsFamily.value());
+	if (vkCreateCommandPool(m_Device, &poolInfo, nullptr, &m_TransferCommandPool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create transfer command pool");
+	}
 }
 
 void Application::CreateVertexBuffer()
 {
-	VkDeviceSize bufferSize = sizeof(m_Vertices[0]) * m_Vertices.size();
+	const std::vector<Vertex>& vertices = m_Scene.GetVertices();
+	UploadBuffer(
+		vertices.data(),
+		sizeof(vertices[0]) * vertices.size(),
+		VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+			| VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
+		MemoryBudget::CategoryMeshes,
+		m_VertexBuffer,
+		m_VertexBufferMemory,
+		VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT);
+
+	// The mesh shader fetches vertices itself
+	m_MeshletPushConstants.VertexBufferIndex = m_BindlessHeap.RegisterStorageBuffer(m_VertexBuffer);
+}
 
+void Application::UploadBuffer(
+	const void* data,
+	VkDeviceSize size,
+	VkBufferUsageFlags usage,
+	MemoryBudget::Category category,
+	VkBuffer& buffer,
+	VkDeviceMemory& bufferMemory,
+	VkMemoryAllocateFlags allocateFlags)
+{
 	// Host visible buffer
 	VkBuffer stagingBuffer; 
 	VkDeviceMemory stagingBufferMemory;
 	CreateBuffer(
-		bufferSize, 
+		size, 
 		VK_BUFFER_USAGE_TRANSFER_SRC_BIT, 
 		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 
+		MemoryBudget::CategoryStaging,
 		stagingBuffer,
 		stagingBufferMemory);
 
 	// Map buffer memory into CPU accessible memory
-	void* data;
-	vkMapMemory(m_Device, stagingBufferMemory, 0, bufferSize, 0, &data);
-	memcpy(data, m_Vertices.data(), (size_t)bufferSize);	
+	void* mapped;
+	vkMapMemory(m_Device, stagingBufferMemory, 0, size, 0, &mapped);
+	memcpy(mapped, data, (size_t)size);
 	vkUnmapMemory(m_Device, stagingBufferMemory);
 
 	// Device local buffer
 	CreateBuffer(
-		bufferSize,
-		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+		size,
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage,
 		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		m_VertexBuffer,
-		m_VertexBufferMemory);
+		category,
+		buffer,
+		bufferMemory,
+		allocateFlags);
 
-	CopyBuffer(stagingBuffer, m_VertexBuffer, bufferSize);
+	CopyBuffer(stagingBuffer, buffer, size);
 
 	vkDestroyBuffer(m_Device, stagingBuffer, nullptr);
-	vkFreeMemory(m_Device, stagingBufferMemory, nullptr);
+	m_MemoryBudget.Free(stagingBufferMemory);
 }
 
 void Application::CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size)
@@ -833,7 +2102,7 @@ void Application::CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSiz
 	VkCommandBufferAllocateInfo allocInfo{};
 	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	allocInfo.commandPool = m_CommandPool;
+	allocInfo.commandPool = m_TransferCommandPool;
 	allocInfo.commandBufferCount = 1;
 
 	VkCommandBuffer commandBuffer;
@@ -850,59 +2119,104 @@ void Application::CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSiz
 
 	vkBeginCommandBuffer(commandBuffer, &beginInfo);
 	vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
-	vkEndCommandBuffer(commandBuffer);
 
-	VkSubmitInfo submitInfo{};
-	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &commandBuffer;
+	// A transfer queue of its own belongs to another family, which releases the buffer to the graphics family. The
+	// graphics queue acquires it once the copy's timeline value is reached
+	bool transferQueue = m_FrameScheduler.HasOwnQueue(FrameScheduler::Transfer);
+	VkBufferMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = 0;
+	barrier.srcQueueFamilyIndex = m_QueueFamilyIndices.TransferFamily.value_or(m_QueueFamilyIndices.GraphicsFamily.value());
+	barrier.dstQueueFamilyIndex = m_QueueFamilyIndices.GraphicsFamily.value();
+	barrier.buffer = dstBuffer;
+	barrier.offset = 0;
+	barrier.size = VK_WHOLE_SIZE;
+	if (transferQueue)
+	{
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+	}
+	vkEndCommandBuffer(commandBuffer);
 
-	vkQueueSubmit(m_GraphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-	vkQueueWaitIdle(m_GraphicsQueue);
+	// Only waits for the copy, frames in flight keep running
+	FrameScheduler::SyncPoint copied = m_FrameScheduler.Submit(FrameScheduler::Transfer, { { commandBuffer } });
+	if (transferQueue)
+	{
+		VkCommandBuffer acquireCommands = BeginSingleTimeCommands();
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+		vkCmdPipelineBarrier(acquireCommands, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+		EndSingleTimeCommands(acquireCommands, FrameScheduler::Graphics, { { copied, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT } });
+	}
+	m_FrameScheduler.Wait(copied);
 
-	vkFreeCommandBuffers(m_Device, m_CommandPool, 1, &commandBuffer);
+	vkFreeCommandBuffers(m_Device, m_TransferCommandPool, 1, &commandBuffer);
 }
 
 void Application::CreateIndexBuffer()
 {
-	VkDeviceSize bufferSize = sizeof(m_Indices[0]) * m_Indices.size();
-
-	// Host visible buffer
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
-	CreateBuffer(
-		bufferSize,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		stagingBuffer,
-		stagingBufferMemory);
-
-	// Map buffer memory into CPU accessible memory
-	void* data;
-	vkMapMemory(m_Device, stagingBufferMemory, 0, bufferSize, 0, &data);
-	memcpy(data, m_Indices.data(), (size_t)bufferSize);
-	vkUnmapMemory(m_Device, stagingBufferMemory);
-
-	// Device local buffer
-	CreateBuffer(
-		bufferSize,
-		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+	const std::vector<uint32_t>& indices = m_Scene.GetIndices();
+	UploadBuffer(
+		indices.data(),
+		sizeof(indices[0]) * indices.size(),
+		VK_BUFFER_USAGE_INDEX_BUFFER_BIT
+			| VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
+		MemoryBudget::CategoryMeshes,
 		m_IndexBuffer,
-		m_IndexBufferMemory);
-
-	CopyBuffer(stagingBuffer, m_IndexBuffer, bufferSize);
+		m_IndexBufferMemory,
+		VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT);
+}
 
-	vkDestroyBuffer(m_Device, stagingBuffer, nullptr);
-	vkFreeMemory(m_Device, stagingBufferMemory, nullptr);
+void Application::CreateInstanceBuffer()
+{
+	const std::vector<InstanceData>& instances = m_Scene.GetInstances();
+	UploadBuffer(
+		instances.data(),
+		sizeof(instances[0]) * instances.size(),
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		MemoryBudget::CategoryMeshes,
+		m_InstanceBuffer,
+		m_InstanceBufferMemory);
+
+	// Read by the vertex shader through gl_InstanceIndex, which starts at each draw's firstInstance
+	m_DrawPushConstants.InstanceBufferIndex = m_BindlessHeap.RegisterStorageBuffer(m_InstanceBuffer);
 }
 
-void Application::CreateBuffer(
-	VkDeviceSize size,
-	VkBufferUsageFlags usage,
+void Application::CreateIndirectBuffer()
+{
+	const std::vector<VkDrawIndexedIndirectCommand>& drawCommands = m_Scene.GetDrawCommands();
+	UploadBuffer(
+		drawCommands.data(),
+		sizeof(drawCommands[0]) * drawCommands.size(),
+		VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		MemoryBudget::CategoryMeshes,
+		m_IndirectBuffer,
+		m_IndirectBufferMemory);
+
+	// Rewritten every frame with the selected levels of detail, at worst one command per instance
+	m_LodDrawBuffers.resize(m_MaxFramesInFlight);
+	m_LodDrawBufferMemories.resize(m_MaxFramesInFlight);
+	m_LodDrawCounts.assign(m_MaxFramesInFlight, 0);
+	for (size_t i = 0; i < m_MaxFramesInFlight; ++i)
+	{
+		CreateBuffer(
+			sizeof(VkDrawIndexedIndirectCommand) * m_Scene.GetInstances().size(),
+			VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			MemoryBudget::CategoryMeshes,
+			m_LodDrawBuffers[i],
+			m_LodDrawBufferMemories[i]);
+	}
+}
+
+void Application::CreateBuffer(
+	VkDeviceSize size,
+	VkBufferUsageFlags usage,
 	VkMemoryPropertyFlags properties,
+	MemoryBudget::Category category,
 	VkBuffer& buffer,
-	VkDeviceMemory& bufferMemory)
+	VkDeviceMemory& bufferMemory,
+	VkMemoryAllocateFlags allocateFlags)
 {
 	VkBufferCreateInfo bufferInfo{};
 	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -918,14 +2232,17 @@ void Application::CreateBuffer(
 	VkMemoryRequirements memRequirements;
 	vkGetBufferMemoryRequirements(m_Device, buffer, &memRequirements);
 
+	// Needed for buffers referenced by device address (acceleration structure inputs, shader binding table)
+	VkMemoryAllocateFlagsInfo flagsInfo{};
+	flagsInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
+	flagsInfo.flags = allocateFlags;
+
 	VkMemoryAllocateInfo allocInfo{};
 	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.pNext = allocateFlags != 0 ? &flagsInfo : nullptr;
 	allocInfo.allocationSize = memRequirements.size;
 	allocInfo.memoryTypeIndex = FindMemoryType(memRequirements.memoryTypeBits, properties);
-	if (vkAllocateMemory(m_Device, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS)
-	{
-		throw std::runtime_error("Failed to allocate buffer memory");
-	}
+	bufferMemory = m_MemoryBudget.Allocate(allocInfo, category);
 
 	vkBindBufferMemory(m_Device, buffer, bufferMemory, 0);
 }
@@ -947,33 +2264,28 @@ uint32_t Application::FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags
 
 void Application::CreateDescriptorSetLayout()
 {
+	// Textures and samplers live in the bindless heap, set 0 holds what the raster shaders declare there
+	ShaderReflection vertexReflection = ShaderReflection::Reflect(GetShaderCode(m_VertexShader));
+	ShaderReflection fragmentReflection = ShaderReflection::Reflect(GetShaderCode(m_FragmentShader));
+	std::vector<ReflectedBinding> bindings = PipelineLayoutCache::GetBindings({ &vertexReflection, &fragmentReflection }, 0);
+	for (ReflectedBinding& binding : bindings)
+	{
+		binding.Stages = VK_SHADER_STAGE_ALL; // The same sets are bound for every stage, from ray generation to the meshlet shaders
+	}
+	m_DescriptorSetLayout = m_LayoutCache.GetSetLayout(bindings);
 
-
-	VkDescriptorSetLayoutBinding uboLayoutBinding{};
-	uboLayoutBinding.binding = 0;
-	uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	uboLayoutBinding.descriptorCount = 1;
-	uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT; // In which stages is the descriptor referenced
-	uboLayoutBinding.pImmutableSamplers = nullptr;
-
-	VkDescriptorSetLayoutBinding samplerLayoutBinding{};
-	samplerLayoutBinding.binding = 1;
-	samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	samplerLayoutBinding.descriptorCount = 1;
-	samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-	samplerLayoutBinding.pImmutableSamplers = nullptr;
-
-	std::array<VkDescriptorSetLayoutBinding, 2> bindings = { uboLayoutBinding, samplerLayoutBinding };
-
-	VkDescriptorSetLayoutCreateInfo layoutInfo{};
-	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-	layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
-	layoutInfo.pBindings = bindings.data();
-
-	if (vkCreateDescriptorSetLayout(m_Device, &layoutInfo, nullptr, &m_DescriptorSetLayout) != VK_SUCCESS)
+	// The object ring buffer is one buffer bound at a different offset for every draw, which reflection cannot tell
+	ShaderReflection ringReflection = ShaderReflection::Reflect(GetShaderCode(m_ObjectRingVertexShader));
+	std::vector<ReflectedBinding> objectBindings = PipelineLayoutCache::GetBindings({ &ringReflection }, 2);
+	for (ReflectedBinding& binding : objectBindings)
 	{
-		throw std::runtime_error("Failed to create descriptor set layout");
+		if (binding.Type != VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER)
+		{
+			throw std::runtime_error("Set 2 of the object ring vertex shader may only hold uniform buffers");
+		}
+		binding.Type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 	}
+	m_ObjectSetLayout = m_LayoutCache.GetSetLayout(objectBindings);
 }
 
 void Application::CreateUniformBuffers()
@@ -989,77 +2301,43 @@ void Application::CreateUniformBuffers()
 			bufferSize,
 			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
 			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 
+			MemoryBudget::CategoryOther,
 			m_UniformBuffers[i],
 			m_UniformBufferMemories[i]);
 	}
 }
 
-void Application::CreateDescriptorPool()
+void Application::CreateObjectRingBuffer()
 {
-	std::array<VkDescriptorPoolSize, 2> poolSizes{};
-	poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	poolSizes[0].descriptorCount = static_cast<uint32_t>(m_MaxFramesInFlight);
-	poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	poolSizes[1].descriptorCount = static_cast<uint32_t>(m_MaxFramesInFlight);
-
-	VkDescriptorPoolCreateInfo poolInfo{};
-	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
-	poolInfo.pPoolSizes = poolSizes.data();
-	poolInfo.maxSets = static_cast<uint32_t>(m_MaxFramesInFlight);
+	// Each frame in flight writes its own run of slots while recording, so the GPU never reads a slot being rewritten.
+	// A slot per benchmark draw, whatever the size of the scene
+	m_ObjectRingStride = AlignUp(sizeof(ObjectData), m_MinUniformBufferOffsetAlignment);
+	VkDeviceSize bufferSize = static_cast<VkDeviceSize>(m_ObjectRingStride) * s_PerDrawBenchmarkDraws * m_MaxFramesInFlight;
+	CreateBuffer(
+		bufferSize,
+		VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		MemoryBudget::CategoryOther,
+		m_ObjectRingBuffer,
+		m_ObjectRingBufferMemory);
 
-	if (vkCreateDescriptorPool(m_Device, &poolInfo, nullptr, &m_DescriptorPool) != VK_SUCCESS)
-	{
-		throw std::runtime_error("Failed to create descriptor pool");
-	}
+	void* data;
+	vkMapMemory(m_Device, m_ObjectRingBufferMemory, 0, bufferSize, 0, &data);
+	m_ObjectRingData = static_cast<uint8_t*>(data);
 }
 
 void Application::CreateDescriptorSets()
 {
-	std::vector<VkDescriptorSetLayout> layouts(m_MaxFramesInFlight, m_DescriptorSetLayout);
-	VkDescriptorSetAllocateInfo allocInfo{};
-	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-	allocInfo.descriptorPool = m_DescriptorPool;
-	allocInfo.descriptorSetCount = static_cast<uint32_t>(m_MaxFramesInFlight);
-	allocInfo.pSetLayouts = layouts.data();
-
 	m_DescriptorSets.resize(m_MaxFramesInFlight);
-	if (vkAllocateDescriptorSets(m_Device, &allocInfo, m_DescriptorSets.data()) != VK_SUCCESS)
-	{
-		throw std::runtime_error("Failed to allocate descriptor sets");
-	}
-
 	for (size_t i = 0; i < m_MaxFramesInFlight; ++i)
 	{
-		VkDescriptorBufferInfo bufferInfo{};
-		bufferInfo.buffer = m_UniformBuffers[i];
-		bufferInfo.offset = 0;
-		bufferInfo.range = sizeof(UniformBufferObject);
-
-		VkDescriptorImageInfo imageInfo{};
-		imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		imageInfo.imageView = m_TextureImageView;
-		imageInfo.sampler = m_TextureSampler;
-
-		std::array<VkWriteDescriptorSet, 2> descriptorWrites{};
-		descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[0].dstSet = m_DescriptorSets[i];
-		descriptorWrites[0].dstBinding = 0;
-		descriptorWrites[0].dstArrayElement = 0;
-		descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		descriptorWrites[0].descriptorCount = 1;
-		descriptorWrites[0].pBufferInfo = &bufferInfo;
-
-		descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[1].dstSet = m_DescriptorSets[i];
-		descriptorWrites[1].dstBinding = 1;	
-		descriptorWrites[1].dstArrayElement = 0;
-		descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-		descriptorWrites[1].descriptorCount = 1;
-		descriptorWrites[1].pImageInfo = &imageInfo;
-
-		vkUpdateDescriptorSets(m_Device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+		m_DescriptorSets[i] = m_DescriptorAllocator.GetSet(m_DescriptorSetLayout, {
+			DescriptorAllocator::Buffer(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, m_UniformBuffers[i], 0, sizeof(UniformBufferObject)) });
 	}
+
+	// A single set covers the whole ring, the dynamic offset picks the slot
+	m_ObjectRingDescriptorSet = m_DescriptorAllocator.GetSet(m_ObjectSetLayout, {
+		DescriptorAllocator::Buffer(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, m_ObjectRingBuffer, 0, sizeof(ObjectData)) });
 }
 
 
@@ -1089,67 +2367,988 @@ void Application::RecordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t in
 		throw std::runtime_error("Failed to begin recording command buffer");
 	}
 
-	VkRenderPassBeginInfo renderPassInfo{};
-	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-	renderPassInfo.renderPass = m_RenderPass;
-	renderPassInfo.framebuffer = m_SwapchainFramebuffers[index];
-	renderPassInfo.renderArea.offset = { 0, 0 };
-	renderPassInfo.renderArea.extent = m_SwapchainExtent;
+	m_Profiler.ResetQueries(commandBuffer, m_CurrentFrame);
+	m_TextureStreamer.RecordUploads(commandBuffer, m_CurrentFrame);
+	m_Profiler.SetCounter("Textures loading", m_TextureStreamer.GetPendingCount());
+	m_Profiler.SetCounter("Mips dropped", m_TextureStreamer.GetDroppedMipCount());
+	MemoryPool::Statistics textureHeap = m_TextureStreamer.GetHeapStatistics();
+	m_Profiler.SetCounter("Texture heap blocks", textureHeap.BlockCount);
+	m_Profiler.SetCounter("Texture heap fragmentation (%)", textureHeap.Fragmentation * 100.0);
+	if (m_VirtualTexturingSupported)
+	{
+		m_VirtualTexture.RecordUpdates(commandBuffer, m_CurrentFrame);
+		m_Profiler.SetCounter("VT pages", m_VirtualTexture.GetResidentPageCount());
+		m_Profiler.SetCounter("VT uploads", m_VirtualTexture.GetUploadCount());
+	}
+
+	// Switching modes hands the shared attachment memory over, so wait for everything the other mode wrote
+	if (m_AttachmentsAliased && m_UseRaytracing != m_LastFrameRaytraced)
+	{
+		VkMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+		vkCmdPipelineBarrier(
+			commandBuffer,
+			VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+			VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+			0,
+			1,
+			&barrier,
+			0,
+			nullptr,
+			0,
+			nullptr);
+
+		// Their contents and layouts are gone, so the graph starts them over from the undefined layout
+		m_RenderGraph.Forget(m_ColorImage);
+		m_RenderGraph.Forget(m_DepthImage);
+		m_RenderGraph.Forget(m_SceneColorImage);
+		m_RenderGraph.Forget(m_RtOutputImage);
+	}
+	m_LastFrameRaytraced = m_UseRaytracing;
+
+	m_RenderGraph.Reset();
+	m_RenderGraph.SetSynchronization2(m_UseDynamicRendering);
+	if (m_UseRaytracing)
+	{
+		AddRaytracingPasses(index);
+		m_DepthPyramidValid = false; // Nothing writes depth while ray tracing
+	}
+	else
+	{
+		AddRasterPasses(index);
+		if (m_PerDrawFramesLeft > 0 && m_PerDrawScheme == PerDrawTransientSets)
+		{
+			AllocatePerDrawSets();
+		}
+	}
+	m_RenderGraph.Execute(commandBuffer, m_CurrentFrame);
+
+	if (m_VirtualTexturingSupported)
+	{
+		m_VirtualTexture.RecordFeedbackBarrier(commandBuffer, m_CurrentFrame);
+	}
+
+	if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to record command buffer");
+	}
+}
+
+void Application::AddRasterPasses(uint32_t imageIndex)
+{
+	// Meshlets are always culled, first per instance and then per meshlet
+	bool culling = m_UseGpuCulling || m_UseMeshlets;
+	bool meshShading = m_UseMeshlets && m_MeshShadingSupported;
+
+	// This frame's culling tests against the pyramid built last frame, before this frame's pass rebuilds it
+	bool occlusion = m_DepthPyramidValid;
+	m_MeshletPushConstants.OcclusionEnabled = occlusion ? 1 : 0;
+
+	RenderGraph::ResourceHandle color = m_RenderGraph.ImportImage("Color", m_ColorImage, VK_IMAGE_ASPECT_COLOR_BIT);
+	VkImageAspectFlags depthAspect = VK_IMAGE_ASPECT_DEPTH_BIT | (HasStencilComponent(m_DepthFormat) ? VK_IMAGE_ASPECT_STENCIL_BIT : 0);
+	RenderGraph::ResourceHandle depth = m_RenderGraph.ImportImage("Depth", m_DepthImage, depthAspect);
+	RenderGraph::ResourceHandle swapchain = ImportSwapchainImage(imageIndex);
+	// Resolved into the swapchain image, unless the scene is drawn smaller and scaled up to it afterwards
+	RenderGraph::ResourceHandle target
+		= m_Upscaling ? m_RenderGraph.ImportImage("Scene color", m_SceneColorImage, VK_IMAGE_ASPECT_COLOR_BIT) : swapchain;
+	RenderGraph::ResourceHandle culledDraws = m_RenderGraph.ImportBuffer("Culled draws", m_CulledDrawBuffer);
+	RenderGraph::ResourceHandle stats = m_RenderGraph.ImportBuffer("Culling stats", m_CullingStatsBuffer);
+	RenderGraph::ResourceHandle workItems = m_RenderGraph.ImportBuffer("Meshlet work items", m_MeshletWorkItemBuffer);
+	RenderGraph::ResourceHandle readback = m_RenderGraph.ImportBuffer("Culling readback", m_CullingReadbackBuffers[m_CurrentFrame]);
+	RenderGraph::ResourceHandle pyramid = m_RenderGraph.ImportImage("Depth pyramid", m_DepthPyramidImage, VK_IMAGE_ASPECT_COLOR_BIT, m_DepthPyramidLevels);
+	RenderGraph::Access pyramidRead = { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL };
+
+	if (culling)
+	{
+		m_RenderGraph.AddPass(
+			"Cull",
+			[&](RenderGraph::PassBuilder& pass)
+			{
+				if (occlusion)
+				{
+					pass.Read(pyramid, pyramidRead);
+				}
+				// Counters are cleared with a transfer before the dispatch
+				pass.Overwrite(stats, {
+					VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+					VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT });
+				pass.Overwrite(m_UseMeshlets ? workItems : culledDraws, { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT });
+			},
+			[this, occlusion](VkCommandBuffer commandBuffer) { CullInstances(commandBuffer, occlusion); });
+	}
+	if (m_UseMeshlets && !m_MeshShadingSupported)
+	{
+		m_RenderGraph.AddPass(
+			"Meshlet cull",
+			[&](RenderGraph::PassBuilder& pass)
+			{
+				if (occlusion)
+				{
+					pass.Read(pyramid, pyramidRead);
+				}
+				pass.Read(workItems, { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT });
+				// Dispatched with the arguments written by instance culling, and counts the meshlets it keeps
+				pass.Write(stats, {
+					VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+					VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT });
+				pass.Overwrite(culledDraws, { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT });
+			},
+			[this](VkCommandBuffer commandBuffer) { CullMeshlets(commandBuffer); });
+	}
+
+	// Levels of detail were selected on the CPU for this frame when not culling on the GPU
+	uint32_t drawCount = static_cast<uint32_t>(m_Scene.GetDrawCommands().size());
+	if (!culling && m_UseLods)
+	{
+		drawCount = m_LodDrawCounts[m_CurrentFrame];
+	}
+	else if (!culling)
+	{
+		uint32_t triangleCount = 0;
+		for (const VkDrawIndexedIndirectCommand& command : m_Scene.GetDrawCommands())
+		{
+			triangleCount += command.indexCount / 3 * command.instanceCount;
+		}
+		m_Profiler.SetCounter("Triangles", triangleCount);
+		m_Profiler.SetCounter("LOD error (px)", 0.0);
+	}
+	m_Profiler.SetCounter("Instances", static_cast<double>(m_Scene.GetInstances().size()));
+	m_Profiler.SetCounter("Draw calls", culling || m_MultiDrawIndirectSupported ? 1.0 : static_cast<double>(drawCount));
 
 	std::array<VkClearValue, 2> clearValues{}; // Order of clear values should be identical to order of attachments
 	clearValues[0].color = { {0.0f, 0.0f, 0.0f, 1.0f} };
 	clearValues[1].depthStencil = { 1.0f, 0 }; // Clear depth buffer with 1's, the furthest possible depth
 
+	// Without a render pass, the attachments are described in the command buffer and resolved straight into the target
+	bool dynamicRendering = m_UseDynamicRendering;
+	VkRenderingAttachmentInfoKHR colorAttachment{};
+	colorAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+	colorAttachment.imageView = m_ColorImageView;
+	colorAttachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	colorAttachment.resolveMode = VK_RESOLVE_MODE_AVERAGE_BIT_KHR;
+	colorAttachment.resolveImageView = m_Upscaling ? m_SceneColorImageView : m_SwapchainImageViews[imageIndex];
+	colorAttachment.resolveImageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE; // Only the resolved image is kept
+	colorAttachment.clearValue = clearValues[0];
+
+	VkRenderingAttachmentInfoKHR depthAttachment{};
+	depthAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+	depthAttachment.imageView = m_DepthImageView;
+	depthAttachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	depthAttachment.storeOp = m_DepthSamplingSupported ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	depthAttachment.clearValue = clearValues[1];
+
+	VkRenderingInfoKHR renderingInfo{};
+	renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR;
+	renderingInfo.renderArea.offset = { 0, 0 };
+	renderingInfo.renderArea.extent = m_RenderExtent;
+	renderingInfo.layerCount = 1;
+	renderingInfo.colorAttachmentCount = 1;
+	renderingInfo.pColorAttachments = &colorAttachment;
+	renderingInfo.pDepthAttachment = &depthAttachment;
+
+	// Framebuffers are only needed, and only created, once the render pass path draws to these render targets
+	if (!dynamicRendering && m_Framebuffers.empty())
+	{
+		CreateFramebuffers();
+	}
+
+	VkRenderPassBeginInfo renderPassInfo{};
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	renderPassInfo.renderPass = m_RenderPass;
+	renderPassInfo.framebuffer = dynamicRendering ? VK_NULL_HANDLE : m_Framebuffers[m_Upscaling ? 0 : imageIndex];
+	renderPassInfo.renderArea.offset = { 0, 0 };
+	renderPassInfo.renderArea.extent = m_RenderExtent;
 	renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
 	renderPassInfo.pClearValues = clearValues.data();
 
-	vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_GraphicsPipeline);
-	
-	VkBuffer vertexBuffers[] = { m_VertexBuffer };
-	VkDeviceSize offsets[] = { 0 };
-	vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
-	vkCmdBindIndexBuffer(commandBuffer, m_IndexBuffer, 0, VK_INDEX_TYPE_UINT32);
+	m_RenderGraph.AddPass(
+		"Raster",
+		[&](RenderGraph::PassBuilder& pass)
+		{
+			if (dynamicRendering)
+			{
+				// Rendering leaves layouts alone, so the graph moves the attachments into theirs
+				pass.Overwrite(color, {
+					VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+					VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+					VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL });
+				pass.Overwrite(depth, {
+					VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+					VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+					VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL });
+				pass.Overwrite(target, {
+					VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+					VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+					VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL });
+				pass.SetRendering(renderingInfo, { m_SwapchainImageFormat }, m_DepthFormat, m_MsaaSamples);
+			}
+			else
+			{
+				// The render pass clears the attachments and leaves them in its final layouts
+				pass.Overwrite(color, {
+					VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+					VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+					VK_IMAGE_LAYOUT_UNDEFINED,
+					VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL });
+				pass.Overwrite(depth, {
+					VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+					VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+					VK_IMAGE_LAYOUT_UNDEFINED,
+					VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL });
+				pass.Overwrite(target, {
+					VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+					VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+					VK_IMAGE_LAYOUT_UNDEFINED,
+					VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL });
+				pass.SetRenderPass(renderPassInfo);
+			}
+			if (meshShading)
+			{
+				// The task shader culls meshlets, launched by the arguments instance culling wrote
+				if (occlusion)
+				{
+					pass.Read(pyramid, { VK_PIPELINE_STAGE_TASK_SHADER_BIT_NV, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL });
+				}
+				pass.Read(workItems, { VK_PIPELINE_STAGE_TASK_SHADER_BIT_NV, VK_ACCESS_SHADER_READ_BIT });
+				pass.Write(stats, {
+					VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_TASK_SHADER_BIT_NV,
+					VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT });
+			}
+			else if (culling)
+			{
+				pass.Read(culledDraws, { VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT });
+				pass.Read(stats, { VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT });
+			}
+		},
+		[this, culling, meshShading, dynamicRendering, drawCount](VkCommandBuffer commandBuffer)
+		{
+			DrawScene(commandBuffer, culling, meshShading, dynamicRendering, drawCount);
+		});
+
+	if (m_Upscaling)
+	{
+		m_RenderGraph.AddPass(
+			"Upscale",
+			[&](RenderGraph::PassBuilder& pass)
+			{
+				pass.Read(target, { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL });
+				pass.Overwrite(swapchain, { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL });
+			},
+			[this, imageIndex](VkCommandBuffer commandBuffer)
+			{
+				BlitToSwapchain(commandBuffer, m_SceneColorImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, imageIndex);
+			});
+	}
+
+	if (!culling)
+	{
+		m_DepthPyramidValid = false;
+		return;
+	}
+
+	m_RenderGraph.AddPass(
+		"Culling stats",
+		[&](RenderGraph::PassBuilder& pass)
+		{
+			pass.Read(stats, { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT });
+			pass.Overwrite(readback, { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT });
+		},
+		[this](VkCommandBuffer commandBuffer) { CopyCullingStats(commandBuffer); });
+	m_RenderGraph.MarkOutput(readback);
+	m_CullingStatsPending[m_CurrentFrame] = true;
+
+	// Occlusion culling against the previous frame's depth may let newly uncovered objects show up one frame late
+	m_DepthPyramidValid = m_DepthSamplingSupported;
+	if (m_DepthSamplingSupported)
+	{
+		m_RenderGraph.AddPass(
+			"Depth pyramid",
+			[&](RenderGraph::PassBuilder& pass)
+			{
+				pass.Read(depth, { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL });
+				pass.Overwrite(pyramid, {
+					VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+					VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+					VK_IMAGE_LAYOUT_GENERAL });
+			},
+			[this](VkCommandBuffer commandBuffer) { BuildDepthPyramid(commandBuffer); });
+		m_RenderGraph.MarkOutput(pyramid);
+	}
+}
+
+RenderGraph::ResourceHandle Application::ImportSwapchainImage(uint32_t imageIndex)
+{
+	// Last used by the presentation engine, and only available once the acquire semaphore waited at these stages
+	RenderGraph::Access acquired = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT };
+	RenderGraph::ResourceHandle swapchain
+		= m_RenderGraph.ImportImage("Swapchain", m_SwapchainImages[imageIndex], VK_IMAGE_ASPECT_COLOR_BIT, 1, acquired);
+	m_RenderGraph.MarkOutput(swapchain, { VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR });
+	return swapchain;
+}
+
+void Application::BlitToSwapchain(VkCommandBuffer commandBuffer, VkImage source, VkImageLayout sourceLayout, uint32_t imageIndex)
+{
+	VkImageBlit blit{};
+	blit.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+	blit.srcOffsets[1] = { static_cast<int32_t>(m_RenderExtent.width), static_cast<int32_t>(m_RenderExtent.height), 1 };
+	blit.dstSubresource = blit.srcSubresource;
+	blit.dstOffsets[1] = { static_cast<int32_t>(m_SwapchainExtent.width), static_cast<int32_t>(m_SwapchainExtent.height), 1 };
+	vkCmdBlitImage(
+		commandBuffer,
+		source,
+		sourceLayout,
+		m_SwapchainImages[imageIndex],
+		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		1,
+		&blit,
+		m_Upscaling ? VK_FILTER_LINEAR : VK_FILTER_NEAREST);
+}
+
+void Application::DrawScene(VkCommandBuffer commandBuffer, bool culling, bool meshShading, bool dynamicRendering, uint32_t drawCount)
+{
+	VkViewport viewport{};
+	viewport.width = static_cast<float>(m_RenderExtent.width);
+	viewport.height = static_cast<float>(m_RenderExtent.height);
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+	VkRect2D scissor{};
+	scissor.extent = m_RenderExtent;
+
+	std::array<VkDescriptorSet, 2> descriptorSets = { m_DescriptorSets[m_CurrentFrame], m_BindlessHeap.GetDescriptorSet(m_CurrentFrame) };
+	if (meshShading)
+	{
+		// One task workgroup per work item written by the instance culling pass
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, dynamicRendering ? m_FramePipelines.DynamicMeshletPipeline : m_FramePipelines.MeshletPipeline);
+		vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+		vkCmdBindDescriptorSets(
+			commandBuffer,
+			VK_PIPELINE_BIND_POINT_GRAPHICS,
+			m_FramePipelines.MeshletLayout,
+			0,
+			static_cast<uint32_t>(descriptorSets.size()),
+			descriptorSets.data(),
+			0,
+			nullptr);
+		vkCmdPushConstants(
+			commandBuffer,
+			m_FramePipelines.MeshletLayout,
+			VK_SHADER_STAGE_TASK_BIT_NV | VK_SHADER_STAGE_MESH_BIT_NV,
+			0,
+			sizeof(MeshletPushConstants),
+			&m_MeshletPushConstants);
+		vkCmdDrawMeshTasksIndirectNV(
+			commandBuffer,
+			m_CullingStatsBuffer,
+			offsetof(CullingStats, MeshletTasks),
+			1,
+			sizeof(VkDrawMeshTasksIndirectCommandNV));
+	}
+	else
+	{
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, dynamicRendering ? m_FramePipelines.DynamicPipeline : m_FramePipelines.Pipeline);
+		vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+		VkBuffer vertexBuffers[] = { m_VertexBuffer };
+		VkDeviceSize offsets[] = { 0 };
+		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+		vkCmdBindIndexBuffer(commandBuffer, m_IndexBuffer, 0, VK_INDEX_TYPE_UINT32);
+
+		if (m_PerDrawFramesLeft > 0)
+		{
+			DrawObjects(commandBuffer, dynamicRendering);
+			return;
+		}
+
+		vkCmdBindDescriptorSets(
+			commandBuffer,
+			VK_PIPELINE_BIND_POINT_GRAPHICS,
+			m_FramePipelines.Layout,
+			0,
+			static_cast<uint32_t>(descriptorSets.size()),
+			descriptorSets.data(),
+			0,
+			nullptr);
+		vkCmdPushConstants(commandBuffer, m_FramePipelines.Layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(DrawPushConstants), &m_DrawPushConstants);
+
+		// Every instance of every mesh comes from the indirect buffer, one command per mesh, or per visible instance
+		// or meshlet when culled
+		if (culling)
+		{
+			vkCmdDrawIndexedIndirectCountKHR(
+				commandBuffer,
+				m_CulledDrawBuffer,
+				0,
+				m_CullingStatsBuffer,
+				offsetof(CullingStats, DrawCount),
+				m_MaxCulledDraws,
+				sizeof(VkDrawIndexedIndirectCommand));
+		}
+		else
+		{
+			VkBuffer indirectBuffer = m_UseLods ? m_LodDrawBuffers[m_CurrentFrame] : m_IndirectBuffer;
+			if (m_MultiDrawIndirectSupported)
+			{
+				vkCmdDrawIndexedIndirect(commandBuffer, indirectBuffer, 0, drawCount, sizeof(VkDrawIndexedIndirectCommand));
+			}
+			else
+			{
+				for (uint32_t i = 0; i < drawCount; ++i)
+				{
+					vkCmdDrawIndexedIndirect(commandBuffer, indirectBuffer, i * sizeof(VkDrawIndexedIndirectCommand), 1, sizeof(VkDrawIndexedIndirectCommand));
+				}
+			}
+		}
+	}
+}
+
+void Application::AllocatePerDrawSets()
+{
+	// Counted with the draws of the scheme, as if each set were allocated right before its draw
+	auto start = std::chrono::high_resolution_clock::now();
+	uint32_t frameOffset = m_CurrentFrame * m_ObjectRingStride * s_PerDrawBenchmarkDraws;
+	m_PerDrawSets.resize(s_PerDrawBenchmarkDraws);
+	for (uint32_t i = 0; i < s_PerDrawBenchmarkDraws; ++i)
+	{
+		// The slot is the set's own buffer range, so its dynamic offset stays 0
+		m_PerDrawSets[i] = m_DescriptorAllocator.AllocateTransient(m_ObjectSetLayout, {
+			DescriptorAllocator::Buffer(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, m_ObjectRingBuffer, frameOffset + i * m_ObjectRingStride, sizeof(ObjectData)) });
+	}
+	m_PerDrawMs[PerDrawTransientSets] += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void Application::DrawObjects(VkCommandBuffer commandBuffer, bool dynamicRendering)
+{
+	// Every instance is a draw of its own mesh at full detail, cycling through the instances for a fixed number of draws
+	// so the cost per draw does not depend on the scene. The per frame set and the bindless heap are bound once, unless
+	// the scheme measures binding everything again for every draw
+	PerDrawScheme scheme = m_PerDrawScheme;
+	bool pushConstants = scheme == PerDrawPushConstants;
+	VkPipelineLayout layout = pushConstants ? m_GraphicsPipelines.ObjectPushLayout : m_GraphicsPipelines.ObjectRingLayout;
+	VkPipeline pipeline = pushConstants
+		? (dynamicRendering ? m_GraphicsPipelines.DynamicObjectPushPipeline : m_GraphicsPipelines.ObjectPushPipeline)
+		: (dynamicRendering ? m_GraphicsPipelines.DynamicObjectRingPipeline : m_GraphicsPipelines.ObjectRingPipeline);
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+
+	const std::vector<InstanceData>& instances = m_Scene.GetInstances();
+	const std::vector<MeshInfo>& meshes = m_Scene.GetMeshes();
+	std::array<VkDescriptorSet, 3> descriptorSets = { m_DescriptorSets[m_CurrentFrame], m_BindlessHeap.GetDescriptorSet(m_CurrentFrame), m_ObjectRingDescriptorSet };
+	uint32_t frameOffset = m_CurrentFrame * m_ObjectRingStride * s_PerDrawBenchmarkDraws;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	bool rebind = scheme == PerDrawRebind || scheme == PerDrawTransientSets;
+	if (!rebind)
+	{
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 0, 2, descriptorSets.data(), 0, nullptr);
+	}
+	for (uint32_t i = 0; i < s_PerDrawBenchmarkDraws; ++i)
+	{
+		const InstanceData& instance = instances[i % instances.size()];
+		ObjectData object{ instance.Transform, instance.TextureIndex, instance.SamplerIndex };
+		if (pushConstants)
+		{
+			vkCmdPushConstants(commandBuffer, layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(ObjectData), &object);
+		}
+		else
+		{
+			uint32_t offset = frameOffset + i * m_ObjectRingStride;
+			memcpy(m_ObjectRingData + offset, &object, sizeof(ObjectData));
+			if (scheme == PerDrawTransientSets)
+			{
+				descriptorSets[2] = m_PerDrawSets[i];
+				offset = 0;
+			}
+			if (rebind)
+			{
+				vkCmdBindDescriptorSets(
+					commandBuffer,
+					VK_PIPELINE_BIND_POINT_GRAPHICS,
+					layout,
+					0,
+					static_cast<uint32_t>(descriptorSets.size()),
+					descriptorSets.data(),
+					1,
+					&offset);
+			}
+			else
+			{
+				vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 2, 1, &descriptorSets[2], 1, &offset);
+			}
+		}
+		const MeshInfo& mesh = meshes[instance.MeshIndex];
+		vkCmdDrawIndexed(commandBuffer, mesh.IndexCount, 1, mesh.FirstIndex, mesh.VertexOffset, 0);
+	}
+	m_PerDrawMs[scheme] += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	m_PerDrawCalls[scheme] += s_PerDrawBenchmarkDraws;
+}
+
+void Application::CreateCullingBuffers()
+{
+	const std::vector<MeshInfo>& meshes = m_Scene.GetMeshes();
+	UploadBuffer(
+		meshes.data(),
+		sizeof(meshes[0]) * meshes.size(),
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		MemoryBudget::CategoryMeshes,
+		m_MeshBuffer,
+		m_MeshBufferMemory);
+
+	const std::vector<Meshlet>& meshlets = m_Scene.GetMeshlets();
+	UploadBuffer(
+		meshlets.data(),
+		sizeof(meshlets[0]) * meshlets.size(),
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		MemoryBudget::CategoryMeshes,
+		m_MeshletBuffer,
+		m_MeshletBufferMemory);
+
+	const std::vector<uint32_t>& meshletData = m_Scene.GetMeshletData();
+	UploadBuffer(
+		meshletData.data(),
+		sizeof(meshletData[0]) * meshletData.size(),
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		MemoryBudget::CategoryMeshes,
+		m_MeshletDataBuffer,
+		m_MeshletDataBufferMemory);
+
+	// Every visible instance adds one work item per 32 meshlets. Items past the limit are dropped, as are the
+	// task workgroups past what one indirect mesh task draw can launch
+	uint64_t meshletChunks = 0;
+	for (const InstanceData& instance : m_Scene.GetInstances())
+	{
+		meshletChunks += (m_Scene.GetMeshes()[instance.MeshIndex].MeshletCount + 31) / 32;
+	}
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(m_PhysicalDevice, &properties);
+	uint64_t maxWorkItems = std::min<uint64_t>(meshletChunks, properties.limits.maxComputeWorkGroupCount[0]);
+	if (m_MeshShadingSupported)
+	{
+		VkPhysicalDeviceMeshShaderPropertiesNV meshShaderProperties{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_PROPERTIES_NV };
+		VkPhysicalDeviceProperties2 properties2{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2 };
+		properties2.pNext = &meshShaderProperties;
+		vkGetPhysicalDeviceProperties2(m_PhysicalDevice, &properties2);
+		maxWorkItems = std::min<uint64_t>(maxWorkItems, meshShaderProperties.maxDrawMeshTasksCount);
+	}
+	m_MaxMeshletWorkItems = static_cast<uint32_t>(maxWorkItems);
+	CreateBuffer(
+		sizeof(glm::uvec2) * std::max(m_MaxMeshletWorkItems, 1u),
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		MemoryBudget::CategoryMeshes,
+		m_MeshletWorkItemBuffer,
+		m_MeshletWorkItemBufferMemory);
+
+	// Worst case, every instance survives and gets its own command, or every meshlet when drawing meshlets without mesh shaders
+	uint32_t meshletCount = static_cast<uint32_t>(std::min<size_t>(meshlets.size(), s_MaxMeshletDraws));
+	m_MaxCulledDraws = std::max(static_cast<uint32_t>(m_Scene.GetInstances().size()), meshletCount);
+	CreateBuffer(
+		sizeof(VkDrawIndexedIndirectCommand) * m_MaxCulledDraws,
+		VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		MemoryBudget::CategoryMeshes,
+		m_CulledDrawBuffer,
+		m_CulledDrawBufferMemory);
+
+	CreateBuffer(
+		sizeof(CullingStats),
+		VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+			| VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		MemoryBudget::CategoryOther,
+		m_CullingStatsBuffer,
+		m_CullingStatsBufferMemory);
+
+	// Stats are copied out per frame in flight and read once that frame's submissions have completed
+	m_CullingReadbackBuffers.resize(m_MaxFramesInFlight);
+	m_CullingReadbackBufferMemories.resize(m_MaxFramesInFlight);
+	m_CullingStatsPending.assign(m_MaxFramesInFlight, false);
+	for (size_t i = 0; i < m_MaxFramesInFlight; ++i)
+	{
+		CreateBuffer(
+			sizeof(CullingStats),
+			VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			MemoryBudget::CategoryOther,
+			m_CullingReadbackBuffers[i],
+			m_CullingReadbackBufferMemories[i]);
+	}
+
+	m_MeshletPushConstants.InstanceBufferIndex = m_DrawPushConstants.InstanceBufferIndex;
+	m_MeshletPushConstants.MeshBufferIndex = m_BindlessHeap.RegisterStorageBuffer(m_MeshBuffer);
+	m_MeshletPushConstants.MeshletBufferIndex = m_BindlessHeap.RegisterStorageBuffer(m_MeshletBuffer);
+	m_MeshletPushConstants.MeshletDataBufferIndex = m_BindlessHeap.RegisterStorageBuffer(m_MeshletDataBuffer);
+	m_MeshletPushConstants.WorkItemBufferIndex = m_BindlessHeap.RegisterStorageBuffer(m_MeshletWorkItemBuffer);
+	m_MeshletPushConstants.DrawBufferIndex = m_BindlessHeap.RegisterStorageBuffer(m_CulledDrawBuffer);
+	m_MeshletPushConstants.StatsBufferIndex = m_BindlessHeap.RegisterStorageBuffer(m_CullingStatsBuffer);
+	m_MeshletPushConstants.MaxDrawCount = m_MaxCulledDraws;
+}
+
+void Application::CreateDepthPyramidSampler()
+{
+	// Only read with texelFetch, so no filtering
+	VkSamplerCreateInfo samplerInfo{};
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerInfo.magFilter = VK_FILTER_NEAREST;
+	samplerInfo.minFilter = VK_FILTER_NEAREST;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.minLod = 0.0f;
+	samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+	if (vkCreateSampler(m_Device, &samplerInfo, nullptr, &m_DepthPyramidSampler) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create depth pyramid sampler");
+	}
+	m_MeshletPushConstants.DepthPyramidSamplerIndex = m_BindlessHeap.RegisterSampler(m_DepthPyramidSampler);
+}
+
+void Application::CreateDepthPyramid()
+{
+	// Level 0 matches the depth buffer, so reducing it only folds the samples together
+	uint32_t width = m_RenderExtent.width;
+	uint32_t height = m_RenderExtent.height;
+	m_DepthPyramidLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
+
+	CreateImage(
+		width,
+		height,
+		m_DepthPyramidLevels,
+		VK_SAMPLE_COUNT_1_BIT,
+		VK_FORMAT_R32_SFLOAT,
+		VK_IMAGE_TILING_OPTIMAL,
+		VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		MemoryBudget::CategoryAttachments,
+		m_DepthPyramidImage,
+		m_DepthPyramidImageMemory);
+	// Left undefined, the render graph moves it to the general layout when the first pyramid pass overwrites it
+
+	m_DepthPyramidView = CreateImageView(m_DepthPyramidImage, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, m_DepthPyramidLevels);
+	m_DepthPyramidMipViews.resize(m_DepthPyramidLevels);
+	for (uint32_t i = 0; i < m_DepthPyramidLevels; ++i)
+	{
+		m_DepthPyramidMipViews[i] = CreateImageView(m_DepthPyramidImage, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, 1, i);
+	}
+	m_MeshletPushConstants.DepthPyramidIndex = m_BindlessHeap.RegisterSampledImage(m_DepthPyramidView, VK_IMAGE_LAYOUT_GENERAL);
+
+	// One set per level, reading the level above it (the depth buffer for level 0) and writing the level itself
+	m_DepthReduceDescriptorSets.resize(m_DepthPyramidLevels);
+	for (uint32_t i = 0; i < m_DepthPyramidLevels; ++i)
+	{
+		std::vector<DescriptorAllocator::Write> writes = { DescriptorAllocator::Image(
+			1,
+			VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+			m_DepthPyramidMipViews[i],
+			VK_IMAGE_LAYOUT_GENERAL) };
+
+		// Without a sampleable depth buffer level 0 is never built, so leave its source unwritten
+		if (i > 0 || m_DepthSamplingSupported)
+		{
+			writes.push_back(DescriptorAllocator::Image(
+				0,
+				VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+				i == 0 ? m_DepthImageView : m_DepthPyramidMipViews[i - 1],
+				i == 0 ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL,
+				m_DepthPyramidSampler));
+		}
+		m_DepthReduceDescriptorSets[i] = m_DescriptorAllocator.GetSet(m_DepthReduceDescriptorSetLayout, writes);
+	}
+
+	// Holds nothing until a frame has been rasterized into it
+	m_DepthPyramidValid = false;
+}
+
+void Application::CreateCullingDescriptorSets()
+{
+	// Written in place when the depth pyramid is recreated, so these are not shared through the set cache
+	m_CullDescriptorSets.resize(m_MaxFramesInFlight);
+	for (size_t i = 0; i < m_MaxFramesInFlight; ++i)
+	{
+		m_CullDescriptorSets[i] = m_DescriptorAllocator.Allocate(m_CullDescriptorSetLayout);
+
+		// Binding 5, the depth pyramid, is written by UpdateCullingDescriptorSet
+		std::array<uint32_t, 6> bindings = { 0, 1, 2, 3, 4, 6 };
+		std::array<VkDescriptorBufferInfo, 6> bufferInfos{};
+		bufferInfos[0] = { m_UniformBuffers[i], 0, sizeof(UniformBufferObject) };
+		bufferInfos[1] = { m_InstanceBuffer, 0, VK_WHOLE_SIZE };
+		bufferInfos[2] = { m_MeshBuffer, 0, VK_WHOLE_SIZE };
+		bufferInfos[3] = { m_CulledDrawBuffer, 0, VK_WHOLE_SIZE };
+		bufferInfos[4] = { m_CullingStatsBuffer, 0, VK_WHOLE_SIZE };
+		bufferInfos[5] = { m_MeshletWorkItemBuffer, 0, VK_WHOLE_SIZE };
+
+		std::array<VkWriteDescriptorSet, 6> descriptorWrites{};
+		for (uint32_t j = 0; j < descriptorWrites.size(); ++j)
+		{
+			descriptorWrites[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[j].dstSet = m_CullDescriptorSets[i];
+			descriptorWrites[j].dstBinding = bindings[j];
+			descriptorWrites[j].descriptorType = bindings[j] == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			descriptorWrites[j].descriptorCount = 1;
+			descriptorWrites[j].pBufferInfo = &bufferInfos[j];
+		}
+		vkUpdateDescriptorSets(m_Device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+	}
+}
+
+void Application::UpdateCullingDescriptorSet(uint32_t frame)
+{
+	// The depth pyramid is recreated with the render targets, so its binding is written separately
+	VkDescriptorImageInfo imageInfo{};
+	imageInfo.sampler = m_DepthPyramidSampler;
+	imageInfo.imageView = m_DepthPyramidView;
+	imageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+	VkWriteDescriptorSet imageWrite{};
+	imageWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	imageWrite.dstSet = m_CullDescriptorSets[frame];
+	imageWrite.dstBinding = 5;
+	imageWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	imageWrite.descriptorCount = 1;
+	imageWrite.pImageInfo = &imageInfo;
+	vkUpdateDescriptorSets(m_Device, 1, &imageWrite, 0, nullptr);
+}
 
+void Application::CreateCullingPipelines()
+{
+	// Culling: camera, instances, meshes, output draws, stats, the depth pyramid and the meshlet work items
+	ShaderReflection cullReflection = ShaderReflection::Reflect(GetShaderCode(m_CullShader));
+	CheckPushConstantSize(cullReflection, sizeof(CullPushConstants), "Culling");
+	m_CullPipelineLayout = m_LayoutCache.GetPipelineLayout({ &cullReflection });
+	m_CullDescriptorSetLayout = m_LayoutCache.GetSetLayout(PipelineLayoutCache::GetBindings({ &cullReflection }, 0));
+	m_CullPipeline = CreateComputePipeline(m_CullShader, m_CullPipelineLayout);
+
+	// Meshlet culling reaches everything through the bindless heap
+	ShaderReflection meshletCullReflection = ShaderReflection::Reflect(GetShaderCode(m_MeshletCullShader));
+	CheckPushConstantSize(meshletCullReflection, sizeof(MeshletPushConstants), "Meshlet culling");
+	m_MeshletCullPipelineLayout = m_LayoutCache.GetPipelineLayout(
+		{ &meshletCullReflection },
+		{ { 0, m_DescriptorSetLayout }, { 1, m_BindlessHeap.GetLayout() } });
+	m_MeshletCullPipeline = CreateComputePipeline(m_MeshletCullShader, m_MeshletCullPipelineLayout);
+
+	// Depth reduction: source level and destination level. Same shader compiled twice, the multisampled variant only
+	// reduces a multisampled depth buffer into level 0, and both declare the same interface so they share a layout
+	ShaderReflection depthReduceReflection = ShaderReflection::Reflect(GetShaderCode(m_DepthReduceShader));
+	ShaderReflection depthReduceMsReflection = ShaderReflection::Reflect(GetShaderCode(m_DepthReduceMsShader));
+	CheckPushConstantSize(depthReduceReflection, sizeof(DepthReducePushConstants), "Depth reduce");
+	m_DepthReducePipelineLayout = m_LayoutCache.GetPipelineLayout({ &depthReduceReflection });
+	if (m_LayoutCache.GetPipelineLayout({ &depthReduceMsReflection }) != m_DepthReducePipelineLayout)
+	{
+		throw std::runtime_error("Depth reduce variants declare different descriptors or push constants");
+	}
+	m_DepthReduceDescriptorSetLayout = m_LayoutCache.GetSetLayout(PipelineLayoutCache::GetBindings({ &depthReduceReflection }, 0));
+	m_DepthReducePipeline = CreateComputePipeline(m_DepthReduceShader, m_DepthReducePipelineLayout);
+	m_DepthReduceMsPipeline = CreateComputePipeline(m_DepthReduceMsShader, m_DepthReducePipelineLayout);
+}
+
+VkPipeline Application::CreateComputePipeline(const ShaderSource& source, VkPipelineLayout layout)
+{
+	VkShaderModule shaderModule = CreateShaderModule(GetShaderCode(source));
+
+	VkComputePipelineCreateInfo pipelineInfo{};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineInfo.stage.module = shaderModule;
+	pipelineInfo.stage.pName = "main";
+	pipelineInfo.layout = layout;
+
+	VkPipeline pipeline;
+	if (vkCreateComputePipelines(m_Device, m_PipelineCache, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create compute pipeline");
+	}
+
+	vkDestroyShaderModule(m_Device, shaderModule, nullptr);
+	return pipeline;
+}
+
+void Application::CullInstances(VkCommandBuffer commandBuffer, bool occlusion)
+{
+	// Counters start at zero, the meshlet dispatch at one row of workgroups
+	CullingStats initialStats{};
+	initialStats.MeshletDispatch = { 0, 1, 1 };
+	vkCmdUpdateBuffer(commandBuffer, m_CullingStatsBuffer, 0, sizeof(CullingStats), &initialStats);
+
+	VkMemoryBarrier clearBarrier{};
+	clearBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	clearBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(
+		commandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0,
+		1, &clearBarrier,
+		0, nullptr,
+		0, nullptr);
+
+	CullPushConstants pushConstants{};
+	pushConstants.InstanceCount = static_cast<uint32_t>(m_Scene.GetInstances().size());
+	pushConstants.OcclusionEnabled = occlusion ? 1 : 0;
+	pushConstants.MeshletMode = m_UseMeshlets ? 1 : 0;
+	pushConstants.MaxWorkItems = m_MaxMeshletWorkItems;
+	pushConstants.LodEnabled = m_UseLods ? 1 : 0;
+	pushConstants.LodPixelsPerUnit = m_LodPixelsPerUnit;
+	pushConstants.LodErrorThreshold = m_LodErrorThreshold;
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_CullPipeline);
 	vkCmdBindDescriptorSets(
 		commandBuffer,
-		VK_PIPELINE_BIND_POINT_GRAPHICS,
-		m_PipelineLayout,
+		VK_PIPELINE_BIND_POINT_COMPUTE,
+		m_CullPipelineLayout,
 		0,
 		1,
-		&m_DescriptorSets[m_CurrentFrame],
+		&m_CullDescriptorSets[m_CurrentFrame],
 		0,
 		nullptr);
+	vkCmdPushConstants(commandBuffer, m_CullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullPushConstants), &pushConstants);
+	vkCmdDispatch(commandBuffer, (pushConstants.InstanceCount + 63) / 64, 1, 1);
+}
 
-	vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(m_Indices.size()), 1, 0, 0, 0);
+void Application::CullMeshlets(VkCommandBuffer commandBuffer)
+{
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_MeshletCullPipeline);
+	std::array<VkDescriptorSet, 2> descriptorSets = { m_DescriptorSets[m_CurrentFrame], m_BindlessHeap.GetDescriptorSet(m_CurrentFrame) };
+	vkCmdBindDescriptorSets(
+		commandBuffer,
+		VK_PIPELINE_BIND_POINT_COMPUTE,
+		m_MeshletCullPipelineLayout,
+		0,
+		static_cast<uint32_t>(descriptorSets.size()),
+		descriptorSets.data(),
+		0,
+		nullptr);
+	vkCmdPushConstants(
+		commandBuffer,
+		m_MeshletCullPipelineLayout,
+		VK_SHADER_STAGE_COMPUTE_BIT,
+		0,
+		sizeof(MeshletPushConstants),
+		&m_MeshletPushConstants);
+	vkCmdDispatchIndirect(commandBuffer, m_CullingStatsBuffer, offsetof(CullingStats, MeshletDispatch));
+}
 
-	vkCmdEndRenderPass(commandBuffer);
+void Application::CopyCullingStats(VkCommandBuffer commandBuffer)
+{
+	VkBufferCopy copyRegion{};
+	copyRegion.size = sizeof(CullingStats);
+	vkCmdCopyBuffer(commandBuffer, m_CullingStatsBuffer, m_CullingReadbackBuffers[m_CurrentFrame], 1, &copyRegion);
 
-	if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+	VkMemoryBarrier readbackBarrier{};
+	readbackBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	readbackBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	readbackBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	vkCmdPipelineBarrier(
+		commandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_PIPELINE_STAGE_HOST_BIT,
+		0,
+		1, &readbackBarrier,
+		0, nullptr,
+		0, nullptr);
+}
+
+void Application::BuildDepthPyramid(VkCommandBuffer commandBuffer)
+{
+	glm::uvec2 sourceSize(m_RenderExtent.width, m_RenderExtent.height);
+	for (uint32_t i = 0; i < m_DepthPyramidLevels; ++i)
 	{
-		throw std::runtime_error("Failed to record command buffer");
+		DepthReducePushConstants pushConstants{};
+		pushConstants.SourceSize = sourceSize;
+		pushConstants.DestinationSize = i == 0 ? sourceSize : glm::max(sourceSize / 2u, glm::uvec2(1));
+		pushConstants.SampleCount = static_cast<uint32_t>(m_MsaaSamples);
+
+		VkPipeline pipeline = i == 0 && m_MsaaSamples != VK_SAMPLE_COUNT_1_BIT ? m_DepthReduceMsPipeline : m_DepthReducePipeline;
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+		vkCmdBindDescriptorSets(
+			commandBuffer,
+			VK_PIPELINE_BIND_POINT_COMPUTE,
+			m_DepthReducePipelineLayout,
+			0,
+			1,
+			&m_DepthReduceDescriptorSets[i],
+			0,
+			nullptr);
+		vkCmdPushConstants(
+			commandBuffer,
+			m_DepthReducePipelineLayout,
+			VK_SHADER_STAGE_COMPUTE_BIT,
+			0,
+			sizeof(DepthReducePushConstants),
+			&pushConstants);
+		vkCmdDispatch(commandBuffer, (pushConstants.DestinationSize.x + 7) / 8, (pushConstants.DestinationSize.y + 7) / 8, 1);
+
+		// The next level reads this one. The graph makes the last level visible to the next frame's culling
+		VkImageMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = m_DepthPyramidImage;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseMipLevel = i;
+		barrier.subresourceRange.levelCount = 1;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = 1;
+		vkCmdPipelineBarrier(
+			commandBuffer,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0,
+			0, nullptr,
+			0, nullptr,
+			1, &barrier);
+
+		sourceSize = pushConstants.DestinationSize;
+	}
+}
+
+void Application::ReadCullingStats(uint32_t frame)
+{
+	if (!m_CullingStatsPending[frame])
+	{
+		return;
 	}
+	m_CullingStatsPending[frame] = false;
+
+	CullingStats stats;
+	void* data;
+	vkMapMemory(m_Device, m_CullingReadbackBufferMemories[frame], 0, sizeof(stats), 0, &data);
+	memcpy(&stats, data, sizeof(stats));
+	vkUnmapMemory(m_Device, m_CullingReadbackBufferMemories[frame]);
+
+	m_Profiler.SetCounter("Visible", stats.DrawCount);
+	m_Profiler.SetCounter("Visible instances", stats.VisibleInstances);
+	m_Profiler.SetCounter("Frustum culled", stats.FrustumCulled);
+	m_Profiler.SetCounter("Occlusion culled", stats.OcclusionCulled);
+	m_Profiler.SetCounter("Meshlets culled", stats.MeshletsCulled);
+	m_Profiler.SetCounter("Triangles", stats.TriangleCount);
+	m_Profiler.SetCounter("LOD error (px)", stats.MaxLodError);
 }
 
 void Application::CreateSyncObjects() 
 {
 	m_ImageAvailableSemaphores.resize(m_MaxFramesInFlight);
 	m_RenderFinishedSemaphores.resize(m_MaxFramesInFlight);
-	m_InFlightFences.resize(m_MaxFramesInFlight);
 
+	// Frames are waited on through the frame scheduler's timelines, these only order acquiring and presenting
 	VkSemaphoreCreateInfo semaphoreInfo{};
 	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-	VkFenceCreateInfo fenceInfo{};
-	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-	// Create the fence already signaled, so it doesn't block on the first frame
-	fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-
 	for (size_t i = 0; i < m_MaxFramesInFlight; ++i)
 	{
 		if (vkCreateSemaphore(m_Device, &semaphoreInfo, nullptr, &m_ImageAvailableSemaphores[i]) != VK_SUCCESS ||
-			vkCreateSemaphore(m_Device, &semaphoreInfo, nullptr, &m_RenderFinishedSemaphores[i]) != VK_SUCCESS ||
-			vkCreateFence(m_Device, &fenceInfo, nullptr, &m_InFlightFences[i]) != VK_SUCCESS)
+			vkCreateSemaphore(m_Device, &semaphoreInfo, nullptr, &m_RenderFinishedSemaphores[i]) != VK_SUCCESS)
 		{
 			throw std::runtime_error("Failed to create semaphores");
 		}
@@ -1157,31 +3356,27 @@ void Application::CreateSyncObjects()
 }
 
 
-std::vector<char> Application::ReadFile(const std::string& filename)
+void Application::PreloadShaders(const std::vector<const ShaderSource*>& sources)
 {
-	std::ifstream file(filename, std::ios::ate | std::ios::binary);
-	if (!file.is_open())
+	for (const ShaderSource* source : sources)
 	{
-		throw std::runtime_error("Failed to open file" + filename);
+		m_PreloadedShaders.at(source->GetName()) = m_ShaderCompiler.Compile(*source);
 	}
+}
 
-	size_t fileSize = (size_t)file.tellg();
-	std::vector<char> buffer(fileSize);
-
-	file.seekg(0);
-	file.read(buffer.data(), fileSize);
-
-	file.close();
-
-	return buffer;
+std::vector<uint32_t> Application::GetShaderCode(const ShaderSource& source)
+{
+	// Only read from once preloading finished, so the map is never written concurrently
+	auto preloaded = m_PreloadedShaders.find(source.GetName());
+	return preloaded != m_PreloadedShaders.end() && !preloaded->second.empty() ? preloaded->second : m_ShaderCompiler.Compile(source);
 }
 
-VkShaderModule Application::CreateShaderModule(const std::vector<char>& code)
+VkShaderModule Application::CreateShaderModule(const std::vector<uint32_t>& code)
 {
 	VkShaderModuleCreateInfo createInfo{};
 	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-	createInfo.codeSize = code.size();
-	createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+	createInfo.codeSize = code.size() * sizeof(uint32_t);
+	createInfo.pCode = code.data();
 
 	VkShaderModule shaderModule;
 	if (vkCreateShaderModule(m_Device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS)
@@ -1191,21 +3386,245 @@ VkShaderModule Application::CreateShaderModule(const std::vector<char>& code)
 	return shaderModule;
 }
 
+void Application::WatchShaders()
+{
+	m_ShaderWatcher.Setup(&m_ShaderCompiler);
+
+	// Ray tracing shaders are left out, their pipeline also sizes the shader binding table
+	std::vector<ShaderSource> graphicsShaders = { m_VertexShader, m_ObjectPushVertexShader, m_ObjectRingVertexShader, m_FragmentShader };
+	if (m_MeshShadingSupported)
+	{
+		graphicsShaders.push_back(m_TaskShader);
+		graphicsShaders.push_back(m_MeshShader);
+	}
+	m_ShaderWatcher.Watch("graphics pipelines", graphicsShaders, [this]
+	{
+		std::shared_lock<std::shared_mutex> lock(m_GraphicsPipelineMutex);
+		GraphicsPipelineSet pipelines{};
+		CreateGraphicsPipeline(pipelines);
+		uint64_t generation = m_GraphicsPipelineGeneration;
+
+		std::lock_guard<std::mutex> swapLock(m_PipelineSwapMutex);
+		m_PipelineSwaps.push_back([this, pipelines, generation]() mutable
+		{
+			// A set built before the render thread rebuilt the pipelines itself is never used
+			if (generation == m_GraphicsPipelineGeneration)
+			{
+				std::swap(m_GraphicsPipelines, pipelines);
+				ResetMaterialPipelines(); // Specialized from the previous shaders
+			}
+			RetireGraphicsPipeline(pipelines);
+		});
+	});
+	WatchComputePipeline(m_CullShader, m_CullPipelineLayout, m_CullPipeline);
+	WatchComputePipeline(m_MeshletCullShader, m_MeshletCullPipelineLayout, m_MeshletCullPipeline);
+	WatchComputePipeline(m_DepthReduceShader, m_DepthReducePipelineLayout, m_DepthReducePipeline);
+	WatchComputePipeline(m_DepthReduceMsShader, m_DepthReducePipelineLayout, m_DepthReduceMsPipeline);
+	m_ShaderWatcher.Start();
+}
+
+void Application::WatchComputePipeline(const ShaderSource& source, VkPipelineLayout layout, VkPipeline& pipeline)
+{
+	// Compute layouts never change after startup, so only the pipeline is rebuilt
+	m_ShaderWatcher.Watch(source.GetName(), { source }, [this, source, layout, &pipeline]
+	{
+		VkPipeline newPipeline = CreateComputePipeline(source, layout);
+		std::lock_guard<std::mutex> lock(m_PipelineSwapMutex);
+		m_PipelineSwaps.push_back([this, newPipeline, &pipeline]
+		{
+			m_RetiredPipelines.push_back({ { pipeline }, m_MaxFramesInFlight });
+			pipeline = newPipeline;
+		});
+	});
+}
+
+void Application::ApplyPipelineSwaps()
+{
+	std::vector<std::function<void()>> swaps;
+	{
+		std::lock_guard<std::mutex> lock(m_PipelineSwapMutex);
+		swaps.swap(m_PipelineSwaps);
+	}
+	for (const std::function<void()>& swap : swaps)
+	{
+		swap();
+	}
+}
+
+void Application::ReleaseRetiredPipelines()
+{
+	// Counted down once per frame, the frames that could still use them have completed once it reaches 0
+	for (RetiredPipelines& retired : m_RetiredPipelines)
+	{
+		if (retired.FramesLeft > 0)
+		{
+			--retired.FramesLeft;
+		}
+		if (retired.FramesLeft == 0)
+		{
+			for (VkPipeline pipeline : retired.Pipelines)
+			{
+				vkDestroyPipeline(m_Device, pipeline, nullptr);
+			}
+		}
+	}
+	std::erase_if(m_RetiredPipelines, [](const RetiredPipelines& retired) { return retired.FramesLeft == 0; });
+}
 
 void Application::MainLoop()
 {
-	while (!glfwWindowShouldClose(m_Window))
+	// The first packet is ready before the render thread starts, so it always has one to draw
+	Simulate();
+	m_Running = true;
+	std::thread simulationThread(&Application::SimulationLoop, this);
+	std::thread renderThread(&Application::RenderLoop, this);
+
+	// GLFW only handles events on the main thread. The other threads wake it up to set the title or to stop
+	while (!glfwWindowShouldClose(m_Window) && m_Running)
 	{
-		glfwPollEvents();
-		DrawFrame();
+		glfwWaitEvents();
+
+		std::lock_guard<std::mutex> lock(m_TitleMutex);
+		if (!m_PendingTitle.empty())
+		{
+			glfwSetWindowTitle(m_Window, m_PendingTitle.c_str());
+			m_PendingTitle.clear();
+		}
 	}
 
+	m_Running = false;
+	simulationThread.join();
+	renderThread.join();
 	vkDeviceWaitIdle(m_Device);
+	if (m_ThreadException)
+	{
+		std::rethrow_exception(m_ThreadException);
+	}
+}
+
+void Application::SimulationLoop()
+{
+	try
+	{
+		// Fixed steps, the render thread draws whichever one is newest when it starts a frame
+		auto step = std::chrono::duration_cast<std::chrono::high_resolution_clock::duration>(std::chrono::duration<double>(1.0 / s_SimulationRate));
+		auto nextStep = std::chrono::high_resolution_clock::now();
+		while (m_Running)
+		{
+			Simulate();
+
+			// Steps that fell behind are dropped rather than caught up on
+			nextStep = std::max(nextStep + step, std::chrono::high_resolution_clock::now());
+			std::this_thread::sleep_until(nextStep);
+		}
+	}
+	catch (...)
+	{
+		std::lock_guard<std::mutex> lock(m_ThreadExceptionMutex);
+		m_ThreadException = std::current_exception();
+		m_Running = false;
+		glfwPostEmptyEvent();
+	}
+}
+
+void Application::Simulate()
+{
+	static auto startTime = std::chrono::high_resolution_clock::now();
+
+	auto currentTime = std::chrono::high_resolution_clock::now();
+	float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
+
+	FramePacket& packet = m_FramePackets.GetWriteBuffer();
+	packet.Time = currentTime;
+	packet.Model = glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+	packet.View = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f) * m_CameraScale, glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+	float width = static_cast<float>(std::max(m_ViewportWidth.load(), 1u));
+	float height = static_cast<float>(std::max(m_ViewportHeight.load(), 1u));
+	packet.Projection = glm::perspective(glm::radians(45.0f), width / height, 0.1f, 10.0f * m_CameraScale);
+	packet.Projection[1][1] *= -1; // Invert Y coordinate (Vulkan vs OpenGL)
+
+	// Screen pixels covered by one unit at distance one, shared with the culling shader
+	packet.LodPixelsPerUnit = std::abs(packet.Projection[1][1]) * height * 0.5f;
+	packet.LodsSelected = m_SimulateLods;
+	if (packet.LodsSelected)
+	{
+		packet.Lods = m_Scene.SelectLods(packet.View * packet.Model, packet.LodPixelsPerUnit, m_LodErrorThreshold, packet.LodDrawCommands);
+	}
+	m_Scene.GatherVisibleTextures(packet.Projection * packet.View * packet.Model, packet.VisibleTextures);
+
+	packet.SimulationMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - currentTime).count();
+	m_FramePackets.Publish();
+}
+
+void Application::RenderLoop()
+{
+	try
+	{
+		while (m_Running)
+		{
+			auto frameStart = std::chrono::high_resolution_clock::now();
+			ApplyInput();
+			DrawFrame();
+			m_Profiler.SetCounter("Render thread (ms)", std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - frameStart).count());
+
+			// Report the profiled times once per second
+			if (frameStart - m_LastTitleUpdate > std::chrono::seconds(1))
+			{
+				m_LastTitleUpdate = frameStart;
+				std::string title = std::string("Vulkan") + (m_UseRaytracing ? " (ray traced)" : "")
+					+ (m_UseDynamicRendering ? " (dynamic rendering)" : "") + m_Profiler.GetSummary();
+				std::lock_guard<std::mutex> lock(m_TitleMutex);
+				m_PendingTitle = title;
+				glfwPostEmptyEvent();
+			}
+		}
+	}
+	catch (...)
+	{
+		std::lock_guard<std::mutex> lock(m_ThreadExceptionMutex);
+		m_ThreadException = std::current_exception();
+		m_Running = false;
+		glfwPostEmptyEvent();
+	}
 }
 
 void Application::DrawFrame()
 {
-	vkWaitForFences(m_Device, 1, &m_InFlightFences[m_CurrentFrame], VK_TRUE, UINT64_MAX);
+	// The slot's command buffer, semaphores, uniforms and readbacks are reused from here on
+	m_FrameScheduler.BeginFrame(m_CurrentFrame);
+	m_Profiler.BeginFrame(m_CurrentFrame);
+	ReadCullingStats(m_CurrentFrame);
+	if (m_VirtualTexturingSupported)
+	{
+		m_VirtualTexture.ReadFeedback(m_CurrentFrame);
+	}
+	m_BindlessHeap.BeginFrame(m_CurrentFrame);
+	m_DescriptorAllocator.BeginFrame(m_CurrentFrame);
+	m_TextureStreamer.NextFrame();
+	ReleaseRetiredPipelines();
+	ReleaseRetiredRenderTargets();
+	ApplyPipelineSwaps();
+
+	// Read after the slot's retired resources were freed, so the streamer sees what is actually left in use
+	m_MemoryBudget.Update();
+	m_Profiler.SetCounter("VRAM used (MB)", static_cast<double>(m_MemoryBudget.GetDeviceLocalUsage()) / (1024.0 * 1024.0));
+	m_Profiler.SetCounter("VRAM budget (MB)", static_cast<double>(m_MemoryBudget.GetDeviceLocalBudget()) / (1024.0 * 1024.0));
+
+	// Measured on the frame this slot held before, and applied before anything of this frame uses the render targets.
+	// Turned off, the governor goes back to the best level
+	bool levelChanged = m_UseQualityGovernor ? m_QualityGovernor.Update(m_Profiler.GetGpuFrameTimeMs()) : m_QualityGovernor.Reset();
+	if (levelChanged || m_QualityLevelPending)
+	{
+		m_QualityLevelPending = !ApplyQualityLevel();
+	}
+
+	// The slot's previous frame, the last to read the previous render targets through its sets, has completed
+	if (m_RenderTargetSetsStale[m_CurrentFrame])
+	{
+		UpdateRtDescriptorSet(m_CurrentFrame);
+		UpdateCullingDescriptorSet(m_CurrentFrame);
+		m_RenderTargetSetsStale[m_CurrentFrame] = false;
+	}
 
 	uint32_t imageIndex;
 	VkResult result 
@@ -1220,39 +3639,49 @@ void Application::DrawFrame()
 		throw std::runtime_error("Failed to acquire swap chain image");
 	}
 
-	// Only reset the fence if we are submitting work, to avoid deadlocks
-	vkResetFences(m_Device, 1, &m_InFlightFences[m_CurrentFrame]);
+	// The newest simulation step, or the previous one again when none was published since
+	m_FramePackets.Acquire();
+	const FramePacket& packet = m_FramePackets.GetReadBuffer();
+	UpdateUniformBuffer(m_CurrentFrame, packet);
+	m_TextureStreamer.MarkUsed(packet.VisibleTextures);
+
+	// The material's specialized pipelines once they are ready, the generic ones until then
+	m_FramePipelines = GetMaterialPipelines(m_MaterialFeatures);
+	m_Profiler.SetCounter("Pipelines compiling", static_cast<double>(m_PendingMaterialPipelines.size()));
+	m_Profiler.SetCounter("Descriptor pools", m_DescriptorAllocator.GetPoolCount());
 
 	vkResetCommandBuffer(m_CommandBuffers[m_CurrentFrame], 0);
 	
+	auto recordStart = std::chrono::high_resolution_clock::now();
 	RecordCommandBuffer(m_CommandBuffers[m_CurrentFrame], imageIndex);
-
-	UpdateUniformBuffer(m_CurrentFrame);
-
-	VkSubmitInfo submitInfo{};
-	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-
-	VkSemaphore waitSemaphores[] = { m_ImageAvailableSemaphores[m_CurrentFrame]};
-	VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-	submitInfo.waitSemaphoreCount = 1;
-	submitInfo.pWaitSemaphores = waitSemaphores;
-	submitInfo.pWaitDstStageMask = waitStages;
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &m_CommandBuffers[m_CurrentFrame];
-
-	VkSemaphore signalSemaphores[] = { m_RenderFinishedSemaphores[m_CurrentFrame]};
-	submitInfo.signalSemaphoreCount = 1;
-	submitInfo.pSignalSemaphores = signalSemaphores;
-
-	if (vkQueueSubmit(m_GraphicsQueue, 1, &submitInfo, m_InFlightFences[m_CurrentFrame]) != VK_SUCCESS)
+	double recordMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - recordStart).count();
+	m_Profiler.SetCounter("Record (ms)", recordMs);
+	if (m_BenchmarkFramesLeft > 0)
 	{
-		throw std::runtime_error("Failed to submit draw command buffer");
+		UpdateRecordingBenchmark(recordMs);
 	}
+	if (m_PerDrawFramesLeft > 0)
+	{
+		UpdatePerDrawBenchmark();
+	}
+
+	FrameScheduler::Submission submission;
+	submission.CommandBuffers = { m_CommandBuffers[m_CurrentFrame] };
+	submission.WaitSemaphore = m_ImageAvailableSemaphores[m_CurrentFrame];
+	submission.WaitSemaphoreStages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT;
+	submission.SignalSemaphore = m_RenderFinishedSemaphores[m_CurrentFrame];
+	submission.Waits = { m_TextureStreamer.GetUploadDependency() };
+	m_FrameScheduler.Submit(FrameScheduler::Graphics, submission);
+
+	// Age of the step once its frame is submitted, and how many frames the GPU has queued up including this one
+	m_Profiler.SetCounter("Simulation (ms)", packet.SimulationMs);
+	m_Profiler.SetCounter("Packet age (ms)", std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - packet.Time).count());
+	m_Profiler.SetCounter("Pipeline depth", m_FrameScheduler.GetFramesInFlight());
 
 	VkPresentInfoKHR presentInfo{};
 	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 	presentInfo.waitSemaphoreCount = 1;
-	presentInfo.pWaitSemaphores = signalSemaphores;
+	presentInfo.pWaitSemaphores = &m_RenderFinishedSemaphores[m_CurrentFrame];
 	VkSwapchainKHR swapchains[] = { m_Swapchain };
 	presentInfo.swapchainCount = 1;
 	presentInfo.pSwapchains = swapchains;
@@ -1270,205 +3699,200 @@ void Application::DrawFrame()
 		throw std::runtime_error("Failed to acquire swap chain image");
 	}
 
+	if (!m_FirstFramePresented)
+	{
+		m_FirstFramePresented = true;
+		std::cout << "First frame presented " << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - m_StartupBegin).count()
+			<< " ms after startup began" << std::endl;
+	}
+
 	m_CurrentFrame = (m_CurrentFrame + 1) % m_MaxFramesInFlight;
 }
 
-void Application::UpdateUniformBuffer(uint32_t currentImage)
+void Application::StartRecordingBenchmark()
 {
-	static auto startTime = std::chrono::high_resolution_clock::now();
-
-	auto currentTime = std::chrono::high_resolution_clock::now();
-	float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
-
-	UniformBufferObject ubo{};
-	ubo.Model = glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	ubo.View = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	ubo.Projection = glm::perspective(glm::radians(45.0f), m_SwapchainExtent.width / (float)m_SwapchainExtent.height, 0.1f, 10.0f);
-	ubo.Projection[1][1] *= -1; // Invert Y coordinate (Vulkan vs OpenGL)
-
-	// Copy data to uniform buffer
-	void* data;
-	vkMapMemory(m_Device, m_UniformBufferMemories[currentImage], 0, sizeof(ubo), 0, &data);
-	memcpy(data, &ubo, sizeof(ubo));
-	vkUnmapMemory(m_Device, m_UniformBufferMemories[currentImage]);
+	m_BenchmarkFramesLeft = s_BenchmarkFrames;
+	m_BenchmarkRestoreDynamicRendering = m_UseDynamicRendering;
+	m_BenchmarkRecordMs = {};
+	m_BenchmarkFrameCounts = {};
+	std::cout << "Benchmarking command buffer recording over " << s_BenchmarkFrames << " frames..." << std::endl;
 }
 
-void Application::CreateTextureImage()
+void Application::UpdateRecordingBenchmark(double recordMs)
 {
-	// Read texture to staging buffer
-	int texWidth, texHeight, texChannels;
-	stbi_uc* pixels = stbi_load(m_TexturePath.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-	m_MipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(texWidth, texHeight)))) + 1;
-	VkDeviceSize imageSize = texWidth * texHeight * 4;
-	if (!pixels)
+	// The paths alternate every frame so both record the same scene from the same camera. Each path's first frame is
+	// left out, as it may create its framebuffers
+	uint32_t path = m_UseDynamicRendering ? 1 : 0;
+	if (m_BenchmarkFramesLeft <= s_BenchmarkFrames - 2)
 	{
-		throw std::runtime_error("Failed to load texture image");
+		m_BenchmarkRecordMs[path] += recordMs;
+		++m_BenchmarkFrameCounts[path];
 	}
+	m_UseDynamicRendering = !m_UseDynamicRendering;
 
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
-	CreateBuffer(
-		imageSize,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		stagingBuffer,
-		stagingBufferMemory);
-
-	void* data;
-	vkMapMemory(m_Device, stagingBufferMemory, 0, imageSize, 0, &data);
-	memcpy(data, pixels, static_cast<size_t>(imageSize));
-	vkUnmapMemory(m_Device, stagingBufferMemory);
+	if (--m_BenchmarkFramesLeft == 0)
+	{
+		double renderPassMs = m_BenchmarkRecordMs[0] / std::max(m_BenchmarkFrameCounts[0], 1u);
+		double dynamicRenderingMs = m_BenchmarkRecordMs[1] / std::max(m_BenchmarkFrameCounts[1], 1u);
+		std::cout << "Recording: render pass + vkCmdPipelineBarrier " << renderPassMs << " ms, dynamic rendering + synchronization2 "
+			<< dynamicRenderingMs << " ms per frame (" << (m_UseRaytracing ? "ray traced" : "rasterized") << ")" << std::endl;
+		m_UseDynamicRendering = m_BenchmarkRestoreDynamicRendering;
+	}
+}
 
-	stbi_image_free(pixels);
+void Application::StartPerDrawBenchmark()
+{
+	// Objects are only drawn one by one in place of the rasterized indirect draws
+	if (m_UseRaytracing || m_UseMeshlets)
+	{
+		std::cout << "The per draw benchmark needs rasterization without meshlets" << std::endl;
+		return;
+	}
+	m_PerDrawFramesLeft = s_BenchmarkFrames;
+	m_PerDrawScheme = PerDrawPushConstants;
+	m_PerDrawMs = {};
+	m_PerDrawCalls = {};
+	std::cout << "Benchmarking per draw data over " << s_BenchmarkFrames << " frames of " << s_PerDrawBenchmarkDraws << " draws, cycling through "
+		<< m_Scene.GetInstances().size() << " instances..." << std::endl;
+}
 
-	CreateImage(
-		texWidth, 
-		texHeight, 
-		m_MipLevels,
-		VK_SAMPLE_COUNT_1_BIT,
-		VK_FORMAT_R8G8B8A8_SRGB, 
-		VK_IMAGE_TILING_OPTIMAL, 
-		VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		m_TextureImage,
-		m_TextureImageMemory);
-
-	// Copy staging buffer to texture image
-	TransitionImageLayout(
-		m_TextureImage, 
-		VK_FORMAT_R8G8B8A8_SRGB, 
-		VK_IMAGE_LAYOUT_UNDEFINED, 
-		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-		m_MipLevels);
-	CopyBufferToImage(stagingBuffer, m_TextureImage, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
-	/*TransitionImageLayout(
-		m_TextureImage,
-		VK_FORMAT_R8G8B8A8_SRGB,
-		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, // Prepare for shader access
-		1); */
-	// Transition each level to VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL independently for mipmapping
-	
-	vkDestroyBuffer(m_Device, stagingBuffer, nullptr);
-	vkFreeMemory(m_Device, stagingBufferMemory, nullptr);
+void Application::UpdatePerDrawBenchmark()
+{
+	// The schemes take turns every frame, so all of them draw the same scene from the same camera
+	m_PerDrawScheme = static_cast<PerDrawScheme>((m_PerDrawScheme + 1) % PerDrawSchemeCount);
 
-	GenerateMipmaps(m_TextureImage, VK_FORMAT_R8G8B8A8_SRGB, texWidth, texHeight, m_MipLevels);
+	if (--m_PerDrawFramesLeft == 0)
+	{
+		// Throughput per scheme, with the CPU time of a single draw alongside it
+		const std::array<const char*, PerDrawSchemeCount> names = { "push constants", "dynamic offset", "every set rebound", "a new set per draw" };
+		std::cout << "Draw calls recorded per ms of CPU time:" << std::endl;
+		for (uint32_t i = 0; i < PerDrawSchemeCount; ++i)
+		{
+			double drawsPerMs = m_PerDrawMs[i] > 0.0 ? m_PerDrawCalls[i] / m_PerDrawMs[i] : 0.0;
+			double usPerDraw = m_PerDrawCalls[i] > 0 ? m_PerDrawMs[i] * 1000.0 / m_PerDrawCalls[i] : 0.0;
+			std::cout << "  " << names[i] << ": " << drawsPerMs << " draws/ms, " << usPerDraw << " us per draw" << std::endl;
+		}
+	}
 }
-void Application::GenerateMipmaps(VkImage image, VkFormat imageFormat, int32_t texWidth, int32_t texHeight, uint32_t mipLevels)
-{
-	VkFormatProperties formatProperties;
-	vkGetPhysicalDeviceFormatProperties(m_PhysicalDevice, imageFormat, &formatProperties);
 
-	if (!(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT))
+bool Application::ApplyQualityLevel()
+{
+	const QualityGovernor::Level& level = m_QualityGovernor.GetLevel();
+	bool samplesChanged = level.Samples != m_MsaaSamples;
+	bool targetsChanged = samplesChanged || level.RenderScale != m_RenderScale;
+	bool sampleShadingChanged = level.MinSampleShading != m_MinSampleShading;
+
+	// Hot reload and the pipeline compiler read the render pass and sample state while they build pipelines. Rather than
+	// waiting for a build to finish, the level is applied on a later frame
+	std::unique_lock<std::shared_mutex> lock(m_GraphicsPipelineMutex, std::try_to_lock);
+	if (!lock.owns_lock())
 	{
-		throw std::runtime_error("Texture image format does not support linear filtering");
+		return false;
 	}
 
-	VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+	// Frames in flight keep drawing with the previous targets and pipelines, which are retired instead of destroyed
+	m_MinSampleShading = level.MinSampleShading;
+	if (targetsChanged)
+	{
+		RetireRenderTargets(samplesChanged ? m_RenderPass : VK_NULL_HANDLE);
+		m_MsaaSamples = level.Samples;
+		m_RenderScale = level.RenderScale;
+		UpdateRenderExtent();
+		CreateRenderTargets();
+	}
+	// The sample count is part of the render pass and both are baked into the pipelines, which have to match the new
+	// targets before this frame draws
+	if (samplesChanged)
+	{
+		CreateRenderPass();
+		RetireGraphicsPipeline(m_GraphicsPipelines);
+		CreateGraphicsPipeline(m_GraphicsPipelines);
+		++m_GraphicsPipelineGeneration;
+		ResetMaterialPipelines();
+	}
+	else if (sampleShadingChanged)
+	{
+		// Only pipeline state, so frames keep drawing with the current pipelines until the new ones are built
+		uint64_t generation = ++m_GraphicsPipelineGeneration;
+		m_PipelineCompiler.Submit("sample shading", [this, generation]
+		{
+			std::shared_lock<std::shared_mutex> lock(m_GraphicsPipelineMutex);
+			GraphicsPipelineSet pipelines{};
+			CreateGraphicsPipeline(pipelines);
 
-	VkImageMemoryBarrier barrier{};
-	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-	barrier.image = image;
-	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	barrier.subresourceRange.baseArrayLayer = 0;
-	barrier.subresourceRange.layerCount = 1;
-	barrier.subresourceRange.levelCount = 1;
+			std::lock_guard<std::mutex> swapLock(m_PipelineSwapMutex);
+			m_PipelineSwaps.push_back([this, pipelines, generation]() mutable
+			{
+				// The render thread rebuilt the pipelines itself since, with whatever sample shading is current
+				if (generation == m_GraphicsPipelineGeneration)
+				{
+					std::swap(m_GraphicsPipelines, pipelines);
+					ResetMaterialPipelines(); // Specialized with the previous sample shading
+				}
+				RetireGraphicsPipeline(pipelines);
+			});
+		});
+	}
 
-	int32_t mipWidth = texWidth;
-	int32_t mipHeight = texHeight;
+	m_Profiler.SetCounter("Render scale", m_RenderScale);
+	m_Profiler.SetCounter("MSAA samples", m_MsaaSamples);
+	return true;
+}
 
-	for (uint32_t i = 1; i < mipLevels; ++i)
+void Application::UpdateUniformBuffer(uint32_t currentImage, const FramePacket& packet)
+{
+	UniformBufferObject ubo{};
+	ubo.Model = packet.Model;
+	ubo.View = packet.View;
+	ubo.Projection = packet.Projection;
+	if (m_VirtualTexturingSupported)
 	{
-		barrier.subresourceRange.baseMipLevel = i - 1;
-		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-		
-		vkCmdPipelineBarrier(
-			commandBuffer,
-			VK_PIPELINE_STAGE_TRANSFER_BIT,
-			VK_PIPELINE_STAGE_TRANSFER_BIT,
-			0,
-			0,
-			nullptr,
-			0,
-			nullptr,
-			1,
-			&barrier);
-
-		VkImageBlit blit{};
-		blit.srcOffsets[0] = { 0, 0, 0 };
-		blit.srcOffsets[1] = {mipWidth, mipHeight, 1};
-		blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		blit.srcSubresource.mipLevel = i - 1;
-		blit.srcSubresource.baseArrayLayer = 0;
-		blit.srcSubresource.layerCount = 1;
-		blit.dstOffsets[0] = { 0, 0, 0 };
-		blit.dstOffsets[1] = { mipWidth > 1 ? mipWidth / 2 : 1, mipHeight > 1 ? mipHeight / 2 : 1, 1 };
-		blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		blit.dstSubresource.mipLevel = i;
-		blit.dstSubresource.baseArrayLayer = 0;
-		blit.dstSubresource.layerCount = 1;
-
-		vkCmdBlitImage(
-			commandBuffer, 
-			image, 
-			VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, 
-			image, 
-			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 
-			1, 
-			&blit, 
-			VK_FILTER_LINEAR);
-
-		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		ubo.VirtualTexture = m_VirtualTexture.GetShaderIndices(currentImage);
+		ubo.VirtualTexture.Enabled = m_UseVirtualTexture;
+	}
+	ubo.MaterialFeatures = m_MaterialFeatures;
 
-		vkCmdPipelineBarrier(
-			commandBuffer,
-			VK_PIPELINE_STAGE_TRANSFER_BIT,
-			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-			0,
-			0,
-			nullptr,
-			0,
-			nullptr,
-			1,
-			&barrier);
+	// Copy data to uniform buffer
+	void* data;
+	vkMapMemory(m_Device, m_UniformBufferMemories[currentImage], 0, sizeof(ubo), 0, &data);
+	memcpy(data, &ubo, sizeof(ubo));
+	vkUnmapMemory(m_Device, m_UniformBufferMemories[currentImage]);
 
-		if (mipWidth > 1)
-		{
-			mipWidth /= 2;
-		}
+	// Levels were picked by the simulation step. Right after L enables them the step may not have any yet, and the
+	// frame slot's previous commands are drawn once more
+	m_LodPixelsPerUnit = packet.LodPixelsPerUnit;
+	if (m_UseLods && packet.LodsSelected)
+	{
+		const LodSelection& selection = packet.Lods;
+		const std::vector<VkDrawIndexedIndirectCommand>& commands = packet.LodDrawCommands;
+		m_LodDrawCounts[currentImage] = static_cast<uint32_t>(commands.size());
+
+		vkMapMemory(m_Device, m_LodDrawBufferMemories[currentImage], 0, sizeof(commands[0]) * commands.size(), 0, &data);
+		memcpy(data, commands.data(), sizeof(commands[0]) * commands.size());
+		vkUnmapMemory(m_Device, m_LodDrawBufferMemories[currentImage]);
 
-		if (mipHeight > 1)
+		// Culling picks its own levels on the GPU and reports them with its stats
+		if (!m_UseGpuCulling && !m_UseMeshlets)
 		{
-			mipHeight /= 2;
+			m_Profiler.SetCounter("Triangles", selection.TriangleCount);
+			m_Profiler.SetCounter("LOD error (px)", selection.MaxErrorPixels);
 		}
 	}
+}
 
-	barrier.subresourceRange.baseMipLevel = mipLevels - 1;
-	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-	vkCmdPipelineBarrier(
-		commandBuffer,
-		VK_PIPELINE_STAGE_TRANSFER_BIT,
-		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-		0,
-		0,
-		nullptr,
-		0,
-		nullptr,
-		1,
-		&barrier);
-	EndSingleTimeCommands(commandBuffer);
+VkFormat Application::FindTextureFormat()
+{
+	// Prefer block compressed formats the device can copy into and filter, RGBA8 support is mandatory.
+	// There is no ASTC encoder here, so ASTC is only picked when a cache built offline is present
+	std::vector<VkFormat> candidates = { VK_FORMAT_BC7_SRGB_BLOCK, VK_FORMAT_BC1_RGB_SRGB_BLOCK, VK_FORMAT_R8G8B8A8_SRGB };
+	if (TextureStreamer::IsCacheFresh(TextureStreamer::GetCachePath(m_TexturePath, VK_FORMAT_ASTC_4x4_SRGB_BLOCK), m_TexturePath))
+	{
+		candidates.insert(candidates.begin(), VK_FORMAT_ASTC_4x4_SRGB_BLOCK);
+	}
+	return FindSupportedFormat(
+		candidates,
+		VK_IMAGE_TILING_OPTIMAL,
+		VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT | VK_FORMAT_FEATURE_TRANSFER_DST_BIT);
 }
 
 VkSampleCountFlagBits Application::GetMaxUsableSampleCount()
@@ -1510,38 +3934,188 @@ VkSampleCountFlagBits Application::GetMaxUsableSampleCount()
 
 void Application::CreateDepthResources()
 {
-	VkFormat depthFormat = FindDepthFormat();
+	m_DepthFormat = FindDepthFormat();
+
+	// Unless it is sampled for occlusion culling, depth never leaves the render pass
+	VkImageUsageFlags usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT
+		| (m_DepthSamplingSupported ? VK_IMAGE_USAGE_SAMPLED_BIT : VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT);
 	CreateImage(
-		m_SwapchainExtent.width,
-		m_SwapchainExtent.height,
+		m_RenderExtent.width,
+		m_RenderExtent.height,
 		1,
 		m_MsaaSamples,
-		depthFormat,
+		m_DepthFormat,
 		VK_IMAGE_TILING_OPTIMAL,
-		VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		m_DepthImage,
-		m_DepthImageMemory);
-	m_DepthImageView = CreateImageView(m_DepthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
+		usage,
+		m_DepthImage);
 }
 
 void Application::CreateColorResources()
 {
-	VkFormat colorFormat = m_SwapchainImageFormat;
-
+	// Only ever resolved, so its samples never leave the render pass
 	CreateImage(
-		m_SwapchainExtent.width,
-		m_SwapchainExtent.height,
+		m_RenderExtent.width,
+		m_RenderExtent.height,
 		1,
 		m_MsaaSamples,
-		colorFormat,
+		m_SwapchainImageFormat,
 		VK_IMAGE_TILING_OPTIMAL,
 		VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		m_ColorImage,
-		m_ColorImageMemory);
+		m_ColorImage);
+
+	// Resolve target blitted up to the swapchain image, which is resolved into directly at full resolution
+	m_SceneColorImage = VK_NULL_HANDLE;
+	if (m_Upscaling)
+	{
+		CreateImage(
+			m_RenderExtent.width,
+			m_RenderExtent.height,
+			1,
+			VK_SAMPLE_COUNT_1_BIT,
+			m_SwapchainImageFormat,
+			VK_IMAGE_TILING_OPTIMAL,
+			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+			m_SceneColorImage);
+	}
+}
+
+void Application::AllocateAttachmentMemory()
+{
+	VkPhysicalDeviceMemoryProperties memProperties;
+	vkGetPhysicalDeviceMemoryProperties(m_PhysicalDevice, &memProperties);
+
+	struct Attachment
+	{
+		VkImage Image;
+		VkMemoryRequirements Requirements;
+	};
+	auto getAttachment = [&](VkImage image)
+	{
+		Attachment attachment{ image };
+		vkGetImageMemoryRequirements(m_Device, image, &attachment.Requirements);
+		return attachment;
+	};
+	Attachment color = getAttachment(m_ColorImage);
+	Attachment depth = getAttachment(m_DepthImage);
+	Attachment rtOutput = getAttachment(m_RtOutputImage);
+	VkDeviceSize dedicatedSize = color.Requirements.size + depth.Requirements.size + rtOutput.Requirements.size;
+	std::vector<Attachment> remaining;
+	if (m_SceneColorImage != VK_NULL_HANDLE)
+	{
+		Attachment sceneColor = getAttachment(m_SceneColorImage);
+		dedicatedSize += sceneColor.Requirements.size;
+		remaining.push_back(sceneColor);
+	}
+
+	VkDeviceSize allocatedSize = 0;
+	std::vector<VkDeviceMemory> lazyMemories;
+	auto allocate = [&](const std::vector<Attachment>& attachments, uint32_t memoryTypeIndex)
+	{
+		VkMemoryAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		allocInfo.memoryTypeIndex = memoryTypeIndex;
+		for (const Attachment& attachment : attachments)
+		{
+			allocInfo.allocationSize = std::max(allocInfo.allocationSize, attachment.Requirements.size);
+		}
+
+		VkDeviceMemory memory = m_MemoryBudget.Allocate(allocInfo, MemoryBudget::CategoryAttachments);
+		m_AttachmentMemories.push_back(memory);
+		if (memProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT)
+		{
+			lazyMemories.push_back(memory);
+		}
+		else
+		{
+			allocatedSize += allocInfo.allocationSize;
+		}
+
+		// Every image starts at offset 0, which satisfies any alignment
+		for (const Attachment& attachment : attachments)
+		{
+			vkBindImageMemory(m_Device, attachment.Image, memory, 0);
+		}
+	};
+
+	// Transient attachments on tile-based GPUs only need backing memory if they spill out of tile memory
+	auto findLazyMemoryType = [&](uint32_t typeFilter) -> std::optional<uint32_t>
+	{
+		VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+		for (uint32_t i = 0; i < memProperties.memoryTypeCount; ++i)
+		{
+			if (typeFilter & (1 << i) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties)
+			{
+				return i;
+			}
+		}
+		return std::nullopt;
+	};
+
+	std::optional<uint32_t> lazyColorType = findLazyMemoryType(color.Requirements.memoryTypeBits);
+	if (lazyColorType)
+	{
+		allocate({ color }, *lazyColorType);
+	}
+	else
+	{
+		remaining.push_back(color);
+	}
+	std::optional<uint32_t> lazyDepthType = m_DepthSamplingSupported ? std::nullopt : findLazyMemoryType(depth.Requirements.memoryTypeBits);
+	if (lazyDepthType)
+	{
+		allocate({ depth }, *lazyDepthType);
+	}
+	else
+	{
+		remaining.push_back(depth);
+	}
+
+	// Ray traced frames never touch the raster attachments and rasterized frames never touch the ray traced output,
+	// so the largest raster attachment still needing real memory can share it with the output
+	std::sort(remaining.begin(), remaining.end(), [](const Attachment& a, const Attachment& b) { return a.Requirements.size > b.Requirements.size; });
+	m_AttachmentsAliased = false;
+	for (auto attachment = remaining.begin(); attachment != remaining.end(); ++attachment)
+	{
+		uint32_t typeFilter = attachment->Requirements.memoryTypeBits & rtOutput.Requirements.memoryTypeBits;
+		if (typeFilter != 0)
+		{
+			allocate({ *attachment, rtOutput }, FindMemoryType(typeFilter, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT));
+			remaining.erase(attachment);
+			m_AttachmentsAliased = true;
+			break;
+		}
+	}
+	if (!m_AttachmentsAliased)
+	{
+		remaining.push_back(rtOutput);
+	}
+	for (const Attachment& attachment : remaining)
+	{
+		allocate({ attachment }, FindMemoryType(attachment.Requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT));
+	}
+
+	// Views can only be created once the images are bound
+	m_ColorImageView = CreateImageView(m_ColorImage, m_SwapchainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+	m_DepthImageView = CreateImageView(m_DepthImage, m_DepthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
+	m_SceneColorImageView = m_SceneColorImage != VK_NULL_HANDLE
+		? CreateImageView(m_SceneColorImage, m_SwapchainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1)
+		: VK_NULL_HANDLE;
+	m_RtOutputImageView = CreateImageView(m_RtOutputImage, m_RtOutputFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+
+	// Lazily allocated memory is only committed once a render pass actually spills out of tile memory
+	VkDeviceSize committedSize = 0;
+	for (VkDeviceMemory memory : lazyMemories)
+	{
+		VkDeviceSize size = 0;
+		vkGetDeviceMemoryCommitment(m_Device, memory, &size);
+		committedSize += size;
+	}
 
-	m_ColorImageView = CreateImageView(m_ColorImage, colorFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+	constexpr double megabyte = 1024.0 * 1024.0;
+	std::cout << "Attachment memory: " << dedicatedSize / megabyte << " MB with dedicated allocations, "
+		<< allocatedSize / megabyte << " MB allocated + " << committedSize / megabyte << " MB lazily committed ("
+		<< lazyMemories.size() << " lazy, " << (m_AttachmentsAliased ? "ray traced output aliased" : "no aliasing") << ")" << std::endl;
+	m_Profiler.SetCounter("Attachment MB", (allocatedSize + committedSize) / megabyte);
 }
 
 VkFormat Application::FindDepthFormat()
@@ -1549,7 +4123,7 @@ VkFormat Application::FindDepthFormat()
 	return FindSupportedFormat(
 		{ VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT },
 		VK_IMAGE_TILING_OPTIMAL,
-		VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
+		VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT);
 }
 
 VkFormat Application::FindSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features)
@@ -1576,11 +4150,6 @@ bool Application::HasStencilComponent(VkFormat format)
 	return format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT;
 }
 
-void Application::CreateTextureImageView()
-{
-	m_TextureImageView = CreateImageView(m_TextureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT, m_MipLevels);
-}
-
 void Application::CreateTextureSampler()
 {
 	VkSamplerCreateInfo samplerInfo{};
@@ -1612,7 +4181,7 @@ void Application::CreateTextureSampler()
 	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
 	samplerInfo.mipLodBias = 0.0f;
 	samplerInfo.minLod = 0.0f;
-	samplerInfo.maxLod = static_cast<float>(m_MipLevels);
+	samplerInfo.maxLod = VK_LOD_CLAMP_NONE; // Streamed textures differ in level count, their views limit the levels
 
 	if (vkCreateSampler(m_Device, &samplerInfo, nullptr, &m_TextureSampler) != VK_SUCCESS)
 	{
@@ -1620,8 +4189,45 @@ void Application::CreateTextureSampler()
 	}
 }
 
+void Application::RegisterBindlessResources()
+{
+	// Shows the placeholder until the streamer has uploaded the texture
+	m_Material.TextureIndex = m_TextureStreamer.Request(m_TexturePath, FindTextureFormat());
+	m_Material.SamplerIndex = m_BindlessHeap.RegisterSampler(m_TextureSampler);
+}
+
+void Application::LoadVirtualTextureData()
+{
+	if (!m_VirtualTexturingSupported)
+	{
+		return;
+	}
+
+	// Loaded up front, which also writes the cache the streamer then reads
+	m_VirtualTextureData = TextureStreamer::LoadTexture(m_TexturePath, FindTextureFormat());
+}
+
+void Application::CreateVirtualTexture()
+{
+	if (!m_VirtualTexturingSupported)
+	{
+		return;
+	}
+
+	m_VirtualTexture.Setup(
+		m_Device,
+		m_PhysicalDevice,
+		&m_BindlessHeap,
+		&m_MemoryBudget,
+		m_MaxFramesInFlight,
+		m_VirtualTextureData,
+		m_VirtualTextureBudget);
+	m_VirtualTextureData = TextureData{};
+	std::cout << "Virtual texture: " << m_VirtualTexture.GetPageCount() << " pages" << std::endl;
+}
+
 
-VkImageView Application::CreateImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels)
+VkImageView Application::CreateImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels, uint32_t baseMipLevel)
 {
 	VkImageView imageView;
 
@@ -1637,7 +4243,7 @@ VkImageView Application::CreateImageView(VkImage image, VkFormat format, VkImage
 	viewInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
 
 	viewInfo.subresourceRange.aspectMask = aspectFlags;
-	viewInfo.subresourceRange.baseMipLevel = 0;
+	viewInfo.subresourceRange.baseMipLevel = baseMipLevel;
 	viewInfo.subresourceRange.levelCount = mipLevels;
 	viewInfo.subresourceRange.baseArrayLayer = 0;
 	viewInfo.subresourceRange.layerCount = 1;
@@ -1651,12 +4257,12 @@ VkImageView Application::CreateImageView(VkImage image, VkFormat format, VkImage
 }
 
 
-VkCommandBuffer Application::BeginSingleTimeCommands()
+VkCommandBuffer Application::BeginSingleTimeCommands(FrameScheduler::QueueType queue)
 {
 	VkCommandBufferAllocateInfo allocInfo{};
 	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	allocInfo.commandPool = m_CommandPool;
+	allocInfo.commandPool = queue == FrameScheduler::Transfer ? m_TransferCommandPool : m_CommandPool;
 	allocInfo.commandBufferCount = 1;
 
 	VkCommandBuffer commandBuffer;
@@ -1671,19 +4277,16 @@ VkCommandBuffer Application::BeginSingleTimeCommands()
 	return commandBuffer;
 }
 
-void Application::EndSingleTimeCommands(VkCommandBuffer commandBuffer)
+void Application::EndSingleTimeCommands(VkCommandBuffer commandBuffer, FrameScheduler::QueueType queue, const std::vector<FrameScheduler::Dependency>& waits)
 {
 	vkEndCommandBuffer(commandBuffer);
 
-	VkSubmitInfo submitInfo{};
-	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &commandBuffer;
+	FrameScheduler::Submission submission;
+	submission.CommandBuffers = { commandBuffer };
+	submission.Waits = waits;
+	m_FrameScheduler.Wait(m_FrameScheduler.Submit(queue, submission));
 
-	vkQueueSubmit(m_GraphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-	vkQueueWaitIdle(m_GraphicsQueue);
-
-	vkFreeCommandBuffers(m_Device, m_CommandPool, 1, &commandBuffer);
+	vkFreeCommandBuffers(m_Device, queue == FrameScheduler::Transfer ? m_TransferCommandPool : m_CommandPool, 1, &commandBuffer);
 }
 
 void Application::TransitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels)
@@ -1717,11 +4320,19 @@ void Application::TransitionImageLayout(VkImage image, VkFormat format, VkImageL
 	else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
 	{
 		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 
 		sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
 		destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
 	}
+	else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_GENERAL)
+	{
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+
+		sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+		destinationStage = VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR;
+	}
 	else
 	{
 		throw std::runtime_error("Unsupported layout transition");
@@ -1741,29 +4352,33 @@ void Application::TransitionImageLayout(VkImage image, VkFormat format, VkImageL
 	EndSingleTimeCommands(commandBuffer);
 }
 
-void Application::CopyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height)
+void Application::CreateImage(
+	uint32_t width,
+	uint32_t height,
+	uint32_t mipLevels,
+	VkSampleCountFlagBits numSamples,
+	VkFormat format,
+	VkImageTiling tiling,
+	VkImageUsageFlags usage,
+	VkMemoryPropertyFlags properties,
+	MemoryBudget::Category category,
+	VkImage& image,
+	VkDeviceMemory& imageMemory)
 {
-	VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
-
-	VkBufferImageCopy region{};
-	region.bufferOffset = 0;
-	region.bufferRowLength = 0; // No padding
-	region.bufferImageHeight = 0; // No padding
+	CreateImage(width, height, mipLevels, numSamples, format, tiling, usage, image);
 
-	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	region.imageSubresource.mipLevel = 0;
-	region.imageSubresource.baseArrayLayer = 0;
-	region.imageSubresource.layerCount = 1;
-
-	region.imageOffset = { 0, 0, 0 };
-	region.imageExtent = { width, height, 1 };
+	VkMemoryRequirements memRequirements{};
+	vkGetImageMemoryRequirements(m_Device, image, &memRequirements);
 
-	vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = memRequirements.size;
+	allocInfo.memoryTypeIndex = FindMemoryType(memRequirements.memoryTypeBits, properties);
+	imageMemory = m_MemoryBudget.Allocate(allocInfo, category);
 
-	EndSingleTimeCommands(commandBuffer);
+	vkBindImageMemory(m_Device, image, imageMemory, 0);
 }
 
-
 void Application::CreateImage(
 	uint32_t width,
 	uint32_t height,
@@ -1772,9 +4387,7 @@ void Application::CreateImage(
 	VkFormat format,
 	VkImageTiling tiling,
 	VkImageUsageFlags usage,
-	VkMemoryPropertyFlags properties,
-	VkImage& image,
-	VkDeviceMemory& imageMemory)
+	VkImage& image)
 {
 	VkImageCreateInfo imageInfo{};
 	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -1796,21 +4409,6 @@ void Application::CreateImage(
 	{
 		throw std::runtime_error("Failed to create image");
 	}
-
-	VkMemoryRequirements memRequirements{};
-	vkGetImageMemoryRequirements(m_Device, image, &memRequirements);
-
-	VkMemoryAllocateInfo allocInfo{};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = FindMemoryType(memRequirements.memoryTypeBits, properties);
-
-	if (vkAllocateMemory(m_Device, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS)
-	{
-		throw std::runtime_error("Failed to allocate image memory");
-	}
-
-	vkBindImageMemory(m_Device, image, imageMemory, 0);
 }
 
 void Application::LoadModel()
@@ -1825,6 +4423,8 @@ void Application::LoadModel()
 		throw std::runtime_error(warn + err);
 	}
 
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
 	std::unordered_map<Vertex, uint32_t> uniqueVertices{};
 	for (const auto& shape : shapes)
 	{
@@ -1848,97 +4448,284 @@ void Application::LoadModel()
 			// Check if already seen a vertex with the same position and texture coordinates
 			if (uniqueVertices.count(vertex) == 0)
 			{
-				uniqueVertices[vertex] = static_cast<uint32_t>(m_Vertices.size());
-				m_Vertices.push_back(vertex);
+				uniqueVertices[vertex] = static_cast<uint32_t>(vertices.size());
+				vertices.push_back(vertex);
 			}
 
-			m_Indices.push_back(uniqueVertices[vertex]);
+			indices.push_back(uniqueVertices[vertex]);
+		}
+	}
+
+	uint32_t modelMeshIndex = m_Scene.AddMesh(vertices, indices);
+	m_SceneMeshIndices.push_back(modelMeshIndex);
+
+	const MeshInfo& mesh = m_Scene.GetMeshes()[modelMeshIndex];
+	for (uint32_t i = 0; i < mesh.LodCount; ++i)
+	{
+		std::cout << "LOD " << i << ": " << mesh.Lods[i].IndexCount / 3 << " triangles, error " << mesh.Lods[i].Error << std::endl;
+	}
+
+	// Coarser levels become meshes of their own, so the scene has several meshes of different sizes to sort and draw.
+	// Their indices are relative to the model's vertices, which each copy brings along
+	uint32_t lodCount = mesh.LodCount;
+	for (uint32_t i = 1; i < lodCount && i <= m_SimplifiedMeshCount; ++i)
+	{
+		const MeshLod& lod = m_Scene.GetMeshes()[modelMeshIndex].Lods[i];
+		std::vector<uint32_t> lodIndices(
+			m_Scene.GetIndices().begin() + lod.FirstIndex,
+			m_Scene.GetIndices().begin() + lod.FirstIndex + lod.IndexCount);
+		m_SceneMeshIndices.push_back(m_Scene.AddMesh(vertices, lodIndices));
+	}
+}
+
+void Application::BuildScene()
+{
+	// Square grid of instances centered on the origin, neighbours using different meshes
+	float gridOffset = (m_InstanceGridSize - 1) * m_InstanceSpacing * 0.5f;
+	for (uint32_t x = 0; x < m_InstanceGridSize; ++x)
+	{
+		for (uint32_t y = 0; y < m_InstanceGridSize; ++y)
+		{
+			uint32_t meshIndex = m_SceneMeshIndices[(x + y) % m_SceneMeshIndices.size()];
+			glm::vec3 position(x * m_InstanceSpacing - gridOffset, y * m_InstanceSpacing - gridOffset, 0.0f);
+			m_Scene.AddInstance(meshIndex, glm::translate(glm::mat4(1.0f), position), m_Material.TextureIndex, m_Material.SamplerIndex);
 		}
 	}
+	m_Scene.BuildDrawCommands();
+	m_CameraScale = 1.0f + gridOffset * 0.5f;
+
+	std::cout << "Scene: " << m_Scene.GetInstances().size() << " instances of " << m_Scene.GetMeshes().size() << " meshes in "
+		<< m_Scene.GetDrawCommands().size() << " indirect draw commands" << std::endl;
 }
 
 void Application::RecreateSwapchain()
 {
-	int width = 0, height = 0;
-	glfwGetFramebufferSize(m_Window, &width, &height);
-	while (width == 0 || height == 0)
+	// Minimized, the main thread keeps handling events until the window has a size again
+	while ((m_FramebufferWidth == 0 || m_FramebufferHeight == 0) && m_Running)
 	{
-		glfwGetFramebufferSize(m_Window, &width, &height);
-		glfwWaitEvents();
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	if (!m_Running)
+	{
+		return;
 	}
 
 	vkDeviceWaitIdle(m_Device);
+	// Hot reload and the pipeline compiler read the swapchain format and the render pass while they build pipelines
+	std::lock_guard<std::shared_mutex> lock(m_GraphicsPipelineMutex);
 
+	VkFormat oldFormat = m_SwapchainImageFormat;
 	CleanupSwapchain();
+	m_RenderGraph.ForgetAll(); // The swapchain images were just destroyed and the render targets retired
 
 	CreateSwapchain();
 	CreateImageViews();
-	CreateRenderPass();
-	CreateGraphicsPipeline();
-	CreateColorResources();
-	CreateDepthResources();
-	CreateFramebuffers();
+	// The render pass and pipelines only depend on the swapchain's format, which a resize normally keeps
+	if (m_SwapchainImageFormat != oldFormat)
+	{
+		DestroyGraphicsPipeline(m_GraphicsPipelines);
+		vkDestroyRenderPass(m_Device, m_RenderPass, nullptr);
+		CreateRenderPass();
+		CreateGraphicsPipeline(m_GraphicsPipelines);
+		++m_GraphicsPipelineGeneration;
+		ResetMaterialPipelines();
+	}
+	CreateRenderTargets();
 }
 
 void Application::CleanupSwapchain()
 {
-	vkDestroyImageView(m_Device, m_ColorImageView, nullptr);
-	vkDestroyImage(m_Device, m_ColorImage, nullptr);
-	vkFreeMemory(m_Device, m_ColorImageMemory, nullptr);
+	RetireRenderTargets();
 
-	vkDestroyImageView(m_Device, m_DepthImageView, nullptr);
-	vkDestroyImage(m_Device, m_DepthImage, nullptr);
-	vkFreeMemory(m_Device, m_DepthImageMemory, nullptr);
-
-	for (auto framebuffer : m_SwapchainFramebuffers)
+	for (auto imageView : m_SwapchainImageViews)
 	{
-		vkDestroyFramebuffer(m_Device, framebuffer, nullptr);
+		vkDestroyImageView(m_Device, imageView, nullptr);
 	}
 
-	vkDestroyPipeline(m_Device, m_GraphicsPipeline, nullptr);
-	vkDestroyPipelineLayout(m_Device, m_PipelineLayout, nullptr);
-	vkDestroyRenderPass(m_Device, m_RenderPass, nullptr);
+	vkDestroySwapchainKHR(m_Device, m_Swapchain, nullptr);
+}
 
+void Application::CreateRenderTargets()
+{
+	CreateColorResources();
+	CreateDepthResources();
+	CreateRtOutputImage();
+	AllocateAttachmentMemory();
+	CreateDepthPyramid();
+	m_RenderTargetSetsStale.assign(m_MaxFramesInFlight, true);
+}
 
-	for (auto imageView : m_SwapchainImageViews)
+void Application::RetireRenderTargets(VkRenderPass renderPass)
+{
+	RetiredRenderTargets retired{};
+	retired.Images = { m_RtOutputImage, m_ColorImage, m_SceneColorImage, m_DepthImage, m_DepthPyramidImage };
+	retired.ImageViews = { m_RtOutputImageView, m_ColorImageView, m_SceneColorImageView, m_DepthImageView, m_DepthPyramidView };
+	retired.ImageViews.insert(retired.ImageViews.end(), m_DepthPyramidMipViews.begin(), m_DepthPyramidMipViews.end());
+	retired.Memories = m_AttachmentMemories;
+	retired.Memories.push_back(m_DepthPyramidImageMemory);
+	retired.Framebuffers = m_Framebuffers;
+	retired.RenderPass = renderPass;
+	retired.FramesLeft = m_MaxFramesInFlight;
+
+	// Their replacements start over from the undefined layout
+	for (VkImage image : retired.Images)
 	{
-		vkDestroyImageView(m_Device, imageView, nullptr);
+		m_RenderGraph.Forget(image);
 	}
+	m_RetiredRenderTargets.push_back(std::move(retired));
 
-	vkDestroySwapchainKHR(m_Device, m_Swapchain, nullptr);
+	// Both hold on to what they release until the frames that may use it have completed
+	m_BindlessHeap.Release(BindlessHeap::SampledImages, m_MeshletPushConstants.DepthPyramidIndex);
+	for (VkDescriptorSet set : m_DepthReduceDescriptorSets)
+	{
+		m_DescriptorAllocator.Release(set);
+	}
+	m_DepthReduceDescriptorSets.clear();
+	m_DepthPyramidMipViews.clear();
+	m_AttachmentMemories.clear();
+	m_Framebuffers.clear();
+}
+
+void Application::ReleaseRetiredRenderTargets()
+{
+	// Counted down like retired pipelines
+	for (RetiredRenderTargets& retired : m_RetiredRenderTargets)
+	{
+		if (retired.FramesLeft > 0)
+		{
+			--retired.FramesLeft;
+		}
+		if (retired.FramesLeft > 0)
+		{
+			continue;
+		}
+
+		for (VkFramebuffer framebuffer : retired.Framebuffers)
+		{
+			vkDestroyFramebuffer(m_Device, framebuffer, nullptr);
+		}
+		for (VkImageView imageView : retired.ImageViews)
+		{
+			vkDestroyImageView(m_Device, imageView, nullptr);
+		}
+		for (VkImage image : retired.Images)
+		{
+			vkDestroyImage(m_Device, image, nullptr);
+		}
+		for (VkDeviceMemory memory : retired.Memories)
+		{
+			m_MemoryBudget.Free(memory);
+		}
+		vkDestroyRenderPass(m_Device, retired.RenderPass, nullptr);
+	}
+	std::erase_if(m_RetiredRenderTargets, [](const RetiredRenderTargets& retired) { return retired.FramesLeft == 0; });
 }
 
 
 void Application::Cleanup()
 {
+	// The device is idle, so every replaced pipeline can go right away
+	m_ShaderWatcher.Stop();
+	m_PipelineCompiler.Stop();
+	m_PipelineCompiler.PrintStatistics();
+	m_MemoryBudget.PrintReport();
+	ApplyPipelineSwaps();
+	ResetMaterialPipelines();
+	for (RetiredPipelines& retired : m_RetiredPipelines)
+	{
+		retired.FramesLeft = 1;
+	}
+	ReleaseRetiredPipelines();
 
 	for (size_t i = 0; i < m_MaxFramesInFlight; ++i)
 	{
 		vkDestroySemaphore(m_Device, m_ImageAvailableSemaphores[i], nullptr);
 		vkDestroySemaphore(m_Device, m_RenderFinishedSemaphores[i], nullptr);
-		vkDestroyFence(m_Device, m_InFlightFences[i], nullptr);
 
 		vkDestroyBuffer(m_Device, m_UniformBuffers[i], nullptr);
-		vkFreeMemory(m_Device, m_UniformBufferMemories[i], nullptr);
+		m_MemoryBudget.Free(m_UniformBufferMemories[i]);
 	}
 
 	vkDestroyCommandPool(m_Device, m_CommandPool, nullptr);
+	vkDestroyCommandPool(m_Device, m_TransferCommandPool, nullptr);
 
 	CleanupSwapchain();
+	for (RetiredRenderTargets& retired : m_RetiredRenderTargets)
+	{
+		retired.FramesLeft = 1;
+	}
+	ReleaseRetiredRenderTargets();
+	DestroyGraphicsPipeline(m_GraphicsPipelines);
+	vkDestroyRenderPass(m_Device, m_RenderPass, nullptr);
 
 	vkDestroySampler(m_Device, m_TextureSampler, nullptr);
-	vkDestroyImageView(m_Device, m_TextureImageView, nullptr);
-	vkDestroyImage(m_Device, m_TextureImage, nullptr);
-	vkFreeMemory(m_Device, m_TextureImageMemory, nullptr);
+	m_TextureStreamer.Destroy();
+	if (m_VirtualTexturingSupported)
+	{
+		m_VirtualTexture.Destroy();
+	}
 
-	vkDestroyDescriptorPool(m_Device, m_DescriptorPool, nullptr);
-	vkDestroyDescriptorSetLayout(m_Device, m_DescriptorSetLayout, nullptr);
+	m_DescriptorAllocator.Destroy();
+	m_BindlessHeap.Destroy();
 
 	vkDestroyBuffer(m_Device, m_VertexBuffer, nullptr);
-	vkFreeMemory(m_Device, m_VertexBufferMemory, nullptr);
+	m_MemoryBudget.Free(m_VertexBufferMemory);
 	
 	vkDestroyBuffer(m_Device, m_IndexBuffer, nullptr);
-	vkFreeMemory(m_Device, m_IndexBufferMemory, nullptr);
+	m_MemoryBudget.Free(m_IndexBufferMemory);
+
+	vkDestroyBuffer(m_Device, m_InstanceBuffer, nullptr);
+	m_MemoryBudget.Free(m_InstanceBufferMemory);
+
+	vkUnmapMemory(m_Device, m_ObjectRingBufferMemory);
+	vkDestroyBuffer(m_Device, m_ObjectRingBuffer, nullptr);
+	m_MemoryBudget.Free(m_ObjectRingBufferMemory);
+
+	vkDestroyBuffer(m_Device, m_IndirectBuffer, nullptr);
+	m_MemoryBudget.Free(m_IndirectBufferMemory);
+	for (size_t i = 0; i < m_MaxFramesInFlight; ++i)
+	{
+		vkDestroyBuffer(m_Device, m_LodDrawBuffers[i], nullptr);
+		m_MemoryBudget.Free(m_LodDrawBufferMemories[i]);
+	}
+
+	vkDestroyPipeline(m_Device, m_CullPipeline, nullptr);
+	vkDestroyPipeline(m_Device, m_DepthReducePipeline, nullptr);
+	vkDestroyPipeline(m_Device, m_DepthReduceMsPipeline, nullptr);
+	vkDestroyPipeline(m_Device, m_MeshletCullPipeline, nullptr);
+	vkDestroySampler(m_Device, m_DepthPyramidSampler, nullptr);
+	vkDestroyBuffer(m_Device, m_MeshBuffer, nullptr);
+	m_MemoryBudget.Free(m_MeshBufferMemory);
+	vkDestroyBuffer(m_Device, m_CulledDrawBuffer, nullptr);
+	m_MemoryBudget.Free(m_CulledDrawBufferMemory);
+	vkDestroyBuffer(m_Device, m_CullingStatsBuffer, nullptr);
+	m_MemoryBudget.Free(m_CullingStatsBufferMemory);
+	vkDestroyBuffer(m_Device, m_MeshletBuffer, nullptr);
+	m_MemoryBudget.Free(m_MeshletBufferMemory);
+	vkDestroyBuffer(m_Device, m_MeshletDataBuffer, nullptr);
+	m_MemoryBudget.Free(m_MeshletDataBufferMemory);
+	vkDestroyBuffer(m_Device, m_MeshletWorkItemBuffer, nullptr);
+	m_MemoryBudget.Free(m_MeshletWorkItemBufferMemory);
+	for (size_t i = 0; i < m_MaxFramesInFlight; ++i)
+	{
+		vkDestroyBuffer(m_Device, m_CullingReadbackBuffers[i], nullptr);
+		m_MemoryBudget.Free(m_CullingReadbackBufferMemories[i]);
+	}
+
+	vkDestroyPipeline(m_Device, m_RtPipeline, nullptr);
+	vkDestroyPipelineLayout(m_Device, m_RtPipelineLayout, nullptr);
+	vkDestroyDescriptorPool(m_Device, m_RtDescriptorPool, nullptr);
+	vkDestroyDescriptorSetLayout(m_Device, m_RtDescriptorSetLayout, nullptr);
+	m_LayoutCache.Destroy(); // After the ray tracing layout, which uses the per frame set layout
+	vkDestroyBuffer(m_Device, m_RtSbtBuffer, nullptr);
+	m_MemoryBudget.Free(m_RtSbtBufferMemory);
+	m_RtBuilder.Destroy();
+
+	m_RenderGraph.Destroy();
+	m_FrameScheduler.Destroy();
+	m_Profiler.Destroy();
+	SavePipelineCache();
+	vkDestroyPipelineCache(m_Device, m_PipelineCache, nullptr);
 
 	vkDestroyDevice(m_Device, nullptr);
 	vkDestroySurfaceKHR(m_VkInstance, m_WindowSurface, nullptr);
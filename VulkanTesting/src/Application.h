@@ -21,82 +21,167 @@
 #include <array>
 #include <optional>
 #include <chrono>
-
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <exception>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <map>
+
+#include "Vertex.h"
+#include "Scene.h"
 #include "ObjModel.h"
 #include "AccelerationStructure.h"
+#include "Profiler.h"
+#include "FrameScheduler.h"
+#include "BindlessHeap.h"
+#include "RenderGraph.h"
+#include "TextureStreamer.h"
+#include "VirtualTexture.h"
+#include "TripleBuffer.h"
+#include "QualityGovernor.h"
+#include "StartupGraph.h"
+#include "ShaderCompiler.h"
+#include "ShaderWatcher.h"
+#include "ShaderReflection.h"
+#include "PipelineCompiler.h"
+#include "DescriptorAllocator.h"
+#include "MemoryBudget.h"
 
 struct UniformBufferObject
 {
 	alignas(16) glm::mat4 Model;
 	alignas(16) glm::mat4 View;
 	alignas(16) glm::mat4 Projection;
+	alignas(16) VirtualTextureIndices VirtualTexture;
+	alignas(16) uint32_t MaterialFeatures; // Read by the generic pipelines only
 };
 
+// Material features of shader.frag, one pipeline permutation per combination
+enum MaterialFeature : uint32_t
+{
+	MaterialTextured = 1 << 0,
+	MaterialAlphaTest = 1 << 1,
+	MaterialVertexColor = 1 << 2
+};
 
-struct Vertex
+// One step of the simulation thread, handed to the render thread and only read from there on. Instances are static
+// in this scene, so the animated transform is the scene's model matrix
+struct FramePacket
 {
-	glm::vec3 Position;
-	glm::vec3 Color;
-	glm::vec2 TextureCoordinates;
+	std::chrono::high_resolution_clock::time_point Time;
+	glm::mat4 Model;
+	glm::mat4 View;
+	glm::mat4 Projection;
+	float LodPixelsPerUnit = 0.0f;
+	// CPU level of detail selection, only made when LODs were enabled as the step ran
+	bool LodsSelected = false;
+	LodSelection Lods{};
+	std::vector<VkDrawIndexedIndirectCommand> LodDrawCommands;
+	// Bindless indices of the textures of instances in view, the last to lose mips when memory runs short
+	std::vector<uint32_t> VisibleTextures;
+	double SimulationMs = 0.0;
+};
 
-	static VkVertexInputBindingDescription GetBindingDescription()
-	{
-		VkVertexInputBindingDescription bindingDescription{};
-		bindingDescription.binding = 0; // Index of binding in array of bindings
-		bindingDescription.stride = sizeof(Vertex); // Bytes from one entry to the next
-		bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX; // Move to the next data entry after each vertex
-		return bindingDescription;
-	}
+// Indices into the bindless heap, stored per instance
+struct MaterialIndices
+{
+	uint32_t TextureIndex;
+	uint32_t SamplerIndex;
+};
 
-	static std::array<VkVertexInputAttributeDescription, 3> GetAttributeDescriptions()
-	{
-		std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions{};
-
-		// Position
-		attributeDescriptions[0].binding = 0; // From which binding is the per-vertex data coming
-		attributeDescriptions[0].location = 0; // Reference to 'location' directive in vertex shader input
-		attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT; // Commonly used format for vec2 data
-		attributeDescriptions[0].offset = offsetof(Vertex, Position);
-
-		// Color
-		attributeDescriptions[1].binding = 0; 
-		attributeDescriptions[1].location = 1; 
-		attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT; // Commonly used format for vec3 data
-		attributeDescriptions[1].offset = offsetof(Vertex, Color);
-
-		// Color
-		attributeDescriptions[2].binding = 0;
-		attributeDescriptions[2].location = 2;
-		attributeDescriptions[2].format = VK_FORMAT_R32G32B32_SFLOAT;
-		attributeDescriptions[2].offset = offsetof(Vertex, TextureCoordinates);
-
-		return attributeDescriptions;
-	}
+struct DrawPushConstants
+{
+	uint32_t InstanceBufferIndex; // Bindless storage buffer holding the scene's InstanceData
+};
 
-	bool operator==(const Vertex& other) const
-	{
-		return Position == other.Position && Color == other.Color && TextureCoordinates == other.TextureCoordinates;
-	}
+// Data of an object drawn on its own, pushed as constants or written to the object ring buffer. Matches the object
+// blocks of shader.vert
+struct ObjectData
+{
+	glm::mat4 Transform;
+	uint32_t TextureIndex;
+	uint32_t SamplerIndex;
 };
 
-namespace std
+// How each object's data reaches shader.vert when every object is a draw of its own
+enum PerDrawScheme : uint32_t
 {
-	template<> struct hash<Vertex>
-	{
-		size_t operator()(Vertex const& vertex) const
-		{
-			return
-				((hash<glm::vec3>()(vertex.Position) ^
-				 (hash<glm::vec3>()(vertex.Color) << 1)) >> 1) ^
-				 (hash<glm::vec2>()(vertex.TextureCoordinates) << 1);
-		}
-	};
-}
+	PerDrawPushConstants,
+	PerDrawDynamicOffset, // The object set bound again with the slot's offset, the others stay bound
+	PerDrawRebind,        // Every set bound again, as with a descriptor set per object
+	PerDrawTransientSets, // A descriptor set allocated and written for every draw, and every set bound again
+	PerDrawSchemeCount
+};
+
+struct CullPushConstants
+{
+	uint32_t InstanceCount;
+	uint32_t OcclusionEnabled; // Only once the depth pyramid holds a previous frame
+	uint32_t MeshletMode;      // Emit meshlet work items for the visible instances instead of draws
+	uint32_t MaxWorkItems;
+	uint32_t LodEnabled;
+	float LodPixelsPerUnit;
+	float LodErrorThreshold;
+};
+
+// Bindless indices and settings of the meshlet culling and drawing shaders
+struct MeshletPushConstants
+{
+	uint32_t InstanceBufferIndex;
+	uint32_t MeshBufferIndex;
+	uint32_t MeshletBufferIndex;
+	uint32_t MeshletDataBufferIndex;
+	uint32_t VertexBufferIndex;
+	uint32_t WorkItemBufferIndex;
+	uint32_t DrawBufferIndex;
+	uint32_t StatsBufferIndex;
+	uint32_t DepthPyramidIndex;
+	uint32_t DepthPyramidSamplerIndex;
+	uint32_t OcclusionEnabled;
+	uint32_t MaxDrawCount;
+};
+
+struct DepthReducePushConstants
+{
+	glm::uvec2 SourceSize;
+	glm::uvec2 DestinationSize;
+	uint32_t SampleCount;
+};
+
+// Written by the culling shaders, DrawCount is also the count for the indirect draw.
+// In meshlet mode the instance pass also fills the indirect arguments of the meshlet pass
+struct CullingStats
+{
+	uint32_t DrawCount;
+	uint32_t VisibleInstances;
+	uint32_t FrustumCulled;
+	uint32_t OcclusionCulled;
+	uint32_t MeshletsCulled;
+	uint32_t TriangleCount;
+	float MaxLodError; // Projected, in pixels
+	uint32_t WorkItemCount;
+	VkDispatchIndirectCommand MeshletDispatch;
+	VkDrawMeshTasksIndirectCommandNV MeshletTasks;
+};
+
+struct RtPushConstants
+{
+	glm::vec4 ClearColor;
+};
+
 
 struct QueueFamilyIndices
 {
 	std::optional<uint32_t> GraphicsFamily;
 	std::optional<uint32_t> PresentFamily;
+	// Families without graphics, for async compute and transfers. Absent when every family supports graphics. Uploads go
+	// to the transfer family, nothing is submitted to the compute family yet
+	std::optional<uint32_t> ComputeFamily;
+	std::optional<uint32_t> TransferFamily;
 
 	bool IsComplete()
 	{
@@ -104,6 +189,40 @@ struct QueueFamilyIndices
 	}
 };
 
+// Device and queue families picked on a previous run. Ids, driver version and UUID identify the device, and any
+// mismatch discards the entry
+struct DeviceCacheEntry
+{
+	uint32_t Version;
+	uint32_t DeviceCount;
+	uint32_t VendorId;
+	uint32_t DeviceId;
+	uint32_t DriverVersion;
+	uint8_t PipelineCacheUuid[VK_UUID_SIZE];
+	uint32_t GraphicsFamily;
+	uint32_t PresentFamily;
+	int32_t ComputeFamily; // -1 when absent
+	int32_t TransferFamily;
+};
+
+// Pipelines drawing the scene, rebuilt together when the render pass, the sample count or their shaders change
+struct GraphicsPipelineSet
+{
+	VkPipelineLayout Layout = VK_NULL_HANDLE;
+	VkPipeline Pipeline = VK_NULL_HANDLE;
+	VkPipeline DynamicPipeline = VK_NULL_HANDLE; // For dynamic rendering
+	VkPipelineLayout MeshletLayout = VK_NULL_HANDLE;
+	VkPipeline MeshletPipeline = VK_NULL_HANDLE;
+	VkPipeline DynamicMeshletPipeline = VK_NULL_HANDLE;
+	// shader.vert variants drawing one object per draw, only in the generic set
+	VkPipelineLayout ObjectPushLayout = VK_NULL_HANDLE;
+	VkPipeline ObjectPushPipeline = VK_NULL_HANDLE;
+	VkPipeline DynamicObjectPushPipeline = VK_NULL_HANDLE;
+	VkPipelineLayout ObjectRingLayout = VK_NULL_HANDLE;
+	VkPipeline ObjectRingPipeline = VK_NULL_HANDLE;
+	VkPipeline DynamicObjectRingPipeline = VK_NULL_HANDLE;
+};
+
 struct SwapchainSupportDetails
 {
 	VkSurfaceCapabilitiesKHR Capabilities;
@@ -114,6 +233,8 @@ struct SwapchainSupportDetails
 class Application
 {
 public:
+	// Copies of the scene's meshes along each side of the instance grid, set before Run
+	void SetInstanceGridSize(uint32_t size) { m_InstanceGridSize = size > 0 ? size : 1; }
 	void Run();
 private:
 	void InitWindow();
@@ -125,10 +246,16 @@ private:
 	void CreateInstance();
 	bool CheckValidationLayerSupport();
 	void PickPhysicalDevice();
-	bool IsDeviceSuitable(VkPhysicalDevice device);
+	bool IsDeviceSuitable(VkPhysicalDevice device, const QueueFamilyIndices& indices);
+	double RateDevice(VkPhysicalDevice device, const QueueFamilyIndices& indices);
+	bool LoadDeviceCache(const std::vector<VkPhysicalDevice>& devices);
+	void SaveDeviceCache(uint32_t deviceCount);
 	QueueFamilyIndices FindQueueFamilies(VkPhysicalDevice device);
 	bool CheckDeviceExtensionSupport(VkPhysicalDevice device);
 	void CreateLogicalDevice();
+	void LoadPipelineCacheData();
+	void CreatePipelineCache();
+	void SavePipelineCache();
 	void CreateSurface();
 	void CreateSwapchain();
 	void CreateImageViews();
@@ -136,33 +263,62 @@ private:
 	VkSurfaceFormatKHR ChooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats);
 	VkPresentModeKHR ChooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes);
 	VkExtent2D ChooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities);
+	void UpdateRenderExtent();
 	void CreateRenderPass();
 	void CreateDescriptorSetLayout();
-	void CreateGraphicsPipeline();
-	static std::vector<char> ReadFile(const std::string& filename);
-	VkShaderModule CreateShaderModule(const std::vector<char>& code);
+	bool CreateGraphicsPipeline(GraphicsPipelineSet& pipelines, uint32_t materialFeatures = s_GenericMaterial, bool cachedOnly = false);
+	void DestroyGraphicsPipeline(const GraphicsPipelineSet& pipelines);
+	void RetireGraphicsPipeline(const GraphicsPipelineSet& pipelines);
+	const GraphicsPipelineSet& GetMaterialPipelines(uint32_t materialFeatures);
+	void RequestMaterialPipelines(uint32_t materialFeatures);
+	void ResetMaterialPipelines();
+	static std::string GetMaterialName(uint32_t materialFeatures);
+	void PreloadShaders(const std::vector<const ShaderSource*>& sources);
+	std::vector<uint32_t> GetShaderCode(const ShaderSource& source);
+	VkShaderModule CreateShaderModule(const std::vector<uint32_t>& code);
+	void WatchShaders();
+	void WatchComputePipeline(const ShaderSource& source, VkPipelineLayout layout, VkPipeline& pipeline);
+	void ApplyPipelineSwaps();
+	void ReleaseRetiredPipelines();
 	void CreateFramebuffers();
 	void CreateCommandPool();
 	void CreateCommandBuffers();
 	void RecordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t index);
+	void AddRasterPasses(uint32_t imageIndex);
+	RenderGraph::ResourceHandle ImportSwapchainImage(uint32_t imageIndex);
+	void BlitToSwapchain(VkCommandBuffer commandBuffer, VkImage source, VkImageLayout sourceLayout, uint32_t imageIndex);
+	void DrawScene(VkCommandBuffer commandBuffer, bool culling, bool meshShading, bool dynamicRendering, uint32_t drawCount);
+	// Passes record on worker threads, so the sets of the transient sets scheme are allocated before the graph executes
+	void AllocatePerDrawSets();
+	void DrawObjects(VkCommandBuffer commandBuffer, bool dynamicRendering);
 	void CreateSyncObjects();
 	void CreateVertexBuffer();
 	void CreateBuffer(
 		VkDeviceSize size, 
 		VkBufferUsageFlags usage, 
 		VkMemoryPropertyFlags properties, 
+		MemoryBudget::Category category,
 		VkBuffer& buffer, 
-		VkDeviceMemory& deviceMemory);
+		VkDeviceMemory& deviceMemory,
+		VkMemoryAllocateFlags allocateFlags = 0);
 	void CreateIndexBuffer();
+	void CreateInstanceBuffer();
+	void CreateIndirectBuffer();
+	void UploadBuffer(
+		const void* data,
+		VkDeviceSize size,
+		VkBufferUsageFlags usage,
+		MemoryBudget::Category category,
+		VkBuffer& buffer,
+		VkDeviceMemory& bufferMemory,
+		VkMemoryAllocateFlags allocateFlags = 0);
 	void CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
 	uint32_t FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
 	void CreateUniformBuffers();
-	void CreateDescriptorPool();
+	void CreateObjectRingBuffer();
 	void CreateDescriptorSets();
-	void UpdateUniformBuffer(uint32_t currentImage);
-	void CreateTextureImage();
-	void CreateTextureImageView();
-	VkImageView CreateImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels);
+	void UpdateUniformBuffer(uint32_t currentImage, const FramePacket& packet);
+	VkImageView CreateImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels, uint32_t baseMipLevel = 0);
 	void CreateImage(
 		uint32_t width, 
 		uint32_t height, 
@@ -172,33 +328,86 @@ private:
 		VkImageTiling tiling, 
 		VkImageUsageFlags usage,
 		VkMemoryPropertyFlags properties,
+		MemoryBudget::Category category,
 		VkImage& image, 
 		VkDeviceMemory& imageMemory);
-	VkCommandBuffer BeginSingleTimeCommands();
-	void EndSingleTimeCommands(VkCommandBuffer commandBuffer);
+	void CreateImage(
+		uint32_t width,
+		uint32_t height,
+		uint32_t mipLevels,
+		VkSampleCountFlagBits numSamples,
+		VkFormat format,
+		VkImageTiling tiling,
+		VkImageUsageFlags usage,
+		VkImage& image);
+	VkCommandBuffer BeginSingleTimeCommands(FrameScheduler::QueueType queue = FrameScheduler::Graphics);
+	// Submits after the waits and blocks until the commands have completed
+	void EndSingleTimeCommands(
+		VkCommandBuffer commandBuffer,
+		FrameScheduler::QueueType queue = FrameScheduler::Graphics,
+		const std::vector<FrameScheduler::Dependency>& waits = {});
 	void TransitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels);
-	void CopyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height);
+	VkFormat FindTextureFormat();
 	void CreateTextureSampler();
+	void RegisterBindlessResources();
+	void LoadVirtualTextureData();
+	void CreateVirtualTexture();
 	void CreateDepthResources();
 	void CreateColorResources();
+	void AllocateAttachmentMemory();
 	VkFormat FindDepthFormat();
 	VkFormat FindSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features);
 	bool HasStencilComponent(VkFormat format);
 	void LoadModel();
-	void GenerateMipmaps(VkImage image, VkFormat imageFormat, int32_t texWidth, int32_t texHeight, uint32_t mipLevels);
+	void BuildScene();
 	VkSampleCountFlagBits GetMaxUsableSampleCount();
 
 	void CreateBottomLevelAS();
+	void CreateTopLevelAS();
+	void CreateRtOutputImage();
+	void CreateRtDescriptorSet();
+	void UpdateRtDescriptorSet(uint32_t frame);
+	void CreateRtPipeline();
+	void CreateRtShaderBindingTable();
+	void AddRaytracingPasses(uint32_t imageIndex);
+	void Trace(VkCommandBuffer commandBuffer);
+
+	void CreateCullingBuffers();
+	void CreateDepthPyramidSampler();
+	void CreateDepthPyramid();
+	void CreateCullingDescriptorSets();
+	void UpdateCullingDescriptorSet(uint32_t frame);
+	void CreateCullingPipelines();
+	VkPipeline CreateComputePipeline(const ShaderSource& source, VkPipelineLayout layout);
+	void CullInstances(VkCommandBuffer commandBuffer, bool occlusion);
+	void CullMeshlets(VkCommandBuffer commandBuffer);
+	void CopyCullingStats(VkCommandBuffer commandBuffer);
+	void BuildDepthPyramid(VkCommandBuffer commandBuffer);
+	void ReadCullingStats(uint32_t frame);
 
 	void MainLoop();
+	void SimulationLoop();
+	void Simulate();
+	void RenderLoop();
+	void ApplyInput();
+	void HandleKey(int key);
 	void DrawFrame();
+	void StartRecordingBenchmark();
+	void UpdateRecordingBenchmark(double recordMs);
+	void StartPerDrawBenchmark();
+	void UpdatePerDrawBenchmark();
+	bool ApplyQualityLevel();
 
 	void Cleanup();
 
 	void RecreateSwapchain();
 	void CleanupSwapchain();
+	void CreateRenderTargets();
+	void RetireRenderTargets(VkRenderPass renderPass = VK_NULL_HANDLE);
+	void ReleaseRetiredRenderTargets();
 
 	static void FramebufferResizeCallback(GLFWwindow* window, int width, int height);
+	static void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods);
 
 	const uint32_t m_MaxFramesInFlight = 2;
 	uint32_t m_CurrentFrame = 0;
@@ -233,8 +442,79 @@ private:
 	// Present queue
 	VkQueue m_PresentQueue;
 
+	// Dedicated compute and transfer queues, the graphics queue when the device has none
+	VkQueue m_ComputeQueue;
+	VkQueue m_TransferQueue;
+
 	QueueFamilyIndices m_QueueFamilyIndices;
 
+	// Picked device, so later runs skip ranking and probing
+	const std::string m_DeviceCachePath = "device_cache.bin";
+	static constexpr uint32_t s_DeviceCacheVersion = 1;
+	// Score per GB/s of copy bandwidth, only compared between devices of the same type
+	static constexpr double s_BandwidthScore = 1.0;
+
+	// Shared by every pipeline and persisted between runs
+	VkPipelineCache m_PipelineCache = VK_NULL_HANDLE;
+	const std::string m_PipelineCachePath = "pipeline_cache.bin";
+	std::vector<char> m_PipelineCacheData; // Read ahead on a startup worker, released once the cache is created
+
+	// GLSL compiled at runtime. Startup compiles every shader ahead on workers and keeps the results until it is done
+	ShaderCompiler m_ShaderCompiler;
+	const std::string m_ShaderCachePath = "shader_cache";
+	const ShaderSource m_VertexShader{ "resources/shaders/shader.vert" };
+	const ShaderSource m_ObjectPushVertexShader{ "resources/shaders/shader.vert", { "OBJECT_PUSH_CONSTANTS" } };
+	const ShaderSource m_ObjectRingVertexShader{ "resources/shaders/shader.vert", { "OBJECT_RING_BUFFER" } };
+	const ShaderSource m_FragmentShader{ "resources/shaders/shader.frag" };
+	const ShaderSource m_TaskShader{ "resources/shaders/meshlet.task" };
+	const ShaderSource m_MeshShader{ "resources/shaders/meshlet.mesh" };
+	const ShaderSource m_CullShader{ "resources/shaders/cull.comp" };
+	const ShaderSource m_MeshletCullShader{ "resources/shaders/meshletcull.comp" };
+	const ShaderSource m_DepthReduceShader{ "resources/shaders/depthreduce.comp" };
+	const ShaderSource m_DepthReduceMsShader{ "resources/shaders/depthreduce.comp", { "MULTISAMPLED" } };
+	const ShaderSource m_RaygenShader{ "resources/shaders/raytrace.rgen" };
+	const ShaderSource m_MissShader{ "resources/shaders/raytrace.rmiss" };
+	const ShaderSource m_ClosestHitShader{ "resources/shaders/raytrace.rchit" };
+	std::unordered_map<std::string, std::vector<uint32_t>> m_PreloadedShaders;
+
+	// Set and pipeline layouts derived from the shaders, shared between pipelines with the same interface and owned here
+	PipelineLayoutCache m_LayoutCache;
+
+	// Hot reload. The watcher thread builds new pipelines and queues swaps the render thread applies before its next
+	// frame, and replaced pipelines are destroyed once no frame in flight can use them
+	struct RetiredPipelines
+	{
+		std::vector<VkPipeline> Pipelines;
+		uint32_t FramesLeft;
+	};
+	ShaderWatcher m_ShaderWatcher;
+	std::mutex m_PipelineSwapMutex;
+	std::vector<std::function<void()>> m_PipelineSwaps;
+	std::vector<RetiredPipelines> m_RetiredPipelines; // Render thread only
+	// Held shared while other threads build graphics pipelines and exclusively while the render thread changes what
+	// they are built from. The render thread bumps the generation whenever it rebuilds them itself, which makes a
+	// reloaded set built against the previous render pass stale
+	std::shared_mutex m_GraphicsPipelineMutex;
+	uint64_t m_GraphicsPipelineGeneration = 0;
+
+	// Material permutations. Each combination of material features gets graphics pipelines specialized for it, taken
+	// from the pipeline cache when it already holds them and compiled on background threads otherwise. Frames draw with
+	// the generic set, which reads the features from the uniform buffer, until the specialized one is ready
+	static constexpr uint32_t s_GenericMaterial = ~0u;
+	static constexpr uint32_t s_PipelineCompilerThreads = 2;
+	uint32_t m_MaterialFeatures = MaterialTextured; // Toggled with the 1, 2 and 3 keys
+	bool m_PipelineCacheControlSupported = false;
+	PipelineCompiler m_PipelineCompiler;
+	// Render thread only. Sets built before the generation last changed are retired instead of used
+	std::unordered_map<uint32_t, GraphicsPipelineSet> m_MaterialPipelines;
+	std::unordered_set<uint32_t> m_PendingMaterialPipelines;
+	uint64_t m_MaterialPipelineGeneration = 0;
+	GraphicsPipelineSet m_FramePipelines; // What the frame being recorded draws with
+
+	// Time to first frame, from before the window opens to the first present
+	std::chrono::high_resolution_clock::time_point m_StartupBegin;
+	bool m_FirstFramePresented = false;
+
 	// Swapchain
 	const std::vector<const char*> m_DeviceExtensions = { 
 		VK_KHR_SWAPCHAIN_EXTENSION_NAME,
@@ -245,7 +525,9 @@ private:
 		VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME,
 		VK_KHR_SPIRV_1_4_EXTENSION_NAME,
 		VK_KHR_MAINTENANCE3_EXTENSION_NAME,
-		VK_KHR_SHADER_FLOAT_CONTROLS_EXTENSION_NAME
+		VK_KHR_SHADER_FLOAT_CONTROLS_EXTENSION_NAME,
+		VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME,
+		VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME
 		//VK_VERSION_1_1"
 	};
 	VkSwapchainKHR m_Swapchain;
@@ -253,55 +535,217 @@ private:
 	std::vector<VkImageView> m_SwapchainImageViews;
 	VkFormat m_SwapchainImageFormat;
 	VkExtent2D m_SwapchainExtent;
-	std::vector<VkFramebuffer> m_SwapchainFramebuffers;
+	// One per swapchain image, or a single one resolving into the scene color image when upscaling
+	std::vector<VkFramebuffer> m_Framebuffers;
+
+	// Scenes are drawn at a fraction of the swapchain extent picked by the quality governor, and scaled up to it when
+	// the two differ
+	VkExtent2D m_RenderExtent;
+	float m_RenderScale = 1.0f;
+	bool m_Upscaling = false;
+	VkImage m_SceneColorImage = VK_NULL_HANDLE; // Only while upscaling
+	VkImageView m_SceneColorImageView = VK_NULL_HANDLE;
+	// Render targets replaced while frames in flight may still draw to them, destroyed like retired pipelines. The
+	// render pass is only retired along with them when the sample count changed
+	struct RetiredRenderTargets
+	{
+		std::vector<VkImage> Images;
+		std::vector<VkImageView> ImageViews;
+		std::vector<VkDeviceMemory> Memories;
+		std::vector<VkFramebuffer> Framebuffers;
+		VkRenderPass RenderPass = VK_NULL_HANDLE;
+		uint32_t FramesLeft = 0;
+	};
+	std::vector<RetiredRenderTargets> m_RetiredRenderTargets; // Render thread only
+	// Slots whose ray tracing and culling sets still bind the previous render targets, rewritten when the slot comes around
+	std::vector<bool> m_RenderTargetSetsStale;
 
 	VkRenderPass m_RenderPass;
 	VkDescriptorSetLayout m_DescriptorSetLayout;
-	VkPipelineLayout m_PipelineLayout;
-	VkPipeline m_GraphicsPipeline;
+	GraphicsPipelineSet m_GraphicsPipelines;
+
+	// Rendering without render pass and framebuffer objects, with barriers through synchronization2
+	bool m_DynamicRenderingSupported = false;
+	bool m_UseDynamicRendering = false; // Toggled with the D key
+
+	// CPU cost of recording a frame through each path, alternating between them. Started with the B key
+	static constexpr uint32_t s_BenchmarkFrames = 1000;
+	uint32_t m_BenchmarkFramesLeft = 0;
+	bool m_BenchmarkRestoreDynamicRendering = false;
+	std::array<double, 2> m_BenchmarkRecordMs{};
+	std::array<uint32_t, 2> m_BenchmarkFrameCounts{};
+
+	// Draw calls per ms of CPU time, and the time of each call, under each scheme in turn, drawing the instances one by
+	// one and starting over until the frame has made s_PerDrawBenchmarkDraws draws. Started with the P key
+	static constexpr uint32_t s_PerDrawBenchmarkDraws = 10000;
+	uint32_t m_PerDrawFramesLeft = 0;
+	PerDrawScheme m_PerDrawScheme = PerDrawPushConstants;
+	std::array<double, PerDrawSchemeCount> m_PerDrawMs{};
+	std::array<uint64_t, PerDrawSchemeCount> m_PerDrawCalls{};
 
 	VkCommandPool m_CommandPool;
+	VkCommandPool m_TransferCommandPool; // For the transfer queue's family, the graphics family without one
 	std::vector<VkCommandBuffer> m_CommandBuffers;
 
-	// GPU/CPU synchronization
+	// GPU/CPU synchronization. Binary semaphores are only left for the swapchain
+	FrameScheduler m_FrameScheduler;
 	std::vector<VkSemaphore> m_ImageAvailableSemaphores, m_RenderFinishedSemaphores;
-	std::vector<VkFence> m_InFlightFences;
 
-	bool m_FramebufferResized = false;
+	std::atomic<bool> m_FramebufferResized = false;
+
+	// Threads. The main thread polls window events, the simulation thread publishes frame packets at a fixed rate and
+	// the render thread records and submits frames from the latest one. Vulkan objects belong to the render thread
+	static constexpr double s_SimulationRate = 240.0; // Steps per second
+	std::atomic<bool> m_Running = false;
+	std::exception_ptr m_ThreadException;
+	std::mutex m_ThreadExceptionMutex;
+	TripleBuffer<FramePacket> m_FramePackets;
+	std::atomic<bool> m_SimulateLods = true; // m_UseLods, as seen by the simulation thread
+	// Written by the main thread's callbacks, GLFW may not be called from the other threads
+	std::atomic<uint32_t> m_FramebufferWidth = 0;
+	std::atomic<uint32_t> m_FramebufferHeight = 0;
+	// Extent the render thread currently draws at, for the simulation's projection
+	std::atomic<uint32_t> m_ViewportWidth = 0;
+	std::atomic<uint32_t> m_ViewportHeight = 0;
+	// Keys pressed on the main thread, applied by the render thread before its next frame
+	std::mutex m_InputMutex;
+	std::vector<int> m_PendingKeys;
+	// Title composed by the render thread, set on the window by the main thread
+	std::mutex m_TitleMutex;
+	std::string m_PendingTitle;
+
+	// Every device memory allocation goes through it, tagged with what it holds
+	MemoryBudget m_MemoryBudget;
+	bool m_MemoryBudgetSupported = false; // VK_EXT_memory_budget, otherwise usage is only what was allocated
 
 	std::vector<VkBuffer> m_UniformBuffers;
 	std::vector<VkDeviceMemory> m_UniformBufferMemories;
 
-	VkDescriptorPool m_DescriptorPool;
+	// Every descriptor set outside the bindless heap and the ray tracing set
+	DescriptorAllocator m_DescriptorAllocator;
 	std::vector<VkDescriptorSet> m_DescriptorSets;
 
-	uint32_t m_MipLevels;
-	VkImage m_TextureImage;
-	VkDeviceMemory m_TextureImageMemory;
-	VkImageView m_TextureImageView;
+	// Object data of draws made one object at a time, a slot per instance and frame in flight. Set 2 of the ring
+	// variant of shader.vert reads one slot, picked by the dynamic offset it is bound with
+	VkDescriptorSetLayout m_ObjectSetLayout; // Owned by the layout cache
+	VkDescriptorSet m_ObjectRingDescriptorSet;
+	VkBuffer m_ObjectRingBuffer;
+	VkDeviceMemory m_ObjectRingBufferMemory;
+	uint8_t* m_ObjectRingData = nullptr; // Mapped for as long as the buffer lives
+	uint32_t m_ObjectRingStride = 0; // ObjectData rounded up to the dynamic offset alignment
+	std::vector<VkDescriptorSet> m_PerDrawSets; // Transient set of each benchmark draw this frame
+	uint32_t m_MinUniformBufferOffsetAlignment = 1;
+
+	TextureStreamer m_TextureStreamer;
 	VkSampler m_TextureSampler;
+
+	// Bindless resources
+	BindlessHeap m_BindlessHeap;
+	MaterialIndices m_Material{};
 	
 	// Depth buffer
+	VkFormat m_DepthFormat;
 	VkImage m_DepthImage;
-	VkDeviceMemory m_DepthImageMemory;
 	VkImageView m_DepthImageView;
 
 	// Model
 	const std::string m_ModelPath = "resources/models/viking_room.obj";
 	const std::string m_TexturePath = "resources/textures/viking_room.png";
-	std::vector<Vertex> m_Vertices;
-	std::vector<uint32_t> m_Indices;
+
+	// Virtual texture of the same image, paged into a cache smaller than the texture so eviction is exercised
+	VirtualTexture m_VirtualTexture;
+	TextureData m_VirtualTextureData; // Decoded on a startup worker, released once the virtual texture is set up
+	const VkDeviceSize m_VirtualTextureBudget = 2 * 1024 * 1024;
+	bool m_VirtualTexturingSupported = false; // Needs stores and atomics in fragment shaders for the feedback
+	bool m_UseVirtualTexture = false; // Toggled with the V key
+
+	// Scene, drawn with one indirect command per mesh. The model and simplified copies of it are spread over a
+	// square grid, and the camera backs off far enough to see all of it
+	Scene m_Scene;
+	std::vector<uint32_t> m_SceneMeshIndices;
+	const uint32_t m_SimplifiedMeshCount = 3; // Made from the model's coarser levels of detail, when it has them
+	uint32_t m_InstanceGridSize = 100;
+	const float m_InstanceSpacing = 2.5f;
+	float m_CameraScale = 1.0f;
 	VkBuffer m_VertexBuffer;
 	VkDeviceMemory m_VertexBufferMemory;
 	VkBuffer m_IndexBuffer;
 	VkDeviceMemory m_IndexBufferMemory;
+	VkBuffer m_InstanceBuffer;
+	VkDeviceMemory m_InstanceBufferMemory;
+	VkBuffer m_IndirectBuffer;
+	VkDeviceMemory m_IndirectBufferMemory;
+	DrawPushConstants m_DrawPushConstants{};
+	bool m_MultiDrawIndirectSupported = false;
+
+	// Levels of detail, picked per instance from their projected error. On the CPU while drawing without culling,
+	// the commands then go through a per frame indirect buffer
+	bool m_UseLods = true; // Toggled with the L key
+	const float m_LodErrorThreshold = 1.0f; // Pixels
+	float m_LodPixelsPerUnit = 0.0f;
+	std::vector<VkBuffer> m_LodDrawBuffers;
+	std::vector<VkDeviceMemory> m_LodDrawBufferMemories;
+	std::vector<uint32_t> m_LodDrawCounts;
+
+	// GPU culling, compacting visible instances into m_CulledDrawBuffer
+	bool m_UseGpuCulling = true; // Toggled with the C key
+	VkBuffer m_MeshBuffer;
+	VkDeviceMemory m_MeshBufferMemory;
+	VkBuffer m_CulledDrawBuffer;
+	VkDeviceMemory m_CulledDrawBufferMemory;
+	VkBuffer m_CullingStatsBuffer;
+	VkDeviceMemory m_CullingStatsBufferMemory;
+	std::vector<VkBuffer> m_CullingReadbackBuffers;
+	std::vector<VkDeviceMemory> m_CullingReadbackBufferMemories;
+	std::vector<bool> m_CullingStatsPending;
+	VkDescriptorSetLayout m_CullDescriptorSetLayout;
+	std::vector<VkDescriptorSet> m_CullDescriptorSets;
+	VkPipelineLayout m_CullPipelineLayout;
+	VkPipeline m_CullPipeline;
+	uint32_t m_MaxCulledDraws = 0;
+
+	// Meshlets, culled per cluster by the task shader or, without mesh shading, by a compute pass feeding indirect draws
+	bool m_UseMeshlets = false; // Toggled with the M key
+	bool m_MeshShadingSupported = false;
+	static constexpr uint32_t s_MaxMeshletDraws = 1 << 20;
+	VkBuffer m_MeshletBuffer;
+	VkDeviceMemory m_MeshletBufferMemory;
+	VkBuffer m_MeshletDataBuffer;
+	VkDeviceMemory m_MeshletDataBufferMemory;
+	VkBuffer m_MeshletWorkItemBuffer;
+	VkDeviceMemory m_MeshletWorkItemBufferMemory;
+	uint32_t m_MaxMeshletWorkItems = 0;
+	MeshletPushConstants m_MeshletPushConstants{};
+	VkPipelineLayout m_MeshletCullPipelineLayout;
+	VkPipeline m_MeshletCullPipeline;
+
+	// Hierarchical depth, the max depth of the previous frame at every mip level
+	bool m_DepthSamplingSupported = false;
+	bool m_DepthPyramidValid = false;
+	VkImage m_DepthPyramidImage;
+	VkDeviceMemory m_DepthPyramidImageMemory;
+	VkImageView m_DepthPyramidView;
+	std::vector<VkImageView> m_DepthPyramidMipViews;
+	uint32_t m_DepthPyramidLevels = 0;
+	VkSampler m_DepthPyramidSampler;
+	VkDescriptorSetLayout m_DepthReduceDescriptorSetLayout;
+	std::vector<VkDescriptorSet> m_DepthReduceDescriptorSets;
+	VkPipelineLayout m_DepthReducePipelineLayout;
+	VkPipeline m_DepthReducePipeline;
+	VkPipeline m_DepthReduceMsPipeline;
 
 	// Multisampling
 	VkSampleCountFlagBits m_MsaaSamples = VK_SAMPLE_COUNT_1_BIT;
+	VkSampleCountFlags m_QualitySampleCounts = 0; // Counts the quality governor may switch to
+	float m_MinSampleShading = 0.0f;
 	VkImage m_ColorImage;
-	VkDeviceMemory m_ColorImageMemory;
 	VkImageView m_ColorImageView;
 
+	// Memory backing the color, depth, scene color and ray traced output images, shared where their lifetimes do not overlap
+	std::vector<VkDeviceMemory> m_AttachmentMemories;
+	bool m_AttachmentsAliased = false;
+	bool m_LastFrameRaytraced = false;
+
 	// Ray tracing
 	const std::vector<const char*> m_InstanceExtensions = { 
 		VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME,
@@ -309,5 +753,37 @@ private:
 	VkPhysicalDeviceRayTracingPipelinePropertiesKHR m_RtProperties{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR};
 	std::vector<ObjModel> m_ObjModel;   // Model on host
 	RaytracingBuilder m_RtBuilder;
+	bool m_UseRaytracing = false; // Toggled with the R key
+	VkImage m_RtOutputImage;
+	VkFormat m_RtOutputFormat;
+	VkImageView m_RtOutputImageView;
+	VkDescriptorPool m_RtDescriptorPool;
+	VkDescriptorSetLayout m_RtDescriptorSetLayout;
+	std::vector<VkDescriptorSet> m_RtDescriptorSets; // Per frame, so a slot's output binding can change while others are in flight
+	std::vector<VkRayTracingShaderGroupCreateInfoKHR> m_RtShaderGroups;
+	VkPipelineLayout m_RtPipelineLayout;
+	VkPipeline m_RtPipeline;
+	RtPushConstants m_RtPushConstants{ glm::vec4(0.0f, 0.0f, 0.0f, 1.0f) };
+
+	// Shader binding table, with one region per shader group type
+	VkBuffer m_RtSbtBuffer;
+	VkDeviceMemory m_RtSbtBufferMemory;
+	VkStridedDeviceAddressRegionKHR m_RgenRegion{};
+	VkStridedDeviceAddressRegionKHR m_MissRegion{};
+	VkStridedDeviceAddressRegionKHR m_HitRegion{};
+	VkStridedDeviceAddressRegionKHR m_CallRegion{};
+
+	// Frame graph, rebuilt every frame
+	RenderGraph m_RenderGraph;
+
+	// Render resolution and multisampling follow the GPU frame time, toggled with the Q key
+	QualityGovernor m_QualityGovernor;
+	bool m_UseQualityGovernor = true;
+	bool m_QualityLevelPending = false; // Changed, but not applied while another thread was building pipelines
+	double m_TargetFrameMs = 1000.0 / 60.0;
+
+	// Profiling
+	Profiler m_Profiler;
+	std::chrono::high_resolution_clock::time_point m_LastTitleUpdate;
 
 };
\ No newline at end of file
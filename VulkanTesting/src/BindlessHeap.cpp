@@ -0,0 +1,219 @@
+#include "BindlessHeap.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+void BindlessHeap::Setup(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t framesInFlight)
+{
+	m_Device = device;
+	m_FramesInFlight = framesInFlight;
+
+	VkPhysicalDeviceDescriptorIndexingProperties indexingProperties{};
+	indexingProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES;
+	VkPhysicalDeviceProperties2 properties{};
+	properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+	properties.pNext = &indexingProperties;
+	vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+
+	m_Capacities[SampledImages] = std::min({
+		s_MaxSampledImages,
+		indexingProperties.maxDescriptorSetUpdateAfterBindSampledImages,
+		indexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages });
+	m_Capacities[Samplers] = std::min({
+		s_MaxSamplers,
+		indexingProperties.maxDescriptorSetUpdateAfterBindSamplers,
+		indexingProperties.maxPerStageDescriptorUpdateAfterBindSamplers });
+	m_Capacities[StorageBuffers] = std::min({
+		s_MaxStorageBuffers,
+		indexingProperties.maxDescriptorSetUpdateAfterBindStorageBuffers,
+		indexingProperties.maxPerStageDescriptorUpdateAfterBindStorageBuffers });
+
+	std::array<VkDescriptorType, BindingCount> types = {
+		VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+		VK_DESCRIPTOR_TYPE_SAMPLER,
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER };
+
+	std::array<VkDescriptorSetLayoutBinding, BindingCount> bindings{};
+	std::array<VkDescriptorBindingFlags, BindingCount> bindingFlags{};
+	std::array<VkDescriptorPoolSize, BindingCount> poolSizes{};
+	for (uint32_t i = 0; i < BindingCount; ++i)
+	{
+		bindings[i].binding = i;
+		bindings[i].descriptorType = types[i];
+		bindings[i].descriptorCount = m_Capacities[i];
+		bindings[i].stageFlags = VK_SHADER_STAGE_ALL;
+		bindings[i].pImmutableSamplers = nullptr;
+
+		// Unused slots may stay unwritten, and slots may be written while the set is bound in the command buffer being
+		// recorded. Sets of frames in flight are never written, see Write
+		bindingFlags[i] = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT;
+
+		poolSizes[i].type = types[i];
+		poolSizes[i].descriptorCount = m_Capacities[i] * framesInFlight;
+	}
+
+	VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo{};
+	bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+	bindingFlagsInfo.bindingCount = static_cast<uint32_t>(bindingFlags.size());
+	bindingFlagsInfo.pBindingFlags = bindingFlags.data();
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo{};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.pNext = &bindingFlagsInfo;
+	layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+	layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+	layoutInfo.pBindings = bindings.data();
+	if (vkCreateDescriptorSetLayout(m_Device, &layoutInfo, nullptr, &m_Layout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create bindless descriptor set layout");
+	}
+
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+	poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	poolInfo.pPoolSizes = poolSizes.data();
+	poolInfo.maxSets = framesInFlight;
+	if (vkCreateDescriptorPool(m_Device, &poolInfo, nullptr, &m_Pool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create bindless descriptor pool");
+	}
+
+	std::vector<VkDescriptorSetLayout> layouts(framesInFlight, m_Layout);
+	VkDescriptorSetAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = m_Pool;
+	allocInfo.descriptorSetCount = framesInFlight;
+	allocInfo.pSetLayouts = layouts.data();
+	m_DescriptorSets.resize(framesInFlight);
+	if (vkAllocateDescriptorSets(m_Device, &allocInfo, m_DescriptorSets.data()) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate bindless descriptor sets");
+	}
+	m_PendingWrites.resize(framesInFlight);
+}
+
+void BindlessHeap::Destroy()
+{
+	vkDestroyDescriptorPool(m_Device, m_Pool, nullptr);
+	vkDestroyDescriptorSetLayout(m_Device, m_Layout, nullptr);
+	m_Pool = VK_NULL_HANDLE;
+	m_Layout = VK_NULL_HANDLE;
+	m_DescriptorSets.clear();
+	m_PendingWrites.clear();
+}
+
+uint32_t BindlessHeap::RegisterSampledImage(VkImageView imageView, VkImageLayout layout)
+{
+	uint32_t index = AllocateIndex(SampledImages);
+	UpdateSampledImage(index, imageView, layout);
+	return index;
+}
+
+uint32_t BindlessHeap::RegisterSampler(VkSampler sampler)
+{
+	uint32_t index = AllocateIndex(Samplers);
+	PendingWrite write{ Samplers, index };
+	write.ImageInfo.sampler = sampler;
+	Write(write);
+	return index;
+}
+
+uint32_t BindlessHeap::RegisterStorageBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range)
+{
+	uint32_t index = AllocateIndex(StorageBuffers);
+	UpdateStorageBuffer(index, buffer, offset, range);
+	return index;
+}
+
+void BindlessHeap::UpdateSampledImage(uint32_t index, VkImageView imageView, VkImageLayout layout)
+{
+	PendingWrite write{ SampledImages, index };
+	write.ImageInfo.imageView = imageView;
+	write.ImageInfo.imageLayout = layout;
+	Write(write);
+}
+
+void BindlessHeap::UpdateStorageBuffer(uint32_t index, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range)
+{
+	PendingWrite write{ StorageBuffers, index };
+	write.BufferInfo = { buffer, offset, range };
+	Write(write);
+}
+
+void BindlessHeap::Release(Binding binding, uint32_t index)
+{
+	m_PendingReleases.push_back({ binding, index, m_FramesInFlight });
+}
+
+void BindlessHeap::BeginFrame(uint32_t frame)
+{
+	m_CurrentFrame = frame;
+	for (const PendingWrite& write : m_PendingWrites[frame])
+	{
+		Apply(m_DescriptorSets[frame], write);
+	}
+	m_PendingWrites[frame].clear();
+
+	for (auto release = m_PendingReleases.begin(); release != m_PendingReleases.end();)
+	{
+		if (--release->FramesLeft == 0)
+		{
+			m_FreeIndices[release->ResourceBinding].push_back(release->Index);
+			release = m_PendingReleases.erase(release);
+		}
+		else
+		{
+			++release;
+		}
+	}
+}
+
+uint32_t BindlessHeap::AllocateIndex(Binding binding)
+{
+	std::vector<uint32_t>& freeIndices = m_FreeIndices[binding];
+	if (!freeIndices.empty())
+	{
+		uint32_t index = freeIndices.back();
+		freeIndices.pop_back();
+		return index;
+	}
+
+	if (m_NextIndices[binding] >= m_Capacities[binding])
+	{
+		throw std::runtime_error("Bindless descriptor heap is full");
+	}
+	return m_NextIndices[binding]++;
+}
+
+void BindlessHeap::Write(const PendingWrite& write)
+{
+	// The frames holding the other sets may still be reading the slot, so they get the write once they have completed
+	Apply(m_DescriptorSets[m_CurrentFrame], write);
+	for (uint32_t frame = 0; frame < m_FramesInFlight; ++frame)
+	{
+		if (frame != m_CurrentFrame)
+		{
+			m_PendingWrites[frame].push_back(write);
+		}
+	}
+}
+
+void BindlessHeap::Apply(VkDescriptorSet set, const PendingWrite& write)
+{
+	static constexpr std::array<VkDescriptorType, BindingCount> types = {
+		VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+		VK_DESCRIPTOR_TYPE_SAMPLER,
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER };
+
+	VkWriteDescriptorSet descriptorWrite{};
+	descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrite.dstSet = set;
+	descriptorWrite.dstBinding = write.ResourceBinding;
+	descriptorWrite.dstArrayElement = write.Index;
+	descriptorWrite.descriptorType = types[write.ResourceBinding];
+	descriptorWrite.descriptorCount = 1;
+	descriptorWrite.pImageInfo = write.ResourceBinding == StorageBuffers ? nullptr : &write.ImageInfo;
+	descriptorWrite.pBufferInfo = write.ResourceBinding == StorageBuffers ? &write.BufferInfo : nullptr;
+	vkUpdateDescriptorSets(m_Device, 1, &descriptorWrite, 0, nullptr);
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+// Descriptor sets holding large, partially bound arrays of sampled images, samplers and storage buffers.
+// Resources are registered once and referenced from shaders by their index, so draws never rebind descriptors.
+// Each frame in flight has its own set. Writes land in the set of the frame being recorded right away, and in every
+// other set when its frame begins, once the frames that used it have completed. Between frames the device has to be
+// idle, as it is during startup and when render targets are rebuilt. Render thread only, or the main thread during
+// startup
+class BindlessHeap
+{
+public:
+	enum Binding : uint32_t
+	{
+		SampledImages = 0,
+		Samplers = 1,
+		StorageBuffers = 2,
+		BindingCount
+	};
+
+	void Setup(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t framesInFlight);
+	void Destroy();
+
+	uint32_t RegisterSampledImage(VkImageView imageView, VkImageLayout layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	uint32_t RegisterSampler(VkSampler sampler);
+	uint32_t RegisterStorageBuffer(VkBuffer buffer, VkDeviceSize offset = 0, VkDeviceSize range = VK_WHOLE_SIZE);
+	void UpdateSampledImage(uint32_t index, VkImageView imageView, VkImageLayout layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	void UpdateStorageBuffer(uint32_t index, VkBuffer buffer, VkDeviceSize offset = 0, VkDeviceSize range = VK_WHOLE_SIZE);
+
+	// Released indices are only reused once the frames that may still reference them have completed
+	void Release(Binding binding, uint32_t index);
+	// Called once the frame slot's previous submissions have completed, applies the writes its set missed
+	void BeginFrame(uint32_t frame);
+
+	VkDescriptorSetLayout GetLayout() const { return m_Layout; }
+	VkDescriptorSet GetDescriptorSet(uint32_t frame) const { return m_DescriptorSets[frame]; }
+	uint32_t GetCapacity(Binding binding) const { return m_Capacities[binding]; }
+
+	// Preferred sizes, clamped to the device's update-after-bind limits
+	static constexpr uint32_t s_MaxSampledImages = 16384;
+	static constexpr uint32_t s_MaxSamplers = 256;
+	static constexpr uint32_t s_MaxStorageBuffers = 16384;
+
+private:
+	struct PendingRelease
+	{
+		Binding ResourceBinding;
+		uint32_t Index;
+		uint32_t FramesLeft;
+	};
+
+	struct PendingWrite
+	{
+		Binding ResourceBinding;
+		uint32_t Index;
+		VkDescriptorImageInfo ImageInfo;
+		VkDescriptorBufferInfo BufferInfo;
+	};
+
+	uint32_t AllocateIndex(Binding binding);
+	// Writes the current frame's set and queues the write for the others
+	void Write(const PendingWrite& write);
+	void Apply(VkDescriptorSet set, const PendingWrite& write);
+
+	VkDevice m_Device;
+	uint32_t m_FramesInFlight;
+	VkDescriptorSetLayout m_Layout = VK_NULL_HANDLE;
+	VkDescriptorPool m_Pool = VK_NULL_HANDLE;
+	std::vector<VkDescriptorSet> m_DescriptorSets;
+	std::vector<std::vector<PendingWrite>> m_PendingWrites; // Per frame slot, in the order they were made
+	uint32_t m_CurrentFrame = 0;
+
+	std::array<uint32_t, BindingCount> m_Capacities{};
+	std::array<uint32_t, BindingCount> m_NextIndices{};
+	std::array<std::vector<uint32_t>, BindingCount> m_FreeIndices;
+	std::vector<PendingRelease> m_PendingReleases;
+};
@@ -0,0 +1,269 @@
+#include "DescriptorAllocator.h"
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+
+// Descriptors of each type a pool holds per set it can allocate. Sets needing more of one type run it out sooner,
+// which only means the next pool is created earlier
+struct PoolSizeRatio
+{
+	VkDescriptorType Type;
+	float Ratio;
+};
+static const std::array<PoolSizeRatio, 7> s_PoolSizeRatios = { {
+	{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1.0f },
+	{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1.0f },
+	{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4.0f },
+	{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1.0f },
+	{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1.0f },
+	{ VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 1.0f },
+	{ VK_DESCRIPTOR_TYPE_SAMPLER, 1.0f } } };
+
+DescriptorAllocator::Write DescriptorAllocator::Buffer(uint32_t binding, VkDescriptorType type, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range)
+{
+	Write write{};
+	write.Binding = binding;
+	write.Type = type;
+	write.BufferInfo = { buffer, offset, range };
+	return write;
+}
+
+DescriptorAllocator::Write DescriptorAllocator::Image(uint32_t binding, VkDescriptorType type, VkImageView imageView, VkImageLayout layout, VkSampler sampler)
+{
+	Write write{};
+	write.Binding = binding;
+	write.Type = type;
+	write.ImageInfo = { sampler, imageView, layout };
+	return write;
+}
+
+void DescriptorAllocator::Setup(VkDevice device, uint32_t framesInFlight)
+{
+	m_Device = device;
+	m_FramesInFlight = framesInFlight;
+	m_FramePools.resize(framesInFlight);
+}
+
+void DescriptorAllocator::Destroy()
+{
+	auto destroyGroup = [this](PoolGroup& group)
+	{
+		for (VkDescriptorPool pool : group.Ready)
+		{
+			vkDestroyDescriptorPool(m_Device, pool, nullptr);
+		}
+		for (VkDescriptorPool pool : group.Full)
+		{
+			vkDestroyDescriptorPool(m_Device, pool, nullptr);
+		}
+		group = {};
+	};
+	destroyGroup(m_PersistentPools);
+	for (PoolGroup& group : m_FramePools)
+	{
+		destroyGroup(group);
+	}
+	m_SetCache.clear();
+	m_CachedSets.clear();
+	m_FreeSets.clear();
+	m_PendingReleases.clear();
+}
+
+void DescriptorAllocator::BeginFrame(uint32_t frame)
+{
+	m_CurrentFrame = frame;
+
+	// The slot's transient sets were only used by its previous commands
+	PoolGroup& group = m_FramePools[frame];
+	for (VkDescriptorPool pool : group.Full)
+	{
+		group.Ready.push_back(pool);
+	}
+	group.Full.clear();
+	for (VkDescriptorPool pool : group.Ready)
+	{
+		vkResetDescriptorPool(m_Device, pool, 0);
+	}
+
+	for (auto release = m_PendingReleases.begin(); release != m_PendingReleases.end();)
+	{
+		if (--release->FramesLeft == 0)
+		{
+			m_FreeSets[release->Layout].push_back(release->Set);
+			release = m_PendingReleases.erase(release);
+		}
+		else
+		{
+			++release;
+		}
+	}
+}
+
+VkDescriptorSet DescriptorAllocator::Allocate(VkDescriptorSetLayout layout)
+{
+	return AllocateFrom(m_PersistentPools, layout);
+}
+
+VkDescriptorSet DescriptorAllocator::GetSet(VkDescriptorSetLayout layout, const std::vector<Write>& writes)
+{
+	Key key = MakeKey(layout, writes);
+	auto cached = m_SetCache.find(key);
+	if (cached != m_SetCache.end())
+	{
+		return cached->second;
+	}
+
+	// A released set of the same layout is rewritten rather than a new one allocated, as pools never free single sets
+	VkDescriptorSet set;
+	std::vector<VkDescriptorSet>& freeSets = m_FreeSets[layout];
+	if (!freeSets.empty())
+	{
+		set = freeSets.back();
+		freeSets.pop_back();
+	}
+	else
+	{
+		set = AllocateFrom(m_PersistentPools, layout);
+	}
+	WriteSet(set, writes);
+
+	m_SetCache[key] = set;
+	m_CachedSets[set] = { layout, key };
+	return set;
+}
+
+void DescriptorAllocator::Release(VkDescriptorSet set)
+{
+	auto cached = m_CachedSets.find(set);
+	if (cached == m_CachedSets.end())
+	{
+		throw std::runtime_error("Released a descriptor set that was not made by GetSet");
+	}
+	m_SetCache.erase(cached->second.Key);
+	m_PendingReleases.push_back({ set, cached->second.Layout, m_FramesInFlight });
+	m_CachedSets.erase(cached);
+}
+
+VkDescriptorSet DescriptorAllocator::AllocateTransient(VkDescriptorSetLayout layout, const std::vector<Write>& writes)
+{
+	VkDescriptorSet set = AllocateFrom(m_FramePools[m_CurrentFrame], layout);
+	WriteSet(set, writes);
+	return set;
+}
+
+uint32_t DescriptorAllocator::GetPoolCount() const
+{
+	size_t count = m_PersistentPools.Ready.size() + m_PersistentPools.Full.size();
+	for (const PoolGroup& group : m_FramePools)
+	{
+		count += group.Ready.size() + group.Full.size();
+	}
+	return static_cast<uint32_t>(count);
+}
+
+VkDescriptorSet DescriptorAllocator::AllocateFrom(PoolGroup& group, VkDescriptorSetLayout layout)
+{
+	VkDescriptorSetAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &layout;
+
+	// A pool that ran out is set aside and the allocation retried once, from a pool that is new and large enough
+	for (uint32_t attempt = 0; attempt < 2; ++attempt)
+	{
+		if (group.Ready.empty())
+		{
+			group.Ready.push_back(CreatePool(group.SetsPerPool));
+			group.SetsPerPool = std::min(group.SetsPerPool * 2, s_MaxSetsPerPool);
+		}
+
+		allocInfo.descriptorPool = group.Ready.back();
+		VkDescriptorSet set;
+		VkResult result = vkAllocateDescriptorSets(m_Device, &allocInfo, &set);
+		if (result == VK_SUCCESS)
+		{
+			return set;
+		}
+		if (result != VK_ERROR_OUT_OF_POOL_MEMORY && result != VK_ERROR_FRAGMENTED_POOL)
+		{
+			break;
+		}
+		group.Full.push_back(group.Ready.back());
+		group.Ready.pop_back();
+	}
+	throw std::runtime_error("Failed to allocate descriptor set");
+}
+
+VkDescriptorPool DescriptorAllocator::CreatePool(uint32_t maxSets)
+{
+	std::array<VkDescriptorPoolSize, s_PoolSizeRatios.size()> poolSizes{};
+	for (size_t i = 0; i < poolSizes.size(); ++i)
+	{
+		poolSizes[i].type = s_PoolSizeRatios[i].Type;
+		poolSizes[i].descriptorCount = static_cast<uint32_t>(s_PoolSizeRatios[i].Ratio * maxSets);
+	}
+
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	poolInfo.pPoolSizes = poolSizes.data();
+	poolInfo.maxSets = maxSets;
+
+	VkDescriptorPool pool;
+	if (vkCreateDescriptorPool(m_Device, &poolInfo, nullptr, &pool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create descriptor pool");
+	}
+	return pool;
+}
+
+void DescriptorAllocator::WriteSet(VkDescriptorSet set, const std::vector<Write>& writes)
+{
+	std::vector<VkWriteDescriptorSet> descriptorWrites(writes.size());
+	for (size_t i = 0; i < writes.size(); ++i)
+	{
+		const Write& write = writes[i];
+		bool image = write.Type == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER
+			|| write.Type == VK_DESCRIPTOR_TYPE_STORAGE_IMAGE
+			|| write.Type == VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE
+			|| write.Type == VK_DESCRIPTOR_TYPE_SAMPLER;
+		descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[i].dstSet = set;
+		descriptorWrites[i].dstBinding = write.Binding;
+		descriptorWrites[i].dstArrayElement = 0;
+		descriptorWrites[i].descriptorType = write.Type;
+		descriptorWrites[i].descriptorCount = 1;
+		descriptorWrites[i].pImageInfo = image ? &write.ImageInfo : nullptr;
+		descriptorWrites[i].pBufferInfo = image ? nullptr : &write.BufferInfo;
+	}
+	vkUpdateDescriptorSets(m_Device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+}
+
+DescriptorAllocator::Key DescriptorAllocator::MakeKey(VkDescriptorSetLayout layout, const std::vector<Write>& writes)
+{
+	Key key;
+	key.push_back(reinterpret_cast<uint64_t>(layout));
+	for (const Write& write : writes)
+	{
+		key.push_back((static_cast<uint64_t>(write.Binding) << 32) | static_cast<uint64_t>(write.Type));
+		key.push_back(reinterpret_cast<uint64_t>(write.BufferInfo.buffer));
+		key.push_back(write.BufferInfo.offset);
+		key.push_back(write.BufferInfo.range);
+		key.push_back(reinterpret_cast<uint64_t>(write.ImageInfo.sampler));
+		key.push_back(reinterpret_cast<uint64_t>(write.ImageInfo.imageView));
+		key.push_back(static_cast<uint64_t>(write.ImageInfo.imageLayout));
+	}
+	return key;
+}
+
+size_t DescriptorAllocator::KeyHash::operator()(const Key& key) const
+{
+	// 64 bit FNV-1a over the words of the key
+	uint64_t hash = 14695981039346656037ull;
+	for (uint64_t word : key)
+	{
+		hash = (hash ^ word) * 1099511628211ull;
+	}
+	return static_cast<size_t>(hash);
+}
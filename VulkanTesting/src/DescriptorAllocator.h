@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+// Descriptor sets for any layout, from pools created as they fill up. Persistent sets live until they are released,
+// transient ones until their frame slot comes around again, when the slot's pools are reset in one go. Sets are cached
+// by layout and bound resources, so binding the same resources twice gives the same set without writing it again.
+// Render thread only, or the main thread during startup. Render graph passes record on worker threads, so they only
+// bind sets allocated before the graph executes
+class DescriptorAllocator
+{
+public:
+	// One descriptor of a set, a buffer or an image depending on its type
+	struct Write
+	{
+		uint32_t Binding;
+		VkDescriptorType Type;
+		VkDescriptorBufferInfo BufferInfo{};
+		VkDescriptorImageInfo ImageInfo{};
+	};
+	static Write Buffer(uint32_t binding, VkDescriptorType type, VkBuffer buffer, VkDeviceSize offset = 0, VkDeviceSize range = VK_WHOLE_SIZE);
+	static Write Image(uint32_t binding, VkDescriptorType type, VkImageView imageView, VkImageLayout layout, VkSampler sampler = VK_NULL_HANDLE);
+
+	void Setup(VkDevice device, uint32_t framesInFlight);
+	void Destroy();
+
+	// Resets the pools of the slot's transient sets. Called once the slot's previous commands have completed
+	void BeginFrame(uint32_t frame);
+
+	// A set the caller writes and updates itself, for bindings that change in place
+	VkDescriptorSet Allocate(VkDescriptorSetLayout layout);
+	// The set binding these resources, written the first time they are asked for and shared from then on
+	VkDescriptorSet GetSet(VkDescriptorSetLayout layout, const std::vector<Write>& writes);
+	// A set from GetSet whose resources are going away. It is reused for new bindings of its layout once the frames that
+	// may still use it have completed
+	void Release(VkDescriptorSet set);
+	// Written now and valid until the current frame slot begins again
+	VkDescriptorSet AllocateTransient(VkDescriptorSetLayout layout, const std::vector<Write>& writes);
+
+	uint32_t GetPoolCount() const;
+	uint32_t GetCachedSetCount() const { return static_cast<uint32_t>(m_CachedSets.size()); }
+
+	// A new pool holds twice the sets of the previous one of its group, up to the maximum
+	static constexpr uint32_t s_InitialSetsPerPool = 32;
+	static constexpr uint32_t s_MaxSetsPerPool = 4096;
+
+private:
+	// Pools with room left and pools that ran out. Allocating only tries the last ready pool
+	struct PoolGroup
+	{
+		std::vector<VkDescriptorPool> Ready;
+		std::vector<VkDescriptorPool> Full;
+		uint32_t SetsPerPool = s_InitialSetsPerPool;
+	};
+
+	struct CachedSet
+	{
+		VkDescriptorSetLayout Layout;
+		std::vector<uint64_t> Key;
+	};
+
+	struct PendingRelease
+	{
+		VkDescriptorSet Set;
+		VkDescriptorSetLayout Layout;
+		uint32_t FramesLeft;
+	};
+
+	// Sets are looked up by their layout and writes, hashed with FNV-1a
+	using Key = std::vector<uint64_t>;
+	struct KeyHash
+	{
+		size_t operator()(const Key& key) const;
+	};
+
+	VkDescriptorSet AllocateFrom(PoolGroup& group, VkDescriptorSetLayout layout);
+	VkDescriptorPool CreatePool(uint32_t maxSets);
+	void WriteSet(VkDescriptorSet set, const std::vector<Write>& writes);
+	static Key MakeKey(VkDescriptorSetLayout layout, const std::vector<Write>& writes);
+
+	VkDevice m_Device;
+	uint32_t m_FramesInFlight;
+	uint32_t m_CurrentFrame = 0;
+	PoolGroup m_PersistentPools;
+	std::vector<PoolGroup> m_FramePools;
+
+	std::unordered_map<Key, VkDescriptorSet, KeyHash> m_SetCache;
+	std::unordered_map<VkDescriptorSet, CachedSet> m_CachedSets;
+	std::unordered_map<VkDescriptorSetLayout, std::vector<VkDescriptorSet>> m_FreeSets; // Released sets by layout
+	std::vector<PendingRelease> m_PendingReleases;
+};
@@ -0,0 +1,180 @@
+#include "DeviceProbe.h"
+
+#include <vector>
+
+double DeviceProbe::MeasureCopyBandwidth(VkPhysicalDevice physicalDevice, uint32_t queueFamily)
+{
+	float queuePriority = 1.0f;
+	VkDeviceQueueCreateInfo queueInfo{};
+	queueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+	queueInfo.queueFamilyIndex = queueFamily;
+	queueInfo.queueCount = 1;
+	queueInfo.pQueuePriorities = &queuePriority;
+
+	// Copies need no features or extensions
+	VkDeviceCreateInfo deviceInfo{};
+	deviceInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	deviceInfo.queueCreateInfoCount = 1;
+	deviceInfo.pQueueCreateInfos = &queueInfo;
+	VkDevice device;
+	if (vkCreateDevice(physicalDevice, &deviceInfo, nullptr, &device) != VK_SUCCESS)
+	{
+		return 0.0;
+	}
+
+	Resources resources;
+	double bandwidth = TimeCopies(physicalDevice, device, queueFamily, resources);
+	Destroy(device, resources);
+	vkDestroyDevice(device, nullptr);
+	return bandwidth;
+}
+
+double DeviceProbe::TimeCopies(VkPhysicalDevice physicalDevice, VkDevice device, uint32_t queueFamily, Resources& resources)
+{
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+	uint32_t familyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> families(familyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, families.data());
+	uint32_t timestampBits = families[queueFamily].timestampValidBits;
+	if (timestampBits == 0)
+	{
+		return 0.0;
+	}
+
+	VkPhysicalDeviceMemoryProperties memProperties;
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+	for (size_t i = 0; i < resources.Buffers.size(); ++i)
+	{
+		VkBufferCreateInfo bufferInfo{};
+		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bufferInfo.size = s_BufferSize;
+		bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+		bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		if (vkCreateBuffer(device, &bufferInfo, nullptr, &resources.Buffers[i]) != VK_SUCCESS)
+		{
+			return 0.0;
+		}
+
+		VkMemoryRequirements requirements;
+		vkGetBufferMemoryRequirements(device, resources.Buffers[i], &requirements);
+		VkMemoryAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		allocInfo.allocationSize = requirements.size;
+		allocInfo.memoryTypeIndex = memProperties.memoryTypeCount;
+		for (uint32_t type = 0; type < memProperties.memoryTypeCount; ++type)
+		{
+			if ((requirements.memoryTypeBits & (1 << type)) && (memProperties.memoryTypes[type].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+			{
+				allocInfo.memoryTypeIndex = type;
+				break;
+			}
+		}
+		if (allocInfo.memoryTypeIndex == memProperties.memoryTypeCount
+			|| vkAllocateMemory(device, &allocInfo, nullptr, &resources.Memories[i]) != VK_SUCCESS)
+		{
+			return 0.0;
+		}
+		vkBindBufferMemory(device, resources.Buffers[i], resources.Memories[i], 0);
+	}
+
+	VkQueryPoolCreateInfo queryPoolInfo{};
+	queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	queryPoolInfo.queryCount = 2;
+	VkCommandPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.queueFamilyIndex = queueFamily;
+	VkFenceCreateInfo fenceInfo{};
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	if (vkCreateQueryPool(device, &queryPoolInfo, nullptr, &resources.QueryPool) != VK_SUCCESS
+		|| vkCreateCommandPool(device, &poolInfo, nullptr, &resources.CommandPool) != VK_SUCCESS
+		|| vkCreateFence(device, &fenceInfo, nullptr, &resources.Fence) != VK_SUCCESS)
+	{
+		return 0.0;
+	}
+
+	VkCommandBufferAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.commandPool = resources.CommandPool;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandBufferCount = 1;
+	VkCommandBuffer commandBuffer;
+	if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) != VK_SUCCESS)
+	{
+		return 0.0;
+	}
+
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	vkBeginCommandBuffer(commandBuffer, &beginInfo);
+	vkCmdResetQueryPool(commandBuffer, resources.QueryPool, 0, 2);
+
+	// Each copy reads what the previous one wrote, so they cannot overlap
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+	vkCmdFillBuffer(commandBuffer, resources.Buffers[0], 0, VK_WHOLE_SIZE, 0);
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, resources.QueryPool, 0);
+	VkBufferCopy region{ 0, 0, s_BufferSize };
+	for (uint32_t i = 0; i < s_CopyCount; ++i)
+	{
+		vkCmdCopyBuffer(commandBuffer, resources.Buffers[i % 2], resources.Buffers[(i + 1) % 2], 1, &region);
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+	}
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, resources.QueryPool, 1);
+	if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+	{
+		return 0.0;
+	}
+
+	VkSubmitInfo submitInfo{};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+	VkQueue queue;
+	vkGetDeviceQueue(device, queueFamily, 0, &queue);
+	if (vkQueueSubmit(queue, 1, &submitInfo, resources.Fence) != VK_SUCCESS
+		|| vkWaitForFences(device, 1, &resources.Fence, VK_TRUE, UINT64_MAX) != VK_SUCCESS)
+	{
+		return 0.0;
+	}
+
+	std::array<uint64_t, 2> timestamps{};
+	if (vkGetQueryPoolResults(
+		device,
+		resources.QueryPool,
+		0,
+		2,
+		sizeof(timestamps),
+		timestamps.data(),
+		sizeof(uint64_t),
+		VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT) != VK_SUCCESS)
+	{
+		return 0.0;
+	}
+
+	// Only the valid bits count, the counter may wrap around between the two
+	uint64_t mask = timestampBits < 64 ? (uint64_t(1) << timestampBits) - 1 : UINT64_MAX;
+	uint64_t ticks = (timestamps[1] - timestamps[0]) & mask;
+	double seconds = static_cast<double>(ticks) * properties.limits.timestampPeriod / 1e9;
+	return seconds > 0.0 ? static_cast<double>(s_BufferSize) * s_CopyCount / seconds / 1e9 : 0.0;
+}
+
+void DeviceProbe::Destroy(VkDevice device, Resources& resources)
+{
+	// A failed submission may still leave work behind
+	vkDeviceWaitIdle(device);
+	vkDestroyFence(device, resources.Fence, nullptr);
+	vkDestroyCommandPool(device, resources.CommandPool, nullptr);
+	vkDestroyQueryPool(device, resources.QueryPool, nullptr);
+	for (size_t i = 0; i < resources.Buffers.size(); ++i)
+	{
+		vkDestroyBuffer(device, resources.Buffers[i], nullptr);
+		vkFreeMemory(device, resources.Memories[i], nullptr);
+	}
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <array>
+#include <vulkan/vulkan.h>
+
+// Short measurements run on a temporary logical device while picking a physical device, to tell apart devices that
+// look alike on paper
+class DeviceProbe
+{
+public:
+	// Copies between two device local buffers on the family's first queue, timed with timestamps. Returns GB/s, or 0
+	// when the device cannot run or time the copies
+	static double MeasureCopyBandwidth(VkPhysicalDevice physicalDevice, uint32_t queueFamily);
+
+private:
+	static constexpr VkDeviceSize s_BufferSize = 64 * 1024 * 1024;
+	static constexpr uint32_t s_CopyCount = 8;
+
+	// Objects of the temporary device, null until created
+	struct Resources
+	{
+		std::array<VkBuffer, 2> Buffers{};
+		std::array<VkDeviceMemory, 2> Memories{};
+		VkQueryPool QueryPool = VK_NULL_HANDLE;
+		VkCommandPool CommandPool = VK_NULL_HANDLE;
+		VkFence Fence = VK_NULL_HANDLE;
+	};
+
+	static double TimeCopies(VkPhysicalDevice physicalDevice, VkDevice device, uint32_t queueFamily, Resources& resources);
+	static void Destroy(VkDevice device, Resources& resources);
+};
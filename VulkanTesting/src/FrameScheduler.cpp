@@ -0,0 +1,216 @@
+#include "FrameScheduler.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+void FrameScheduler::Setup(VkDevice device, const std::array<VkQueue, QueueTypeCount>& queues, uint32_t framesInFlight, Profiler* profiler)
+{
+	m_Device = device;
+	m_Profiler = profiler;
+
+	VkSemaphoreTypeCreateInfoKHR typeInfo{};
+	typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+	typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+	typeInfo.initialValue = 0;
+
+	VkSemaphoreCreateInfo semaphoreInfo{};
+	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	semaphoreInfo.pNext = &typeInfo;
+
+	for (uint32_t type = 0; type < QueueTypeCount; ++type)
+	{
+		auto timeline = std::find_if(m_Timelines.begin(), m_Timelines.end(), [&](const Timeline& timeline)
+		{
+			return timeline.Queue == queues[type];
+		});
+		if (timeline != m_Timelines.end())
+		{
+			m_TimelineIndices[type] = static_cast<uint32_t>(timeline - m_Timelines.begin());
+			continue;
+		}
+
+		m_TimelineIndices[type] = static_cast<uint32_t>(m_Timelines.size());
+		m_Timelines.push_back({ queues[type] });
+		if (vkCreateSemaphore(m_Device, &semaphoreInfo, nullptr, &m_Timelines.back().Semaphore) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create timeline semaphore");
+		}
+	}
+
+	m_FrameValues.assign(framesInFlight, std::vector<uint64_t>(m_Timelines.size(), 0));
+}
+
+void FrameScheduler::Destroy()
+{
+	for (Timeline& timeline : m_Timelines)
+	{
+		vkDestroySemaphore(m_Device, timeline.Semaphore, nullptr);
+	}
+	m_Timelines.clear();
+	m_FrameValues.clear();
+}
+
+void FrameScheduler::BeginFrame(uint32_t frame)
+{
+	m_Frame = frame;
+	WaitValues(m_FrameValues[frame]);
+	std::fill(m_FrameValues[frame].begin(), m_FrameValues[frame].end(), 0);
+
+	m_FrameWaitMs = m_PendingWaitMs;
+	m_PendingWaitMs = 0.0;
+	if (m_Profiler != nullptr)
+	{
+		m_Profiler->SetCounter("CPU wait (ms)", m_FrameWaitMs);
+	}
+}
+
+FrameScheduler::SyncPoint FrameScheduler::Submit(QueueType queue, const Submission& submission)
+{
+	uint32_t timelineIndex = m_TimelineIndices[queue];
+	Timeline& timeline = m_Timelines[timelineIndex];
+
+	// Values are only read for timeline semaphores, binary ones get a placeholder
+	std::vector<VkSemaphore> waitSemaphores;
+	std::vector<uint64_t> waitValues;
+	std::vector<VkPipelineStageFlags> waitStages;
+	for (const Dependency& dependency : submission.Waits)
+	{
+		if (dependency.Point.Value == 0)
+		{
+			continue;
+		}
+		waitSemaphores.push_back(m_Timelines[m_TimelineIndices[dependency.Point.Queue]].Semaphore);
+		waitValues.push_back(dependency.Point.Value);
+		waitStages.push_back(dependency.Stages);
+	}
+	if (submission.WaitSemaphore != VK_NULL_HANDLE)
+	{
+		waitSemaphores.push_back(submission.WaitSemaphore);
+		waitValues.push_back(0);
+		waitStages.push_back(submission.WaitSemaphoreStages);
+	}
+
+	SyncPoint point = { queue, timeline.LastSubmitted + 1 };
+	std::vector<VkSemaphore> signalSemaphores = { timeline.Semaphore };
+	std::vector<uint64_t> signalValues = { point.Value };
+	if (submission.SignalSemaphore != VK_NULL_HANDLE)
+	{
+		signalSemaphores.push_back(submission.SignalSemaphore);
+		signalValues.push_back(0);
+	}
+
+	VkTimelineSemaphoreSubmitInfoKHR timelineInfo{};
+	timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+	timelineInfo.waitSemaphoreValueCount = static_cast<uint32_t>(waitValues.size());
+	timelineInfo.pWaitSemaphoreValues = waitValues.data();
+	timelineInfo.signalSemaphoreValueCount = static_cast<uint32_t>(signalValues.size());
+	timelineInfo.pSignalSemaphoreValues = signalValues.data();
+
+	VkSubmitInfo submitInfo{};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.pNext = &timelineInfo;
+	submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+	submitInfo.pWaitSemaphores = waitSemaphores.data();
+	submitInfo.pWaitDstStageMask = waitStages.data();
+	submitInfo.commandBufferCount = static_cast<uint32_t>(submission.CommandBuffers.size());
+	submitInfo.pCommandBuffers = submission.CommandBuffers.data();
+	submitInfo.signalSemaphoreCount = static_cast<uint32_t>(signalSemaphores.size());
+	submitInfo.pSignalSemaphores = signalSemaphores.data();
+	if (vkQueueSubmit(timeline.Queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to submit command buffers");
+	}
+
+	timeline.LastSubmitted = point.Value;
+	m_FrameValues[m_Frame][timelineIndex] = point.Value;
+	return point;
+}
+
+bool FrameScheduler::IsComplete(const SyncPoint& point)
+{
+	Timeline& timeline = m_Timelines[m_TimelineIndices[point.Queue]];
+	if (point.Value > timeline.LastCompleted)
+	{
+		vkGetSemaphoreCounterValueKHR(m_Device, timeline.Semaphore, &timeline.LastCompleted);
+	}
+	return point.Value <= timeline.LastCompleted;
+}
+
+void FrameScheduler::Wait(const SyncPoint& point)
+{
+	std::vector<uint64_t> values(m_Timelines.size(), 0);
+	values[m_TimelineIndices[point.Queue]] = point.Value;
+	WaitValues(values);
+}
+
+void FrameScheduler::WaitIdle()
+{
+	std::vector<uint64_t> values;
+	for (const Timeline& timeline : m_Timelines)
+	{
+		values.push_back(timeline.LastSubmitted);
+	}
+	WaitValues(values);
+}
+
+uint32_t FrameScheduler::GetFramesInFlight()
+{
+	for (Timeline& timeline : m_Timelines)
+	{
+		vkGetSemaphoreCounterValueKHR(m_Device, timeline.Semaphore, &timeline.LastCompleted);
+	}
+
+	uint32_t framesInFlight = 0;
+	for (const std::vector<uint64_t>& values : m_FrameValues)
+	{
+		for (size_t i = 0; i < values.size(); ++i)
+		{
+			if (values[i] > m_Timelines[i].LastCompleted)
+			{
+				++framesInFlight;
+				break;
+			}
+		}
+	}
+	return framesInFlight;
+}
+
+void FrameScheduler::WaitValues(const std::vector<uint64_t>& values)
+{
+	std::vector<VkSemaphore> semaphores;
+	std::vector<uint64_t> pendingValues;
+	for (size_t i = 0; i < values.size(); ++i)
+	{
+		if (values[i] > m_Timelines[i].LastCompleted)
+		{
+			semaphores.push_back(m_Timelines[i].Semaphore);
+			pendingValues.push_back(values[i]);
+		}
+	}
+	if (semaphores.empty())
+	{
+		return;
+	}
+
+	VkSemaphoreWaitInfoKHR waitInfo{};
+	waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+	waitInfo.semaphoreCount = static_cast<uint32_t>(semaphores.size());
+	waitInfo.pSemaphores = semaphores.data();
+	waitInfo.pValues = pendingValues.data();
+
+	auto waitStart = std::chrono::high_resolution_clock::now();
+	if (vkWaitSemaphoresKHR(m_Device, &waitInfo, UINT64_MAX) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to wait for timeline semaphores");
+	}
+	double waitMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - waitStart).count();
+	m_PendingWaitMs += waitMs;
+	m_TotalWaitMs += waitMs;
+
+	for (size_t i = 0; i < values.size(); ++i)
+	{
+		m_Timelines[i].LastCompleted = std::max(m_Timelines[i].LastCompleted, values[i]);
+	}
+}
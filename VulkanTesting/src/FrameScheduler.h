@@ -0,0 +1,93 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+class Profiler;
+
+// Orders GPU work with one timeline semaphore per queue. Every submission signals the next value of its queue's
+// timeline, so work on any queue can wait for work on any other by value, and the CPU only blocks on the submissions
+// that still use what it is about to reuse. Queue types without a queue of their own share the graphics timeline
+class FrameScheduler
+{
+public:
+	enum QueueType : uint32_t
+	{
+		Graphics = 0,
+		Compute = 1,
+		Transfer = 2,
+		QueueTypeCount
+	};
+
+	// Reached once every submission to the queue up to Value has completed. Value 0 is always reached
+	struct SyncPoint
+	{
+		QueueType Queue = Graphics;
+		uint64_t Value = 0;
+	};
+
+	struct Dependency
+	{
+		SyncPoint Point;
+		VkPipelineStageFlags Stages; // Stages of the submission that wait for the point
+	};
+
+	struct Submission
+	{
+		std::vector<VkCommandBuffer> CommandBuffers;
+		std::vector<Dependency> Waits;
+		// Binary semaphores for the swapchain, which cannot use timeline semaphores
+		VkSemaphore WaitSemaphore = VK_NULL_HANDLE;
+		VkPipelineStageFlags WaitSemaphoreStages = 0;
+		VkSemaphore SignalSemaphore = VK_NULL_HANDLE;
+	};
+
+	// Queues may repeat, queue types given the same queue share its timeline
+	void Setup(VkDevice device, const std::array<VkQueue, QueueTypeCount>& queues, uint32_t framesInFlight, Profiler* profiler);
+	void Destroy();
+
+	// Waits until the submissions made the last time this frame slot was used have completed, so its resources can be
+	// reused. Later submissions belong to the frame until the next call
+	void BeginFrame(uint32_t frame);
+	SyncPoint Submit(QueueType queue, const Submission& submission);
+
+	bool IsComplete(const SyncPoint& point);
+	// Blocks until the point is reached, counted in the frame's wait time
+	void Wait(const SyncPoint& point);
+	// Blocks until everything submitted so far has completed
+	void WaitIdle();
+	// Frame slots whose submissions have not all completed yet
+	uint32_t GetFramesInFlight();
+
+	VkQueue GetQueue(QueueType queue) const { return m_Timelines[m_TimelineIndices[queue]].Queue; }
+	bool HasOwnQueue(QueueType queue) const { return queue == Graphics || m_TimelineIndices[queue] != m_TimelineIndices[Graphics]; }
+	// CPU time spent blocked since the previous frame began, including the wait for this frame slot
+	double GetFrameWaitMs() const { return m_FrameWaitMs; }
+	double GetTotalWaitMs() const { return m_TotalWaitMs; }
+
+private:
+	struct Timeline
+	{
+		VkQueue Queue;
+		VkSemaphore Semaphore = VK_NULL_HANDLE;
+		uint64_t LastSubmitted = 0;
+		uint64_t LastCompleted = 0; // Cached, so reached points are recognized without asking the device
+	};
+
+	// Waits for all values at once, values of 0 are skipped
+	void WaitValues(const std::vector<uint64_t>& values);
+
+	VkDevice m_Device;
+	Profiler* m_Profiler;
+	std::vector<Timeline> m_Timelines;
+	std::array<uint32_t, QueueTypeCount> m_TimelineIndices{};
+
+	// Last value each timeline signaled for each frame slot
+	std::vector<std::vector<uint64_t>> m_FrameValues;
+	uint32_t m_Frame = 0;
+
+	double m_FrameWaitMs = 0.0;
+	double m_PendingWaitMs = 0.0; // Waited since the frame began, reported with the next frame
+	double m_TotalWaitMs = 0.0;
+};
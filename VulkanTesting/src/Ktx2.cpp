@@ -0,0 +1,219 @@
+#include "Ktx2.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+static constexpr std::array<uint8_t, 12> s_Identifier = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+
+struct Ktx2Header
+{
+	uint8_t Identifier[12];
+	uint32_t VkFormat;
+	uint32_t TypeSize;
+	uint32_t PixelWidth;
+	uint32_t PixelHeight;
+	uint32_t PixelDepth;
+	uint32_t LayerCount;
+	uint32_t FaceCount;
+	uint32_t LevelCount;
+	uint32_t SupercompressionScheme;
+	uint32_t DfdByteOffset;
+	uint32_t DfdByteLength;
+	uint32_t KvdByteOffset;
+	uint32_t KvdByteLength;
+	uint64_t SgdByteOffset;
+	uint64_t SgdByteLength;
+};
+
+struct Ktx2LevelIndex
+{
+	uint64_t ByteOffset;
+	uint64_t ByteLength;
+	uint64_t UncompressedByteLength;
+};
+
+// Khronos Data Format basic descriptor block, one sample per channel
+static std::vector<uint32_t> BuildDataFormatDescriptor(VkFormat format)
+{
+	struct Sample
+	{
+		uint32_t ChannelType;
+		uint32_t BitOffset;
+		uint32_t BitLength;
+		uint32_t Upper;
+	};
+
+	uint32_t colorModel;
+	uint32_t blockDimension = Ktx2::IsBlockCompressed(format) ? 3 : 0; // Stored as size minus one
+	std::vector<Sample> samples;
+	switch (format)
+	{
+	case VK_FORMAT_R8G8B8A8_SRGB:
+		colorModel = 1; // RGBSDA
+		samples = { { 0, 0, 8, 255 }, { 1, 8, 8, 255 }, { 2, 16, 8, 255 }, { 15 | 0x10, 24, 8, 255 } }; // Alpha is linear
+		break;
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+		colorModel = 128; // BC1A
+		samples = { { 0, 0, 64, 0xFFFFFFFF } };
+		break;
+	case VK_FORMAT_BC7_SRGB_BLOCK:
+		colorModel = 135; // BC7
+		samples = { { 0, 0, 128, 0xFFFFFFFF } };
+		break;
+	case VK_FORMAT_ASTC_4x4_SRGB_BLOCK:
+		colorModel = 162; // ASTC
+		samples = { { 0, 0, 128, 0xFFFFFFFF } };
+		break;
+	default:
+		throw std::runtime_error("Unsupported KTX2 texture format");
+	}
+
+	uint32_t blockSize = 24 + 16 * static_cast<uint32_t>(samples.size());
+	std::vector<uint32_t> words;
+	words.push_back(4 + blockSize); // Total size
+	words.push_back(0); // Vendor and descriptor type
+	words.push_back(2 | blockSize << 16); // Version and block size
+	words.push_back(colorModel | 1 << 8 | 2 << 16); // BT.709 primaries, sRGB transfer
+	words.push_back(blockDimension | blockDimension << 8);
+	words.push_back(Ktx2::GetBlockSize(format));
+	words.push_back(0);
+	for (const Sample& sample : samples)
+	{
+		words.push_back(sample.BitOffset | (sample.BitLength - 1) << 16 | sample.ChannelType << 24);
+		words.push_back(0); // Sample position
+		words.push_back(0);
+		words.push_back(sample.Upper);
+	}
+	return words;
+}
+
+bool Ktx2::Read(const std::string& path, TextureData& texture)
+{
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file.is_open())
+	{
+		return false;
+	}
+	size_t fileSize = static_cast<size_t>(file.tellg());
+	std::vector<uint8_t> bytes(fileSize);
+	file.seekg(0);
+	file.read(reinterpret_cast<char*>(bytes.data()), fileSize);
+
+	Ktx2Header header;
+	if (fileSize < sizeof(header))
+	{
+		return false;
+	}
+	memcpy(&header, bytes.data(), sizeof(header));
+	if (memcmp(header.Identifier, s_Identifier.data(), s_Identifier.size()) != 0
+		|| header.SupercompressionScheme != 0
+		|| header.PixelDepth != 0
+		|| header.LayerCount > 1
+		|| header.FaceCount != 1
+		|| header.LevelCount == 0)
+	{
+		return false;
+	}
+
+	texture.Format = static_cast<VkFormat>(header.VkFormat);
+	texture.Width = header.PixelWidth;
+	texture.Height = header.PixelHeight;
+	if (GetBlockSize(texture.Format) == 0 || fileSize < sizeof(header) + sizeof(Ktx2LevelIndex) * header.LevelCount)
+	{
+		return false;
+	}
+
+	texture.Levels.resize(header.LevelCount);
+	for (uint32_t i = 0; i < header.LevelCount; ++i)
+	{
+		Ktx2LevelIndex level;
+		memcpy(&level, bytes.data() + sizeof(header) + sizeof(level) * i, sizeof(level));
+		uint32_t width = std::max(texture.Width >> i, 1u);
+		uint32_t height = std::max(texture.Height >> i, 1u);
+		if (level.ByteLength != GetLevelSize(texture.Format, width, height) || level.ByteOffset + level.ByteLength > fileSize)
+		{
+			return false;
+		}
+		texture.Levels[i].assign(bytes.begin() + level.ByteOffset, bytes.begin() + level.ByteOffset + level.ByteLength);
+	}
+	return true;
+}
+
+void Ktx2::Write(const std::string& path, const TextureData& texture)
+{
+	std::vector<uint32_t> dfd = BuildDataFormatDescriptor(texture.Format);
+
+	Ktx2Header header{};
+	memcpy(header.Identifier, s_Identifier.data(), s_Identifier.size());
+	header.VkFormat = texture.Format;
+	header.TypeSize = 1;
+	header.PixelWidth = texture.Width;
+	header.PixelHeight = texture.Height;
+	header.FaceCount = 1;
+	header.LevelCount = static_cast<uint32_t>(texture.Levels.size());
+	header.DfdByteOffset = static_cast<uint32_t>(sizeof(header) + sizeof(Ktx2LevelIndex) * texture.Levels.size());
+	header.DfdByteLength = static_cast<uint32_t>(dfd.size() * sizeof(uint32_t));
+
+	// Levels are stored smallest first, each aligned to the block size
+	size_t alignment = std::max<size_t>(GetBlockSize(texture.Format), 4);
+	std::vector<Ktx2LevelIndex> levels(texture.Levels.size());
+	size_t offset = header.DfdByteOffset + header.DfdByteLength;
+	for (size_t i = texture.Levels.size(); i-- > 0;)
+	{
+		offset = (offset + alignment - 1) / alignment * alignment;
+		levels[i].ByteOffset = offset;
+		levels[i].ByteLength = texture.Levels[i].size();
+		levels[i].UncompressedByteLength = texture.Levels[i].size();
+		offset += texture.Levels[i].size();
+	}
+
+	std::vector<uint8_t> bytes(offset, 0);
+	memcpy(bytes.data(), &header, sizeof(header));
+	memcpy(bytes.data() + sizeof(header), levels.data(), sizeof(Ktx2LevelIndex) * levels.size());
+	memcpy(bytes.data() + header.DfdByteOffset, dfd.data(), header.DfdByteLength);
+	for (size_t i = 0; i < texture.Levels.size(); ++i)
+	{
+		memcpy(bytes.data() + levels[i].ByteOffset, texture.Levels[i].data(), texture.Levels[i].size());
+	}
+
+	std::ofstream file(path, std::ios::binary);
+	if (!file.is_open())
+	{
+		throw std::runtime_error("Failed to write texture cache");
+	}
+	file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+}
+
+uint32_t Ktx2::GetBlockSize(VkFormat format)
+{
+	switch (format)
+	{
+	case VK_FORMAT_R8G8B8A8_SRGB:
+		return 4;
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+		return 8;
+	case VK_FORMAT_BC7_SRGB_BLOCK:
+	case VK_FORMAT_ASTC_4x4_SRGB_BLOCK:
+		return 16;
+	default:
+		return 0;
+	}
+}
+
+bool Ktx2::IsBlockCompressed(VkFormat format)
+{
+	return format != VK_FORMAT_R8G8B8A8_SRGB;
+}
+
+size_t Ktx2::GetLevelSize(VkFormat format, uint32_t width, uint32_t height)
+{
+	if (IsBlockCompressed(format))
+	{
+		width = (width + 3) / 4;
+		height = (height + 3) / 4;
+	}
+	return static_cast<size_t>(width) * height * GetBlockSize(format);
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <string>
+
+#include "TextureData.h"
+
+// Reads and writes single image KTX2 containers without supercompression, holding the mips ready for upload
+class Ktx2
+{
+public:
+	// Returns false if the file is missing or is not a texture this loader handles
+	static bool Read(const std::string& path, TextureData& texture);
+	static void Write(const std::string& path, const TextureData& texture);
+
+	// Bytes per texel for uncompressed formats, per 4x4 block for block compressed ones
+	static uint32_t GetBlockSize(VkFormat format);
+	static bool IsBlockCompressed(VkFormat format);
+	static size_t GetLevelSize(VkFormat format, uint32_t width, uint32_t height);
+};
@@ -0,0 +1,154 @@
+#include "MemoryBudget.h"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+static double ToMegabytes(VkDeviceSize size)
+{
+	return static_cast<double>(size) / (1024.0 * 1024.0);
+}
+
+void MemoryBudget::Setup(VkDevice device, VkPhysicalDevice physicalDevice, bool budgetExtensionEnabled)
+{
+	m_Device = device;
+	m_PhysicalDevice = physicalDevice;
+	m_BudgetExtensionEnabled = budgetExtensionEnabled;
+	vkGetPhysicalDeviceMemoryProperties(m_PhysicalDevice, &m_MemoryProperties);
+	Update();
+}
+
+VkDeviceMemory MemoryBudget::Allocate(const VkMemoryAllocateInfo& allocInfo, Category category)
+{
+	VkDeviceMemory memory;
+	VkResult result = vkAllocateMemory(m_Device, &allocInfo, nullptr, &memory);
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	uint32_t heapIndex = m_MemoryProperties.memoryTypes[allocInfo.memoryTypeIndex].heapIndex;
+	if (result != VK_SUCCESS)
+	{
+		std::string reason = result == VK_ERROR_OUT_OF_DEVICE_MEMORY || result == VK_ERROR_OUT_OF_HOST_MEMORY ? "out of memory" : "error";
+		throw std::runtime_error("Failed to allocate " + std::to_string(allocInfo.allocationSize) + " bytes of "
+			+ GetCategoryName(category) + " memory (" + reason + ", heap " + std::to_string(heapIndex) + " has "
+			+ std::to_string(m_AllocatedPerHeap[heapIndex]) + " bytes allocated of a "
+			+ std::to_string(m_HeapBudget[heapIndex]) + " byte budget)");
+	}
+
+	// Lazily allocated memory is only backed if transient attachments spill out of tile memory, which is rare
+	VkDeviceSize size = allocInfo.allocationSize;
+	if (m_MemoryProperties.memoryTypes[allocInfo.memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT)
+	{
+		size = 0;
+	}
+	m_Allocations[memory] = { category, heapIndex, size };
+	m_CategoryUsage[category] += size;
+	m_PeakCategoryUsage[category] = std::max(m_PeakCategoryUsage[category], m_CategoryUsage[category]);
+	m_AllocatedPerHeap[heapIndex] += size;
+	return memory;
+}
+
+void MemoryBudget::Free(VkDeviceMemory memory)
+{
+	if (memory == VK_NULL_HANDLE)
+	{
+		return;
+	}
+	vkFreeMemory(m_Device, memory, nullptr);
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	auto allocation = m_Allocations.find(memory);
+	if (allocation == m_Allocations.end())
+	{
+		throw std::runtime_error("Freed device memory that was not allocated through the memory budget");
+	}
+	m_CategoryUsage[allocation->second.MemoryCategory] -= allocation->second.Size;
+	m_AllocatedPerHeap[allocation->second.HeapIndex] -= allocation->second.Size;
+	m_Allocations.erase(allocation);
+}
+
+void MemoryBudget::Update()
+{
+	VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT };
+	if (m_BudgetExtensionEnabled)
+	{
+		VkPhysicalDeviceMemoryProperties2 memoryProperties2{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2 };
+		memoryProperties2.pNext = &budgetProperties;
+		vkGetPhysicalDeviceMemoryProperties2(m_PhysicalDevice, &memoryProperties2);
+	}
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	for (uint32_t i = 0; i < m_MemoryProperties.memoryHeapCount; ++i)
+	{
+		if (m_BudgetExtensionEnabled)
+		{
+			// Usage includes what the driver allocated on our behalf, and the budget shrinks as other processes take memory
+			m_HeapUsage[i] = budgetProperties.heapUsage[i];
+			m_HeapBudget[i] = budgetProperties.heapBudget[i];
+		}
+		else
+		{
+			m_HeapUsage[i] = m_AllocatedPerHeap[i];
+			m_HeapBudget[i] = static_cast<VkDeviceSize>(m_MemoryProperties.memoryHeaps[i].size * s_FallbackBudgetShare);
+		}
+	}
+
+	m_PeakDeviceLocalUsage = std::max(m_PeakDeviceLocalUsage, SumDeviceLocal(m_HeapUsage));
+}
+
+VkDeviceSize MemoryBudget::GetUsage(Category category) const
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_CategoryUsage[category];
+}
+
+VkDeviceSize MemoryBudget::GetDeviceLocalUsage() const
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return SumDeviceLocal(m_HeapUsage);
+}
+
+VkDeviceSize MemoryBudget::GetDeviceLocalBudget() const
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return SumDeviceLocal(m_HeapBudget);
+}
+
+void MemoryBudget::PrintReport() const
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	std::cout << "Device memory (MB, current / peak):";
+	for (uint32_t i = 0; i < CategoryCount; ++i)
+	{
+		std::cout << " " << GetCategoryName(static_cast<Category>(i)) << " " << ToMegabytes(m_CategoryUsage[i])
+			<< " / " << ToMegabytes(m_PeakCategoryUsage[i]) << ",";
+	}
+	std::cout << " device local peak " << ToMegabytes(m_PeakDeviceLocalUsage)
+		<< (m_BudgetExtensionEnabled ? " (VK_EXT_memory_budget)" : " (tracked, no VK_EXT_memory_budget)") << std::endl;
+}
+
+VkDeviceSize MemoryBudget::SumDeviceLocal(const HeapSizes& sizes) const
+{
+	VkDeviceSize sum = 0;
+	for (uint32_t i = 0; i < m_MemoryProperties.memoryHeapCount; ++i)
+	{
+		if (m_MemoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+		{
+			sum += sizes[i];
+		}
+	}
+	return sum;
+}
+
+const char* MemoryBudget::GetCategoryName(Category category)
+{
+	switch (category)
+	{
+	case CategoryMeshes: return "meshes";
+	case CategoryTextures: return "textures";
+	case CategoryAttachments: return "attachments";
+	case CategoryAccelerationStructures: return "acceleration structures";
+	case CategoryStaging: return "staging";
+	default: return "other";
+	}
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vulkan/vulkan.h>
+
+// Every device memory allocation goes through here, tagged with what it holds. Heap budgets and usage are read once a
+// frame, from VK_EXT_memory_budget when the device has it. Without it the budget is a share of each heap's size and
+// usage is what was allocated here. Thread safe
+class MemoryBudget
+{
+public:
+	enum Category : uint32_t
+	{
+		CategoryMeshes,
+		CategoryTextures,
+		CategoryAttachments,
+		CategoryAccelerationStructures,
+		CategoryStaging,
+		CategoryOther,
+		CategoryCount
+	};
+
+	void Setup(VkDevice device, VkPhysicalDevice physicalDevice, bool budgetExtensionEnabled);
+
+	VkDeviceMemory Allocate(const VkMemoryAllocateInfo& allocInfo, Category category);
+	// Null handles are ignored, like vkFreeMemory does
+	void Free(VkDeviceMemory memory);
+
+	// Reads the heap budgets, once per frame
+	void Update();
+
+	VkDeviceSize GetUsage(Category category) const;
+	// Summed over the device local heaps, which is where running out hurts
+	VkDeviceSize GetDeviceLocalUsage() const;
+	VkDeviceSize GetDeviceLocalBudget() const;
+	void PrintReport() const;
+
+	static const char* GetCategoryName(Category category);
+
+	// Share of a heap assumed available without the extension, leaving room for other applications and the driver
+	static constexpr double s_FallbackBudgetShare = 0.8;
+
+private:
+	struct Allocation
+	{
+		Category MemoryCategory;
+		uint32_t HeapIndex;
+		VkDeviceSize Size;
+	};
+
+	using HeapSizes = std::array<VkDeviceSize, VK_MAX_MEMORY_HEAPS>;
+	// Callers hold the mutex
+	VkDeviceSize SumDeviceLocal(const HeapSizes& sizes) const;
+
+	VkDevice m_Device;
+	VkPhysicalDevice m_PhysicalDevice;
+	bool m_BudgetExtensionEnabled = false;
+	VkPhysicalDeviceMemoryProperties m_MemoryProperties{};
+
+	mutable std::mutex m_Mutex;
+	std::unordered_map<VkDeviceMemory, Allocation> m_Allocations;
+	std::array<VkDeviceSize, CategoryCount> m_CategoryUsage{};
+	HeapSizes m_AllocatedPerHeap{};
+	HeapSizes m_HeapUsage{};
+	HeapSizes m_HeapBudget{};
+	std::array<VkDeviceSize, CategoryCount> m_PeakCategoryUsage{};
+	VkDeviceSize m_PeakDeviceLocalUsage = 0;
+};
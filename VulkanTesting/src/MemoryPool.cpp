@@ -0,0 +1,191 @@
+#include "MemoryPool.h"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+static VkDeviceSize AlignUp(VkDeviceSize size, VkDeviceSize alignment)
+{
+	return (size + alignment - 1) / alignment * alignment;
+}
+
+void MemoryPool::Setup(VkDevice device, MemoryBudget* memoryBudget, MemoryBudget::Category category)
+{
+	m_Device = device;
+	m_MemoryBudget = memoryBudget;
+	m_Category = category;
+}
+
+void MemoryPool::Destroy()
+{
+	for (auto& [id, block] : m_Blocks)
+	{
+		m_MemoryBudget->Free(block.Memory);
+	}
+	m_Blocks.clear();
+	m_DefragmentedBlock = s_NoBlock;
+}
+
+bool MemoryPool::Allocate(const VkMemoryRequirements& requirements, uint32_t memoryTypeIndex, bool allowNewBlock, Allocation& allocation)
+{
+	VkDeviceSize offset;
+	for (auto& [id, block] : m_Blocks)
+	{
+		if (id != m_DefragmentedBlock && block.MemoryTypeIndex == memoryTypeIndex && AllocateFrom(block, requirements, offset))
+		{
+			allocation = { block.Memory, offset, requirements.size, id };
+			return true;
+		}
+	}
+	if (!allowNewBlock)
+	{
+		return false;
+	}
+
+	// Resources larger than a block get a block of their own
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = std::max(s_BlockSize, requirements.size);
+	allocInfo.memoryTypeIndex = memoryTypeIndex;
+
+	uint32_t id = m_NextBlockId++;
+	Block& block = m_Blocks[id];
+	block.Memory = m_MemoryBudget->Allocate(allocInfo, m_Category);
+	block.MemoryTypeIndex = memoryTypeIndex;
+	block.Size = allocInfo.allocationSize;
+	AllocateFrom(block, requirements, offset);
+	allocation = { block.Memory, offset, requirements.size, id };
+	return true;
+}
+
+void MemoryPool::Free(const Allocation& allocation)
+{
+	if (allocation.Memory == VK_NULL_HANDLE)
+	{
+		return;
+	}
+
+	auto block = m_Blocks.find(allocation.Block);
+	if (block == m_Blocks.end() || block->second.Allocations.erase(allocation.Offset) == 0)
+	{
+		throw std::runtime_error("Freed a range that is not in the memory pool");
+	}
+	block->second.UsedBytes -= allocation.Size;
+	if (!block->second.Allocations.empty())
+	{
+		return;
+	}
+
+	m_MemoryBudget->Free(block->second.Memory);
+	m_Blocks.erase(block);
+	if (allocation.Block == m_DefragmentedBlock)
+	{
+		m_DefragmentedBlock = s_NoBlock;
+		PrintStatistics("before defragmenting", m_StatisticsBeforeDefragmentation);
+		PrintStatistics("after defragmenting", GetStatistics());
+	}
+}
+
+bool MemoryPool::BeginDefragmentation()
+{
+	if (IsDefragmenting())
+	{
+		return true;
+	}
+
+	// The sparsest block whose ranges would fit in the free bytes of the other blocks of its type, though they may
+	// still be too scattered, which the owner finds out when a move fails
+	uint32_t sparsest = s_NoBlock;
+	double sparsestUsage = s_SparseBlockUsage;
+	for (const auto& [id, block] : m_Blocks)
+	{
+		double usage = static_cast<double>(block.UsedBytes) / static_cast<double>(block.Size);
+		if (usage >= sparsestUsage)
+		{
+			continue;
+		}
+
+		VkDeviceSize freeElsewhere = 0;
+		for (const auto& [otherId, other] : m_Blocks)
+		{
+			if (otherId != id && other.MemoryTypeIndex == block.MemoryTypeIndex)
+			{
+				freeElsewhere += other.Size - other.UsedBytes;
+			}
+		}
+		if (freeElsewhere >= block.UsedBytes)
+		{
+			sparsest = id;
+			sparsestUsage = usage;
+		}
+	}
+
+	if (sparsest != s_NoBlock)
+	{
+		m_DefragmentedBlock = sparsest;
+		m_StatisticsBeforeDefragmentation = GetStatistics();
+	}
+	return IsDefragmenting();
+}
+
+void MemoryPool::CancelDefragmentation()
+{
+	m_DefragmentedBlock = s_NoBlock;
+}
+
+MemoryPool::Statistics MemoryPool::GetStatistics() const
+{
+	Statistics statistics;
+	for (const auto& [id, block] : m_Blocks)
+	{
+		++statistics.BlockCount;
+		statistics.BlockBytes += block.Size;
+		statistics.UsedBytes += block.UsedBytes;
+
+		// Gaps between the ranges in use and after the last one, alignment padding included
+		VkDeviceSize end = 0;
+		for (const auto& [offset, size] : block.Allocations)
+		{
+			statistics.LargestFreeRange = std::max(statistics.LargestFreeRange, offset - end);
+			end = offset + size;
+		}
+		statistics.LargestFreeRange = std::max(statistics.LargestFreeRange, block.Size - end);
+	}
+
+	VkDeviceSize freeBytes = statistics.BlockBytes - statistics.UsedBytes;
+	if (freeBytes > 0)
+	{
+		statistics.Fragmentation = 1.0 - static_cast<double>(statistics.LargestFreeRange) / static_cast<double>(freeBytes);
+	}
+	return statistics;
+}
+
+bool MemoryPool::AllocateFrom(Block& block, const VkMemoryRequirements& requirements, VkDeviceSize& offset)
+{
+	// First fit between the ranges in use
+	VkDeviceSize candidate = 0;
+	for (const auto& [allocationOffset, allocationSize] : block.Allocations)
+	{
+		if (allocationOffset >= candidate + requirements.size)
+		{
+			break;
+		}
+		candidate = AlignUp(allocationOffset + allocationSize, requirements.alignment);
+	}
+	if (candidate + requirements.size > block.Size)
+	{
+		return false;
+	}
+
+	block.Allocations[candidate] = requirements.size;
+	block.UsedBytes += requirements.size;
+	offset = candidate;
+	return true;
+}
+
+void MemoryPool::PrintStatistics(const char* label, const Statistics& statistics) const
+{
+	std::cout << "Memory pool " << label << ": " << statistics.BlockCount << " blocks, "
+		<< statistics.UsedBytes / (1024 * 1024) << " of " << statistics.BlockBytes / (1024 * 1024) << " MB used, largest free range "
+		<< statistics.LargestFreeRange / (1024 * 1024) << " MB, " << statistics.Fragmentation * 100.0 << "% fragmented" << std::endl;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <vulkan/vulkan.h>
+
+#include "MemoryBudget.h"
+
+// Places resources in large blocks of device memory instead of giving each its own allocation. Every block holds one
+// memory type, and ranges are placed first fit with the ranges in use kept sorted by offset. Blocks are freed as soon
+// as they are empty. Defragmenting marks the most sparsely used block: nothing new is placed in it while its owners
+// move their resources out, and it is freed with its last range.
+// Only holds optimal tiling images, so neighbouring ranges never need bufferImageGranularity padding. Render thread
+// only, or the main thread during startup
+class MemoryPool
+{
+public:
+	struct Allocation
+	{
+		VkDeviceMemory Memory = VK_NULL_HANDLE;
+		VkDeviceSize Offset = 0;
+		VkDeviceSize Size = 0;
+		uint32_t Block = 0;
+	};
+
+	struct Statistics
+	{
+		uint32_t BlockCount = 0;
+		VkDeviceSize BlockBytes = 0;
+		VkDeviceSize UsedBytes = 0;
+		VkDeviceSize LargestFreeRange = 0;
+		// Share of the free bytes outside the largest free range, zero when they are all in one range
+		double Fragmentation = 0.0;
+	};
+
+	void Setup(VkDevice device, MemoryBudget* memoryBudget, MemoryBudget::Category category);
+	void Destroy();
+
+	// Returns false only when no block has room and allowNewBlock is false
+	bool Allocate(const VkMemoryRequirements& requirements, uint32_t memoryTypeIndex, bool allowNewBlock, Allocation& allocation);
+	void Free(const Allocation& allocation);
+
+	// Marks the most sparsely used block, if one is used less than the threshold and others of its type could take
+	// its ranges. Returns whether a block is being defragmented
+	bool BeginDefragmentation();
+	// Leaves the block as it is, for when its ranges no longer fit elsewhere
+	void CancelDefragmentation();
+	bool IsDefragmenting() const { return m_DefragmentedBlock != s_NoBlock; }
+	bool IsBeingDefragmented(const Allocation& allocation) const { return allocation.Block == m_DefragmentedBlock; }
+
+	Statistics GetStatistics() const;
+
+	static constexpr VkDeviceSize s_BlockSize = 64 * 1024 * 1024;
+	static constexpr double s_SparseBlockUsage = 0.5;
+
+private:
+	struct Block
+	{
+		VkDeviceMemory Memory;
+		uint32_t MemoryTypeIndex;
+		VkDeviceSize Size;
+		VkDeviceSize UsedBytes = 0;
+		std::map<VkDeviceSize, VkDeviceSize> Allocations; // Offset to size of ranges in use
+	};
+
+	static constexpr uint32_t s_NoBlock = ~0u;
+
+	bool AllocateFrom(Block& block, const VkMemoryRequirements& requirements, VkDeviceSize& offset);
+	void PrintStatistics(const char* label, const Statistics& statistics) const;
+
+	VkDevice m_Device;
+	MemoryBudget* m_MemoryBudget;
+	MemoryBudget::Category m_Category;
+
+	std::map<uint32_t, Block> m_Blocks; // By id, oldest first, so ranges gather in the oldest blocks
+	uint32_t m_NextBlockId = 0;
+	uint32_t m_DefragmentedBlock = s_NoBlock;
+	Statistics m_StatisticsBeforeDefragmentation;
+};
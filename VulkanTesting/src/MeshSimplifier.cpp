@@ -0,0 +1,252 @@
+#include "MeshSimplifier.h"
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+
+void MeshSimplifier::Setup(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices)
+{
+	m_Positions.resize(vertices.size());
+	for (size_t i = 0; i < vertices.size(); ++i)
+	{
+		m_Positions[i] = vertices[i].Position;
+	}
+	m_Indices = indices;
+	m_MaxCost = 0.0;
+
+	// Vertices split on texture coordinates share a position. Those seams, and open borders, stay in place
+	std::vector<uint32_t> positionIndices(vertices.size());
+	std::vector<uint32_t> positionUses;
+	std::unordered_map<glm::vec3, uint32_t> uniquePositions;
+	for (size_t i = 0; i < vertices.size(); ++i)
+	{
+		auto [position, inserted] = uniquePositions.try_emplace(m_Positions[i], static_cast<uint32_t>(uniquePositions.size()));
+		positionIndices[i] = position->second;
+		if (inserted)
+		{
+			positionUses.push_back(0);
+		}
+		++positionUses[position->second];
+	}
+
+	std::unordered_map<uint64_t, uint32_t> edgeUses;
+	for (size_t i = 0; i + 2 < m_Indices.size(); i += 3)
+	{
+		for (size_t corner = 0; corner < 3; ++corner)
+		{
+			uint64_t a = positionIndices[m_Indices[i + corner]];
+			uint64_t b = positionIndices[m_Indices[i + (corner + 1) % 3]];
+			++edgeUses[std::min(a, b) << 32 | std::max(a, b)];
+		}
+	}
+	std::vector<bool> borderPositions(positionUses.size(), false);
+	for (const auto& [edge, uses] : edgeUses)
+	{
+		if (uses == 1)
+		{
+			borderPositions[edge >> 32] = true;
+			borderPositions[edge & 0xFFFFFFFF] = true;
+		}
+	}
+
+	m_Locked.resize(vertices.size());
+	for (size_t i = 0; i < vertices.size(); ++i)
+	{
+		m_Locked[i] = positionUses[positionIndices[i]] > 1 || borderPositions[positionIndices[i]];
+	}
+
+	// Each vertex starts with the planes of the triangles around it
+	m_Quadrics.assign(vertices.size(), Quadric{});
+	for (size_t i = 0; i + 2 < m_Indices.size(); i += 3)
+	{
+		glm::dvec3 a = m_Positions[m_Indices[i + 0]];
+		glm::dvec3 b = m_Positions[m_Indices[i + 1]];
+		glm::dvec3 c = m_Positions[m_Indices[i + 2]];
+		glm::dvec3 normal = glm::cross(b - a, c - a);
+		double area = glm::length(normal);
+		if (area == 0.0)
+		{
+			continue;
+		}
+		normal /= area;
+
+		Quadric quadric = PlaneQuadric(glm::dvec4(normal, -glm::dot(normal, a)));
+		for (size_t corner = 0; corner < 3; ++corner)
+		{
+			AddQuadric(m_Quadrics[m_Indices[i + corner]], quadric);
+		}
+	}
+}
+
+bool MeshSimplifier::Simplify(size_t targetTriangleCount)
+{
+	bool collapsedAny = false;
+	while (m_Indices.size() / 3 > targetTriangleCount)
+	{
+		size_t vertexCount = m_Positions.size();
+		size_t triangleCount = m_Indices.size() / 3;
+
+		m_TriangleOffsets.assign(vertexCount + 1, 0);
+		for (uint32_t index : m_Indices)
+		{
+			++m_TriangleOffsets[index + 1];
+		}
+		for (size_t i = 0; i < vertexCount; ++i)
+		{
+			m_TriangleOffsets[i + 1] += m_TriangleOffsets[i];
+		}
+		m_Triangles.resize(m_Indices.size());
+		std::vector<uint32_t> fill(m_TriangleOffsets.begin(), m_TriangleOffsets.end() - 1);
+		for (size_t i = 0; i < m_Indices.size(); ++i)
+		{
+			m_Triangles[fill[m_Indices[i]]++] = static_cast<uint32_t>(i / 3);
+		}
+
+		std::vector<Collapse> collapses;
+		collapses.reserve(m_Indices.size() * 2);
+		for (size_t i = 0; i < m_Indices.size(); i += 3)
+		{
+			for (size_t corner = 0; corner < 3; ++corner)
+			{
+				uint32_t a = m_Indices[i + corner];
+				uint32_t b = m_Indices[i + (corner + 1) % 3];
+				if (!m_Locked[a])
+				{
+					collapses.push_back({ a, b, CollapseCost(a, b) });
+				}
+				if (!m_Locked[b])
+				{
+					collapses.push_back({ b, a, CollapseCost(b, a) });
+				}
+			}
+		}
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.Cost < b.Cost; });
+
+		// Every vertex takes part in at most one collapse per pass, so the adjacency stays valid
+		std::vector<uint32_t> remap(vertexCount);
+		for (size_t i = 0; i < vertexCount; ++i)
+		{
+			remap[i] = static_cast<uint32_t>(i);
+		}
+		std::vector<bool> touched(vertexCount, false);
+		size_t trianglesToRemove = triangleCount - targetTriangleCount;
+		size_t trianglesRemoved = 0;
+		for (const Collapse& collapse : collapses)
+		{
+			if (trianglesRemoved >= trianglesToRemove)
+			{
+				break;
+			}
+			if (touched[collapse.From] || touched[collapse.To] || FlipsTriangle(collapse.From, collapse.To))
+			{
+				continue;
+			}
+
+			remap[collapse.From] = collapse.To;
+			AddQuadric(m_Quadrics[collapse.To], m_Quadrics[collapse.From]);
+			m_MaxCost = std::max(m_MaxCost, collapse.Cost);
+			for (uint32_t i = m_TriangleOffsets[collapse.From]; i < m_TriangleOffsets[collapse.From + 1]; ++i)
+			{
+				uint32_t triangle = m_Triangles[i];
+				for (size_t corner = 0; corner < 3; ++corner)
+				{
+					uint32_t vertex = m_Indices[triangle * 3 + corner];
+					touched[vertex] = true;
+					trianglesRemoved += vertex == collapse.To ? 1 : 0;
+				}
+			}
+		}
+
+		size_t written = 0;
+		for (size_t i = 0; i < m_Indices.size(); i += 3)
+		{
+			uint32_t a = remap[m_Indices[i + 0]];
+			uint32_t b = remap[m_Indices[i + 1]];
+			uint32_t c = remap[m_Indices[i + 2]];
+			if (a != b && b != c && c != a)
+			{
+				m_Indices[written++] = a;
+				m_Indices[written++] = b;
+				m_Indices[written++] = c;
+			}
+		}
+		m_Indices.resize(written);
+
+		if (trianglesRemoved == 0)
+		{
+			break;
+		}
+		collapsedAny = true;
+	}
+
+	return collapsedAny;
+}
+
+float MeshSimplifier::GetError() const
+{
+	return static_cast<float>(std::sqrt(m_MaxCost));
+}
+
+MeshSimplifier::Quadric MeshSimplifier::PlaneQuadric(const glm::dvec4& plane)
+{
+	return {
+		plane.x * plane.x, plane.x * plane.y, plane.x * plane.z, plane.x * plane.w,
+		plane.y * plane.y, plane.y * plane.z, plane.y * plane.w,
+		plane.z * plane.z, plane.z * plane.w,
+		plane.w * plane.w };
+}
+
+void MeshSimplifier::AddQuadric(Quadric& target, const Quadric& source)
+{
+	for (size_t i = 0; i < target.size(); ++i)
+	{
+		target[i] += source[i];
+	}
+}
+
+double MeshSimplifier::EvaluateQuadric(const Quadric& q, const glm::dvec3& p)
+{
+	// Sum of squared distances to the accumulated planes
+	double error = q[0] * p.x * p.x + 2.0 * q[1] * p.x * p.y + 2.0 * q[2] * p.x * p.z + 2.0 * q[3] * p.x
+		+ q[4] * p.y * p.y + 2.0 * q[5] * p.y * p.z + 2.0 * q[6] * p.y
+		+ q[7] * p.z * p.z + 2.0 * q[8] * p.z
+		+ q[9];
+	return std::max(error, 0.0);
+}
+
+double MeshSimplifier::CollapseCost(uint32_t from, uint32_t to) const
+{
+	Quadric quadric = m_Quadrics[from];
+	AddQuadric(quadric, m_Quadrics[to]);
+	return EvaluateQuadric(quadric, m_Positions[to]);
+}
+
+bool MeshSimplifier::FlipsTriangle(uint32_t from, uint32_t to) const
+{
+	for (uint32_t i = m_TriangleOffsets[from]; i < m_TriangleOffsets[from + 1]; ++i)
+	{
+		const uint32_t* triangle = &m_Indices[m_Triangles[i] * 3];
+		if (triangle[0] == to || triangle[1] == to || triangle[2] == to)
+		{
+			continue; // Collapses away
+		}
+
+		std::array<glm::vec3, 3> before = { m_Positions[triangle[0]], m_Positions[triangle[1]], m_Positions[triangle[2]] };
+		std::array<glm::vec3, 3> after = before;
+		for (size_t corner = 0; corner < 3; ++corner)
+		{
+			if (triangle[corner] == from)
+			{
+				after[corner] = m_Positions[to];
+			}
+		}
+
+		glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+		glm::vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+		if (glm::dot(normalBefore, normalAfter) <= 0.0f)
+		{
+			return true;
+		}
+	}
+	return false;
+}
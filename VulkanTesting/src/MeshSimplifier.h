@@ -0,0 +1,49 @@
+#pragma once
+
+#include <array>
+#include <vector>
+
+#include "Vertex.h"
+
+// Quadric error metric simplifier collapsing edges onto one of their vertices, so every level of detail indexes
+// the original vertices. Calls to Simplify continue from the previous result, building a chain of coarser levels
+class MeshSimplifier
+{
+public:
+	void Setup(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices);
+
+	// Collapses the cheapest edges until at most targetTriangleCount triangles are left. Returns false once
+	// nothing more can be collapsed
+	bool Simplify(size_t targetTriangleCount);
+
+	const std::vector<uint32_t>& GetIndices() const { return m_Indices; }
+	// Largest deviation introduced so far, in mesh units
+	float GetError() const;
+
+private:
+	// Symmetric 4x4 matrix, upper triangle in row order
+	using Quadric = std::array<double, 10>;
+
+	struct Collapse
+	{
+		uint32_t From;
+		uint32_t To;
+		double Cost;
+	};
+
+	static Quadric PlaneQuadric(const glm::dvec4& plane);
+	static void AddQuadric(Quadric& target, const Quadric& source);
+	static double EvaluateQuadric(const Quadric& quadric, const glm::dvec3& position);
+	double CollapseCost(uint32_t from, uint32_t to) const;
+	bool FlipsTriangle(uint32_t from, uint32_t to) const;
+
+	std::vector<glm::vec3> m_Positions;
+	std::vector<uint32_t> m_Indices;
+	std::vector<Quadric> m_Quadrics;
+	std::vector<bool> m_Locked; // On a border or a seam, moving it would open cracks
+	double m_MaxCost = 0.0;
+
+	// Triangles around each vertex, rebuilt every pass
+	std::vector<uint32_t> m_TriangleOffsets;
+	std::vector<uint32_t> m_Triangles;
+};
@@ -0,0 +1,126 @@
+#include "MeshletBuilder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+static constexpr uint32_t s_Unassigned = std::numeric_limits<uint32_t>::max();
+
+void MeshletBuilder::Build(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices)
+{
+	m_Meshlets.clear();
+	m_MeshletData.clear();
+	m_MeshletIndices.clear();
+	m_LocalIndices.assign(vertices.size(), s_Unassigned);
+	m_Vertices.clear();
+	m_Triangles.clear();
+
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		uint32_t newVertices = 0;
+		for (size_t corner = 0; corner < 3; ++corner)
+		{
+			newVertices += m_LocalIndices[indices[i + corner]] == s_Unassigned ? 1 : 0;
+		}
+
+		if (m_Vertices.size() + newVertices > s_MaxVertices || m_Triangles.size() / 3 + 1 > s_MaxTriangles)
+		{
+			FinishMeshlet(vertices);
+		}
+
+		for (size_t corner = 0; corner < 3; ++corner)
+		{
+			uint32_t vertexIndex = indices[i + corner];
+			if (m_LocalIndices[vertexIndex] == s_Unassigned)
+			{
+				m_LocalIndices[vertexIndex] = static_cast<uint32_t>(m_Vertices.size());
+				m_Vertices.push_back(vertexIndex);
+			}
+			m_Triangles.push_back(static_cast<uint8_t>(m_LocalIndices[vertexIndex]));
+		}
+	}
+
+	if (!m_Triangles.empty())
+	{
+		FinishMeshlet(vertices);
+	}
+}
+
+void MeshletBuilder::FinishMeshlet(const std::vector<Vertex>& vertices)
+{
+	Meshlet meshlet{};
+	meshlet.VertexOffset = static_cast<uint32_t>(m_MeshletData.size());
+	meshlet.VertexCount = static_cast<uint32_t>(m_Vertices.size());
+	meshlet.TriangleCount = static_cast<uint32_t>(m_Triangles.size() / 3);
+	meshlet.FirstIndex = static_cast<uint32_t>(m_MeshletIndices.size());
+
+	m_MeshletData.insert(m_MeshletData.end(), m_Vertices.begin(), m_Vertices.end());
+
+	meshlet.TriangleOffset = static_cast<uint32_t>(m_MeshletData.size());
+	m_MeshletData.resize(m_MeshletData.size() + (m_Triangles.size() + 3) / 4, 0);
+	for (size_t i = 0; i < m_Triangles.size(); ++i)
+	{
+		m_MeshletData[meshlet.TriangleOffset + i / 4] |= static_cast<uint32_t>(m_Triangles[i]) << (8 * (i % 4));
+		m_MeshletIndices.push_back(m_Vertices[m_Triangles[i]]);
+	}
+
+	// Bounding sphere around the center of the bounding box
+	glm::vec3 minPosition(std::numeric_limits<float>::max());
+	glm::vec3 maxPosition(std::numeric_limits<float>::lowest());
+	for (uint32_t vertexIndex : m_Vertices)
+	{
+		minPosition = glm::min(minPosition, vertices[vertexIndex].Position);
+		maxPosition = glm::max(maxPosition, vertices[vertexIndex].Position);
+	}
+	glm::vec3 center = (minPosition + maxPosition) * 0.5f;
+	float radius = 0.0f;
+	for (uint32_t vertexIndex : m_Vertices)
+	{
+		radius = std::max(radius, glm::length(vertices[vertexIndex].Position - center));
+	}
+	meshlet.BoundingSphere = glm::vec4(center, radius);
+
+	// Normal cone around the average face normal. Triangles are counter-clockwise when seen from the front
+	std::vector<glm::vec3> normals;
+	normals.reserve(meshlet.TriangleCount);
+	glm::vec3 normalSum(0.0f);
+	for (size_t i = 0; i < m_Triangles.size(); i += 3)
+	{
+		const glm::vec3& a = vertices[m_Vertices[m_Triangles[i + 0]]].Position;
+		const glm::vec3& b = vertices[m_Vertices[m_Triangles[i + 1]]].Position;
+		const glm::vec3& c = vertices[m_Vertices[m_Triangles[i + 2]]].Position;
+		glm::vec3 normal = glm::cross(b - a, c - a);
+		float area = glm::length(normal);
+		if (area > 0.0f)
+		{
+			normals.push_back(normal / area);
+			normalSum += normal / area;
+		}
+	}
+
+	// A cutoff of 1 never culls, used when the normals spread over a hemisphere or more
+	meshlet.Cone = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+	float sumLength = glm::length(normalSum);
+	if (sumLength > 0.0f)
+	{
+		glm::vec3 axis = normalSum / sumLength;
+		float minDot = 1.0f;
+		for (const glm::vec3& normal : normals)
+		{
+			minDot = std::min(minDot, glm::dot(axis, normal));
+		}
+		if (minDot > 0.0f)
+		{
+			meshlet.Cone = glm::vec4(axis, std::sqrt(1.0f - minDot * minDot));
+		}
+	}
+
+	m_Meshlets.push_back(meshlet);
+
+	for (uint32_t vertexIndex : m_Vertices)
+	{
+		m_LocalIndices[vertexIndex] = s_Unassigned;
+	}
+	m_Vertices.clear();
+	m_Triangles.clear();
+}
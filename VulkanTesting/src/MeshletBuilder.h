@@ -0,0 +1,45 @@
+#pragma once
+
+#include <vector>
+
+#include "Vertex.h"
+
+// Cluster of up to 64 vertices and 124 triangles, culled as a unit. Matches the std430 layout in culling.glsl
+struct Meshlet
+{
+	uint32_t VertexOffset;   // Into the meshlet data, one mesh relative vertex index per vertex
+	uint32_t TriangleOffset; // Into the meshlet data, three 8-bit local vertex indices per triangle, packed four per uint
+	uint32_t VertexCount;
+	uint32_t TriangleCount;
+	uint32_t FirstIndex;     // The meshlet's triangles as a contiguous range of the index buffer
+	uint32_t MeshIndex;
+	uint32_t Padding[2];
+	glm::vec4 BoundingSphere; // xyz center, w radius, in mesh space
+	glm::vec4 Cone;           // xyz axis, w cutoff. Every triangle faces away when dot(center - eye, axis) >= cutoff * |center - eye| + radius
+};
+
+// Splits an indexed triangle list into meshlets, in index order
+class MeshletBuilder
+{
+public:
+	void Build(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices);
+
+	const std::vector<Meshlet>& GetMeshlets() const { return m_Meshlets; }
+	const std::vector<uint32_t>& GetMeshletData() const { return m_MeshletData; }
+	const std::vector<uint32_t>& GetMeshletIndices() const { return m_MeshletIndices; }
+
+	static constexpr uint32_t s_MaxVertices = 64;
+	static constexpr uint32_t s_MaxTriangles = 124;
+
+private:
+	void FinishMeshlet(const std::vector<Vertex>& vertices);
+
+	std::vector<Meshlet> m_Meshlets;
+	std::vector<uint32_t> m_MeshletData;
+	std::vector<uint32_t> m_MeshletIndices; // Mesh relative, in meshlet order
+
+	// Meshlet being built
+	std::vector<uint32_t> m_LocalIndices; // Per mesh vertex, its index inside the current meshlet
+	std::vector<uint32_t> m_Vertices;
+	std::vector<uint8_t> m_Triangles;
+};
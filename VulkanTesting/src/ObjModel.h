@@ -18,6 +18,8 @@ struct ObjModel
 {
 	uint32_t nbIndices{0};
 	uint32_t nbVertices{0};
+	uint32_t firstIndex{0};   // Offset of the mesh inside the shared index buffer
+	int32_t vertexOffset{0};  // Offset of the mesh inside the shared vertex buffer
 	VkBuffer vertexBuffer;    // Device buffer of all 'Vertex'
 	VkBuffer indexBuffer;     // Device buffer of the indices forming triangles
 	VkBuffer matColorBuffer;  // Device buffer of array of 'Wavefront material'
@@ -0,0 +1,104 @@
+#include "PipelineCompiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <iostream>
+
+void PipelineCompiler::Start(uint32_t threadCount)
+{
+	m_Stopping = false;
+	for (uint32_t i = 0; i < threadCount; ++i)
+	{
+		m_Threads.emplace_back(&PipelineCompiler::WorkerLoop, this);
+	}
+}
+
+void PipelineCompiler::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stopping = true;
+		m_Jobs.clear();
+	}
+	m_JobAdded.notify_all();
+	for (std::thread& thread : m_Threads)
+	{
+		thread.join();
+	}
+	m_Threads.clear();
+}
+
+void PipelineCompiler::Submit(const std::string& name, BuildFunction build)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Jobs.push_back({ name, std::move(build) });
+	}
+	m_JobAdded.notify_one();
+}
+
+void PipelineCompiler::RecordCacheHit(double milliseconds)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	++m_CacheHits;
+	m_CacheHitMs += milliseconds;
+}
+
+void PipelineCompiler::PrintStatistics() const
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	std::cout << "Pipeline permutations: " << m_Compiled << " compiled in the background";
+	if (m_Compiled > 0)
+	{
+		std::cout << " (" << m_CompileMs / m_Compiled << " ms average, " << m_MaxCompileMs << " ms longest)";
+	}
+	std::cout << ", " << m_Failed << " failed, " << m_CacheHits << " found in the pipeline cache";
+	if (m_CacheHits > 0)
+	{
+		std::cout << " (" << m_CacheHitMs / m_CacheHits << " ms average)";
+	}
+	std::cout << std::endl;
+}
+
+void PipelineCompiler::WorkerLoop()
+{
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	while (true)
+	{
+		m_JobAdded.wait(lock, [this] { return m_Stopping || !m_Jobs.empty(); });
+		if (m_Stopping)
+		{
+			return;
+		}
+		Job job = std::move(m_Jobs.front());
+		m_Jobs.pop_front();
+
+		lock.unlock();
+		auto start = std::chrono::high_resolution_clock::now();
+		bool succeeded = true;
+		try
+		{
+			job.Build();
+		}
+		catch (const std::exception& e)
+		{
+			succeeded = false;
+			std::cerr << "Compiling " << job.Name << " failed\n" << e.what() << std::endl;
+		}
+		double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		lock.lock();
+
+		if (succeeded)
+		{
+			++m_Compiled;
+			m_CompileMs += milliseconds;
+			m_MaxCompileMs = std::max(m_MaxCompileMs, milliseconds);
+			std::cout << "Compiled " << job.Name << " in " << milliseconds << " ms" << std::endl;
+		}
+		else
+		{
+			++m_Failed;
+		}
+	}
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Builds pipelines on background threads, so a permutation needed for the first time never stalls a frame. Jobs start
+// in the order they were submitted and are timed for a report of what compiling cost. A job that throws is reported and
+// dropped, whoever submitted it keeps using what it had
+class PipelineCompiler
+{
+public:
+	// Creates the pipelines and hands them over, typically by queueing a swap for the render thread
+	using BuildFunction = std::function<void()>;
+
+	void Start(uint32_t threadCount);
+	// Jobs still queued are dropped, running ones finish first
+	void Stop();
+	void Submit(const std::string& name, BuildFunction build);
+
+	// Pipelines that were found in the pipeline cache and created without a job
+	void RecordCacheHit(double milliseconds);
+	void PrintStatistics() const;
+
+private:
+	struct Job
+	{
+		std::string Name;
+		BuildFunction Build;
+	};
+
+	void WorkerLoop();
+
+	std::vector<std::thread> m_Threads;
+	mutable std::mutex m_Mutex;
+	std::condition_variable m_JobAdded;
+	std::deque<Job> m_Jobs;
+	bool m_Stopping = false;
+
+	uint32_t m_Compiled = 0;
+	uint32_t m_Failed = 0;
+	double m_CompileMs = 0.0;
+	double m_MaxCompileMs = 0.0;
+	uint32_t m_CacheHits = 0;
+	double m_CacheHitMs = 0.0;
+};
@@ -0,0 +1,140 @@
+#include "Profiler.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+void Profiler::Setup(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t framesInFlight)
+{
+	m_Device = device;
+	m_FrameScopes.resize(framesInFlight);
+
+	VkPhysicalDeviceProperties properties{};
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+	m_TimestampPeriod = properties.limits.timestampPeriod;
+	m_TimestampsSupported = properties.limits.timestampComputeAndGraphics == VK_TRUE;
+	if (!m_TimestampsSupported)
+	{
+		return;
+	}
+
+	// Two queries (begin and end) per scope
+	VkQueryPoolCreateInfo queryPoolInfo{};
+	queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	queryPoolInfo.queryCount = framesInFlight * s_MaxScopesPerFrame * 2;
+	if (vkCreateQueryPool(m_Device, &queryPoolInfo, nullptr, &m_QueryPool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create timestamp query pool");
+	}
+}
+
+void Profiler::Destroy()
+{
+	if (m_QueryPool != VK_NULL_HANDLE)
+	{
+		vkDestroyQueryPool(m_Device, m_QueryPool, nullptr);
+		m_QueryPool = VK_NULL_HANDLE;
+	}
+}
+
+void Profiler::BeginFrame(uint32_t frame)
+{
+	std::vector<std::string>& scopes = m_FrameScopes[frame];
+	m_GpuFrameTimeMs = 0.0;
+	if (!m_TimestampsSupported || scopes.empty())
+	{
+		return;
+	}
+
+	std::vector<uint64_t> timestamps(scopes.size() * 2);
+	VkResult result = vkGetQueryPoolResults(
+		m_Device,
+		m_QueryPool,
+		frame * s_MaxScopesPerFrame * 2,
+		static_cast<uint32_t>(timestamps.size()),
+		timestamps.size() * sizeof(uint64_t),
+		timestamps.data(),
+		sizeof(uint64_t),
+		VK_QUERY_RESULT_64_BIT);
+
+	if (result == VK_SUCCESS)
+	{
+		for (size_t i = 0; i < scopes.size(); ++i)
+		{
+			uint64_t ticks = timestamps[2 * i + 1] - timestamps[2 * i];
+			m_GpuTimesMs[scopes[i]] = static_cast<double>(ticks) * m_TimestampPeriod / 1000000.0;
+			m_GpuFrameTimeMs += m_GpuTimesMs[scopes[i]];
+		}
+	}
+	scopes.clear();
+}
+
+void Profiler::ResetQueries(VkCommandBuffer commandBuffer, uint32_t frame)
+{
+	if (!m_TimestampsSupported)
+	{
+		return;
+	}
+
+	vkCmdResetQueryPool(commandBuffer, m_QueryPool, frame * s_MaxScopesPerFrame * 2, s_MaxScopesPerFrame * 2);
+}
+
+void Profiler::BeginGpuScope(VkCommandBuffer commandBuffer, uint32_t frame, const std::string& name, VkPipelineStageFlagBits stage)
+{
+	std::vector<std::string>& scopes = m_FrameScopes[frame];
+	if (!m_TimestampsSupported || scopes.size() >= s_MaxScopesPerFrame)
+	{
+		return;
+	}
+
+	uint32_t query = (frame * s_MaxScopesPerFrame + static_cast<uint32_t>(scopes.size())) * 2;
+	scopes.push_back(name);
+	vkCmdWriteTimestamp(commandBuffer, stage, m_QueryPool, query);
+}
+
+void Profiler::EndGpuScope(VkCommandBuffer commandBuffer, uint32_t frame, const std::string& name, VkPipelineStageFlagBits stage)
+{
+	std::vector<std::string>& scopes = m_FrameScopes[frame];
+	auto scope = std::find(scopes.begin(), scopes.end(), name);
+	if (!m_TimestampsSupported || scope == scopes.end())
+	{
+		return;
+	}
+
+	uint32_t query = (frame * s_MaxScopesPerFrame + static_cast<uint32_t>(scope - scopes.begin())) * 2 + 1;
+	vkCmdWriteTimestamp(commandBuffer, stage, m_QueryPool, query);
+}
+
+double Profiler::GetGpuTimeMs(const std::string& name) const
+{
+	auto time = m_GpuTimesMs.find(name);
+	return time != m_GpuTimesMs.end() ? time->second : 0.0;
+}
+
+void Profiler::SetCounter(const std::string& name, double value)
+{
+	m_Counters[name] = value;
+}
+
+double Profiler::GetCounter(const std::string& name) const
+{
+	auto counter = m_Counters.find(name);
+	return counter != m_Counters.end() ? counter->second : 0.0;
+}
+
+std::string Profiler::GetSummary() const
+{
+	std::ostringstream summary;
+	summary << std::fixed << std::setprecision(2);
+	for (const auto& [name, time] : m_GpuTimesMs)
+	{
+		summary << " | " << name << ": " << time << " ms";
+	}
+	for (const auto& [name, value] : m_Counters)
+	{
+		summary << " | " << name << ": " << value;
+	}
+	return summary.str();
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+// Collects GPU timestamp scopes and CPU-side counters, summarized in the window title
+class Profiler
+{
+public:
+	void Setup(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t framesInFlight);
+	void Destroy();
+
+	// Read back the timestamps recorded the last time this frame slot was used. Its submissions must have completed
+	void BeginFrame(uint32_t frame);
+	void ResetQueries(VkCommandBuffer commandBuffer, uint32_t frame);
+	void BeginGpuScope(
+		VkCommandBuffer commandBuffer,
+		uint32_t frame,
+		const std::string& name,
+		VkPipelineStageFlagBits stage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+	void EndGpuScope(
+		VkCommandBuffer commandBuffer,
+		uint32_t frame,
+		const std::string& name,
+		VkPipelineStageFlagBits stage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+
+	double GetGpuTimeMs(const std::string& name) const;
+	// Sum of the scopes read back by the last BeginFrame, 0 when none were. Time the GPU spent waiting, like for the
+	// swapchain image, is left out
+	double GetGpuFrameTimeMs() const { return m_GpuFrameTimeMs; }
+	void SetCounter(const std::string& name, double value);
+	double GetCounter(const std::string& name) const;
+	std::string GetSummary() const;
+
+private:
+	static constexpr uint32_t s_MaxScopesPerFrame = 16;
+
+	VkDevice m_Device;
+	VkQueryPool m_QueryPool = VK_NULL_HANDLE;
+	float m_TimestampPeriod = 1.0f; // Nanoseconds per timestamp tick
+	bool m_TimestampsSupported = false;
+
+	std::vector<std::vector<std::string>> m_FrameScopes; // Scope names recorded per frame in flight, in query order
+	std::map<std::string, double> m_GpuTimesMs;
+	double m_GpuFrameTimeMs = 0.0;
+	std::map<std::string, double> m_Counters;
+};
@@ -0,0 +1,153 @@
+#include "QualityGovernor.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+void QualityGovernor::Setup(double targetFrameMs, VkSampleCountFlagBits maxSamples, VkSampleCountFlags supportedSamples)
+{
+	m_TargetFrameMs = targetFrameMs;
+
+	std::vector<VkSampleCountFlagBits> sampleCounts = { maxSamples };
+	for (uint32_t count = maxSamples / 2; count >= VK_SAMPLE_COUNT_2_BIT; count /= 2)
+	{
+		if (supportedSamples & count)
+		{
+			sampleCounts.push_back(static_cast<VkSampleCountFlagBits>(count));
+		}
+	}
+	// Samples above 4x go before any resolution, the rest only once the resolution reached the middle scale
+	size_t midSamples = 0;
+	while (midSamples + 1 < sampleCounts.size() && sampleCounts[midSamples] > VK_SAMPLE_COUNT_4_BIT)
+	{
+		++midSamples;
+	}
+
+	m_Levels.clear();
+	auto addLevel = [this](uint32_t scale, VkSampleCountFlagBits samples, float minSampleShading)
+	{
+		m_Levels.push_back({ static_cast<float>(scale) / 100.0f, samples, minSampleShading });
+	};
+	if (maxSamples != VK_SAMPLE_COUNT_1_BIT)
+	{
+		addLevel(100, maxSamples, s_MinSampleShading);
+	}
+	for (size_t i = 0; i <= midSamples; ++i)
+	{
+		addLevel(100, sampleCounts[i], 0.0f);
+	}
+	for (uint32_t scale = 100 - s_ScaleStep; scale >= s_MidScale; scale -= s_ScaleStep)
+	{
+		addLevel(scale, sampleCounts[midSamples], 0.0f);
+	}
+	for (size_t i = midSamples + 1; i < sampleCounts.size(); ++i)
+	{
+		addLevel(s_MidScale, sampleCounts[i], 0.0f);
+	}
+	for (uint32_t scale = s_MidScale - s_ScaleStep; scale >= s_MinScale; scale -= s_ScaleStep)
+	{
+		addLevel(scale, sampleCounts.back(), 0.0f);
+	}
+
+	m_Level = 0;
+	std::cout << "Quality: targeting " << m_TargetFrameMs << " ms of GPU time per frame over " << m_Levels.size()
+		<< " levels, starting at " << Describe(GetLevel()) << std::endl;
+}
+
+bool QualityGovernor::Update(double gpuFrameMs)
+{
+	if (gpuFrameMs <= 0.0)
+	{
+		return false;
+	}
+	if (m_FramesSinceRaise != UINT32_MAX)
+	{
+		++m_FramesSinceRaise;
+	}
+	if (m_CooldownFramesLeft > 0)
+	{
+		--m_CooldownFramesLeft;
+		return false;
+	}
+
+	m_AverageMs = m_AverageMs == 0.0 ? gpuFrameMs : m_AverageMs + (gpuFrameMs - m_AverageMs) * s_Smoothing;
+	if (m_AverageMs > m_TargetFrameMs * s_LowerThreshold)
+	{
+		++m_OverBudgetFrames;
+		m_UnderBudgetFrames = 0;
+	}
+	else if (m_AverageMs < m_TargetFrameMs * s_RaiseThreshold)
+	{
+		++m_UnderBudgetFrames;
+		m_OverBudgetFrames = 0;
+	}
+	else
+	{
+		m_OverBudgetFrames = 0;
+		m_UnderBudgetFrames = 0;
+	}
+
+	if (m_OverBudgetFrames >= s_LowerFrames && m_Level + 1 < m_Levels.size())
+	{
+		// The last raise did not hold, so the next one waits for longer
+		if (m_FramesSinceRaise < m_RaiseFrames)
+		{
+			m_RaiseFrames = std::min(m_RaiseFrames * 2, s_MaxRaiseFrames);
+		}
+		m_FramesSinceRaise = UINT32_MAX;
+		SetLevel(m_Level + 1, "lowered");
+		return true;
+	}
+	if (m_UnderBudgetFrames >= m_RaiseFrames && m_Level > 0)
+	{
+		// The previous raise held, so this one is not treated as a retry
+		if (m_FramesSinceRaise != UINT32_MAX && m_FramesSinceRaise >= m_RaiseFrames)
+		{
+			m_RaiseFrames = s_RaiseFrames;
+		}
+		m_FramesSinceRaise = 0;
+		SetLevel(m_Level - 1, "raised");
+		return true;
+	}
+	return false;
+}
+
+bool QualityGovernor::Reset()
+{
+	m_RaiseFrames = s_RaiseFrames;
+	m_FramesSinceRaise = UINT32_MAX;
+	if (m_Level == 0)
+	{
+		return false;
+	}
+	SetLevel(0, "reset");
+	return true;
+}
+
+void QualityGovernor::SetLevel(size_t level, const char* reason)
+{
+	std::cout << "Quality " << reason << " to " << Describe(m_Levels[level]) << " (GPU " << std::fixed << std::setprecision(2)
+		<< m_AverageMs << " ms, target " << m_TargetFrameMs << " ms)" << std::defaultfloat << std::endl;
+
+	m_Level = level;
+	m_AverageMs = 0.0;
+	m_OverBudgetFrames = 0;
+	m_UnderBudgetFrames = 0;
+	m_CooldownFramesLeft = s_CooldownFrames;
+}
+
+std::string QualityGovernor::Describe(const Level& level)
+{
+	std::ostringstream description;
+	description << static_cast<uint32_t>(level.RenderScale * 100.0f + 0.5f) << "% resolution, " << level.Samples << "x MSAA, ";
+	if (level.MinSampleShading > 0.0f)
+	{
+		description << "sample shading " << level.MinSampleShading;
+	}
+	else
+	{
+		description << "no sample shading";
+	}
+	return description.str();
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+// Trades render resolution and multisampling for GPU time to hold a frame time budget. Settings form a ladder from best
+// to cheapest, and the governor steps down it as soon as frames run over budget, but only steps back up after frames
+// have stayed well under it for a while, so it does not oscillate between two levels
+class QualityGovernor
+{
+public:
+	struct Level
+	{
+		float RenderScale; // Of the swapchain extent, along each side
+		VkSampleCountFlagBits Samples;
+		float MinSampleShading; // 0 disables sample shading
+	};
+
+	// Sample counts are taken from maxSamples down to 2x, skipping those missing from supportedSamples. The render pass
+	// always resolves, so single sampling is never used
+	void Setup(double targetFrameMs, VkSampleCountFlagBits maxSamples, VkSampleCountFlags supportedSamples);
+
+	// Feeds the GPU time of one frame, 0 when it was not measured. Returns true when the level changed
+	bool Update(double gpuFrameMs);
+	// Goes back to the best level. Returns true when the level changed
+	bool Reset();
+
+	const Level& GetLevel() const { return m_Levels[m_Level]; }
+	double GetTargetFrameMs() const { return m_TargetFrameMs; }
+
+private:
+	static constexpr float s_MinSampleShading = 0.2f;
+	static constexpr uint32_t s_ScaleStep = 10; // Percent
+	static constexpr uint32_t s_MidScale = 70;  // Resolution drops below this only once samples are at their minimum
+	static constexpr uint32_t s_MinScale = 50;
+	static constexpr double s_Smoothing = 0.1; // Weight of each new frame in the average
+	// Fractions of the budget. Stepping up costs at most about 1.5 times more, so frames raised from under the upper
+	// threshold do not immediately cross the lower one
+	static constexpr double s_LowerThreshold = 0.9;
+	static constexpr double s_RaiseThreshold = 0.6;
+	static constexpr uint32_t s_LowerFrames = 8;
+	static constexpr uint32_t s_RaiseFrames = 120;
+	static constexpr uint32_t s_MaxRaiseFrames = 960;
+	// Frames recorded before a change are still in flight and in the average right after it
+	static constexpr uint32_t s_CooldownFrames = 8;
+
+	void SetLevel(size_t level, const char* reason);
+	static std::string Describe(const Level& level);
+
+	std::vector<Level> m_Levels;
+	size_t m_Level = 0;
+	double m_TargetFrameMs = 0.0;
+
+	double m_AverageMs = 0.0;
+	uint32_t m_OverBudgetFrames = 0;
+	uint32_t m_UnderBudgetFrames = 0;
+	uint32_t m_CooldownFramesLeft = 0;
+	// Raising again right after a raise had to be undone waits longer each time
+	uint32_t m_RaiseFrames = s_RaiseFrames;
+	uint32_t m_FramesSinceRaise = UINT32_MAX;
+};
@@ -0,0 +1,849 @@
+#include "RenderGraph.h"
+#include "MemoryBudget.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <exception>
+#include <execution>
+#include <numeric>
+#include <stdexcept>
+
+static VkDeviceSize AlignUp(VkDeviceSize size, VkDeviceSize alignment)
+{
+	return (size + alignment - 1) / alignment * alignment;
+}
+
+bool RenderGraph::TransientImageDesc::operator==(const TransientImageDesc& other) const
+{
+	return Extent.width == other.Extent.width
+		&& Extent.height == other.Extent.height
+		&& Format == other.Format
+		&& Usage == other.Usage
+		&& Aspect == other.Aspect
+		&& Samples == other.Samples;
+}
+
+void RenderGraph::PassBuilder::Read(ResourceHandle resource, const Access& access)
+{
+	Use(resource, access, false, false);
+}
+
+void RenderGraph::PassBuilder::Write(ResourceHandle resource, const Access& access)
+{
+	Use(resource, access, true, false);
+}
+
+void RenderGraph::PassBuilder::Overwrite(ResourceHandle resource, const Access& access)
+{
+	Use(resource, access, true, true);
+}
+
+void RenderGraph::PassBuilder::SetRenderPass(const VkRenderPassBeginInfo& beginInfo)
+{
+	Pass& pass = m_Graph.m_Passes[m_Pass];
+	pass.HasRenderPass = true;
+	pass.RenderPassInfo = beginInfo;
+	pass.ClearValues.assign(beginInfo.pClearValues, beginInfo.pClearValues + beginInfo.clearValueCount);
+}
+
+void RenderGraph::PassBuilder::SetRendering(
+	const VkRenderingInfoKHR& renderingInfo,
+	const std::vector<VkFormat>& colorFormats,
+	VkFormat depthFormat,
+	VkSampleCountFlagBits samples)
+{
+	Pass& pass = m_Graph.m_Passes[m_Pass];
+	pass.HasRendering = true;
+	pass.RenderingInfo = renderingInfo;
+	pass.ColorAttachments.assign(renderingInfo.pColorAttachments, renderingInfo.pColorAttachments + renderingInfo.colorAttachmentCount);
+	if (renderingInfo.pDepthAttachment != nullptr)
+	{
+		pass.DepthAttachment = *renderingInfo.pDepthAttachment;
+	}
+	pass.ColorFormats = colorFormats;
+	pass.DepthFormat = depthFormat;
+	pass.Samples = samples;
+}
+
+void RenderGraph::PassBuilder::Use(ResourceHandle resource, const Access& access, bool write, bool discard)
+{
+	// Several declarations of the same resource in one pass become a single use
+	Pass& pass = m_Graph.m_Passes[m_Pass];
+	for (ResourceUse& use : pass.Uses)
+	{
+		if (use.Resource != resource)
+		{
+			continue;
+		}
+		if (use.Usage.Layout != access.Layout)
+		{
+			throw std::runtime_error("Render graph pass " + pass.Name + " uses " + m_Graph.m_Resources[resource].Name + " in two layouts");
+		}
+		use.Usage.Stages |= access.Stages;
+		use.Usage.AccessMask |= access.AccessMask;
+		if (access.FinalLayout != VK_IMAGE_LAYOUT_UNDEFINED)
+		{
+			use.Usage.FinalLayout = access.FinalLayout;
+		}
+		use.Write = use.Write || write;
+		use.Discard = use.Discard && discard;
+		return;
+	}
+	pass.Uses.push_back({ resource, access, write, discard });
+}
+
+void RenderGraph::Setup(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t queueFamily, uint32_t framesInFlight, Profiler* profiler, MemoryBudget* memoryBudget)
+{
+	m_Device = device;
+	m_PhysicalDevice = physicalDevice;
+	m_QueueFamily = queueFamily;
+	m_FramesInFlight = framesInFlight;
+	m_Profiler = profiler;
+	m_MemoryBudget = memoryBudget;
+	m_CommandPools.resize(framesInFlight);
+	m_CommandBuffers.resize(framesInFlight);
+}
+
+void RenderGraph::Destroy()
+{
+	for (std::vector<VkCommandPool>& pools : m_CommandPools)
+	{
+		for (VkCommandPool pool : pools)
+		{
+			vkDestroyCommandPool(m_Device, pool, nullptr);
+		}
+	}
+	m_CommandPools.clear();
+	m_CommandBuffers.clear();
+
+	DestroyTransients(m_TransientImages, m_TransientHeaps);
+	for (RetiredTransients& retired : m_RetiredTransients)
+	{
+		DestroyTransients(retired.Images, retired.Heaps);
+	}
+	m_RetiredTransients.clear();
+}
+
+void RenderGraph::Reset()
+{
+	m_Resources.clear();
+	m_TransientDescs.clear();
+	m_Passes.clear();
+}
+
+RenderGraph::ResourceHandle RenderGraph::ImportImage(
+	const std::string& name,
+	VkImage image,
+	VkImageAspectFlags aspect,
+	uint32_t mipLevels,
+	const Access& initial)
+{
+	Resource resource;
+	resource.Name = name;
+	resource.Image = image;
+	resource.Range = { aspect, 0, mipLevels, 0, 1 };
+	if (initial.Stages != 0 || initial.Layout != VK_IMAGE_LAYOUT_UNDEFINED)
+	{
+		resource.State.Layout = initial.Layout;
+		resource.State.WriteStages = initial.Stages;
+		resource.State.WriteAccess = initial.AccessMask;
+	}
+	else if (auto state = m_ImportedStates.find(GetKey(image)); state != m_ImportedStates.end())
+	{
+		resource.State = state->second;
+	}
+	m_Resources.push_back(resource);
+	return static_cast<ResourceHandle>(m_Resources.size() - 1);
+}
+
+RenderGraph::ResourceHandle RenderGraph::ImportBuffer(const std::string& name, VkBuffer buffer)
+{
+	Resource resource;
+	resource.Name = name;
+	resource.Buffer = buffer;
+	if (auto state = m_ImportedStates.find(GetKey(buffer)); state != m_ImportedStates.end())
+	{
+		resource.State = state->second;
+	}
+	m_Resources.push_back(resource);
+	return static_cast<ResourceHandle>(m_Resources.size() - 1);
+}
+
+RenderGraph::ResourceHandle RenderGraph::CreateImage(const std::string& name, const TransientImageDesc& desc)
+{
+	Resource resource;
+	resource.Name = name;
+	resource.Range = { desc.Aspect, 0, 1, 0, 1 };
+	resource.TransientIndex = static_cast<int32_t>(m_TransientDescs.size());
+	m_TransientDescs.push_back(desc);
+	m_Resources.push_back(resource);
+	return static_cast<ResourceHandle>(m_Resources.size() - 1);
+}
+
+void RenderGraph::MarkOutput(ResourceHandle resource, const Access& access)
+{
+	m_Resources[resource].Output = true;
+	m_Resources[resource].OutputAccess = access;
+}
+
+void RenderGraph::AddPass(const std::string& name, const std::function<void(PassBuilder&)>& setup, std::function<void(VkCommandBuffer)> record)
+{
+	m_Passes.push_back({});
+	m_Passes.back().Name = name;
+	PassBuilder builder(*this, static_cast<uint32_t>(m_Passes.size() - 1));
+	setup(builder);
+	m_Passes.back().Record = std::move(record);
+}
+
+void RenderGraph::Execute(VkCommandBuffer commandBuffer, uint32_t frame)
+{
+	for (auto retired = m_RetiredTransients.begin(); retired != m_RetiredTransients.end();)
+	{
+		if (--retired->FramesLeft == 0)
+		{
+			DestroyTransients(retired->Images, retired->Heaps);
+			retired = m_RetiredTransients.erase(retired);
+		}
+		else
+		{
+			++retired;
+		}
+	}
+
+	std::vector<uint32_t> passes = CullPasses();
+	uint32_t levelCount = AssignLevels(passes);
+	std::stable_sort(passes.begin(), passes.end(), [&](uint32_t a, uint32_t b) { return m_Passes[a].Level < m_Passes[b].Level; });
+
+	// Transient images live from the first to the last level using them. The images are only recreated when that changes
+	std::vector<TransientImage> transients(m_TransientDescs.size());
+	for (size_t i = 0; i < transients.size(); ++i)
+	{
+		transients[i].Desc = m_TransientDescs[i];
+		transients[i].FirstLevel = UINT32_MAX;
+		transients[i].LastLevel = 0;
+	}
+	for (uint32_t passIndex : passes)
+	{
+		for (const ResourceUse& use : m_Passes[passIndex].Uses)
+		{
+			int32_t transientIndex = m_Resources[use.Resource].TransientIndex;
+			if (transientIndex >= 0)
+			{
+				TransientImage& transient = transients[transientIndex];
+				transient.FirstLevel = std::min(transient.FirstLevel, m_Passes[passIndex].Level);
+				transient.LastLevel = std::max(transient.LastLevel, m_Passes[passIndex].Level);
+			}
+		}
+	}
+	for (TransientImage& transient : transients)
+	{
+		transient.FirstLevel = std::min(transient.FirstLevel, transient.LastLevel); // Culled away
+	}
+	bool sameTransients = transients.size() == m_TransientImages.size() && std::equal(
+		transients.begin(),
+		transients.end(),
+		m_TransientImages.begin(),
+		[](const TransientImage& a, const TransientImage& b)
+		{
+			return a.Desc == b.Desc && a.FirstLevel == b.FirstLevel && a.LastLevel == b.LastLevel;
+		});
+	if (!sameTransients)
+	{
+		m_RetiredTransients.push_back({ std::move(m_TransientImages), std::move(m_TransientHeaps), m_FramesInFlight });
+		m_TransientImages.clear();
+		m_TransientHeaps.clear();
+		RealizeTransients(transients);
+	}
+
+	// A transient image's memory may have been used by any image sharing its heap, this frame or the frames before
+	for (uint32_t passIndex : passes)
+	{
+		for (const ResourceUse& use : m_Passes[passIndex].Uses)
+		{
+			int32_t transientIndex = m_Resources[use.Resource].TransientIndex;
+			if (transientIndex >= 0)
+			{
+				TransientHeap& heap = m_TransientHeaps[m_TransientImages[transientIndex].Heap];
+				heap.Stages |= use.Usage.Stages;
+				heap.WriteAccess |= use.Write ? use.Usage.AccessMask : 0;
+			}
+		}
+	}
+	for (Resource& resource : m_Resources)
+	{
+		if (resource.TransientIndex >= 0)
+		{
+			const TransientImage& transient = m_TransientImages[resource.TransientIndex];
+			resource.Image = transient.Image;
+			resource.View = transient.View;
+			resource.State = {};
+			resource.State.WriteStages = m_TransientHeaps[transient.Heap].Stages;
+			resource.State.WriteAccess = m_TransientHeaps[transient.Heap].WriteAccess;
+		}
+	}
+
+	RecordPasses(passes, frame);
+
+	// Passes in the same level do not depend on each other, so a single barrier covers all of them
+	m_BarrierCount = 0;
+	size_t next = 0;
+	for (uint32_t level = 0; level < levelCount; ++level)
+	{
+		BarrierBatch batch;
+		size_t levelEnd = next;
+		for (; levelEnd < passes.size() && m_Passes[passes[levelEnd]].Level == level; ++levelEnd)
+		{
+			for (const ResourceUse& use : m_Passes[passes[levelEnd]].Uses)
+			{
+				AddBarrier(m_Resources[use.Resource], use, batch);
+			}
+		}
+		RecordBarriers(commandBuffer, batch);
+
+		for (; next < levelEnd; ++next)
+		{
+			Pass& pass = m_Passes[passes[next]];
+			m_Profiler->BeginGpuScope(commandBuffer, frame, pass.Name);
+			if (pass.HasRenderPass)
+			{
+				pass.RenderPassInfo.clearValueCount = static_cast<uint32_t>(pass.ClearValues.size());
+				pass.RenderPassInfo.pClearValues = pass.ClearValues.data();
+				vkCmdBeginRenderPass(commandBuffer, &pass.RenderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+			}
+			else if (pass.HasRendering)
+			{
+				pass.RenderingInfo.flags |= VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT_KHR;
+				pass.RenderingInfo.colorAttachmentCount = static_cast<uint32_t>(pass.ColorAttachments.size());
+				pass.RenderingInfo.pColorAttachments = pass.ColorAttachments.data();
+				pass.RenderingInfo.pDepthAttachment = pass.DepthFormat != VK_FORMAT_UNDEFINED ? &pass.DepthAttachment : nullptr;
+				vkCmdBeginRenderingKHR(commandBuffer, &pass.RenderingInfo);
+			}
+			vkCmdExecuteCommands(commandBuffer, 1, &m_CommandBuffers[frame][next]);
+			if (pass.HasRenderPass)
+			{
+				vkCmdEndRenderPass(commandBuffer);
+			}
+			else if (pass.HasRendering)
+			{
+				vkCmdEndRenderingKHR(commandBuffer);
+			}
+			m_Profiler->EndGpuScope(commandBuffer, frame, pass.Name);
+		}
+	}
+
+	// Outputs are left in the layout whatever uses them after the graph expects
+	BarrierBatch outputBatch;
+	for (ResourceHandle handle = 0; handle < m_Resources.size(); ++handle)
+	{
+		Resource& resource = m_Resources[handle];
+		VkImageLayout layout = resource.OutputAccess.Layout;
+		if (resource.Output && resource.Image != VK_NULL_HANDLE && layout != VK_IMAGE_LAYOUT_UNDEFINED && layout != resource.State.Layout)
+		{
+			AddBarrier(resource, { handle, resource.OutputAccess, false, false }, outputBatch);
+		}
+	}
+	RecordBarriers(commandBuffer, outputBatch);
+
+	for (const Resource& resource : m_Resources)
+	{
+		if (resource.TransientIndex < 0)
+		{
+			m_ImportedStates[resource.Image != VK_NULL_HANDLE ? GetKey(resource.Image) : GetKey(resource.Buffer)] = resource.State;
+		}
+	}
+
+	m_Profiler->SetCounter("Culled passes", m_CulledPassCount);
+	m_Profiler->SetCounter("Barriers", m_BarrierCount);
+}
+
+void RenderGraph::Forget(VkImage image)
+{
+	m_ImportedStates.erase(GetKey(image));
+}
+
+void RenderGraph::ForgetAll()
+{
+	m_ImportedStates.clear();
+}
+
+std::vector<uint32_t> RenderGraph::CullPasses()
+{
+	// Walk back from the outputs, keeping the passes that write something an output or a kept pass needs
+	std::vector<bool> needed(m_Resources.size());
+	for (size_t i = 0; i < m_Resources.size(); ++i)
+	{
+		needed[i] = m_Resources[i].Output;
+	}
+
+	std::vector<uint32_t> passes;
+	for (int32_t i = static_cast<int32_t>(m_Passes.size()) - 1; i >= 0; --i)
+	{
+		const Pass& pass = m_Passes[i];
+		bool keep = false;
+		for (const ResourceUse& use : pass.Uses)
+		{
+			keep = keep || (use.Write && needed[use.Resource]);
+		}
+		if (!keep)
+		{
+			continue;
+		}
+
+		passes.push_back(i);
+		for (const ResourceUse& use : pass.Uses)
+		{
+			// Overwritten contents do not need earlier writers, anything else read or kept does
+			needed[use.Resource] = !use.Discard;
+		}
+	}
+	std::reverse(passes.begin(), passes.end());
+
+	m_CulledPassCount = static_cast<uint32_t>(m_Passes.size() - passes.size());
+	return passes;
+}
+
+uint32_t RenderGraph::AssignLevels(const std::vector<uint32_t>& passes)
+{
+	// A pass comes after the last writer of everything it uses, and after the readers of everything it writes or
+	// transitions. Reads in the layout the resource is already in can share a level
+	struct Tracking
+	{
+		int32_t WriterLevel = -1;
+		int32_t ReaderLevel = -1;
+		VkImageLayout Layout;
+	};
+	std::vector<Tracking> tracking(m_Resources.size());
+	for (size_t i = 0; i < m_Resources.size(); ++i)
+	{
+		tracking[i].Layout = m_Resources[i].State.Layout;
+	}
+
+	uint32_t levelCount = 0;
+	for (uint32_t passIndex : passes)
+	{
+		Pass& pass = m_Passes[passIndex];
+		int32_t level = 0;
+		for (const ResourceUse& use : pass.Uses)
+		{
+			const Tracking& resource = tracking[use.Resource];
+			bool transition = use.Usage.Layout != VK_IMAGE_LAYOUT_UNDEFINED && use.Usage.Layout != resource.Layout;
+			int32_t after = use.Write || transition ? std::max(resource.WriterLevel, resource.ReaderLevel) : resource.WriterLevel;
+			level = std::max(level, after + 1);
+		}
+		pass.Level = static_cast<uint32_t>(level);
+		levelCount = std::max(levelCount, pass.Level + 1);
+
+		for (const ResourceUse& use : pass.Uses)
+		{
+			Tracking& resource = tracking[use.Resource];
+			bool transition = use.Usage.Layout != VK_IMAGE_LAYOUT_UNDEFINED && use.Usage.Layout != resource.Layout;
+			if (use.Write || transition)
+			{
+				resource.WriterLevel = level;
+				resource.ReaderLevel = -1;
+			}
+			else
+			{
+				resource.ReaderLevel = std::max(resource.ReaderLevel, level);
+			}
+
+			if (use.Usage.FinalLayout != VK_IMAGE_LAYOUT_UNDEFINED)
+			{
+				resource.Layout = use.Usage.FinalLayout;
+			}
+			else if (use.Usage.Layout != VK_IMAGE_LAYOUT_UNDEFINED)
+			{
+				resource.Layout = use.Usage.Layout;
+			}
+		}
+	}
+	return levelCount;
+}
+
+void RenderGraph::RealizeTransients(const std::vector<TransientImage>& transients)
+{
+	m_TransientImages = transients;
+	std::vector<VkMemoryRequirements> requirements(transients.size());
+	for (size_t i = 0; i < transients.size(); ++i)
+	{
+		const TransientImageDesc& desc = transients[i].Desc;
+		VkImageCreateInfo imageInfo{};
+		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		imageInfo.imageType = VK_IMAGE_TYPE_2D;
+		imageInfo.extent = { desc.Extent.width, desc.Extent.height, 1 };
+		imageInfo.mipLevels = 1;
+		imageInfo.arrayLayers = 1;
+		imageInfo.format = desc.Format;
+		imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		imageInfo.usage = desc.Usage;
+		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		imageInfo.samples = desc.Samples;
+		if (vkCreateImage(m_Device, &imageInfo, nullptr, &m_TransientImages[i].Image) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create transient render graph image");
+		}
+		vkGetImageMemoryRequirements(m_Device, m_TransientImages[i].Image, &requirements[i]);
+	}
+
+	// Largest images first, each at the lowest offset of the first compatible heap where it does not overlap an image
+	// alive in any of the same levels
+	std::vector<uint32_t> order(transients.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return requirements[a].size > requirements[b].size; });
+
+	auto livesWith = [&](uint32_t a, uint32_t b)
+	{
+		return transients[a].FirstLevel <= transients[b].LastLevel && transients[b].FirstLevel <= transients[a].LastLevel;
+	};
+
+	std::vector<VkDeviceSize> offsets(transients.size());
+	std::vector<uint32_t> heapTypeBits;
+	std::vector<VkDeviceSize> heapSizes;
+	std::vector<std::vector<uint32_t>> heapImages;
+	for (uint32_t i : order)
+	{
+		const VkMemoryRequirements& required = requirements[i];
+		bool placed = false;
+		for (uint32_t heap = 0; heap < heapImages.size() && !placed; ++heap)
+		{
+			if ((heapTypeBits[heap] & required.memoryTypeBits) == 0)
+			{
+				continue;
+			}
+
+			std::vector<VkDeviceSize> candidates = { 0 };
+			for (uint32_t other : heapImages[heap])
+			{
+				if (livesWith(i, other))
+				{
+					candidates.push_back(AlignUp(offsets[other] + requirements[other].size, required.alignment));
+				}
+			}
+			std::sort(candidates.begin(), candidates.end());
+			for (VkDeviceSize offset : candidates)
+			{
+				bool overlaps = std::any_of(heapImages[heap].begin(), heapImages[heap].end(), [&](uint32_t other)
+				{
+					return livesWith(i, other) && offset < offsets[other] + requirements[other].size && offsets[other] < offset + required.size;
+				});
+				if (!overlaps)
+				{
+					offsets[i] = offset;
+					placed = true;
+					break;
+				}
+			}
+			if (placed)
+			{
+				m_TransientImages[i].Heap = heap;
+				heapTypeBits[heap] &= required.memoryTypeBits;
+				heapSizes[heap] = std::max(heapSizes[heap], offsets[i] + required.size);
+				heapImages[heap].push_back(i);
+			}
+		}
+		if (!placed)
+		{
+			offsets[i] = 0;
+			m_TransientImages[i].Heap = static_cast<uint32_t>(heapImages.size());
+			heapTypeBits.push_back(required.memoryTypeBits);
+			heapSizes.push_back(required.size);
+			heapImages.push_back({ i });
+		}
+	}
+
+	m_TransientMemorySize = 0;
+	m_TransientHeaps.resize(heapImages.size());
+	for (size_t heap = 0; heap < heapImages.size(); ++heap)
+	{
+		VkMemoryAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		allocInfo.allocationSize = heapSizes[heap];
+		allocInfo.memoryTypeIndex = FindMemoryType(heapTypeBits[heap], VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		m_TransientHeaps[heap].Memory = m_MemoryBudget->Allocate(allocInfo, MemoryBudget::CategoryAttachments);
+		m_TransientMemorySize += heapSizes[heap];
+	}
+
+	for (size_t i = 0; i < m_TransientImages.size(); ++i)
+	{
+		TransientImage& transient = m_TransientImages[i];
+		vkBindImageMemory(m_Device, transient.Image, m_TransientHeaps[transient.Heap].Memory, offsets[i]);
+
+		VkImageViewCreateInfo viewInfo{};
+		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewInfo.image = transient.Image;
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewInfo.format = transient.Desc.Format;
+		viewInfo.subresourceRange = { transient.Desc.Aspect, 0, 1, 0, 1 };
+		if (vkCreateImageView(m_Device, &viewInfo, nullptr, &transient.View) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create transient render graph image view");
+		}
+	}
+}
+
+void RenderGraph::DestroyTransients(std::vector<TransientImage>& images, std::vector<TransientHeap>& heaps)
+{
+	for (TransientImage& image : images)
+	{
+		vkDestroyImageView(m_Device, image.View, nullptr);
+		vkDestroyImage(m_Device, image.Image, nullptr);
+	}
+	for (TransientHeap& heap : heaps)
+	{
+		m_MemoryBudget->Free(heap.Memory);
+	}
+	images.clear();
+	heaps.clear();
+}
+
+void RenderGraph::AddBarrier(Resource& resource, const ResourceUse& use, BarrierBatch& batch)
+{
+	ResourceState& state = resource.State;
+	const Access& access = use.Usage;
+	bool transition = resource.Image != VK_NULL_HANDLE && access.Layout != VK_IMAGE_LAYOUT_UNDEFINED && access.Layout != state.Layout;
+
+	if (use.Write || transition)
+	{
+		// Wait for the last write and every read since, and make the last write visible
+		VkPipelineStageFlags srcStages = state.WriteStages | state.ReadStages;
+		if (transition)
+		{
+			VkImageMemoryBarrier barrier{};
+			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			barrier.srcAccessMask = state.WriteAccess;
+			barrier.dstAccessMask = access.AccessMask;
+			barrier.oldLayout = use.Discard ? VK_IMAGE_LAYOUT_UNDEFINED : state.Layout;
+			barrier.newLayout = access.Layout;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.image = resource.Image;
+			barrier.subresourceRange = resource.Range;
+			batch.AddImage(barrier, srcStages, access.Stages);
+		}
+		else if (srcStages != 0)
+		{
+			batch.AddMemory(srcStages, state.WriteAccess, access.Stages, state.WriteAccess != 0 ? access.AccessMask : 0);
+		}
+
+		if (use.Write)
+		{
+			state.WriteStages = access.Stages;
+			state.WriteAccess = access.AccessMask;
+			state.ReadStages = 0;
+			state.VisibleStages = 0;
+			state.VisibleAccess = 0;
+		}
+		else
+		{
+			// Later readers chain onto this read, which already sees the last write
+			state.WriteStages = access.Stages;
+			state.ReadStages = access.Stages;
+			state.VisibleStages = access.Stages;
+			state.VisibleAccess = access.AccessMask;
+		}
+	}
+	else
+	{
+		bool visible = (access.Stages & ~state.VisibleStages) == 0 && (access.AccessMask & ~state.VisibleAccess) == 0;
+		if (state.WriteStages != 0 && !visible)
+		{
+			batch.AddMemory(state.WriteStages, state.WriteAccess, access.Stages, state.WriteAccess != 0 ? access.AccessMask : 0);
+			state.VisibleStages |= access.Stages;
+			state.VisibleAccess |= access.AccessMask;
+		}
+		state.ReadStages |= access.Stages;
+	}
+
+	if (access.FinalLayout != VK_IMAGE_LAYOUT_UNDEFINED)
+	{
+		state.Layout = access.FinalLayout;
+	}
+	else if (access.Layout != VK_IMAGE_LAYOUT_UNDEFINED)
+	{
+		state.Layout = access.Layout;
+	}
+}
+
+void RenderGraph::BarrierBatch::AddMemory(
+	VkPipelineStageFlags srcStages,
+	VkAccessFlags srcAccess,
+	VkPipelineStageFlags dstStages,
+	VkAccessFlags dstAccess)
+{
+	SrcStages |= srcStages;
+	DstStages |= dstStages;
+	Memory.srcAccessMask |= srcAccess;
+	Memory.dstAccessMask |= dstAccess;
+
+	// Legacy stage and access bits keep their values in the 64-bit synchronization2 flags
+	VkMemoryBarrier2KHR barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2_KHR;
+	barrier.srcStageMask = srcStages;
+	barrier.srcAccessMask = srcAccess;
+	barrier.dstStageMask = dstStages;
+	barrier.dstAccessMask = dstAccess;
+	Memories2.push_back(barrier);
+}
+
+void RenderGraph::BarrierBatch::AddImage(const VkImageMemoryBarrier& barrier, VkPipelineStageFlags srcStages, VkPipelineStageFlags dstStages)
+{
+	SrcStages |= srcStages;
+	DstStages |= dstStages;
+	Images.push_back(barrier);
+
+	VkImageMemoryBarrier2KHR barrier2{};
+	barrier2.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR;
+	barrier2.srcStageMask = srcStages;
+	barrier2.srcAccessMask = barrier.srcAccessMask;
+	barrier2.dstStageMask = dstStages;
+	barrier2.dstAccessMask = barrier.dstAccessMask;
+	barrier2.oldLayout = barrier.oldLayout;
+	barrier2.newLayout = barrier.newLayout;
+	barrier2.srcQueueFamilyIndex = barrier.srcQueueFamilyIndex;
+	barrier2.dstQueueFamilyIndex = barrier.dstQueueFamilyIndex;
+	barrier2.image = barrier.image;
+	barrier2.subresourceRange = barrier.subresourceRange;
+	Images2.push_back(barrier2);
+}
+
+void RenderGraph::RecordBarriers(VkCommandBuffer commandBuffer, BarrierBatch& batch)
+{
+	if (batch.DstStages == 0)
+	{
+		return;
+	}
+
+	if (m_Synchronization2)
+	{
+		// Every barrier waits for its own stages only, and no stage is needed when nothing came before
+		VkDependencyInfoKHR dependencyInfo{};
+		dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR;
+		dependencyInfo.memoryBarrierCount = static_cast<uint32_t>(batch.Memories2.size());
+		dependencyInfo.pMemoryBarriers = batch.Memories2.data();
+		dependencyInfo.imageMemoryBarrierCount = static_cast<uint32_t>(batch.Images2.size());
+		dependencyInfo.pImageMemoryBarriers = batch.Images2.data();
+		vkCmdPipelineBarrier2KHR(commandBuffer, &dependencyInfo);
+		++m_BarrierCount;
+		return;
+	}
+
+	bool memoryBarrier = batch.Memory.srcAccessMask != 0 || batch.Memory.dstAccessMask != 0;
+	vkCmdPipelineBarrier(
+		commandBuffer,
+		batch.SrcStages != 0 ? batch.SrcStages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+		batch.DstStages,
+		0,
+		memoryBarrier ? 1 : 0,
+		&batch.Memory,
+		0,
+		nullptr,
+		static_cast<uint32_t>(batch.Images.size()),
+		batch.Images.data());
+	++m_BarrierCount;
+}
+
+void RenderGraph::RecordPasses(const std::vector<uint32_t>& passes, uint32_t frame)
+{
+	std::vector<VkCommandPool>& pools = m_CommandPools[frame];
+	std::vector<VkCommandBuffer>& commandBuffers = m_CommandBuffers[frame];
+	while (pools.size() < passes.size())
+	{
+		VkCommandPoolCreateInfo poolInfo{};
+		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+		poolInfo.queueFamilyIndex = m_QueueFamily;
+		VkCommandPool pool;
+		if (vkCreateCommandPool(m_Device, &poolInfo, nullptr, &pool) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create render graph command pool");
+		}
+
+		VkCommandBufferAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.commandPool = pool;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+		allocInfo.commandBufferCount = 1;
+		VkCommandBuffer commandBuffer;
+		if (vkAllocateCommandBuffers(m_Device, &allocInfo, &commandBuffer) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to allocate render graph command buffer");
+		}
+		pools.push_back(pool);
+		commandBuffers.push_back(commandBuffer);
+	}
+
+	// Each pass has its own pool, so they can all be recorded at once
+	std::vector<uint32_t> slots(passes.size());
+	std::iota(slots.begin(), slots.end(), 0);
+	std::vector<std::exception_ptr> errors(passes.size());
+	std::for_each(std::execution::par, slots.begin(), slots.end(), [&](uint32_t slot)
+	{
+		try
+		{
+			const Pass& pass = m_Passes[passes[slot]];
+			vkResetCommandPool(m_Device, pools[slot], 0);
+
+			VkCommandBufferInheritanceInfo inheritanceInfo{};
+			inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+			VkCommandBufferBeginInfo beginInfo{};
+			beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+			beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+			beginInfo.pInheritanceInfo = &inheritanceInfo;
+			VkCommandBufferInheritanceRenderingInfoKHR renderingInfo{};
+			renderingInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO_KHR;
+			if (pass.HasRenderPass)
+			{
+				inheritanceInfo.renderPass = pass.RenderPassInfo.renderPass;
+				inheritanceInfo.subpass = 0;
+				inheritanceInfo.framebuffer = pass.RenderPassInfo.framebuffer;
+				beginInfo.flags |= VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+			}
+			else if (pass.HasRendering)
+			{
+				renderingInfo.colorAttachmentCount = static_cast<uint32_t>(pass.ColorFormats.size());
+				renderingInfo.pColorAttachmentFormats = pass.ColorFormats.data();
+				renderingInfo.depthAttachmentFormat = pass.DepthFormat;
+				renderingInfo.rasterizationSamples = pass.Samples;
+				inheritanceInfo.pNext = &renderingInfo;
+				beginInfo.flags |= VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+			}
+			if (vkBeginCommandBuffer(commandBuffers[slot], &beginInfo) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to begin recording render graph pass " + pass.Name);
+			}
+			pass.Record(commandBuffers[slot]);
+			if (vkEndCommandBuffer(commandBuffers[slot]) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to record render graph pass " + pass.Name);
+			}
+		}
+		catch (...)
+		{
+			errors[slot] = std::current_exception();
+		}
+	});
+
+	for (const std::exception_ptr& error : errors)
+	{
+		if (error)
+		{
+			std::rethrow_exception(error);
+		}
+	}
+}
+
+uint32_t RenderGraph::FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties)
+{
+	VkPhysicalDeviceMemoryProperties memProperties;
+	vkGetPhysicalDeviceMemoryProperties(m_PhysicalDevice, &memProperties);
+	for (uint32_t i = 0; i < memProperties.memoryTypeCount; ++i)
+	{
+		if (typeFilter & (1 << i) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties)
+		{
+			return i;
+		}
+	}
+
+	throw std::runtime_error("Failed to find suitable memory type");
+}
@@ -0,0 +1,233 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+class MemoryBudget;
+class Profiler;
+
+// Frame described as passes declaring which resources they read and write. Executing it culls passes whose results
+// are never used, groups the rest into levels of independent passes with one batched barrier in front of each level,
+// and aliases the memory of transient images whose lifetimes do not overlap. Passes are recorded into secondary
+// command buffers in parallel, since every barrier between them is known before recording starts. Barriers go through
+// synchronization2 when it is enabled, keeping each barrier's own stages instead of merging them per level
+class RenderGraph
+{
+public:
+	using ResourceHandle = uint32_t;
+
+	// How a pass uses a resource. Layout is ignored for buffers, and undefined for images the pass transitions itself.
+	// Zero initialized with {}
+	struct Access
+	{
+		VkPipelineStageFlags Stages;
+		VkAccessFlags AccessMask;
+		VkImageLayout Layout;
+		VkImageLayout FinalLayout; // Left behind by the pass when it differs, like a render pass
+	};
+
+	struct TransientImageDesc
+	{
+		VkExtent2D Extent;
+		VkFormat Format;
+		VkImageUsageFlags Usage;
+		VkImageAspectFlags Aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+		VkSampleCountFlagBits Samples = VK_SAMPLE_COUNT_1_BIT;
+
+		bool operator==(const TransientImageDesc& other) const;
+	};
+
+	class PassBuilder
+	{
+	public:
+		void Read(ResourceHandle resource, const Access& access);
+		// Keeps the current contents, so earlier writers stay alive and images are transitioned from their current layout
+		void Write(ResourceHandle resource, const Access& access);
+		// Replaces the whole resource, so earlier contents are discarded
+		void Overwrite(ResourceHandle resource, const Access& access);
+		// The graph begins the render pass around the pass' commands. The clear values are copied
+		void SetRenderPass(const VkRenderPassBeginInfo& beginInfo);
+		// The graph begins dynamic rendering around the pass' commands. The attachments are copied, and the formats and
+		// sample count describe them to the secondary command buffer. Attachments are not transitioned by rendering, so
+		// the pass declares them in their attachment layouts
+		void SetRendering(
+			const VkRenderingInfoKHR& renderingInfo,
+			const std::vector<VkFormat>& colorFormats,
+			VkFormat depthFormat,
+			VkSampleCountFlagBits samples);
+
+	private:
+		friend class RenderGraph;
+		PassBuilder(RenderGraph& graph, uint32_t pass) : m_Graph(graph), m_Pass(pass) {}
+		void Use(ResourceHandle resource, const Access& access, bool write, bool discard);
+
+		RenderGraph& m_Graph;
+		uint32_t m_Pass;
+	};
+
+	void Setup(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t queueFamily, uint32_t framesInFlight, Profiler* profiler, MemoryBudget* memoryBudget);
+	void Destroy();
+	// Requires VK_KHR_synchronization2 to be enabled on the device
+	void SetSynchronization2(bool enabled) { m_Synchronization2 = enabled; }
+
+	// Starts describing a new frame. Imported resources keep the state the previous frames left them in
+	void Reset();
+	// Initial overrides the remembered state, for images last used outside the graph like acquired swapchain images
+	ResourceHandle ImportImage(
+		const std::string& name,
+		VkImage image,
+		VkImageAspectFlags aspect,
+		uint32_t mipLevels = 1,
+		const Access& initial = {});
+	ResourceHandle ImportBuffer(const std::string& name, VkBuffer buffer);
+	ResourceHandle CreateImage(const std::string& name, const TransientImageDesc& desc);
+	// Resources that are used after the graph. Images are left in the layout given by access, when it is defined
+	void MarkOutput(ResourceHandle resource, const Access& access = {});
+	void AddPass(const std::string& name, const std::function<void(PassBuilder&)>& setup, std::function<void(VkCommandBuffer)> record);
+
+	// Records the frame into a primary command buffer, outside of any render pass. The frame's previous use must have completed
+	void Execute(VkCommandBuffer commandBuffer, uint32_t frame);
+
+	// Only valid inside the record callbacks
+	VkImage GetImage(ResourceHandle resource) const { return m_Resources[resource].Image; }
+	VkImageView GetImageView(ResourceHandle resource) const { return m_Resources[resource].View; }
+	VkBuffer GetBuffer(ResourceHandle resource) const { return m_Resources[resource].Buffer; }
+
+	// Drops what is known about an imported image, after it was recreated or its memory was reused outside the graph
+	void Forget(VkImage image);
+	void ForgetAll();
+
+	uint32_t GetCulledPassCount() const { return m_CulledPassCount; }
+	uint32_t GetBarrierCount() const { return m_BarrierCount; }
+	VkDeviceSize GetTransientMemorySize() const { return m_TransientMemorySize; }
+
+private:
+	// What happened to a resource since its last write, to derive the barrier in front of its next use
+	struct ResourceState
+	{
+		VkImageLayout Layout = VK_IMAGE_LAYOUT_UNDEFINED;
+		VkPipelineStageFlags WriteStages = 0;
+		VkAccessFlags WriteAccess = 0;
+		VkPipelineStageFlags ReadStages = 0; // Readers since the last write, which the next write waits for
+		VkPipelineStageFlags VisibleStages = 0; // Where the last write has already been made visible
+		VkAccessFlags VisibleAccess = 0;
+	};
+
+	struct Resource
+	{
+		std::string Name;
+		VkImage Image = VK_NULL_HANDLE;
+		VkImageView View = VK_NULL_HANDLE;
+		VkBuffer Buffer = VK_NULL_HANDLE;
+		VkImageSubresourceRange Range{};
+		int32_t TransientIndex = -1;
+		bool Output = false;
+		Access OutputAccess;
+		ResourceState State;
+	};
+
+	struct ResourceUse
+	{
+		ResourceHandle Resource;
+		Access Usage;
+		bool Write;
+		bool Discard;
+	};
+
+	struct Pass
+	{
+		std::string Name;
+		std::vector<ResourceUse> Uses;
+		std::function<void(VkCommandBuffer)> Record;
+		bool HasRenderPass = false;
+		VkRenderPassBeginInfo RenderPassInfo{};
+		std::vector<VkClearValue> ClearValues;
+		bool HasRendering = false;
+		VkRenderingInfoKHR RenderingInfo{};
+		std::vector<VkRenderingAttachmentInfoKHR> ColorAttachments;
+		VkRenderingAttachmentInfoKHR DepthAttachment{};
+		std::vector<VkFormat> ColorFormats;
+		VkFormat DepthFormat = VK_FORMAT_UNDEFINED;
+		VkSampleCountFlagBits Samples = VK_SAMPLE_COUNT_1_BIT;
+		uint32_t Level = 0;
+	};
+
+	struct TransientImage
+	{
+		TransientImageDesc Desc;
+		uint32_t FirstLevel;
+		uint32_t LastLevel;
+		VkImage Image = VK_NULL_HANDLE;
+		VkImageView View = VK_NULL_HANDLE;
+		uint32_t Heap = 0;
+	};
+
+	struct TransientHeap
+	{
+		VkDeviceMemory Memory = VK_NULL_HANDLE;
+		VkPipelineStageFlags Stages = 0; // Every access made to any image placed in the heap
+		VkAccessFlags WriteAccess = 0;
+	};
+
+	// Transient images replaced by a new frame layout, destroyed once no frame in flight can use them
+	struct RetiredTransients
+	{
+		std::vector<TransientImage> Images;
+		std::vector<TransientHeap> Heaps;
+		uint32_t FramesLeft;
+	};
+
+	// Collected both ways, merged into one set of stages for vkCmdPipelineBarrier and kept apart for synchronization2
+	struct BarrierBatch
+	{
+		VkPipelineStageFlags SrcStages = 0;
+		VkPipelineStageFlags DstStages = 0;
+		VkMemoryBarrier Memory{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+		std::vector<VkImageMemoryBarrier> Images;
+		std::vector<VkMemoryBarrier2KHR> Memories2;
+		std::vector<VkImageMemoryBarrier2KHR> Images2;
+
+		void AddMemory(VkPipelineStageFlags srcStages, VkAccessFlags srcAccess, VkPipelineStageFlags dstStages, VkAccessFlags dstAccess);
+		void AddImage(const VkImageMemoryBarrier& barrier, VkPipelineStageFlags srcStages, VkPipelineStageFlags dstStages);
+	};
+
+	std::vector<uint32_t> CullPasses();
+	uint32_t AssignLevels(const std::vector<uint32_t>& passes);
+	void RealizeTransients(const std::vector<TransientImage>& transients);
+	void DestroyTransients(std::vector<TransientImage>& images, std::vector<TransientHeap>& heaps);
+	void AddBarrier(Resource& resource, const ResourceUse& use, BarrierBatch& batch);
+	void RecordBarriers(VkCommandBuffer commandBuffer, BarrierBatch& batch);
+	void RecordPasses(const std::vector<uint32_t>& passes, uint32_t frame);
+	uint32_t FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
+
+	static uint64_t GetKey(VkImage image) { return (uint64_t)image; }
+	static uint64_t GetKey(VkBuffer buffer) { return (uint64_t)buffer; }
+
+	VkDevice m_Device;
+	VkPhysicalDevice m_PhysicalDevice;
+	uint32_t m_QueueFamily;
+	uint32_t m_FramesInFlight;
+	Profiler* m_Profiler;
+	MemoryBudget* m_MemoryBudget;
+	bool m_Synchronization2 = false;
+
+	// Rebuilt every frame
+	std::vector<Resource> m_Resources;
+	std::vector<TransientImageDesc> m_TransientDescs;
+	std::vector<Pass> m_Passes;
+
+	// Kept across frames
+	std::unordered_map<uint64_t, ResourceState> m_ImportedStates;
+	std::vector<TransientImage> m_TransientImages;
+	std::vector<TransientHeap> m_TransientHeaps;
+	std::vector<RetiredTransients> m_RetiredTransients;
+	std::vector<std::vector<VkCommandPool>> m_CommandPools; // One pool per pass per frame in flight, so passes record on any thread
+	std::vector<std::vector<VkCommandBuffer>> m_CommandBuffers;
+
+	uint32_t m_CulledPassCount = 0;
+	uint32_t m_BarrierCount = 0;
+	VkDeviceSize m_TransientMemorySize = 0;
+};
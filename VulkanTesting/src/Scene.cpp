@@ -0,0 +1,225 @@
+#include "Scene.h"
+#include "MeshSimplifier.h"
+
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <stdexcept>
+
+uint32_t Scene::AddMesh(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices)
+{
+	MeshInfo mesh{};
+	mesh.FirstIndex = static_cast<uint32_t>(m_Indices.size());
+	mesh.IndexCount = static_cast<uint32_t>(indices.size());
+	mesh.VertexOffset = static_cast<int32_t>(m_Vertices.size());
+	mesh.VertexCount = static_cast<uint32_t>(vertices.size());
+
+	// Bounding sphere around the center of the bounding box
+	glm::vec3 minPosition(std::numeric_limits<float>::max());
+	glm::vec3 maxPosition(std::numeric_limits<float>::lowest());
+	for (const auto& vertex : vertices)
+	{
+		minPosition = glm::min(minPosition, vertex.Position);
+		maxPosition = glm::max(maxPosition, vertex.Position);
+	}
+	glm::vec3 center = (minPosition + maxPosition) * 0.5f;
+	float radius = 0.0f;
+	for (const auto& vertex : vertices)
+	{
+		radius = std::max(radius, glm::length(vertex.Position - center));
+	}
+	mesh.BoundingSphere = glm::vec4(center, radius);
+
+	// Indices stay relative to the mesh, the draw's vertex offset rebases them
+	m_Vertices.insert(m_Vertices.end(), vertices.begin(), vertices.end());
+	m_Indices.insert(m_Indices.end(), indices.begin(), indices.end());
+
+	// Levels of detail follow the full mesh in the index buffer, each simplified from the previous one
+	mesh.Lods[0] = { mesh.FirstIndex, mesh.IndexCount, 0.0f, 0 };
+	mesh.LodCount = 1;
+	MeshSimplifier simplifier;
+	simplifier.Setup(vertices, indices);
+	while (mesh.LodCount < MeshInfo::s_MaxLods)
+	{
+		size_t previousTriangles = mesh.Lods[mesh.LodCount - 1].IndexCount / 3;
+		if (previousTriangles / 2 < s_MinLodTriangles || !simplifier.Simplify(previousTriangles / 2))
+		{
+			break;
+		}
+
+		// Stop once locked seams and borders keep a level from getting meaningfully smaller
+		const std::vector<uint32_t>& lodIndices = simplifier.GetIndices();
+		if (lodIndices.size() / 3 > previousTriangles * 9 / 10)
+		{
+			break;
+		}
+
+		MeshLod& lod = mesh.Lods[mesh.LodCount++];
+		lod.FirstIndex = static_cast<uint32_t>(m_Indices.size());
+		lod.IndexCount = static_cast<uint32_t>(lodIndices.size());
+		lod.Error = simplifier.GetError();
+		m_Indices.insert(m_Indices.end(), lodIndices.begin(), lodIndices.end());
+	}
+
+	// Meshlets also keep a meshlet ordered copy of the indices, so each one can be drawn as an index range
+	MeshletBuilder builder;
+	builder.Build(vertices, indices);
+	mesh.MeshletOffset = static_cast<uint32_t>(m_Meshlets.size());
+	mesh.MeshletCount = static_cast<uint32_t>(builder.GetMeshlets().size());
+	uint32_t firstMeshletIndex = static_cast<uint32_t>(m_Indices.size());
+	uint32_t meshletDataOffset = static_cast<uint32_t>(m_MeshletData.size());
+	for (Meshlet meshlet : builder.GetMeshlets())
+	{
+		meshlet.VertexOffset += meshletDataOffset;
+		meshlet.TriangleOffset += meshletDataOffset;
+		meshlet.FirstIndex += firstMeshletIndex;
+		meshlet.MeshIndex = static_cast<uint32_t>(m_Meshes.size());
+		m_Meshlets.push_back(meshlet);
+	}
+	m_Indices.insert(m_Indices.end(), builder.GetMeshletIndices().begin(), builder.GetMeshletIndices().end());
+	m_MeshletData.insert(m_MeshletData.end(), builder.GetMeshletData().begin(), builder.GetMeshletData().end());
+
+	m_Meshes.push_back(mesh);
+
+	return static_cast<uint32_t>(m_Meshes.size() - 1);
+}
+
+void Scene::AddInstance(uint32_t meshIndex, const glm::mat4& transform, uint32_t textureIndex, uint32_t samplerIndex)
+{
+	if (meshIndex >= m_Meshes.size())
+	{
+		throw std::runtime_error("Instance references a mesh that is not in the scene");
+	}
+
+	InstanceData instance{};
+	instance.Transform = transform;
+	instance.MeshIndex = meshIndex;
+	instance.TextureIndex = textureIndex;
+	instance.SamplerIndex = samplerIndex;
+	m_Instances.push_back(instance);
+}
+
+void Scene::BuildDrawCommands()
+{
+	std::stable_sort(m_Instances.begin(), m_Instances.end(), [](const InstanceData& a, const InstanceData& b)
+	{
+		return a.MeshIndex < b.MeshIndex;
+	});
+
+	m_DrawCommands.clear();
+	uint32_t firstInstance = 0;
+	while (firstInstance < m_Instances.size())
+	{
+		uint32_t meshIndex = m_Instances[firstInstance].MeshIndex;
+		uint32_t instanceCount = 0;
+		while (firstInstance + instanceCount < m_Instances.size() && m_Instances[firstInstance + instanceCount].MeshIndex == meshIndex)
+		{
+			++instanceCount;
+		}
+
+		const MeshInfo& mesh = m_Meshes[meshIndex];
+		VkDrawIndexedIndirectCommand command{};
+		command.indexCount = mesh.IndexCount;
+		command.instanceCount = instanceCount;
+		command.firstIndex = mesh.FirstIndex;
+		command.vertexOffset = mesh.VertexOffset;
+		command.firstInstance = firstInstance; // gl_InstanceIndex starts here, indexing the instance buffer
+		m_DrawCommands.push_back(command);
+
+		firstInstance += instanceCount;
+	}
+}
+
+LodSelection Scene::SelectLods(
+	const glm::mat4& view,
+	float pixelsPerUnit,
+	float maxErrorPixels,
+	std::vector<VkDrawIndexedIndirectCommand>& commands) const
+{
+	LodSelection selection{};
+	commands.clear();
+	for (uint32_t i = 0; i < m_Instances.size(); ++i)
+	{
+		const InstanceData& instance = m_Instances[i];
+		const MeshInfo& mesh = m_Meshes[instance.MeshIndex];
+
+		glm::mat4 modelView = view * instance.Transform;
+		glm::vec3 center = modelView * glm::vec4(glm::vec3(mesh.BoundingSphere), 1.0f);
+		float scale = std::max({ glm::length(glm::vec3(modelView[0])), glm::length(glm::vec3(modelView[1])), glm::length(glm::vec3(modelView[2])) });
+		float distance = glm::length(center) - mesh.BoundingSphere.w * scale;
+
+		uint32_t lodIndex = SelectLod(mesh, distance, scale, pixelsPerUnit, maxErrorPixels);
+		const MeshLod& lod = mesh.Lods[lodIndex];
+		selection.TriangleCount += lod.IndexCount / 3;
+		selection.MaxErrorPixels = std::max(selection.MaxErrorPixels, lod.Error * scale * pixelsPerUnit / std::max(distance, s_MinLodDistance));
+
+		// Instances are sorted by mesh, so neighbours often share a level
+		if (!commands.empty())
+		{
+			VkDrawIndexedIndirectCommand& previous = commands.back();
+			if (previous.firstIndex == lod.FirstIndex && previous.firstInstance + previous.instanceCount == i)
+			{
+				++previous.instanceCount;
+				continue;
+			}
+		}
+
+		VkDrawIndexedIndirectCommand command{};
+		command.indexCount = lod.IndexCount;
+		command.instanceCount = 1;
+		command.firstIndex = lod.FirstIndex;
+		command.vertexOffset = mesh.VertexOffset;
+		command.firstInstance = i;
+		commands.push_back(command);
+	}
+	return selection;
+}
+
+void Scene::GatherVisibleTextures(const glm::mat4& viewProjection, std::vector<uint32_t>& textureIndices) const
+{
+	// Frustum planes from the rows of the matrix, with Vulkan's zero to one depth range
+	glm::mat4 rows = glm::transpose(viewProjection);
+	std::array<glm::vec4, 6> planes = {
+		rows[3] + rows[0], rows[3] - rows[0],
+		rows[3] + rows[1], rows[3] - rows[1],
+		rows[2], rows[3] - rows[2] };
+	for (glm::vec4& plane : planes)
+	{
+		plane /= glm::length(glm::vec3(plane));
+	}
+
+	textureIndices.clear();
+	for (const InstanceData& instance : m_Instances)
+	{
+		const MeshInfo& mesh = m_Meshes[instance.MeshIndex];
+		glm::vec4 center = instance.Transform * glm::vec4(glm::vec3(mesh.BoundingSphere), 1.0f);
+		float scale = std::max({ glm::length(glm::vec3(instance.Transform[0])), glm::length(glm::vec3(instance.Transform[1])), glm::length(glm::vec3(instance.Transform[2])) });
+		float radius = mesh.BoundingSphere.w * scale;
+		bool visible = std::all_of(planes.begin(), planes.end(), [&](const glm::vec4& plane)
+		{
+			return glm::dot(glm::vec3(plane), glm::vec3(center)) + plane.w >= -radius;
+		});
+		if (visible)
+		{
+			textureIndices.push_back(instance.TextureIndex);
+		}
+	}
+	std::sort(textureIndices.begin(), textureIndices.end());
+	textureIndices.erase(std::unique(textureIndices.begin(), textureIndices.end()), textureIndices.end());
+}
+
+uint32_t Scene::SelectLod(const MeshInfo& mesh, float distance, float scale, float pixelsPerUnit, float maxErrorPixels)
+{
+	// Levels get coarser and their error only grows, so stop at the first one that would be visible
+	distance = std::max(distance, s_MinLodDistance);
+	uint32_t lodIndex = 0;
+	for (uint32_t i = 1; i < mesh.LodCount; ++i)
+	{
+		if (mesh.Lods[i].Error * scale * pixelsPerUnit / distance > maxErrorPixels)
+		{
+			break;
+		}
+		lodIndex = i;
+	}
+	return lodIndex;
+}
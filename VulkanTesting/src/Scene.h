@@ -0,0 +1,92 @@
+#pragma once
+
+#include <vector>
+
+#include "Vertex.h"
+#include "MeshletBuilder.h"
+
+// Index range of one level of detail, drawn with the mesh's vertex offset
+struct MeshLod
+{
+	uint32_t FirstIndex;
+	uint32_t IndexCount;
+	float Error; // Largest deviation from the full detail mesh, in mesh units
+	uint32_t Padding;
+};
+
+// Range of a mesh inside the shared vertex and index buffers. Matches the std430 layout in culling.glsl
+struct MeshInfo
+{
+	static constexpr uint32_t s_MaxLods = 8;
+
+	uint32_t FirstIndex;
+	uint32_t IndexCount;
+	int32_t VertexOffset;
+	uint32_t VertexCount;
+	glm::vec4 BoundingSphere; // xyz center, w radius, in mesh space
+	uint32_t MeshletOffset;
+	uint32_t MeshletCount;
+	uint32_t LodCount;
+	uint32_t Padding;
+	MeshLod Lods[s_MaxLods]; // Level 0 is the full mesh, each next one has about half the triangles
+};
+
+struct LodSelection
+{
+	uint32_t TriangleCount;
+	float MaxErrorPixels;
+};
+
+// Per-instance data read by the vertex shader through gl_InstanceIndex. Matches the std430 layout in shader.vert
+struct InstanceData
+{
+	glm::mat4 Transform;
+	uint32_t MeshIndex;
+	uint32_t TextureIndex;
+	uint32_t SamplerIndex;
+	uint32_t Padding;
+};
+
+// Many meshes packed into a single vertex and index buffer, drawn instanced from one indirect buffer
+class Scene
+{
+public:
+	uint32_t AddMesh(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices);
+	void AddInstance(uint32_t meshIndex, const glm::mat4& transform, uint32_t textureIndex, uint32_t samplerIndex);
+
+	// Sort instances by mesh so each mesh is one indirect command drawing a contiguous run of instances
+	void BuildDrawCommands();
+
+	// Pick the coarsest level of each instance whose error stays under maxErrorPixels on screen, then merge runs of
+	// instances drawing the same level into commands. pixelsPerUnit is the screen height covered by one unit at distance one.
+	// Only reads the scene, so it can run on the simulation thread while frames are recorded
+	LodSelection SelectLods(
+		const glm::mat4& view,
+		float pixelsPerUnit,
+		float maxErrorPixels,
+		std::vector<VkDrawIndexedIndirectCommand>& commands) const;
+	static uint32_t SelectLod(const MeshInfo& mesh, float distance, float scale, float pixelsPerUnit, float maxErrorPixels);
+
+	// Texture indices of the instances whose bounding spheres touch the frustum, each listed once. Only reads the scene
+	void GatherVisibleTextures(const glm::mat4& viewProjection, std::vector<uint32_t>& textureIndices) const;
+
+	const std::vector<Vertex>& GetVertices() const { return m_Vertices; }
+	const std::vector<uint32_t>& GetIndices() const { return m_Indices; }
+	const std::vector<MeshInfo>& GetMeshes() const { return m_Meshes; }
+	const std::vector<InstanceData>& GetInstances() const { return m_Instances; }
+	const std::vector<VkDrawIndexedIndirectCommand>& GetDrawCommands() const { return m_DrawCommands; }
+	const std::vector<Meshlet>& GetMeshlets() const { return m_Meshlets; }
+	const std::vector<uint32_t>& GetMeshletData() const { return m_MeshletData; }
+
+private:
+	static constexpr size_t s_MinLodTriangles = 64;
+	static constexpr float s_MinLodDistance = 0.001f;
+
+	std::vector<Vertex> m_Vertices;
+	std::vector<uint32_t> m_Indices;
+	std::vector<MeshInfo> m_Meshes;
+	std::vector<InstanceData> m_Instances;
+	std::vector<VkDrawIndexedIndirectCommand> m_DrawCommands;
+	std::vector<Meshlet> m_Meshlets;
+	std::vector<uint32_t> m_MeshletData;
+};
@@ -0,0 +1,207 @@
+#include "ShaderCompiler.h"
+
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+std::string ShaderSource::GetName() const
+{
+	std::string name = Path;
+	for (const std::string& define : Defines)
+	{
+		name += " -D" + define;
+	}
+	return name;
+}
+
+void ShaderCompiler::Setup(const std::string& cacheDirectory)
+{
+	m_CacheDirectory = cacheDirectory;
+	std::filesystem::create_directories(m_CacheDirectory);
+}
+
+std::vector<uint32_t> ShaderCompiler::Compile(const ShaderSource& source)
+{
+	shaderc_shader_kind kind = GetKind(source.Path);
+	std::string text = ReadText(source.Path);
+
+	// The preprocessed text already holds the includes and the defines, hashing it with the options names the blob
+	shaderc::PreprocessedSourceCompilationResult preprocessed
+		= m_Compiler.PreprocessGlsl(text, kind, source.Path.c_str(), CreateOptions(source, nullptr));
+	if (preprocessed.GetCompilationStatus() != shaderc_compilation_status_success)
+	{
+		throw std::runtime_error("Failed to preprocess " + source.GetName() + ":\n" + preprocessed.GetErrorMessage());
+	}
+
+	// 64 bit FNV-1a
+	uint64_t hash = 14695981039346656037ull;
+	auto addToHash = [&hash](const std::string& data)
+	{
+		for (unsigned char c : data)
+		{
+			hash = (hash ^ c) * 1099511628211ull;
+		}
+		hash = (hash ^ 0xff) * 1099511628211ull; // Separator, so moving characters between fields changes the hash
+	};
+	addToHash(std::to_string(s_CacheVersion) + " " + std::to_string(kind));
+	for (const std::string& define : source.Defines)
+	{
+		addToHash(define);
+	}
+	addToHash(std::string(preprocessed.cbegin(), preprocessed.cend()));
+
+	std::ostringstream cacheName;
+	cacheName << std::hex << std::setw(16) << std::setfill('0') << hash << ".spv";
+	std::filesystem::path cachePath = std::filesystem::path(m_CacheDirectory) / cacheName.str();
+	std::ifstream cacheFile(cachePath, std::ios::ate | std::ios::binary);
+	if (cacheFile.is_open())
+	{
+		std::vector<uint32_t> code(static_cast<size_t>(cacheFile.tellg()) / sizeof(uint32_t));
+		cacheFile.seekg(0);
+		if (!code.empty() && cacheFile.read(reinterpret_cast<char*>(code.data()), code.size() * sizeof(uint32_t)))
+		{
+			return code;
+		}
+	}
+
+	shaderc::SpvCompilationResult result = m_Compiler.CompileGlslToSpv(text, kind, source.Path.c_str(), CreateOptions(source, nullptr));
+	if (result.GetCompilationStatus() != shaderc_compilation_status_success)
+	{
+		throw std::runtime_error("Failed to compile " + source.GetName() + ":\n" + result.GetErrorMessage());
+	}
+	std::vector<uint32_t> code(result.cbegin(), result.cend());
+
+	// Written under a name of its own and then renamed, so a thread compiling the same shader never reads half a file
+	std::ostringstream temporaryName;
+	temporaryName << cachePath.string() << "." << std::this_thread::get_id() << ".tmp";
+	{
+		std::ofstream file(temporaryName.str(), std::ios::binary);
+		file.write(reinterpret_cast<const char*>(code.data()), code.size() * sizeof(uint32_t));
+	}
+	std::error_code error;
+	std::filesystem::rename(temporaryName.str(), cachePath, error);
+	if (error)
+	{
+		std::filesystem::remove(temporaryName.str(), error);
+	}
+	return code;
+}
+
+std::vector<std::string> ShaderCompiler::GetDependencies(const ShaderSource& source)
+{
+	// Preprocessing opens every include, a failure only leaves out the files it did not reach
+	std::vector<std::string> files = { source.Path };
+	m_Compiler.PreprocessGlsl(ReadText(source.Path), GetKind(source.Path), source.Path.c_str(), CreateOptions(source, &files));
+	return files;
+}
+
+shaderc::CompileOptions ShaderCompiler::CreateOptions(const ShaderSource& source, std::vector<std::string>* includedFiles) const
+{
+	shaderc::CompileOptions options;
+	for (const std::string& define : source.Defines)
+	{
+		size_t separator = define.find('=');
+		if (separator == std::string::npos)
+		{
+			options.AddMacroDefinition(define);
+		}
+		else
+		{
+			options.AddMacroDefinition(define.substr(0, separator), define.substr(separator + 1));
+		}
+	}
+	if (NeedsVulkan12(GetKind(source.Path)))
+	{
+		options.SetTargetEnvironment(shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_2);
+	}
+	options.SetIncluder(std::make_unique<Includer>(includedFiles));
+	return options;
+}
+
+shaderc_shader_kind ShaderCompiler::GetKind(const std::string& path)
+{
+	static const std::unordered_map<std::string, shaderc_shader_kind> kinds = {
+		{ ".vert", shaderc_vertex_shader },
+		{ ".frag", shaderc_fragment_shader },
+		{ ".comp", shaderc_compute_shader },
+		{ ".task", shaderc_task_shader },
+		{ ".mesh", shaderc_mesh_shader },
+		{ ".rgen", shaderc_raygen_shader },
+		{ ".rmiss", shaderc_miss_shader },
+		{ ".rchit", shaderc_closesthit_shader }
+	};
+	auto kind = kinds.find(std::filesystem::path(path).extension().string());
+	if (kind == kinds.end())
+	{
+		throw std::runtime_error("Unknown shader stage for " + path);
+	}
+	return kind->second;
+}
+
+bool ShaderCompiler::NeedsVulkan12(shaderc_shader_kind kind)
+{
+	return kind == shaderc_task_shader
+		|| kind == shaderc_mesh_shader
+		|| kind == shaderc_raygen_shader
+		|| kind == shaderc_miss_shader
+		|| kind == shaderc_closesthit_shader;
+}
+
+std::string ShaderCompiler::ReadText(const std::string& path)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file.is_open())
+	{
+		throw std::runtime_error("Failed to open file " + path);
+	}
+	std::ostringstream text;
+	text << file.rdbuf();
+	return text.str();
+}
+
+shaderc_include_result* ShaderCompiler::Includer::GetInclude(
+	const char* requestedSource,
+	shaderc_include_type type,
+	const char* requestingSource,
+	size_t /*includeDepth*/)
+{
+	Result* result = new Result();
+	std::filesystem::path path = type == shaderc_include_type_relative
+		? std::filesystem::path(requestingSource).parent_path() / requestedSource
+		: std::filesystem::path(requestedSource);
+	result->Name = path.generic_string();
+
+	std::ifstream file(path, std::ios::binary);
+	if (file.is_open())
+	{
+		std::ostringstream content;
+		content << file.rdbuf();
+		result->Content = content.str();
+		if (m_IncludedFiles != nullptr)
+		{
+			m_IncludedFiles->push_back(result->Name);
+		}
+	}
+	else
+	{
+		// An empty name tells the compiler the include failed, the content is its error message
+		result->Content = "Cannot open " + result->Name;
+		result->Name.clear();
+	}
+
+	result->Include.source_name = result->Name.c_str();
+	result->Include.source_name_length = result->Name.size();
+	result->Include.content = result->Content.c_str();
+	result->Include.content_length = result->Content.size();
+	result->Include.user_data = result;
+	return &result->Include;
+}
+
+void ShaderCompiler::Includer::ReleaseInclude(shaderc_include_result* data)
+{
+	delete static_cast<Result*>(data->user_data);
+}
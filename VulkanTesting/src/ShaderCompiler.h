@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <shaderc/shaderc.hpp>
+
+// GLSL file compiled with a set of defines. The stage comes from the file's extension
+struct ShaderSource
+{
+	std::string Path;
+	std::vector<std::string> Defines; // NAME or NAME=VALUE
+
+	// The path followed by the defines, different for every variant of a file
+	std::string GetName() const;
+};
+
+// Compiles GLSL to SPIR-V at runtime. Results are cached on disk under a hash of the preprocessed source, the defines
+// and the compile options, so shaders whose files and includes did not change load without compiling. Compiling from
+// several threads at once is safe
+class ShaderCompiler
+{
+public:
+	void Setup(const std::string& cacheDirectory);
+
+	// Throws with the compiler's messages when the source does not compile
+	std::vector<uint32_t> Compile(const ShaderSource& source);
+	// The source file and every file it includes, directly or not
+	std::vector<std::string> GetDependencies(const ShaderSource& source);
+
+private:
+	// Bumped whenever the compile options change, so blobs compiled with the old ones are not reused
+	static constexpr uint32_t s_CacheVersion = 1;
+
+	// Resolves includes relative to the including file and records every file it opened
+	class Includer : public shaderc::CompileOptions::IncluderInterface
+	{
+	public:
+		explicit Includer(std::vector<std::string>* includedFiles) : m_IncludedFiles(includedFiles) {}
+
+		shaderc_include_result* GetInclude(const char* requestedSource, shaderc_include_type type, const char* requestingSource, size_t includeDepth) override;
+		void ReleaseInclude(shaderc_include_result* data) override;
+
+	private:
+		// Owns the strings the result points to
+		struct Result
+		{
+			shaderc_include_result Include{};
+			std::string Name;
+			std::string Content;
+		};
+
+		std::vector<std::string>* m_IncludedFiles;
+	};
+
+	shaderc::CompileOptions CreateOptions(const ShaderSource& source, std::vector<std::string>* includedFiles) const;
+	static shaderc_shader_kind GetKind(const std::string& path);
+	// Ray tracing and mesh shading stages target Vulkan 1.2 as in compile.bat, the others Vulkan 1.0
+	static bool NeedsVulkan12(shaderc_shader_kind kind);
+	static std::string ReadText(const std::string& path);
+
+	std::string m_CacheDirectory;
+	shaderc::Compiler m_Compiler;
+};
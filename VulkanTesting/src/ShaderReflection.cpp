@@ -0,0 +1,569 @@
+#include "ShaderReflection.h"
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+#include <string>
+
+// Values from the SPIR-V specification, only the ones the reflection reads
+static constexpr uint32_t s_SpirvMagic = 0x07230203;
+static constexpr uint32_t s_SpirvHeaderWords = 5;
+
+enum SpirvOp : uint32_t
+{
+	OpEntryPoint = 15,
+	OpTypeInt = 21,
+	OpTypeFloat = 22,
+	OpTypeVector = 23,
+	OpTypeMatrix = 24,
+	OpTypeImage = 25,
+	OpTypeSampler = 26,
+	OpTypeSampledImage = 27,
+	OpTypeArray = 28,
+	OpTypeRuntimeArray = 29,
+	OpTypeStruct = 30,
+	OpTypePointer = 32,
+	OpConstant = 43,
+	OpVariable = 59,
+	OpDecorate = 71,
+	OpMemberDecorate = 72,
+	OpTypeAccelerationStructureKHR = 5341
+};
+
+enum SpirvDecoration : uint32_t
+{
+	DecorationBufferBlock = 3,
+	DecorationArrayStride = 6,
+	DecorationMatrixStride = 7,
+	DecorationBuiltIn = 11,
+	DecorationLocation = 30,
+	DecorationBinding = 33,
+	DecorationDescriptorSet = 34,
+	DecorationOffset = 35
+};
+
+enum SpirvStorageClass : uint32_t
+{
+	StorageClassUniformConstant = 0,
+	StorageClassInput = 1,
+	StorageClassUniform = 2,
+	StorageClassPushConstant = 9,
+	StorageClassStorageBuffer = 12
+};
+
+enum SpirvDim : uint32_t
+{
+	DimBuffer = 5,
+	DimSubpassData = 6
+};
+
+struct SpirvType
+{
+	SpirvOp Opcode;
+	std::vector<uint32_t> Operands; // The words following the result id
+};
+
+struct SpirvDecorations
+{
+	uint32_t Set = 0;
+	uint32_t Binding = 0;
+	bool HasLocation = false;
+	uint32_t Location = 0;
+	bool BuiltIn = false;
+	bool BufferBlock = false;
+	uint32_t ArrayStride = 0;
+	std::vector<uint32_t> MemberOffsets;
+	std::vector<uint32_t> MemberMatrixStrides;
+};
+
+struct SpirvVariable
+{
+	uint32_t Id;
+	uint32_t PointerType;
+	SpirvStorageClass StorageClass;
+};
+
+struct SpirvModule
+{
+	uint32_t ExecutionModel = ~0u;
+	std::unordered_map<uint32_t, SpirvType> Types;
+	std::unordered_map<uint32_t, uint32_t> Constants;
+	std::unordered_map<uint32_t, SpirvDecorations> Decorations;
+	std::vector<SpirvVariable> Variables;
+
+	const SpirvType& GetType(uint32_t id) const
+	{
+		auto type = Types.find(id);
+		if (type == Types.end())
+		{
+			throw std::runtime_error("Failed to find SPIR-V type " + std::to_string(id));
+		}
+		return type->second;
+	}
+
+	const SpirvDecorations& GetDecorations(uint32_t id) const
+	{
+		static const SpirvDecorations none;
+		auto decorations = Decorations.find(id);
+		return decorations != Decorations.end() ? decorations->second : none;
+	}
+
+	uint32_t GetConstant(uint32_t id) const
+	{
+		auto constant = Constants.find(id);
+		if (constant == Constants.end())
+		{
+			throw std::runtime_error("Failed to find SPIR-V constant " + std::to_string(id) + ", specialized array sizes are not supported");
+		}
+		return constant->second;
+	}
+};
+
+static SpirvModule ParseModule(const std::vector<uint32_t>& code)
+{
+	if (code.size() < s_SpirvHeaderWords || code[0] != s_SpirvMagic)
+	{
+		throw std::runtime_error("Failed to reflect shader, the code is not SPIR-V");
+	}
+
+	SpirvModule module;
+	for (size_t offset = s_SpirvHeaderWords; offset < code.size();)
+	{
+		uint32_t wordCount = code[offset] >> 16;
+		SpirvOp opcode = static_cast<SpirvOp>(code[offset] & 0xffff);
+		if (wordCount == 0 || offset + wordCount > code.size())
+		{
+			throw std::runtime_error("Failed to reflect shader, the SPIR-V is truncated");
+		}
+		const uint32_t* words = &code[offset];
+		offset += wordCount;
+
+		switch (opcode)
+		{
+		case OpEntryPoint:
+			// Modules compiled from GLSL have a single entry point
+			if (module.ExecutionModel == ~0u)
+			{
+				module.ExecutionModel = words[1];
+			}
+			break;
+		case OpTypeInt:
+		case OpTypeFloat:
+		case OpTypeVector:
+		case OpTypeMatrix:
+		case OpTypeImage:
+		case OpTypeSampler:
+		case OpTypeSampledImage:
+		case OpTypeArray:
+		case OpTypeRuntimeArray:
+		case OpTypeStruct:
+		case OpTypePointer:
+		case OpTypeAccelerationStructureKHR:
+			module.Types[words[1]] = { opcode, std::vector<uint32_t>(words + 2, words + wordCount) };
+			break;
+		case OpConstant:
+			// Only 32 bit integers matter, as array lengths
+			module.Constants[words[2]] = words[3];
+			break;
+		case OpVariable:
+			module.Variables.push_back({ words[2], words[1], static_cast<SpirvStorageClass>(words[3]) });
+			break;
+		case OpDecorate:
+		{
+			SpirvDecorations& decorations = module.Decorations[words[1]];
+			switch (words[2])
+			{
+			case DecorationBufferBlock: decorations.BufferBlock = true; break;
+			case DecorationArrayStride: decorations.ArrayStride = words[3]; break;
+			case DecorationBuiltIn: decorations.BuiltIn = true; break;
+			case DecorationLocation: decorations.HasLocation = true; decorations.Location = words[3]; break;
+			case DecorationBinding: decorations.Binding = words[3]; break;
+			case DecorationDescriptorSet: decorations.Set = words[3]; break;
+			}
+			break;
+		}
+		case OpMemberDecorate:
+		{
+			SpirvDecorations& decorations = module.Decorations[words[1]];
+			uint32_t member = words[2];
+			if (words[3] == DecorationOffset || words[3] == DecorationMatrixStride)
+			{
+				std::vector<uint32_t>& values = words[3] == DecorationOffset ? decorations.MemberOffsets : decorations.MemberMatrixStrides;
+				values.resize(std::max<size_t>(values.size(), member + 1));
+				values[member] = words[4];
+			}
+			break;
+		}
+		default:
+			break;
+		}
+	}
+	return module;
+}
+
+static VkShaderStageFlagBits GetStage(uint32_t executionModel)
+{
+	static const std::unordered_map<uint32_t, VkShaderStageFlagBits> stages = {
+		{ 0, VK_SHADER_STAGE_VERTEX_BIT },
+		{ 1, VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT },
+		{ 2, VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT },
+		{ 3, VK_SHADER_STAGE_GEOMETRY_BIT },
+		{ 4, VK_SHADER_STAGE_FRAGMENT_BIT },
+		{ 5, VK_SHADER_STAGE_COMPUTE_BIT },
+		{ 5267, VK_SHADER_STAGE_TASK_BIT_NV },
+		{ 5268, VK_SHADER_STAGE_MESH_BIT_NV },
+		{ 5313, VK_SHADER_STAGE_RAYGEN_BIT_KHR },
+		{ 5314, VK_SHADER_STAGE_INTERSECTION_BIT_KHR },
+		{ 5315, VK_SHADER_STAGE_ANY_HIT_BIT_KHR },
+		{ 5316, VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR },
+		{ 5317, VK_SHADER_STAGE_MISS_BIT_KHR },
+		{ 5318, VK_SHADER_STAGE_CALLABLE_BIT_KHR }
+	};
+	auto stage = stages.find(executionModel);
+	if (stage == stages.end())
+	{
+		throw std::runtime_error("Failed to reflect shader, unknown execution model " + std::to_string(executionModel));
+	}
+	return stage->second;
+}
+
+static VkDescriptorType GetDescriptorType(const SpirvModule& module, uint32_t typeId, SpirvStorageClass storageClass)
+{
+	// Before SPIR-V 1.3 storage buffers are uniform blocks decorated as buffer blocks
+	if (storageClass == StorageClassStorageBuffer
+		|| (storageClass == StorageClassUniform && module.GetDecorations(typeId).BufferBlock))
+	{
+		return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	}
+	if (storageClass == StorageClassUniform)
+	{
+		return VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	}
+
+	const SpirvType& type = module.GetType(typeId);
+	switch (type.Opcode)
+	{
+	case OpTypeSampler:
+		return VK_DESCRIPTOR_TYPE_SAMPLER;
+	case OpTypeSampledImage:
+		return module.GetType(type.Operands[0]).Operands[1] == DimBuffer
+			? VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER
+			: VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	case OpTypeImage:
+	{
+		// Operands are the sampled type, Dim, Depth, Arrayed, MS, Sampled and Format, Sampled is 2 for storage images
+		bool storage = type.Operands[5] == 2;
+		if (type.Operands[1] == DimBuffer)
+		{
+			return storage ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+		}
+		if (type.Operands[1] == DimSubpassData)
+		{
+			return VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+		}
+		return storage ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+	}
+	case OpTypeAccelerationStructureKHR:
+		return VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
+	default:
+		throw std::runtime_error("Failed to reflect shader, unsupported descriptor type " + std::to_string(type.Opcode));
+	}
+}
+
+// Size of a type laid out with explicit offsets and strides, as push constant blocks are
+static uint32_t GetTypeSize(const SpirvModule& module, uint32_t typeId, uint32_t matrixStride)
+{
+	const SpirvType& type = module.GetType(typeId);
+	switch (type.Opcode)
+	{
+	case OpTypeInt:
+	case OpTypeFloat:
+		return type.Operands[0] / 8;
+	case OpTypeVector:
+		return type.Operands[1] * GetTypeSize(module, type.Operands[0], 0);
+	case OpTypeMatrix:
+		return type.Operands[1] * matrixStride;
+	case OpTypeArray:
+		return module.GetConstant(type.Operands[1]) * module.GetDecorations(typeId).ArrayStride;
+	case OpTypeStruct:
+	{
+		const SpirvDecorations& decorations = module.GetDecorations(typeId);
+		uint32_t size = 0;
+		for (size_t member = 0; member < type.Operands.size(); ++member)
+		{
+			uint32_t offset = member < decorations.MemberOffsets.size() ? decorations.MemberOffsets[member] : 0;
+			uint32_t memberMatrixStride = member < decorations.MemberMatrixStrides.size() ? decorations.MemberMatrixStrides[member] : 0;
+			size = std::max(size, offset + GetTypeSize(module, type.Operands[member], memberMatrixStride));
+		}
+		return size;
+	}
+	default:
+		throw std::runtime_error("Failed to reflect shader, unsupported push constant member type " + std::to_string(type.Opcode));
+	}
+}
+
+static VkFormat GetVertexInputFormat(const SpirvModule& module, uint32_t typeId)
+{
+	static constexpr std::array<VkFormat, 4> floatFormats = {
+		VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32_SFLOAT, VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT };
+	static constexpr std::array<VkFormat, 4> intFormats = {
+		VK_FORMAT_R32_SINT, VK_FORMAT_R32G32_SINT, VK_FORMAT_R32G32B32_SINT, VK_FORMAT_R32G32B32A32_SINT };
+	static constexpr std::array<VkFormat, 4> uintFormats = {
+		VK_FORMAT_R32_UINT, VK_FORMAT_R32G32_UINT, VK_FORMAT_R32G32B32_UINT, VK_FORMAT_R32G32B32A32_UINT };
+
+	const SpirvType* component = &module.GetType(typeId);
+	uint32_t componentCount = 1;
+	if (component->Opcode == OpTypeVector)
+	{
+		componentCount = component->Operands[1];
+		component = &module.GetType(component->Operands[0]);
+	}
+	if ((component->Opcode != OpTypeFloat && component->Opcode != OpTypeInt) || component->Operands[0] != 32 || componentCount > 4)
+	{
+		throw std::runtime_error("Failed to reflect shader, vertex inputs must be 32 bit scalars or vectors");
+	}
+
+	// Integer types carry their signedness after the width
+	const std::array<VkFormat, 4>& formats = component->Opcode == OpTypeFloat ? floatFormats
+		: component->Operands[1] != 0 ? intFormats : uintFormats;
+	return formats[componentCount - 1];
+}
+
+ShaderReflection ShaderReflection::Reflect(const std::vector<uint32_t>& code)
+{
+	SpirvModule module = ParseModule(code);
+
+	ShaderReflection reflection;
+	reflection.Stage = GetStage(module.ExecutionModel);
+	for (const SpirvVariable& variable : module.Variables)
+	{
+		const SpirvType& pointer = module.GetType(variable.PointerType);
+		uint32_t typeId = pointer.Operands[1];
+		const SpirvDecorations& decorations = module.GetDecorations(variable.Id);
+
+		switch (variable.StorageClass)
+		{
+		case StorageClassUniformConstant:
+		case StorageClassUniform:
+		case StorageClassStorageBuffer:
+		{
+			// Arrays of descriptors take one binding, the element type decides the descriptor type
+			uint32_t count = 1;
+			const SpirvType& type = module.GetType(typeId);
+			if (type.Opcode == OpTypeArray)
+			{
+				count = module.GetConstant(type.Operands[1]);
+				typeId = type.Operands[0];
+			}
+			else if (type.Opcode == OpTypeRuntimeArray)
+			{
+				count = 0;
+				typeId = type.Operands[0];
+			}
+			reflection.Bindings.push_back({
+				decorations.Set,
+				decorations.Binding,
+				GetDescriptorType(module, typeId, variable.StorageClass),
+				count,
+				static_cast<VkShaderStageFlags>(reflection.Stage) });
+			break;
+		}
+		case StorageClassPushConstant:
+			reflection.PushConstantSize = GetTypeSize(module, typeId, 0);
+			break;
+		case StorageClassInput:
+			// Built-ins such as gl_VertexIndex have no location and are not fed from vertex buffers
+			if (reflection.Stage == VK_SHADER_STAGE_VERTEX_BIT && decorations.HasLocation && !decorations.BuiltIn)
+			{
+				reflection.VertexInputs.push_back({ decorations.Location, GetVertexInputFormat(module, typeId) });
+			}
+			break;
+		default:
+			break;
+		}
+	}
+
+	std::sort(reflection.Bindings.begin(), reflection.Bindings.end(), [](const ReflectedBinding& a, const ReflectedBinding& b)
+	{
+		return a.Set != b.Set ? a.Set < b.Set : a.Binding < b.Binding;
+	});
+	std::sort(reflection.VertexInputs.begin(), reflection.VertexInputs.end(), [](const ReflectedVertexInput& a, const ReflectedVertexInput& b)
+	{
+		return a.Location < b.Location;
+	});
+	return reflection;
+}
+
+void PipelineLayoutCache::Setup(VkDevice device)
+{
+	m_Device = device;
+}
+
+void PipelineLayoutCache::Destroy()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	for (auto& [key, layout] : m_PipelineLayouts)
+	{
+		vkDestroyPipelineLayout(m_Device, layout, nullptr);
+	}
+	for (auto& [key, layout] : m_SetLayouts)
+	{
+		vkDestroyDescriptorSetLayout(m_Device, layout, nullptr);
+	}
+	m_PipelineLayouts.clear();
+	m_SetLayouts.clear();
+}
+
+std::vector<ReflectedBinding> PipelineLayoutCache::GetBindings(const std::vector<const ShaderReflection*>& shaders, uint32_t set)
+{
+	std::vector<ReflectedBinding> bindings;
+	for (const ShaderReflection* shader : shaders)
+	{
+		for (const ReflectedBinding& binding : shader->Bindings)
+		{
+			if (binding.Set != set)
+			{
+				continue;
+			}
+
+			// Several variables may alias one binding, within a shader or across stages, as long as they agree on its type
+			auto existing = std::find_if(bindings.begin(), bindings.end(), [&binding](const ReflectedBinding& other)
+			{
+				return other.Binding == binding.Binding;
+			});
+			if (existing == bindings.end())
+			{
+				bindings.push_back(binding);
+				continue;
+			}
+			if (existing->Type != binding.Type)
+			{
+				throw std::runtime_error(
+					"Binding " + std::to_string(binding.Binding) + " of set " + std::to_string(set) + " is declared with different descriptor types");
+			}
+			existing->Count = existing->Count == 0 || binding.Count == 0 ? 0 : std::max(existing->Count, binding.Count);
+			existing->Stages |= binding.Stages;
+		}
+	}
+
+	std::sort(bindings.begin(), bindings.end(), [](const ReflectedBinding& a, const ReflectedBinding& b)
+	{
+		return a.Binding < b.Binding;
+	});
+	return bindings;
+}
+
+VkDescriptorSetLayout PipelineLayoutCache::GetSetLayout(const std::vector<ReflectedBinding>& bindings)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return GetSetLayoutLocked(bindings);
+}
+
+VkPipelineLayout PipelineLayoutCache::GetPipelineLayout(
+	const std::vector<const ShaderReflection*>& shaders,
+	const std::map<uint32_t, VkDescriptorSetLayout>& externalSets)
+{
+	uint32_t setCount = externalSets.empty() ? 0 : externalSets.rbegin()->first + 1;
+	VkPushConstantRange pushConstant{};
+	for (const ShaderReflection* shader : shaders)
+	{
+		for (const ReflectedBinding& binding : shader->Bindings)
+		{
+			setCount = std::max(setCount, binding.Set + 1);
+		}
+		if (shader->PushConstantSize > 0)
+		{
+			pushConstant.stageFlags |= shader->Stage;
+			pushConstant.size = std::max(pushConstant.size, shader->PushConstantSize);
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+
+	// Sets no shader uses in between get an empty layout
+	std::vector<VkDescriptorSetLayout> setLayouts(setCount);
+	Key key;
+	for (uint32_t set = 0; set < setCount; ++set)
+	{
+		auto external = externalSets.find(set);
+		setLayouts[set] = external != externalSets.end() ? external->second : GetSetLayoutLocked(GetBindings(shaders, set));
+		key.push_back(reinterpret_cast<uint64_t>(setLayouts[set]));
+	}
+	key.push_back(pushConstant.stageFlags);
+	key.push_back(pushConstant.size);
+
+	auto cached = m_PipelineLayouts.find(key);
+	if (cached != m_PipelineLayouts.end())
+	{
+		return cached->second;
+	}
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+	pipelineLayoutInfo.pSetLayouts = setLayouts.data();
+	pipelineLayoutInfo.pushConstantRangeCount = pushConstant.size > 0 ? 1 : 0;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstant;
+
+	VkPipelineLayout layout;
+	if (vkCreatePipelineLayout(m_Device, &pipelineLayoutInfo, nullptr, &layout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create pipeline layout");
+	}
+	m_PipelineLayouts[key] = layout;
+	return layout;
+}
+
+VkDescriptorSetLayout PipelineLayoutCache::GetSetLayoutLocked(const std::vector<ReflectedBinding>& bindings)
+{
+	Key key;
+	std::vector<VkDescriptorSetLayoutBinding> layoutBindings;
+	for (const ReflectedBinding& binding : bindings)
+	{
+		if (binding.Count == 0)
+		{
+			// Unbounded arrays need the variable count and update after bind flags, only hand written layouts such as the
+			// bindless heap's set them
+			throw std::runtime_error("Binding " + std::to_string(binding.Binding) + " is an unbounded array, its set layout cannot be derived");
+		}
+		key.insert(key.end(), { binding.Binding, static_cast<uint64_t>(binding.Type), binding.Count, binding.Stages });
+
+		VkDescriptorSetLayoutBinding layoutBinding{};
+		layoutBinding.binding = binding.Binding;
+		layoutBinding.descriptorType = binding.Type;
+		layoutBinding.descriptorCount = binding.Count;
+		layoutBinding.stageFlags = binding.Stages;
+		layoutBinding.pImmutableSamplers = nullptr;
+		layoutBindings.push_back(layoutBinding);
+	}
+
+	auto cached = m_SetLayouts.find(key);
+	if (cached != m_SetLayouts.end())
+	{
+		return cached->second;
+	}
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo{};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = static_cast<uint32_t>(layoutBindings.size());
+	layoutInfo.pBindings = layoutBindings.data();
+
+	VkDescriptorSetLayout layout;
+	if (vkCreateDescriptorSetLayout(m_Device, &layoutInfo, nullptr, &layout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create descriptor set layout");
+	}
+	m_SetLayouts[key] = layout;
+	return layout;
+}
+
+size_t PipelineLayoutCache::KeyHash::operator()(const Key& key) const
+{
+	// 64 bit FNV-1a over the words of the key
+	uint64_t hash = 14695981039346656037ull;
+	for (uint64_t word : key)
+	{
+		hash = (hash ^ word) * 1099511628211ull;
+	}
+	return static_cast<size_t>(hash);
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+struct ReflectedBinding
+{
+	uint32_t Set;
+	uint32_t Binding;
+	VkDescriptorType Type;
+	uint32_t Count; // 0 for runtime sized arrays
+	VkShaderStageFlags Stages;
+};
+
+struct ReflectedVertexInput
+{
+	uint32_t Location;
+	VkFormat Format;
+};
+
+// What a pipeline needs to know about a SPIR-V module's interface: its stage, the descriptors it declares, the size of its
+// push constant block and, for vertex shaders, the inputs it reads
+struct ShaderReflection
+{
+	VkShaderStageFlagBits Stage;
+	std::vector<ReflectedBinding> Bindings;
+	uint32_t PushConstantSize = 0;
+	std::vector<ReflectedVertexInput> VertexInputs; // Sorted by location
+
+	// Throws when the code is not SPIR-V or uses a construct the reflection does not handle
+	static ShaderReflection Reflect(const std::vector<uint32_t>& code);
+};
+
+// Creates descriptor set layouts and pipeline layouts from reflected shaders. Identical layouts are created once and
+// shared, so pipelines built from the same interface get the same handles and stay compatible with each other. The cache
+// owns every layout it returns. Safe to use from several threads at once
+class PipelineLayoutCache
+{
+public:
+	void Setup(VkDevice device);
+	void Destroy();
+
+	// The bindings the shaders declare in the set, merged into one entry per binding with the stages using it
+	static std::vector<ReflectedBinding> GetBindings(const std::vector<const ShaderReflection*>& shaders, uint32_t set);
+
+	VkDescriptorSetLayout GetSetLayout(const std::vector<ReflectedBinding>& bindings);
+	// Sets found in externalSets use the given layout, such as the bindless heap's, the others are derived from the
+	// shaders. All push constants share one range visible to every stage that declares them
+	VkPipelineLayout GetPipelineLayout(
+		const std::vector<const ShaderReflection*>& shaders,
+		const std::map<uint32_t, VkDescriptorSetLayout>& externalSets = {});
+
+private:
+	// Layouts are looked up by their full description, hashed with FNV-1a
+	using Key = std::vector<uint64_t>;
+	struct KeyHash
+	{
+		size_t operator()(const Key& key) const;
+	};
+
+	VkDescriptorSetLayout GetSetLayoutLocked(const std::vector<ReflectedBinding>& bindings);
+
+	VkDevice m_Device;
+	std::mutex m_Mutex;
+	std::unordered_map<Key, VkDescriptorSetLayout, KeyHash> m_SetLayouts;
+	std::unordered_map<Key, VkPipelineLayout, KeyHash> m_PipelineLayouts;
+};
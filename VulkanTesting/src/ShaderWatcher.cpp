@@ -0,0 +1,129 @@
+#include "ShaderWatcher.h"
+
+#include <algorithm>
+#include <iostream>
+
+void ShaderWatcher::Setup(ShaderCompiler* compiler)
+{
+	m_Compiler = compiler;
+}
+
+void ShaderWatcher::Watch(const std::string& name, const std::vector<ShaderSource>& sources, BuildFunction build)
+{
+	Program& program = m_Programs.emplace_back();
+	program.Name = name;
+	program.Sources = sources;
+	program.Build = std::move(build);
+	UpdateFiles(program);
+}
+
+void ShaderWatcher::Start()
+{
+	m_Stopping = false;
+	m_Thread = std::thread(&ShaderWatcher::WatcherLoop, this);
+}
+
+void ShaderWatcher::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stopping = true;
+	}
+	m_StopRequested.notify_all();
+	if (m_Thread.joinable())
+	{
+		m_Thread.join();
+	}
+}
+
+void ShaderWatcher::WatcherLoop()
+{
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	while (!m_StopRequested.wait_for(lock, s_PollInterval, [this] { return m_Stopping; }))
+	{
+		bool changing = false;
+		for (auto& [path, writeTime] : m_WriteTimes)
+		{
+			std::filesystem::file_time_type currentTime = GetWriteTime(path);
+			if (currentTime == writeTime)
+			{
+				continue;
+			}
+			writeTime = currentTime;
+			changing = true;
+			for (Program& program : m_Programs)
+			{
+				if (std::find(program.Files.begin(), program.Files.end(), path) != program.Files.end())
+				{
+					program.Changed = true;
+				}
+			}
+		}
+		if (changing)
+		{
+			continue;
+		}
+
+		for (Program& program : m_Programs)
+		{
+			if (!program.Changed)
+			{
+				continue;
+			}
+			program.Changed = false;
+
+			// Compiling first leaves the build with cached SPIR-V only, so a broken shader never half builds a program
+			auto start = std::chrono::high_resolution_clock::now();
+			try
+			{
+				for (const ShaderSource& source : program.Sources)
+				{
+					m_Compiler->Compile(source);
+				}
+				program.Build();
+				std::cout << "Reloaded " << program.Name << " in "
+					<< std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() << " ms" << std::endl;
+			}
+			catch (const std::exception& e)
+			{
+				std::cerr << "Reloading " << program.Name << " failed, keeping the previous version\n" << e.what() << std::endl;
+			}
+			UpdateFiles(program);
+		}
+	}
+}
+
+void ShaderWatcher::UpdateFiles(Program& program)
+{
+	// A source that no longer preprocesses keeps the files it had, so fixing one of its includes is still noticed
+	std::vector<std::string> files;
+	try
+	{
+		for (const ShaderSource& source : program.Sources)
+		{
+			std::vector<std::string> dependencies = m_Compiler->GetDependencies(source);
+			files.insert(files.end(), dependencies.begin(), dependencies.end());
+		}
+	}
+	catch (const std::exception&)
+	{
+		return;
+	}
+
+	program.Files = files;
+	for (const std::string& file : program.Files)
+	{
+		if (m_WriteTimes.find(file) == m_WriteTimes.end())
+		{
+			m_WriteTimes[file] = GetWriteTime(file);
+		}
+	}
+}
+
+std::filesystem::file_time_type ShaderWatcher::GetWriteTime(const std::string& path)
+{
+	// Editors may replace the file while saving, in which case it briefly does not exist
+	std::error_code error;
+	std::filesystem::file_time_type writeTime = std::filesystem::last_write_time(path, error);
+	return error ? std::filesystem::file_time_type::min() : writeTime;
+}
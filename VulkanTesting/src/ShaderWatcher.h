@@ -0,0 +1,54 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "ShaderCompiler.h"
+
+// Watches the shaders of a set of programs on a thread of its own. When a source file or anything it includes changes,
+// only the programs using it are recompiled and rebuilt, still on that thread. A program whose shaders fail to compile
+// keeps what it had, the errors are printed and it is retried on the next change
+class ShaderWatcher
+{
+public:
+	// Creates the program's new pipelines once its shaders compiled. Runs on the watcher thread
+	using BuildFunction = std::function<void()>;
+
+	void Setup(ShaderCompiler* compiler);
+	// Programs are added before Start
+	void Watch(const std::string& name, const std::vector<ShaderSource>& sources, BuildFunction build);
+	void Start();
+	void Stop();
+
+private:
+	static constexpr std::chrono::milliseconds s_PollInterval{ 250 };
+
+	struct Program
+	{
+		std::string Name;
+		std::vector<ShaderSource> Sources;
+		BuildFunction Build;
+		std::vector<std::string> Files; // Sources and their includes, found again after every rebuild
+		bool Changed = false; // Rebuilt once its files stopped changing for a poll, so half saved files are skipped
+	};
+
+	void WatcherLoop();
+	void UpdateFiles(Program& program);
+	static std::filesystem::file_time_type GetWriteTime(const std::string& path);
+
+	ShaderCompiler* m_Compiler = nullptr;
+	std::vector<Program> m_Programs;
+	std::unordered_map<std::string, std::filesystem::file_time_type> m_WriteTimes;
+
+	std::thread m_Thread;
+	std::mutex m_Mutex;
+	std::condition_variable m_StopRequested;
+	bool m_Stopping = false;
+};
@@ -0,0 +1,172 @@
+#include "StartupGraph.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+StartupGraph::TaskId StartupGraph::Add(const std::string& name, Affinity affinity, std::initializer_list<TaskId> dependencies, std::function<void()> work)
+{
+	TaskId id = static_cast<TaskId>(m_Tasks.size());
+	for (TaskId dependency : dependencies)
+	{
+		if (dependency >= id)
+		{
+			throw std::runtime_error("Startup stage " + name + " depends on a stage added after it");
+		}
+		m_Tasks[dependency].Dependents.push_back(id);
+	}
+
+	Task& task = m_Tasks.emplace_back();
+	task.Name = name;
+	task.RunsOn = affinity;
+	task.Work = std::move(work);
+	task.DependenciesLeft = static_cast<uint32_t>(dependencies.size());
+	if (affinity == Affinity::Main)
+	{
+		m_MainOrder.push_back(id);
+	}
+	return id;
+}
+
+void StartupGraph::Run()
+{
+	m_Start = std::chrono::steady_clock::now();
+	m_TasksLeft = static_cast<uint32_t>(m_Tasks.size());
+	uint32_t workerTaskCount = 0;
+	for (TaskId id = 0; id < m_Tasks.size(); ++id)
+	{
+		if (m_Tasks[id].RunsOn == Affinity::Worker)
+		{
+			++workerTaskCount;
+			if (m_Tasks[id].DependenciesLeft == 0)
+			{
+				m_ReadyWorkerTasks.push_back(id);
+			}
+		}
+	}
+
+	std::vector<std::thread> workers;
+	uint32_t workerCount = std::min(std::max(std::thread::hardware_concurrency(), 2u) - 1, workerTaskCount);
+	for (uint32_t i = 0; i < workerCount; ++i)
+	{
+		workers.emplace_back(&StartupGraph::WorkerLoop, this, i + 1);
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		while (!m_Error && m_NextMain < m_MainOrder.size())
+		{
+			// Main stages keep their order, the next one only waits for the worker stages it depends on
+			TaskId id = m_MainOrder[m_NextMain];
+			m_Changed.wait(lock, [&] { return m_Error || m_Tasks[id].DependenciesLeft == 0; });
+			if (m_Error)
+			{
+				break;
+			}
+			++m_NextMain;
+			Execute(id, 0, lock);
+		}
+
+		// Worker stages nothing on the main thread waited for may still be running
+		m_Changed.wait(lock, [&] { return m_TasksLeft == 0 || (m_Error && m_Running == 0); });
+		m_TotalMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_Start).count();
+	}
+	m_Changed.notify_all();
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+
+	if (m_Error)
+	{
+		std::rethrow_exception(m_Error);
+	}
+}
+
+void StartupGraph::WorkerLoop(uint32_t thread)
+{
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	while (true)
+	{
+		m_Changed.wait(lock, [&] { return m_Error || m_TasksLeft == 0 || !m_ReadyWorkerTasks.empty(); });
+		if (m_Error || m_TasksLeft == 0)
+		{
+			return;
+		}
+		TaskId id = m_ReadyWorkerTasks.front();
+		m_ReadyWorkerTasks.pop_front();
+		Execute(id, thread, lock);
+	}
+}
+
+void StartupGraph::Execute(TaskId id, uint32_t thread, std::unique_lock<std::mutex>& lock)
+{
+	Task& task = m_Tasks[id];
+	task.Thread = thread;
+	++m_Running;
+	lock.unlock();
+
+	auto start = std::chrono::steady_clock::now();
+	std::exception_ptr error;
+	try
+	{
+		task.Work();
+	}
+	catch (...)
+	{
+		error = std::current_exception();
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	lock.lock();
+	--m_Running;
+	task.StartMs = std::chrono::duration<double, std::milli>(start - m_Start).count();
+	task.DurationMs = std::chrono::duration<double, std::milli>(end - start).count();
+	if (error)
+	{
+		if (!m_Error)
+		{
+			m_Error = error;
+		}
+		m_Changed.notify_all();
+		return;
+	}
+
+	task.Done = true;
+	--m_TasksLeft;
+	for (TaskId dependent : task.Dependents)
+	{
+		if (--m_Tasks[dependent].DependenciesLeft == 0 && m_Tasks[dependent].RunsOn == Affinity::Worker)
+		{
+			m_ReadyWorkerTasks.push_back(dependent);
+		}
+	}
+	m_Changed.notify_all();
+}
+
+void StartupGraph::PrintTimeline() const
+{
+	std::vector<const Task*> tasks;
+	double serialMs = 0.0;
+	for (const Task& task : m_Tasks)
+	{
+		if (task.Done)
+		{
+			tasks.push_back(&task);
+			serialMs += task.DurationMs;
+		}
+	}
+	std::sort(tasks.begin(), tasks.end(), [](const Task* a, const Task* b) { return a->StartMs < b->StartMs; });
+
+	std::cout << std::fixed << std::setprecision(1) << "Startup took " << m_TotalMs << " ms, " << serialMs
+		<< " ms of stages run one after the other" << std::endl;
+	for (const Task* task : tasks)
+	{
+		std::string thread = task->Thread == 0 ? "main" : "worker " + std::to_string(task->Thread);
+		std::cout << "  " << std::setw(9) << std::left << thread << std::right << std::setw(8) << task->StartMs << " ms +"
+			<< std::setw(8) << task->DurationMs << " ms  " << task->Name << std::endl;
+	}
+	std::cout << std::defaultfloat;
+}
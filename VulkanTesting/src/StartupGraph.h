@@ -0,0 +1,68 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <initializer_list>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Runs the initialization stages as a graph. Worker stages run on a pool of threads as soon as their dependencies are
+// done, while main stages run on the calling thread in the order they were added, since they share the graphics queue
+// and the single time command pool. Every stage is timed for a report of where startup went
+class StartupGraph
+{
+public:
+	using TaskId = uint32_t;
+
+	enum class Affinity
+	{
+		Main,
+		Worker
+	};
+
+	// Dependencies must have been added before, so the graph cannot have cycles
+	TaskId Add(const std::string& name, Affinity affinity, std::initializer_list<TaskId> dependencies, std::function<void()> work);
+
+	// Blocks until every stage has run. The first exception thrown by a stage stops new stages from starting and is
+	// rethrown once the running ones have finished
+	void Run();
+
+	// Stages in the order they started, with the thread they ran on, their start and their duration
+	void PrintTimeline() const;
+
+private:
+	struct Task
+	{
+		std::string Name;
+		Affinity RunsOn;
+		std::function<void()> Work;
+		std::vector<TaskId> Dependents;
+		uint32_t DependenciesLeft = 0;
+		bool Done = false;
+		uint32_t Thread = 0; // 0 is the calling thread, workers count from 1
+		double StartMs = 0.0;
+		double DurationMs = 0.0;
+	};
+
+	void WorkerLoop(uint32_t thread);
+	// Runs the task without the lock held, then releases its dependents
+	void Execute(TaskId id, uint32_t thread, std::unique_lock<std::mutex>& lock);
+
+	std::vector<Task> m_Tasks;
+	std::vector<TaskId> m_MainOrder;
+	size_t m_NextMain = 0;
+
+	std::mutex m_Mutex;
+	std::condition_variable m_Changed;
+	std::deque<TaskId> m_ReadyWorkerTasks;
+	uint32_t m_TasksLeft = 0;
+	uint32_t m_Running = 0;
+	std::exception_ptr m_Error;
+	std::chrono::steady_clock::time_point m_Start;
+	double m_TotalMs = 0.0;
+};
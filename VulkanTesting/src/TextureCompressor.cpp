@@ -0,0 +1,428 @@
+#include "TextureCompressor.h"
+#include "Ktx2.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <execution>
+#include <immintrin.h>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+// Lookup tables between 8-bit sRGB and linear light. Linear values are quantized to 12 bits on the way back
+struct SrgbTables
+{
+	std::array<float, 256> ToLinear;
+	std::array<uint8_t, 4096> ToSrgb;
+};
+
+static const SrgbTables& GetSrgbTables()
+{
+	static const SrgbTables tables = []
+	{
+		SrgbTables result;
+		for (uint32_t i = 0; i < 256; ++i)
+		{
+			float value = i / 255.0f;
+			result.ToLinear[i] = value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+		}
+		for (uint32_t i = 0; i < 4096; ++i)
+		{
+			float value = i / 4095.0f;
+			float srgb = value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+			result.ToSrgb[i] = static_cast<uint8_t>(std::clamp(srgb * 255.0f + 0.5f, 0.0f, 255.0f));
+		}
+		return result;
+	}();
+	return tables;
+}
+
+// Runs rowFunction over [0, rowCount) in parallel, in tiles of rows so small levels do not pay per row scheduling
+template<typename Function>
+static void ForEachRowTile(uint32_t rowCount, Function rowFunction)
+{
+	static constexpr uint32_t tileRows = 16;
+	std::vector<uint32_t> tiles((rowCount + tileRows - 1) / tileRows);
+	std::iota(tiles.begin(), tiles.end(), 0);
+	std::for_each(std::execution::par, tiles.begin(), tiles.end(), [&](uint32_t tile)
+	{
+		for (uint32_t row = tile * tileRows; row < std::min((tile + 1) * tileRows, rowCount); ++row)
+		{
+			rowFunction(row);
+		}
+	});
+}
+
+TextureData TextureCompressor::BuildMipChain(const uint8_t* pixels, uint32_t width, uint32_t height)
+{
+	const SrgbTables& tables = GetSrgbTables();
+
+	TextureData texture;
+	texture.Format = VK_FORMAT_R8G8B8A8_SRGB;
+	texture.Width = width;
+	texture.Height = height;
+	texture.Levels.emplace_back(pixels, pixels + static_cast<size_t>(width) * height * 4);
+
+	// Filter in linear light, alpha is already linear. The chain is kept in floats so rounding does not accumulate
+	std::vector<float> source(static_cast<size_t>(width) * height * 4);
+	ForEachRowTile(height, [&](uint32_t y)
+	{
+		for (size_t i = static_cast<size_t>(y) * width * 4; i < static_cast<size_t>(y + 1) * width * 4; i += 4)
+		{
+			source[i + 0] = tables.ToLinear[pixels[i + 0]];
+			source[i + 1] = tables.ToLinear[pixels[i + 1]];
+			source[i + 2] = tables.ToLinear[pixels[i + 2]];
+			source[i + 3] = pixels[i + 3] / 255.0f;
+		}
+	});
+
+	const __m128 quarter = _mm_set1_ps(0.25f);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 quantizeScale = _mm_setr_ps(4095.0f, 4095.0f, 4095.0f, 255.0f);
+	while (width > 1 || height > 1)
+	{
+		uint32_t levelWidth = std::max(width / 2, 1u);
+		uint32_t levelHeight = std::max(height / 2, 1u);
+		std::vector<float> filtered(static_cast<size_t>(levelWidth) * levelHeight * 4);
+		std::vector<uint8_t> level(static_cast<size_t>(levelWidth) * levelHeight * 4);
+		ForEachRowTile(levelHeight, [&](uint32_t y)
+		{
+			// Average the 2x2 footprint, clamped at odd edges. One SSE register holds a whole RGBA texel
+			const float* row0 = &source[static_cast<size_t>(std::min(y * 2, height - 1)) * width * 4];
+			const float* row1 = &source[static_cast<size_t>(std::min(y * 2 + 1, height - 1)) * width * 4];
+			for (uint32_t x = 0; x < levelWidth; ++x)
+			{
+				uint32_t x0 = std::min(x * 2, width - 1) * 4;
+				uint32_t x1 = std::min(x * 2 + 1, width - 1) * 4;
+				__m128 sum = _mm_add_ps(
+					_mm_add_ps(_mm_loadu_ps(row0 + x0), _mm_loadu_ps(row0 + x1)),
+					_mm_add_ps(_mm_loadu_ps(row1 + x0), _mm_loadu_ps(row1 + x1)));
+				__m128 average = _mm_mul_ps(sum, quarter);
+
+				size_t texel = (static_cast<size_t>(y) * levelWidth + x) * 4;
+				_mm_storeu_ps(&filtered[texel], average);
+
+				// Quantize to table indices for color and to 8 bits for alpha
+				__m128 clamped = _mm_min_ps(_mm_max_ps(average, zero), one);
+				alignas(16) int32_t quantized[4];
+				_mm_store_si128(reinterpret_cast<__m128i*>(quantized), _mm_cvtps_epi32(_mm_mul_ps(clamped, quantizeScale)));
+				level[texel + 0] = tables.ToSrgb[quantized[0]];
+				level[texel + 1] = tables.ToSrgb[quantized[1]];
+				level[texel + 2] = tables.ToSrgb[quantized[2]];
+				level[texel + 3] = static_cast<uint8_t>(quantized[3]);
+			}
+		});
+		texture.Levels.push_back(std::move(level));
+		source = std::move(filtered);
+		width = levelWidth;
+		height = levelHeight;
+	}
+	return texture;
+}
+
+TextureData TextureCompressor::Compress(const TextureData& texture, VkFormat format)
+{
+	if (texture.Format != VK_FORMAT_R8G8B8A8_SRGB)
+	{
+		throw std::runtime_error("Only RGBA8 textures can be compressed");
+	}
+	if (format != VK_FORMAT_BC1_RGB_SRGB_BLOCK && format != VK_FORMAT_BC7_SRGB_BLOCK)
+	{
+		throw std::runtime_error("No encoder for the requested texture format");
+	}
+
+	TextureData compressed;
+	compressed.Format = format;
+	compressed.Width = texture.Width;
+	compressed.Height = texture.Height;
+	compressed.Levels.resize(texture.Levels.size());
+
+	// One work item per block row of every level, so the small levels run alongside the large ones
+	struct BlockRow
+	{
+		uint32_t Level;
+		uint32_t BlockY;
+	};
+	std::vector<BlockRow> rows;
+	for (uint32_t i = 0; i < texture.Levels.size(); ++i)
+	{
+		uint32_t width = std::max(texture.Width >> i, 1u);
+		uint32_t height = std::max(texture.Height >> i, 1u);
+		compressed.Levels[i].resize(Ktx2::GetLevelSize(format, width, height));
+		for (uint32_t blockY = 0; blockY < (height + 3) / 4; ++blockY)
+		{
+			rows.push_back({ i, blockY });
+		}
+	}
+
+	uint32_t blockSize = Ktx2::GetBlockSize(format);
+	std::for_each(std::execution::par, rows.begin(), rows.end(), [&](const BlockRow& row)
+	{
+		uint32_t width = std::max(texture.Width >> row.Level, 1u);
+		uint32_t height = std::max(texture.Height >> row.Level, 1u);
+		uint32_t blocksX = (width + 3) / 4;
+		const std::vector<uint8_t>& source = texture.Levels[row.Level];
+		std::vector<uint8_t>& destination = compressed.Levels[row.Level];
+		for (uint32_t blockX = 0; blockX < blocksX; ++blockX)
+		{
+			// Blocks hanging over the edge repeat the last row and column
+			uint8_t block[64];
+			for (uint32_t y = 0; y < 4; ++y)
+			{
+				for (uint32_t x = 0; x < 4; ++x)
+				{
+					uint32_t sourceX = std::min(blockX * 4 + x, width - 1);
+					uint32_t sourceY = std::min(row.BlockY * 4 + y, height - 1);
+					memcpy(&block[(y * 4 + x) * 4], &source[(static_cast<size_t>(sourceY) * width + sourceX) * 4], 4);
+				}
+			}
+
+			uint8_t* output = &destination[(static_cast<size_t>(row.BlockY) * blocksX + blockX) * blockSize];
+			if (format == VK_FORMAT_BC1_RGB_SRGB_BLOCK)
+			{
+				EncodeBC1Block(block, output);
+			}
+			else
+			{
+				EncodeBC7Block(block, output);
+			}
+		}
+	});
+	return compressed;
+}
+
+// Principal axis of the block's colors, by power iteration on their covariance
+template<int Channels>
+static glm::vec<Channels, float> PrincipalAxis(const uint8_t block[64], const glm::vec<Channels, float>& mean)
+{
+	using Vector = glm::vec<Channels, float>;
+	float covariance[Channels][Channels] = {};
+	for (int i = 0; i < 16; ++i)
+	{
+		Vector d;
+		for (int c = 0; c < Channels; ++c)
+		{
+			d[c] = block[i * 4 + c] - mean[c];
+		}
+		for (int a = 0; a < Channels; ++a)
+		{
+			for (int b = 0; b < Channels; ++b)
+			{
+				covariance[a][b] += d[a] * d[b];
+			}
+		}
+	}
+
+	Vector axis(1.0f);
+	for (int iteration = 0; iteration < 8; ++iteration)
+	{
+		Vector next(0.0f);
+		for (int a = 0; a < Channels; ++a)
+		{
+			for (int b = 0; b < Channels; ++b)
+			{
+				next[a] += covariance[a][b] * axis[b];
+			}
+		}
+		float length = glm::length(next);
+		if (length < 1e-6f)
+		{
+			break;
+		}
+		axis = next / length;
+	}
+	return axis;
+}
+
+// Pixels with the smallest and largest projection on the principal axis
+template<int Channels>
+static void FindEndpoints(const uint8_t block[64], int& minPixel, int& maxPixel)
+{
+	using Vector = glm::vec<Channels, float>;
+	Vector mean(0.0f);
+	for (int i = 0; i < 16; ++i)
+	{
+		for (int c = 0; c < Channels; ++c)
+		{
+			mean[c] += block[i * 4 + c] / 16.0f;
+		}
+	}
+	Vector axis = PrincipalAxis<Channels>(block, mean);
+
+	float minProjection = std::numeric_limits<float>::max();
+	float maxProjection = std::numeric_limits<float>::lowest();
+	minPixel = maxPixel = 0;
+	for (int i = 0; i < 16; ++i)
+	{
+		float projection = 0.0f;
+		for (int c = 0; c < Channels; ++c)
+		{
+			projection += block[i * 4 + c] * axis[c];
+		}
+		if (projection < minProjection)
+		{
+			minProjection = projection;
+			minPixel = i;
+		}
+		if (projection > maxProjection)
+		{
+			maxProjection = projection;
+			maxPixel = i;
+		}
+	}
+}
+
+static uint16_t PackRgb565(const uint8_t* color)
+{
+	return static_cast<uint16_t>((color[0] * 31 + 127) / 255 << 11 | (color[1] * 63 + 127) / 255 << 5 | (color[2] * 31 + 127) / 255);
+}
+
+static glm::ivec3 UnpackRgb565(uint16_t color)
+{
+	int r = color >> 11 & 31;
+	int g = color >> 5 & 63;
+	int b = color & 31;
+	return glm::ivec3(r << 3 | r >> 2, g << 2 | g >> 4, b << 3 | b >> 2);
+}
+
+void TextureCompressor::EncodeBC1Block(const uint8_t block[64], uint8_t* output)
+{
+	int minPixel, maxPixel;
+	FindEndpoints<3>(block, minPixel, maxPixel);
+	uint16_t color0 = PackRgb565(&block[maxPixel * 4]);
+	uint16_t color1 = PackRgb565(&block[minPixel * 4]);
+
+	// color0 > color1 selects the four color mode
+	if (color0 < color1)
+	{
+		std::swap(color0, color1);
+	}
+
+	uint32_t indices = 0;
+	if (color0 != color1)
+	{
+		glm::ivec3 endpoint0 = UnpackRgb565(color0);
+		glm::ivec3 endpoint1 = UnpackRgb565(color1);
+		std::array<glm::ivec3, 4> palette = { endpoint0, endpoint1, (endpoint0 * 2 + endpoint1) / 3, (endpoint0 + endpoint1 * 2) / 3 };
+		for (int i = 0; i < 16; ++i)
+		{
+			glm::ivec3 color(block[i * 4 + 0], block[i * 4 + 1], block[i * 4 + 2]);
+			int bestIndex = 0;
+			int bestError = std::numeric_limits<int>::max();
+			for (int p = 0; p < 4; ++p)
+			{
+				glm::ivec3 d = color - palette[p];
+				int error = d.x * d.x + d.y * d.y + d.z * d.z;
+				if (error < bestError)
+				{
+					bestError = error;
+					bestIndex = p;
+				}
+			}
+			indices |= static_cast<uint32_t>(bestIndex) << (i * 2);
+		}
+	}
+
+	memcpy(output, &color0, 2);
+	memcpy(output + 2, &color1, 2);
+	memcpy(output + 4, &indices, 4);
+}
+
+// Writes value into the 128-bit block, least significant bit first
+static void WriteBits(uint8_t* output, uint32_t& bitOffset, uint32_t value, uint32_t bitCount)
+{
+	for (uint32_t i = 0; i < bitCount; ++i, ++bitOffset)
+	{
+		output[bitOffset / 8] |= static_cast<uint8_t>((value >> i & 1) << (bitOffset % 8));
+	}
+}
+
+void TextureCompressor::EncodeBC7Block(const uint8_t block[64], uint8_t* output)
+{
+	// Mode 6: one subset, 7-bit RGBA endpoints with a shared low bit each, 4-bit indices
+	static constexpr std::array<int, 16> weights = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	int minPixel, maxPixel;
+	FindEndpoints<4>(block, minPixel, maxPixel);
+
+	// Quantize each endpoint with the low bit that reconstructs it best
+	std::array<std::array<uint32_t, 4>, 2> quantized;
+	std::array<uint32_t, 2> lowBits;
+	std::array<glm::ivec4, 2> endpoints;
+	std::array<int, 2> pixels = { minPixel, maxPixel };
+	for (int e = 0; e < 2; ++e)
+	{
+		int bestError = std::numeric_limits<int>::max();
+		for (uint32_t p = 0; p < 2; ++p)
+		{
+			int error = 0;
+			std::array<uint32_t, 4> q;
+			glm::ivec4 reconstructed;
+			for (int c = 0; c < 4; ++c)
+			{
+				int value = block[pixels[e] * 4 + c];
+				q[c] = static_cast<uint32_t>(std::clamp((value - static_cast<int>(p) + 1) / 2, 0, 127));
+				reconstructed[c] = static_cast<int>(q[c] << 1 | p);
+				error += (reconstructed[c] - value) * (reconstructed[c] - value);
+			}
+			if (error < bestError)
+			{
+				bestError = error;
+				quantized[e] = q;
+				lowBits[e] = p;
+				endpoints[e] = reconstructed;
+			}
+		}
+	}
+
+	std::array<uint32_t, 16> indices;
+	for (int i = 0; i < 16; ++i)
+	{
+		glm::ivec4 color(block[i * 4 + 0], block[i * 4 + 1], block[i * 4 + 2], block[i * 4 + 3]);
+		int bestError = std::numeric_limits<int>::max();
+		for (uint32_t w = 0; w < 16; ++w)
+		{
+			glm::ivec4 interpolated = ((64 - weights[w]) * endpoints[0] + weights[w] * endpoints[1] + 32) >> 6;
+			glm::ivec4 d = color - interpolated;
+			int error = d.x * d.x + d.y * d.y + d.z * d.z + d.w * d.w;
+			if (error < bestError)
+			{
+				bestError = error;
+				indices[i] = w;
+			}
+		}
+	}
+
+	// The first index is stored without its top bit, so it has to be below 8
+	if (indices[0] >= 8)
+	{
+		std::swap(quantized[0], quantized[1]);
+		std::swap(lowBits[0], lowBits[1]);
+		for (uint32_t& index : indices)
+		{
+			index = 15 - index;
+		}
+	}
+
+	memset(output, 0, 16);
+	uint32_t bitOffset = 0;
+	WriteBits(output, bitOffset, 1 << 6, 7);
+	for (int c = 0; c < 4; ++c)
+	{
+		WriteBits(output, bitOffset, quantized[0][c], 7);
+		WriteBits(output, bitOffset, quantized[1][c], 7);
+	}
+	WriteBits(output, bitOffset, lowBits[0], 1);
+	WriteBits(output, bitOffset, lowBits[1], 1);
+	WriteBits(output, bitOffset, indices[0], 3);
+	for (int i = 1; i < 16; ++i)
+	{
+		WriteBits(output, bitOffset, indices[i], 4);
+	}
+}
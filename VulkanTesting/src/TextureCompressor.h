@@ -0,0 +1,19 @@
+#pragma once
+
+#include "TextureData.h"
+
+// CPU mip generation and block compression for RGBA8 textures
+class TextureCompressor
+{
+public:
+	// Gamma-correct box filtered mip chain down to 1x1, level 0 is a copy of the sRGB pixels.
+	// Filtering runs in linear light with SSE, each level split into row tiles processed in parallel
+	static TextureData BuildMipChain(const uint8_t* pixels, uint32_t width, uint32_t height);
+
+	// Encodes every level of an RGBA8 texture into BC1 or BC7. Block rows of all levels are encoded in parallel
+	static TextureData Compress(const TextureData& texture, VkFormat format);
+
+private:
+	static void EncodeBC1Block(const uint8_t block[64], uint8_t* output);
+	static void EncodeBC7Block(const uint8_t block[64], uint8_t* output);
+};
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <vector>
+#include <vulkan/vulkan.h>
+
+// Texture with its full mip chain, level 0 first. Levels are tightly packed rows of texels or 4x4 blocks
+struct TextureData
+{
+	VkFormat Format = VK_FORMAT_UNDEFINED;
+	uint32_t Width = 0;
+	uint32_t Height = 0;
+	std::vector<std::vector<uint8_t>> Levels;
+};
@@ -0,0 +1,807 @@
+#include "TextureStreamer.h"
+#include "Ktx2.h"
+#include "TextureCompressor.h"
+
+#include <stb_image.h>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+
+void TextureStreamer::Setup(
+	VkDevice device,
+	VkPhysicalDevice physicalDevice,
+	BindlessHeap* bindlessHeap,
+	MemoryBudget* memoryBudget,
+	FrameScheduler* frameScheduler,
+	uint32_t graphicsFamily,
+	uint32_t transferFamily,
+	uint32_t framesInFlight)
+{
+	m_Device = device;
+	m_PhysicalDevice = physicalDevice;
+	m_BindlessHeap = bindlessHeap;
+	m_MemoryBudget = memoryBudget;
+	m_FrameScheduler = frameScheduler;
+	m_GraphicsFamily = graphicsFamily;
+	m_TransferFamily = transferFamily;
+	m_FramesInFlight = framesInFlight;
+	m_TexturePool.Setup(m_Device, m_MemoryBudget, MemoryBudget::CategoryTextures);
+
+	// A pool per frame slot, each reset once the slot's uploads have completed
+	if (m_FrameScheduler->HasOwnQueue(FrameScheduler::Transfer))
+	{
+		m_UploadCommandPools.resize(m_FramesInFlight);
+		m_UploadCommandBuffers.resize(m_FramesInFlight);
+		for (uint32_t i = 0; i < m_FramesInFlight; ++i)
+		{
+			VkCommandPoolCreateInfo poolInfo{};
+			poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+			poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+			poolInfo.queueFamilyIndex = m_TransferFamily;
+			if (vkCreateCommandPool(m_Device, &poolInfo, nullptr, &m_UploadCommandPools[i]) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to create texture upload command pool");
+			}
+
+			VkCommandBufferAllocateInfo allocInfo{};
+			allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			allocInfo.commandPool = m_UploadCommandPools[i];
+			allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+			allocInfo.commandBufferCount = 1;
+			if (vkAllocateCommandBuffers(m_Device, &allocInfo, &m_UploadCommandBuffers[i]) != VK_SUCCESS)
+			{
+				throw std::runtime_error("Failed to allocate texture upload command buffer");
+			}
+		}
+	}
+
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = s_StagingSize;
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	if (vkCreateBuffer(m_Device, &bufferInfo, nullptr, &m_StagingBuffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create texture staging buffer");
+	}
+
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(m_Device, m_StagingBuffer, &memRequirements);
+
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = memRequirements.size;
+	allocInfo.memoryTypeIndex = FindMemoryType(
+		memRequirements.memoryTypeBits,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	m_StagingMemory = m_MemoryBudget->Allocate(allocInfo, MemoryBudget::CategoryStaging);
+	vkBindBufferMemory(m_Device, m_StagingBuffer, m_StagingMemory, 0);
+
+	// Stays mapped so workers can write into it directly
+	void* data;
+	vkMapMemory(m_Device, m_StagingMemory, 0, s_StagingSize, 0, &data);
+	m_StagingData = static_cast<uint8_t*>(data);
+
+	// Mid grey placeholder, uploaded with the first batch of textures
+	TextureData placeholder;
+	placeholder.Format = VK_FORMAT_R8G8B8A8_SRGB;
+	placeholder.Width = 1;
+	placeholder.Height = 1;
+	placeholder.Levels.push_back({ 128, 128, 128, 255 });
+
+	Texture& texture = m_Textures.emplace_back();
+	CreateTexture(texture, placeholder.Format, placeholder.Width, placeholder.Height, 1);
+	QueueUpload(0, placeholder);
+
+	uint32_t workerCount = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+	for (uint32_t i = 0; i < workerCount; ++i)
+	{
+		m_Workers.emplace_back(&TextureStreamer::WorkerLoop, this);
+	}
+}
+
+void TextureStreamer::Destroy()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stopping = true;
+	}
+	m_JobAvailable.notify_all();
+	m_StagingAvailable.notify_all();
+	for (std::thread& worker : m_Workers)
+	{
+		worker.join();
+	}
+	m_Workers.clear();
+
+	for (Texture& texture : m_Textures)
+	{
+		DestroyTexture(texture);
+	}
+	m_Textures.clear();
+	for (RetiredTexture& retired : m_RetiredTextures)
+	{
+		DestroyTexture(retired.Resources);
+	}
+	m_RetiredTextures.clear();
+	m_RetiredSize = 0;
+	m_TexturePool.Destroy();
+
+	vkUnmapMemory(m_Device, m_StagingMemory);
+	vkDestroyBuffer(m_Device, m_StagingBuffer, nullptr);
+	m_MemoryBudget->Free(m_StagingMemory);
+
+	for (VkCommandPool pool : m_UploadCommandPools)
+	{
+		vkDestroyCommandPool(m_Device, pool, nullptr);
+	}
+	m_UploadCommandPools.clear();
+	m_UploadCommandBuffers.clear();
+}
+
+uint32_t TextureStreamer::Request(const std::string& path, VkFormat format)
+{
+	auto requested = m_RequestedTextures.find({ path, format });
+	if (requested != m_RequestedTextures.end())
+	{
+		return m_Textures[requested->second].BindlessIndex;
+	}
+
+	uint32_t textureId = static_cast<uint32_t>(m_Textures.size());
+	Texture& texture = m_Textures.emplace_back();
+	texture.BindlessIndex = m_BindlessHeap->RegisterSampledImage(m_Textures[0].View);
+	m_RequestedTextures[{ path, format }] = textureId;
+	m_TextureIds[texture.BindlessIndex] = textureId;
+
+	++m_PendingCount;
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Jobs.push_back({ path, format, textureId });
+	}
+	m_JobAvailable.notify_one();
+
+	return texture.BindlessIndex;
+}
+
+void TextureStreamer::MarkUsed(const std::vector<uint32_t>& bindlessIndices)
+{
+	for (uint32_t bindlessIndex : bindlessIndices)
+	{
+		auto textureId = m_TextureIds.find(bindlessIndex);
+		if (textureId != m_TextureIds.end())
+		{
+			m_Textures[textureId->second].LastUsedFrame = m_FrameNumber;
+		}
+	}
+}
+
+void TextureStreamer::RecordUploads(VkCommandBuffer commandBuffer, uint32_t frame)
+{
+	// Before the uploads, so textures are never downgraded in the frame they arrive
+	RecordDowngrades(commandBuffer);
+	RecordDefragmentation(commandBuffer);
+
+	std::deque<Upload> uploads;
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (m_WorkerError)
+		{
+			std::rethrow_exception(m_WorkerError);
+		}
+		uploads.swap(m_Uploads);
+	}
+
+	m_UploadPoint = {};
+	if (uploads.empty())
+	{
+		return;
+	}
+
+	// With a transfer queue of its own the copies are submitted there, overlapping earlier frames, and release the
+	// images to the graphics family. The frame's commands acquire them once the copies have completed. The slot's
+	// previous uploads completed before the frame began, so its pool can be reset
+	bool transferQueue = m_FrameScheduler->HasOwnQueue(FrameScheduler::Transfer);
+	VkCommandBuffer uploadCommands = commandBuffer;
+	if (transferQueue)
+	{
+		vkResetCommandPool(m_Device, m_UploadCommandPools[frame], 0);
+		uploadCommands = m_UploadCommandBuffers[frame];
+
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		if (vkBeginCommandBuffer(uploadCommands, &beginInfo) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to begin recording texture uploads");
+		}
+	}
+
+	std::vector<VkImageMemoryBarrier> acquireBarriers;
+	for (Upload& upload : uploads)
+	{
+		Texture& texture = m_Textures[upload.TextureId];
+		uint32_t mipLevels = static_cast<uint32_t>(upload.Regions.size());
+		if (texture.Image == VK_NULL_HANDLE)
+		{
+			CreateTexture(texture, upload.Format, upload.Width, upload.Height, mipLevels);
+		}
+
+		VkImageMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = texture.Image;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseMipLevel = 0;
+		barrier.subresourceRange.levelCount = mipLevels;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = 1;
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		vkCmdPipelineBarrier(
+			uploadCommands,
+			VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			0,
+			0, nullptr,
+			0, nullptr,
+			1, &barrier);
+
+		vkCmdCopyBufferToImage(
+			uploadCommands,
+			m_StagingBuffer,
+			texture.Image,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			static_cast<uint32_t>(upload.Regions.size()),
+			upload.Regions.data());
+
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		if (transferQueue)
+		{
+			// The release and the acquire make the same layout transition, which happens once
+			barrier.srcQueueFamilyIndex = m_TransferFamily;
+			barrier.dstQueueFamilyIndex = m_GraphicsFamily;
+			barrier.dstAccessMask = 0;
+			vkCmdPipelineBarrier(
+				uploadCommands,
+				VK_PIPELINE_STAGE_TRANSFER_BIT,
+				VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+				0,
+				0, nullptr,
+				0, nullptr,
+				1, &barrier);
+
+			barrier.srcAccessMask = 0;
+			barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+			acquireBarriers.push_back(barrier);
+
+			// On the graphics queue the image was last touched by the acquire
+			texture.LastStages = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+			texture.LastAccess = 0;
+		}
+		else
+		{
+			barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+			vkCmdPipelineBarrier(
+				uploadCommands,
+				VK_PIPELINE_STAGE_TRANSFER_BIT,
+				VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+				0,
+				0, nullptr,
+				0, nullptr,
+				1, &barrier);
+			texture.LastStages = VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+			texture.LastAccess = VK_ACCESS_TRANSFER_WRITE_BIT;
+		}
+
+		// Only this frame's bindless set changes now, and its draws come after the copy. Frames still in flight keep
+		// the placeholder in their own sets, which get the real texture once they have completed
+		if (upload.TextureId != 0)
+		{
+			m_BindlessHeap->UpdateSampledImage(texture.BindlessIndex, texture.View);
+			--m_PendingCount;
+		}
+		m_StagingReleases.push_back({ upload.StagingOffset, m_FramesInFlight });
+	}
+
+	if (transferQueue)
+	{
+		if (vkEndCommandBuffer(uploadCommands) != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to record texture uploads");
+		}
+		m_UploadPoint = m_FrameScheduler->Submit(FrameScheduler::Transfer, { { uploadCommands } });
+
+		// The frame's submission waits for the copies at the fragment shader, where the acquire takes over
+		vkCmdPipelineBarrier(
+			commandBuffer,
+			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			0,
+			0, nullptr,
+			0, nullptr,
+			static_cast<uint32_t>(acquireBarriers.size()), acquireBarriers.data());
+	}
+}
+
+void TextureStreamer::NextFrame()
+{
+	++m_FrameNumber;
+	for (auto retired = m_RetiredTextures.begin(); retired != m_RetiredTextures.end();)
+	{
+		if (--retired->FramesLeft == 0)
+		{
+			m_RetiredSize -= retired->Resources.Size;
+			DestroyTexture(retired->Resources);
+			retired = m_RetiredTextures.erase(retired);
+		}
+		else
+		{
+			++retired;
+		}
+	}
+
+	bool released = false;
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		for (auto release = m_StagingReleases.begin(); release != m_StagingReleases.end();)
+		{
+			if (--release->FramesLeft == 0)
+			{
+				m_StagingAllocations.erase(release->Offset);
+				release = m_StagingReleases.erase(release);
+				released = true;
+			}
+			else
+			{
+				++release;
+			}
+		}
+	}
+
+	if (released)
+	{
+		m_StagingAvailable.notify_all();
+	}
+}
+
+std::string TextureStreamer::GetCachePath(const std::string& path, VkFormat format)
+{
+	std::string extension;
+	switch (format)
+	{
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK: extension = ".bc1.ktx2"; break;
+	case VK_FORMAT_BC7_SRGB_BLOCK: extension = ".bc7.ktx2"; break;
+	case VK_FORMAT_ASTC_4x4_SRGB_BLOCK: extension = ".astc.ktx2"; break;
+	default: extension = ".ktx2"; break;
+	}
+	return std::filesystem::path(path).replace_extension(extension).string();
+}
+
+bool TextureStreamer::IsCacheFresh(const std::string& cachePath, const std::string& sourcePath)
+{
+	std::error_code error;
+	if (!std::filesystem::exists(cachePath, error))
+	{
+		return false;
+	}
+
+	// Caches without their source image next to them are still usable
+	if (!std::filesystem::exists(sourcePath, error))
+	{
+		return true;
+	}
+	return std::filesystem::last_write_time(cachePath, error) >= std::filesystem::last_write_time(sourcePath, error);
+}
+
+void TextureStreamer::WorkerLoop()
+{
+	while (true)
+	{
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_JobAvailable.wait(lock, [this] { return m_Stopping || !m_Jobs.empty(); });
+			if (m_Stopping)
+			{
+				return;
+			}
+			job = std::move(m_Jobs.front());
+			m_Jobs.pop_front();
+		}
+
+		try
+		{
+			QueueUpload(job.TextureId, LoadTexture(job.Path, job.Format));
+		}
+		catch (...)
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_WorkerError = std::current_exception();
+		}
+	}
+}
+
+TextureData TextureStreamer::LoadTexture(const std::string& path, VkFormat format)
+{
+	// Load the cached mips, or encode them from the source image and write the cache for the next run
+	TextureData texture;
+	std::string cachePath = GetCachePath(path, format);
+	if (IsCacheFresh(cachePath, path) && Ktx2::Read(cachePath, texture) && texture.Format == format)
+	{
+		return texture;
+	}
+
+	int texWidth, texHeight, texChannels;
+	stbi_uc* pixels = stbi_load(path.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+	if (!pixels)
+	{
+		throw std::runtime_error("Failed to load texture image " + path);
+	}
+	texture = TextureCompressor::BuildMipChain(pixels, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
+	stbi_image_free(pixels);
+
+	if (format != VK_FORMAT_R8G8B8A8_SRGB)
+	{
+		texture = TextureCompressor::Compress(texture, format);
+	}
+	Ktx2::Write(cachePath, texture);
+	return texture;
+}
+
+void TextureStreamer::QueueUpload(uint32_t textureId, const TextureData& texture)
+{
+	Upload upload;
+	upload.TextureId = textureId;
+	upload.Format = texture.Format;
+	upload.Width = texture.Width;
+	upload.Height = texture.Height;
+
+	// Every level in one staging range, offsets aligned to the block size
+	VkDeviceSize blockSize = Ktx2::GetBlockSize(texture.Format);
+	VkDeviceSize size = 0;
+	for (uint32_t i = 0; i < texture.Levels.size(); ++i)
+	{
+		size = (size + blockSize - 1) / blockSize * blockSize;
+
+		VkBufferImageCopy region{};
+		region.bufferOffset = size;
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.mipLevel = i;
+		region.imageSubresource.baseArrayLayer = 0;
+		region.imageSubresource.layerCount = 1;
+		region.imageOffset = { 0, 0, 0 };
+		region.imageExtent = { std::max(texture.Width >> i, 1u), std::max(texture.Height >> i, 1u), 1 };
+		upload.Regions.push_back(region);
+
+		size += texture.Levels[i].size();
+	}
+
+	if (!AllocateStaging(size, upload.StagingOffset))
+	{
+		return;
+	}
+	for (uint32_t i = 0; i < texture.Levels.size(); ++i)
+	{
+		upload.Regions[i].bufferOffset += upload.StagingOffset;
+		memcpy(m_StagingData + upload.Regions[i].bufferOffset, texture.Levels[i].data(), texture.Levels[i].size());
+	}
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Uploads.push_back(std::move(upload));
+}
+
+bool TextureStreamer::AllocateStaging(VkDeviceSize size, VkDeviceSize& offset)
+{
+	// Copy offsets must be multiples of 4 and of the texel block size, 16 covers every format used here
+	static constexpr VkDeviceSize alignment = 16;
+	if (size > s_StagingSize)
+	{
+		throw std::runtime_error("Texture does not fit in the staging buffer");
+	}
+
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	while (!m_Stopping)
+	{
+		// First fit between the ranges in use, which are kept sorted by offset
+		VkDeviceSize candidate = 0;
+		for (const auto& [allocationOffset, allocationSize] : m_StagingAllocations)
+		{
+			if (allocationOffset - candidate >= size)
+			{
+				break;
+			}
+			candidate = (allocationOffset + allocationSize + alignment - 1) / alignment * alignment;
+		}
+		if (candidate + size <= s_StagingSize)
+		{
+			m_StagingAllocations[candidate] = size;
+			offset = candidate;
+			return true;
+		}
+		m_StagingAvailable.wait(lock);
+	}
+	return false;
+}
+
+bool TextureStreamer::CreateTexture(Texture& texture, VkFormat format, uint32_t width, uint32_t height, uint32_t mipLevels, bool allowNewBlock)
+{
+	VkImageCreateInfo imageInfo{};
+	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.extent = { width, height, 1 };
+	imageInfo.mipLevels = mipLevels;
+	imageInfo.arrayLayers = 1;
+	imageInfo.format = format;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	// Copied from when the texture is downgraded or moved
+	imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	if (vkCreateImage(m_Device, &imageInfo, nullptr, &texture.Image) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create streamed texture image");
+	}
+
+	VkMemoryRequirements memRequirements;
+	vkGetImageMemoryRequirements(m_Device, texture.Image, &memRequirements);
+
+	uint32_t memoryTypeIndex = FindMemoryType(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	if (!m_TexturePool.Allocate(memRequirements, memoryTypeIndex, allowNewBlock, texture.Allocation))
+	{
+		vkDestroyImage(m_Device, texture.Image, nullptr);
+		texture.Image = VK_NULL_HANDLE;
+		return false;
+	}
+	vkBindImageMemory(m_Device, texture.Image, texture.Allocation.Memory, texture.Allocation.Offset);
+	texture.Format = format;
+	texture.Width = width;
+	texture.Height = height;
+	texture.MipLevels = mipLevels;
+	texture.Size = memRequirements.size;
+	texture.LastUsedFrame = m_FrameNumber;
+
+	VkImageViewCreateInfo viewInfo{};
+	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewInfo.image = texture.Image;
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.format = format;
+	viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	viewInfo.subresourceRange.baseMipLevel = 0;
+	viewInfo.subresourceRange.levelCount = mipLevels;
+	viewInfo.subresourceRange.baseArrayLayer = 0;
+	viewInfo.subresourceRange.layerCount = 1;
+	if (vkCreateImageView(m_Device, &viewInfo, nullptr, &texture.View) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create streamed texture image view");
+	}
+	return true;
+}
+
+void TextureStreamer::DestroyTexture(Texture& texture)
+{
+	vkDestroyImageView(m_Device, texture.View, nullptr);
+	vkDestroyImage(m_Device, texture.Image, nullptr);
+	m_TexturePool.Free(texture.Allocation);
+	texture.View = VK_NULL_HANDLE;
+	texture.Image = VK_NULL_HANDLE;
+	texture.Allocation = {};
+}
+
+void TextureStreamer::RecordDowngrades(VkCommandBuffer commandBuffer)
+{
+	// Usage was read at the start of the frame and still includes textures downgraded in earlier frames. Free ranges
+	// in the pool are filled before new blocks are allocated, and defragmenting gives them back
+	VkDeviceSize target = static_cast<VkDeviceSize>(m_MemoryBudget->GetDeviceLocalBudget() * s_DowngradeThreshold);
+	VkDeviceSize usage = m_MemoryBudget->GetDeviceLocalUsage();
+	MemoryPool::Statistics heap = m_TexturePool.GetStatistics();
+	usage -= std::min(m_RetiredSize + heap.BlockBytes - heap.UsedBytes, usage);
+	if (usage <= target)
+	{
+		return;
+	}
+
+	// Least recently used first, skipping the placeholder and textures still waiting for their upload
+	std::vector<uint32_t> candidates;
+	for (uint32_t i = 1; i < m_Textures.size(); ++i)
+	{
+		const Texture& texture = m_Textures[i];
+		if (texture.Image != VK_NULL_HANDLE && texture.MipLevels > 1
+			&& std::min(texture.Width, texture.Height) / 2 >= s_MinResidentSize)
+		{
+			candidates.push_back(i);
+		}
+	}
+	std::sort(candidates.begin(), candidates.end(), [this](uint32_t a, uint32_t b)
+	{
+		return m_Textures[a].LastUsedFrame < m_Textures[b].LastUsedFrame;
+	});
+
+	// The top mip is about three quarters of a texture, so each downgrade frees roughly that much once it retires
+	VkDeviceSize freed = 0;
+	for (uint32_t i = 0; i < candidates.size() && i < s_MaxDowngradesPerFrame && freed < usage - target; ++i)
+	{
+		Texture& texture = m_Textures[candidates[i]];
+		freed += texture.Size * 3 / 4;
+		DowngradeTexture(commandBuffer, texture);
+	}
+}
+
+void TextureStreamer::DowngradeTexture(VkCommandBuffer commandBuffer, Texture& texture)
+{
+	Texture downgraded;
+	downgraded.BindlessIndex = texture.BindlessIndex;
+	CreateTexture(downgraded, texture.Format, std::max(texture.Width / 2, 1u), std::max(texture.Height / 2, 1u), texture.MipLevels - 1);
+	downgraded.LastUsedFrame = texture.LastUsedFrame;
+
+	CopyTexture(commandBuffer, texture, 1, downgraded);
+	ReplaceTexture(texture, downgraded);
+	++m_DroppedMips;
+}
+
+void TextureStreamer::RecordDefragmentation(VkCommandBuffer commandBuffer)
+{
+	if (!m_TexturePool.IsDefragmenting() && (m_FrameNumber < m_NextDefragmentFrame || !m_TexturePool.BeginDefragmentation()))
+	{
+		return;
+	}
+
+	// Once every texture has moved, the block is freed with the images retired from it
+	VkDeviceSize moved = 0;
+	for (uint32_t i = 0; i < m_Textures.size() && moved < s_DefragmentBytesPerFrame; ++i)
+	{
+		Texture& texture = m_Textures[i];
+		if (texture.Image == VK_NULL_HANDLE || !m_TexturePool.IsBeingDefragmented(texture.Allocation))
+		{
+			continue;
+		}
+
+		moved += texture.Size;
+		if (!MoveTexture(commandBuffer, i))
+		{
+			// The free ranges left elsewhere are too small for it, moving more would not free the block
+			m_TexturePool.CancelDefragmentation();
+			m_NextDefragmentFrame = m_FrameNumber + s_DefragmentRetryFrames;
+			return;
+		}
+	}
+}
+
+bool TextureStreamer::MoveTexture(VkCommandBuffer commandBuffer, uint32_t textureId)
+{
+	Texture& texture = m_Textures[textureId];
+	Texture moved;
+	moved.BindlessIndex = texture.BindlessIndex;
+	if (!CreateTexture(moved, texture.Format, texture.Width, texture.Height, texture.MipLevels, false))
+	{
+		return false;
+	}
+	moved.LastUsedFrame = texture.LastUsedFrame;
+
+	CopyTexture(commandBuffer, texture, 0, moved);
+	ReplaceTexture(texture, moved);
+
+	// Textures still waiting for their upload show the placeholder. Like the moved texture's own slot, theirs only change
+	// in the set of the frame being recorded now, and in the other sets once their frames have completed
+	if (textureId == 0)
+	{
+		for (const Texture& pending : m_Textures)
+		{
+			if (pending.Image == VK_NULL_HANDLE)
+			{
+				m_BindlessHeap->UpdateSampledImage(pending.BindlessIndex, texture.View);
+			}
+		}
+	}
+	return true;
+}
+
+void TextureStreamer::CopyTexture(VkCommandBuffer commandBuffer, const Texture& source, uint32_t firstLevel, Texture& destination)
+{
+	// Waits for the last accesses to the source: the transfer that wrote it and the barrier after it, and the earlier
+	// frames that may still be sampling it
+	std::array<VkImageMemoryBarrier, 2> barriers{};
+	for (VkImageMemoryBarrier& barrier : barriers)
+	{
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseMipLevel = 0;
+		barrier.subresourceRange.levelCount = destination.MipLevels;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = 1;
+	}
+	barriers[0].oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barriers[0].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	barriers[0].image = source.Image;
+	barriers[0].subresourceRange.baseMipLevel = firstLevel;
+	barriers[0].srcAccessMask = source.LastAccess;
+	barriers[0].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	barriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	barriers[1].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barriers[1].image = destination.Image;
+	barriers[1].srcAccessMask = 0;
+	barriers[1].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	vkCmdPipelineBarrier(
+		commandBuffer,
+		source.LastStages,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0,
+		0, nullptr,
+		0, nullptr,
+		static_cast<uint32_t>(barriers.size()), barriers.data());
+
+	// Level firstLevel + i of the source is level i of the destination, with the same extent
+	std::vector<VkImageCopy> regions(destination.MipLevels);
+	for (uint32_t i = 0; i < destination.MipLevels; ++i)
+	{
+		uint32_t level = firstLevel + i;
+		VkImageCopy& region = regions[i];
+		region.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1 };
+		region.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, i, 0, 1 };
+		region.srcOffset = { 0, 0, 0 };
+		region.dstOffset = { 0, 0, 0 };
+		region.extent = { std::max(source.Width >> level, 1u), std::max(source.Height >> level, 1u), 1 };
+	}
+	vkCmdCopyImage(
+		commandBuffer,
+		source.Image,
+		VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+		destination.Image,
+		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		static_cast<uint32_t>(regions.size()),
+		regions.data());
+
+	barriers[1].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barriers[1].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barriers[1].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barriers[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(
+		commandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		0,
+		0, nullptr,
+		0, nullptr,
+		1, &barriers[1]);
+	destination.LastStages = VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	destination.LastAccess = VK_ACCESS_TRANSFER_WRITE_BIT;
+}
+
+void TextureStreamer::ReplaceTexture(Texture& texture, const Texture& replacement)
+{
+	// Only the bindless set of the frame being recorded points at the new image now, and its draws come after the copy.
+	// Frames still in flight keep sampling the old image through their own sets, which follow once those frames have
+	// completed, all before the old image is destroyed. The placeholder has no slot of its own
+	if (&texture != &m_Textures[0])
+	{
+		m_BindlessHeap->UpdateSampledImage(texture.BindlessIndex, replacement.View);
+	}
+	m_RetiredTextures.push_back({ texture, m_FramesInFlight });
+	m_RetiredSize += texture.Size;
+	texture = replacement;
+}
+
+uint32_t TextureStreamer::FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties)
+{
+	VkPhysicalDeviceMemoryProperties memProperties;
+	vkGetPhysicalDeviceMemoryProperties(m_PhysicalDevice, &memProperties);
+	for (uint32_t i = 0; i < memProperties.memoryTypeCount; ++i)
+	{
+		if (typeFilter & (1 << i) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties)
+		{
+			return i;
+		}
+	}
+
+	throw std::runtime_error("Failed to find suitable memory type");
+}
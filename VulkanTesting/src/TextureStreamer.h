@@ -0,0 +1,188 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+#include "BindlessHeap.h"
+#include "FrameScheduler.h"
+#include "MemoryBudget.h"
+#include "MemoryPool.h"
+#include "TextureData.h"
+
+// Decodes textures on a pool of worker threads straight into a persistently mapped staging buffer.
+// Requested textures get a bindless slot right away, showing a placeholder until their upload is recorded.
+// Near the device memory budget, the least recently used textures give up their top mip.
+// Images are placed in pooled blocks, and a few are moved out of the sparsest block each frame until it can be freed.
+// Uploads run on the transfer queue when the device has one
+class TextureStreamer
+{
+public:
+	// The transfer family is the graphics family when the device has no transfer queue of its own
+	void Setup(
+		VkDevice device,
+		VkPhysicalDevice physicalDevice,
+		BindlessHeap* bindlessHeap,
+		MemoryBudget* memoryBudget,
+		FrameScheduler* frameScheduler,
+		uint32_t graphicsFamily,
+		uint32_t transferFamily,
+		uint32_t framesInFlight);
+	void Destroy();
+
+	// Returns the bindless index of the texture. Requesting the same file and format twice shares the slot
+	uint32_t Request(const std::string& path, VkFormat format);
+
+	// Textures by bindless index that the coming frame may sample, which keeps them from being downgraded
+	void MarkUsed(const std::vector<uint32_t>& bindlessIndices);
+
+	// Creates the images the workers have finished and records their copies, before anything samples them. Over the
+	// budget, first records the copies that downgrade textures, then those that move textures while defragmenting.
+	// Called once the frame scheduler has begun the frame
+	void RecordUploads(VkCommandBuffer commandBuffer, uint32_t frame);
+	// What the frame's graphics submission waits for, nothing when no upload went to the transfer queue
+	FrameScheduler::Dependency GetUploadDependency() const { return { m_UploadPoint, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT }; }
+	// Staging ranges and downgraded images are released once the frames that used them have completed
+	void NextFrame();
+
+	uint32_t GetPendingCount() const { return m_PendingCount; }
+	uint32_t GetDroppedMipCount() const { return m_DroppedMips; }
+	MemoryPool::Statistics GetHeapStatistics() const { return m_TexturePool.GetStatistics(); }
+
+	// KTX2 file next to the source image holding its mips in the given format
+	static std::string GetCachePath(const std::string& path, VkFormat format);
+	static bool IsCacheFresh(const std::string& cachePath, const std::string& sourcePath);
+	// Reads the cache, or decodes the image, builds its mips and writes the cache. Blocks the calling thread
+	static TextureData LoadTexture(const std::string& path, VkFormat format);
+
+	static constexpr VkDeviceSize s_StagingSize = 64 * 1024 * 1024;
+	// Textures are downgraded while device local usage is above this share of the budget
+	static constexpr double s_DowngradeThreshold = 0.9;
+	// Bounds the copies recorded in one frame
+	static constexpr uint32_t s_MaxDowngradesPerFrame = 4;
+	// Textures are never downgraded below this width or height
+	static constexpr uint32_t s_MinResidentSize = 64;
+	// Bounds the bytes copied in one frame while defragmenting, at least one texture is always moved
+	static constexpr VkDeviceSize s_DefragmentBytesPerFrame = 32 * 1024 * 1024;
+	// Frames to wait after a defragmentation was cancelled before picking a block again
+	static constexpr uint64_t s_DefragmentRetryFrames = 600;
+
+private:
+	struct Job
+	{
+		std::string Path;
+		VkFormat Format;
+		uint32_t TextureId;
+	};
+
+	// Texture written to staging by a worker, waiting for the main thread to record its copy
+	struct Upload
+	{
+		uint32_t TextureId;
+		VkFormat Format;
+		uint32_t Width;
+		uint32_t Height;
+		VkDeviceSize StagingOffset;
+		std::vector<VkBufferImageCopy> Regions;
+	};
+
+	struct StagingRelease
+	{
+		VkDeviceSize Offset;
+		uint32_t FramesLeft;
+	};
+
+	struct Texture
+	{
+		VkImage Image = VK_NULL_HANDLE;
+		MemoryPool::Allocation Allocation;
+		VkImageView View = VK_NULL_HANDLE;
+		uint32_t BindlessIndex = 0;
+		VkFormat Format = VK_FORMAT_UNDEFINED;
+		uint32_t Width = 0;
+		uint32_t Height = 0;
+		uint32_t MipLevels = 0;
+		VkDeviceSize Size = 0;
+		uint64_t LastUsedFrame = 0;
+		// Last accesses to the image, which a copy from it waits for. Set once a transfer has written it
+		VkPipelineStageFlags LastStages = 0;
+		VkAccessFlags LastAccess = 0;
+	};
+
+	// Image replaced by a downgraded or moved one, destroyed once the frames that may sample it have completed
+	struct RetiredTexture
+	{
+		Texture Resources;
+		uint32_t FramesLeft;
+	};
+
+	void WorkerLoop();
+	void QueueUpload(uint32_t textureId, const TextureData& texture);
+
+	// Blocks until the range fits, returns false if the streamer is shutting down
+	bool AllocateStaging(VkDeviceSize size, VkDeviceSize& offset);
+	// Returns false, leaving the texture empty, only when the pool has no room and allowNewBlock is false
+	bool CreateTexture(Texture& texture, VkFormat format, uint32_t width, uint32_t height, uint32_t mipLevels, bool allowNewBlock = true);
+	void DestroyTexture(Texture& texture);
+	void RecordDowngrades(VkCommandBuffer commandBuffer);
+	// Copies every level but the top one into a new image half the size
+	void DowngradeTexture(VkCommandBuffer commandBuffer, Texture& texture);
+	void RecordDefragmentation(VkCommandBuffer commandBuffer);
+	// Copies the texture into a new image outside the block being defragmented, returns false if none has room
+	bool MoveTexture(VkCommandBuffer commandBuffer, uint32_t textureId);
+	// Copies the source levels from firstLevel on into every level of the destination
+	void CopyTexture(VkCommandBuffer commandBuffer, const Texture& source, uint32_t firstLevel, Texture& destination);
+	// Points the bindless slot at the replacement, in each frame's set once no frame in flight reads it, and retires the
+	// old image
+	void ReplaceTexture(Texture& texture, const Texture& replacement);
+	uint32_t FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
+
+	VkDevice m_Device;
+	VkPhysicalDevice m_PhysicalDevice;
+	BindlessHeap* m_BindlessHeap;
+	MemoryBudget* m_MemoryBudget;
+	FrameScheduler* m_FrameScheduler;
+	uint32_t m_GraphicsFamily;
+	uint32_t m_TransferFamily;
+	uint32_t m_FramesInFlight;
+
+	// Per frame slot, only with a transfer queue of its own
+	std::vector<VkCommandPool> m_UploadCommandPools;
+	std::vector<VkCommandBuffer> m_UploadCommandBuffers;
+	FrameScheduler::SyncPoint m_UploadPoint; // Copies submitted this frame
+
+	VkBuffer m_StagingBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory m_StagingMemory = VK_NULL_HANDLE;
+	uint8_t* m_StagingData = nullptr;
+	std::map<VkDeviceSize, VkDeviceSize> m_StagingAllocations; // Offset to size of ranges in use
+	std::vector<StagingRelease> m_StagingReleases;
+
+	MemoryPool m_TexturePool;
+	std::vector<Texture> m_Textures; // The placeholder comes first
+	std::map<std::pair<std::string, VkFormat>, uint32_t> m_RequestedTextures;
+	std::unordered_map<uint32_t, uint32_t> m_TextureIds; // Bindless index to texture
+	std::atomic<uint32_t> m_PendingCount = 0;
+
+	uint64_t m_FrameNumber = 0;
+	std::vector<RetiredTexture> m_RetiredTextures;
+	VkDeviceSize m_RetiredSize = 0; // Still counted as used until the retired textures are destroyed
+	uint32_t m_DroppedMips = 0;
+	uint64_t m_NextDefragmentFrame = 0;
+
+	std::vector<std::thread> m_Workers;
+	std::mutex m_Mutex;
+	std::condition_variable m_JobAvailable;
+	std::condition_variable m_StagingAvailable;
+	std::deque<Job> m_Jobs;
+	std::deque<Upload> m_Uploads;
+	std::exception_ptr m_WorkerError;
+	bool m_Stopping = false;
+};
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Hands the latest value from one producer thread to one consumer thread without locks. Each side owns a buffer and
+// they swap it with the shared middle one, so the producer never waits and the consumer always gets the newest value.
+// Values the consumer never picked up are overwritten, and buffers are reused, so their allocations are kept
+template<typename T>
+class TripleBuffer
+{
+public:
+	// Producer side. The buffer still holds whatever was written to it three publishes ago
+	T& GetWriteBuffer() { return m_Buffers[m_WriteIndex]; }
+	void Publish()
+	{
+		uint32_t previous = m_Middle.exchange(m_WriteIndex | s_NewBit, std::memory_order_acq_rel);
+		m_WriteIndex = previous & s_IndexMask;
+	}
+
+	// Consumer side. Returns false and keeps the current buffer when nothing was published since the last call
+	bool Acquire()
+	{
+		if ((m_Middle.load(std::memory_order_relaxed) & s_NewBit) == 0)
+		{
+			return false;
+		}
+		uint32_t previous = m_Middle.exchange(m_ReadIndex, std::memory_order_acq_rel);
+		m_ReadIndex = previous & s_IndexMask;
+		return true;
+	}
+	const T& GetReadBuffer() const { return m_Buffers[m_ReadIndex]; }
+
+private:
+	static constexpr uint32_t s_IndexMask = 0x3;
+	static constexpr uint32_t s_NewBit = 0x4;
+
+	std::array<T, 3> m_Buffers{};
+	uint32_t m_WriteIndex = 0;
+	std::atomic<uint32_t> m_Middle{ 1 };
+	uint32_t m_ReadIndex = 2;
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#pragma warning(push)
+#pragma warning(disable: 26812) // Disable warnings for unscoped enums in Vulkan
+#include <vulkan/vulkan.h>
+#pragma warning(pop)
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE // Depth ranges from 0 to 1 instead of -1 to 1 (Vulkan vs OpenGL)
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/glm.hpp>
+#include <glm/gtx/hash.hpp>
+
+#include <array>
+#include <cstddef>
+
+struct Vertex
+{
+	glm::vec3 Position;
+	glm::vec3 Color;
+	glm::vec2 TextureCoordinates;
+
+	static VkVertexInputBindingDescription GetBindingDescription()
+	{
+		VkVertexInputBindingDescription bindingDescription{};
+		bindingDescription.binding = 0; // Index of binding in array of bindings
+		bindingDescription.stride = sizeof(Vertex); // Bytes from one entry to the next
+		bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX; // Move to the next data entry after each vertex
+		return bindingDescription;
+	}
+
+	// Offset of the attribute read at each location, the formats come from the vertex shader's inputs
+	static std::array<uint32_t, 3> GetAttributeOffsets()
+	{
+		return {
+			offsetof(Vertex, Position), // Location 0
+			offsetof(Vertex, Color), // Location 1
+			offsetof(Vertex, TextureCoordinates) // Location 2
+		};
+	}
+
+	bool operator==(const Vertex& other) const
+	{
+		return Position == other.Position && Color == other.Color && TextureCoordinates == other.TextureCoordinates;
+	}
+};
+
+namespace std
+{
+	template<> struct hash<Vertex>
+	{
+		size_t operator()(Vertex const& vertex) const
+		{
+			return
+				((hash<glm::vec3>()(vertex.Position) ^
+				 (hash<glm::vec3>()(vertex.Color) << 1)) >> 1) ^
+				 (hash<glm::vec2>()(vertex.TextureCoordinates) << 1);
+		}
+	};
+}
@@ -0,0 +1,545 @@
+#include "VirtualTexture.h"
+#include "Ktx2.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+void VirtualTexture::Setup(
+	VkDevice device,
+	VkPhysicalDevice physicalDevice,
+	BindlessHeap* bindlessHeap,
+	MemoryBudget* memoryBudget,
+	uint32_t framesInFlight,
+	const TextureData& texture,
+	VkDeviceSize budget)
+{
+	m_Device = device;
+	m_PhysicalDevice = physicalDevice;
+	m_BindlessHeap = bindlessHeap;
+	m_MemoryBudget = memoryBudget;
+	m_FramesInFlight = framesInFlight;
+	m_Source = texture;
+
+	if (m_Source.Levels.size() > s_MaxLevels)
+	{
+		throw std::runtime_error("Virtual texture has too many mip levels");
+	}
+
+	// Virtual pages of every level, the ones of levels that fit in a single page are pinned
+	uint32_t pinnedCount = 0;
+	for (uint32_t i = 0; i < m_Source.Levels.size(); ++i)
+	{
+		Level level;
+		level.Width = std::max(m_Source.Width >> i, 1u);
+		level.Height = std::max(m_Source.Height >> i, 1u);
+		level.PagesX = (level.Width + s_PageContent - 1) / s_PageContent;
+		level.PagesY = (level.Height + s_PageContent - 1) / s_PageContent;
+		level.FirstPage = static_cast<uint32_t>(m_Pages.size());
+		m_Levels.push_back(level);
+
+		for (uint32_t y = 0; y < level.PagesY; ++y)
+		{
+			for (uint32_t x = 0; x < level.PagesX; ++x)
+			{
+				Page page;
+				page.Level = i;
+				page.X = x;
+				page.Y = y;
+				page.Pinned = level.PagesX == 1 && level.PagesY == 1;
+				pinnedCount += page.Pinned ? 1 : 0;
+				m_Pages.push_back(page);
+			}
+		}
+	}
+
+	// Load the pinned pages first, coarsest level first
+	for (uint32_t i = static_cast<uint32_t>(m_Pages.size()); i-- > 0;)
+	{
+		if (m_Pages[i].Pinned)
+		{
+			m_Requests.push_back(i);
+		}
+	}
+
+	// As many pages as the budget holds, on a square grid the device can create
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(m_PhysicalDevice, &properties);
+	m_PageBytes = Ktx2::GetLevelSize(m_Source.Format, s_PageSize, s_PageSize);
+	m_CachePagesX = static_cast<uint32_t>(std::sqrt(static_cast<double>(budget / m_PageBytes)));
+	m_CachePagesX = std::min(m_CachePagesX, properties.limits.maxImageDimension2D / s_PageSize);
+	m_CacheSlotCount = m_CachePagesX * m_CachePagesX;
+	if (m_CacheSlotCount <= pinnedCount)
+	{
+		throw std::runtime_error("Virtual texture budget is too small");
+	}
+	for (uint32_t slot = m_CacheSlotCount; slot-- > 0;)
+	{
+		m_FreeSlots.push_back(slot);
+	}
+
+	VkImageCreateInfo imageInfo{};
+	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.extent = { m_CachePagesX * s_PageSize, m_CachePagesX * s_PageSize, 1 };
+	imageInfo.mipLevels = 1;
+	imageInfo.arrayLayers = 1;
+	imageInfo.format = m_Source.Format;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	if (vkCreateImage(m_Device, &imageInfo, nullptr, &m_CacheImage) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create virtual texture cache image");
+	}
+
+	VkMemoryRequirements memRequirements;
+	vkGetImageMemoryRequirements(m_Device, m_CacheImage, &memRequirements);
+
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = memRequirements.size;
+	allocInfo.memoryTypeIndex = FindMemoryType(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	m_CacheMemory = m_MemoryBudget->Allocate(allocInfo, MemoryBudget::CategoryTextures);
+	vkBindImageMemory(m_Device, m_CacheImage, m_CacheMemory, 0);
+
+	VkImageViewCreateInfo viewInfo{};
+	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewInfo.image = m_CacheImage;
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.format = m_Source.Format;
+	viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	viewInfo.subresourceRange.baseMipLevel = 0;
+	viewInfo.subresourceRange.levelCount = 1;
+	viewInfo.subresourceRange.baseArrayLayer = 0;
+	viewInfo.subresourceRange.layerCount = 1;
+	if (vkCreateImageView(m_Device, &viewInfo, nullptr, &m_CacheView) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create virtual texture cache image view");
+	}
+
+	// Pages carry their own borders and levels, so the cache is sampled bilinearly without wrapping or mips
+	VkSamplerCreateInfo samplerInfo{};
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerInfo.magFilter = VK_FILTER_LINEAR;
+	samplerInfo.minFilter = VK_FILTER_LINEAR;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.anisotropyEnable = VK_FALSE;
+	samplerInfo.maxAnisotropy = 1.0f;
+	samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+	samplerInfo.unnormalizedCoordinates = VK_FALSE;
+	samplerInfo.compareEnable = VK_FALSE;
+	samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerInfo.minLod = 0.0f;
+	samplerInfo.maxLod = 0.0f;
+	if (vkCreateSampler(m_Device, &samplerInfo, nullptr, &m_CacheSampler) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create virtual texture sampler");
+	}
+
+	m_CacheTextureIndex = m_BindlessHeap->RegisterSampledImage(m_CacheView);
+	m_CacheSamplerIndex = m_BindlessHeap->RegisterSampler(m_CacheSampler);
+
+	// Page tables, feedback and staging are written or read by the host, one set per frame in flight
+	VkDeviceSize pageTableBytes = sizeof(PageTableHeader) + sizeof(uint32_t) * m_Pages.size();
+	m_FeedbackBytes = sizeof(uint32_t) * ((m_Pages.size() + 31) / 32);
+	m_Frames.resize(m_FramesInFlight);
+	for (FrameResources& frame : m_Frames)
+	{
+		CreateBuffer(
+			pageTableBytes,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			frame.PageTable,
+			frame.PageTableMemory,
+			&frame.PageTableData,
+			MemoryBudget::CategoryTextures);
+		CreateBuffer(
+			m_FeedbackBytes,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			frame.Feedback,
+			frame.FeedbackMemory,
+			&frame.FeedbackData,
+			MemoryBudget::CategoryTextures);
+		CreateBuffer(
+			m_PageBytes * s_MaxUploadsPerFrame,
+			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			frame.Staging,
+			frame.StagingMemory,
+			&frame.StagingData,
+			MemoryBudget::CategoryStaging);
+		memset(frame.FeedbackData, 0, m_FeedbackBytes);
+
+		frame.PageTableIndex = m_BindlessHeap->RegisterStorageBuffer(frame.PageTable);
+		frame.FeedbackIndex = m_BindlessHeap->RegisterStorageBuffer(frame.Feedback);
+	}
+}
+
+void VirtualTexture::Destroy()
+{
+	for (FrameResources& frame : m_Frames)
+	{
+		m_BindlessHeap->Release(BindlessHeap::StorageBuffers, frame.PageTableIndex);
+		m_BindlessHeap->Release(BindlessHeap::StorageBuffers, frame.FeedbackIndex);
+		vkDestroyBuffer(m_Device, frame.PageTable, nullptr);
+		m_MemoryBudget->Free(frame.PageTableMemory);
+		vkDestroyBuffer(m_Device, frame.Feedback, nullptr);
+		m_MemoryBudget->Free(frame.FeedbackMemory);
+		vkDestroyBuffer(m_Device, frame.Staging, nullptr);
+		m_MemoryBudget->Free(frame.StagingMemory);
+	}
+	m_Frames.clear();
+
+	m_BindlessHeap->Release(BindlessHeap::SampledImages, m_CacheTextureIndex);
+	m_BindlessHeap->Release(BindlessHeap::Samplers, m_CacheSamplerIndex);
+	vkDestroySampler(m_Device, m_CacheSampler, nullptr);
+	vkDestroyImageView(m_Device, m_CacheView, nullptr);
+	vkDestroyImage(m_Device, m_CacheImage, nullptr);
+	m_MemoryBudget->Free(m_CacheMemory);
+}
+
+void VirtualTexture::ReadFeedback(uint32_t frame)
+{
+	FrameResources& resources = m_Frames[frame];
+	if (!resources.FeedbackPending)
+	{
+		return;
+	}
+	resources.FeedbackPending = false;
+
+	const uint32_t* requestedPages = static_cast<const uint32_t*>(resources.FeedbackData);
+	std::vector<uint32_t> missing;
+	for (uint32_t word = 0; word < m_FeedbackBytes / sizeof(uint32_t); ++word)
+	{
+		for (uint32_t bits = requestedPages[word]; bits != 0; bits &= bits - 1)
+		{
+			uint32_t pageId = word * 32 + static_cast<uint32_t>(std::countr_zero(bits));
+			if (pageId >= m_Pages.size())
+			{
+				break;
+			}
+
+			// Until the page arrives its fragments sample the closest resident ancestor, which must stay around
+			if (m_Pages[pageId].Slot < 0)
+			{
+				missing.push_back(pageId);
+			}
+			uint32_t usedPage = pageId;
+			while (m_Pages[usedPage].Slot < 0 && m_Pages[usedPage].Level + 1 < m_Levels.size())
+			{
+				const Page& page = m_Pages[usedPage];
+				const Level& parent = m_Levels[page.Level + 1];
+				usedPage = parent.FirstPage + std::min(page.Y / 2, parent.PagesY - 1) * parent.PagesX + std::min(page.X / 2, parent.PagesX - 1);
+			}
+			Touch(usedPage);
+		}
+	}
+
+	// Coarse pages first, they cover the most screen for their size
+	std::stable_sort(missing.begin(), missing.end(), [this](uint32_t a, uint32_t b) { return m_Pages[a].Level > m_Pages[b].Level; });
+	for (uint32_t pageId : m_Requests)
+	{
+		if (m_Pages[pageId].Pinned && m_Pages[pageId].Slot < 0)
+		{
+			missing.insert(missing.begin(), pageId);
+		}
+	}
+	m_Requests = std::move(missing);
+}
+
+void VirtualTexture::RecordUpdates(VkCommandBuffer commandBuffer, uint32_t frame)
+{
+	FrameResources& resources = m_Frames[frame];
+	++m_FrameNumber;
+
+	// Gather the requested pages into staging, as many as fit this frame
+	std::vector<VkBufferImageCopy> regions;
+	for (uint32_t pageId : m_Requests)
+	{
+		Page& page = m_Pages[pageId];
+		uint32_t slot;
+		if (page.Slot >= 0)
+		{
+			continue;
+		}
+		if (regions.size() == s_MaxUploadsPerFrame || !AcquireSlot(slot))
+		{
+			break;
+		}
+
+		VkDeviceSize stagingOffset = regions.size() * m_PageBytes;
+		CopyPage(page, static_cast<uint8_t*>(resources.StagingData) + stagingOffset);
+
+		VkBufferImageCopy region{};
+		region.bufferOffset = stagingOffset;
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.mipLevel = 0;
+		region.imageSubresource.baseArrayLayer = 0;
+		region.imageSubresource.layerCount = 1;
+		region.imageOffset = { static_cast<int32_t>(slot % m_CachePagesX * s_PageSize), static_cast<int32_t>(slot / m_CachePagesX * s_PageSize), 0 };
+		region.imageExtent = { s_PageSize, s_PageSize, 1 };
+		regions.push_back(region);
+
+		page.Slot = static_cast<int32_t>(slot);
+		page.LastUsedFrame = m_FrameNumber;
+		if (!page.Pinned)
+		{
+			m_Lru.push_front(pageId);
+			page.LruPosition = m_Lru.begin();
+		}
+	}
+	m_UploadCount = static_cast<uint32_t>(regions.size());
+
+	if (!regions.empty())
+	{
+		VkImageMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.oldLayout = m_CacheInitialized ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = m_CacheImage;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseMipLevel = 0;
+		barrier.subresourceRange.levelCount = 1;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = 1;
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		vkCmdPipelineBarrier(
+			commandBuffer,
+			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			0,
+			0, nullptr,
+			0, nullptr,
+			1, &barrier);
+
+		vkCmdCopyBufferToImage(
+			commandBuffer,
+			resources.Staging,
+			m_CacheImage,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			static_cast<uint32_t>(regions.size()),
+			regions.data());
+
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(
+			commandBuffer,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			0,
+			0, nullptr,
+			0, nullptr,
+			1, &barrier);
+		m_CacheInitialized = true;
+	}
+
+	WritePageTable(frame);
+
+	// Fragments of this frame set the bits of the pages they need
+	vkCmdFillBuffer(commandBuffer, resources.Feedback, 0, VK_WHOLE_SIZE, 0);
+	VkMemoryBarrier feedbackBarrier{};
+	feedbackBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	feedbackBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	feedbackBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(
+		commandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		0,
+		1, &feedbackBarrier,
+		0, nullptr,
+		0, nullptr);
+}
+
+void VirtualTexture::RecordFeedbackBarrier(VkCommandBuffer commandBuffer, uint32_t frame)
+{
+	VkMemoryBarrier readbackBarrier{};
+	readbackBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	readbackBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	readbackBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	vkCmdPipelineBarrier(
+		commandBuffer,
+		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		VK_PIPELINE_STAGE_HOST_BIT,
+		0,
+		1, &readbackBarrier,
+		0, nullptr,
+		0, nullptr);
+	m_Frames[frame].FeedbackPending = true;
+}
+
+VirtualTextureIndices VirtualTexture::GetShaderIndices(uint32_t frame) const
+{
+	VirtualTextureIndices indices{};
+	indices.PageTableIndex = m_Frames[frame].PageTableIndex;
+	indices.FeedbackIndex = m_Frames[frame].FeedbackIndex;
+	indices.CacheTextureIndex = m_CacheTextureIndex;
+	indices.CacheSamplerIndex = m_CacheSamplerIndex;
+	indices.FrameIndex = static_cast<uint32_t>(m_FrameNumber);
+	return indices;
+}
+
+void VirtualTexture::CopyPage(const Page& page, uint8_t* destination) const
+{
+	// Work in texel blocks, which are single texels for uncompressed formats. Borders wrap like a repeating sampler
+	uint32_t blockDimension = Ktx2::IsBlockCompressed(m_Source.Format) ? 4 : 1;
+	uint32_t blockBytes = Ktx2::GetBlockSize(m_Source.Format);
+	const Level& level = m_Levels[page.Level];
+	const std::vector<uint8_t>& source = m_Source.Levels[page.Level];
+	int32_t levelBlocksX = static_cast<int32_t>((level.Width + blockDimension - 1) / blockDimension);
+	int32_t levelBlocksY = static_cast<int32_t>((level.Height + blockDimension - 1) / blockDimension);
+	int32_t pageBlocks = static_cast<int32_t>(s_PageSize / blockDimension);
+	int32_t originX = (static_cast<int32_t>(page.X * s_PageContent) - static_cast<int32_t>(s_PageBorder)) / static_cast<int32_t>(blockDimension);
+	int32_t originY = (static_cast<int32_t>(page.Y * s_PageContent) - static_cast<int32_t>(s_PageBorder)) / static_cast<int32_t>(blockDimension);
+
+	for (int32_t y = 0; y < pageBlocks; ++y)
+	{
+		int32_t sourceY = ((originY + y) % levelBlocksY + levelBlocksY) % levelBlocksY;
+		for (int32_t x = 0; x < pageBlocks; ++x)
+		{
+			int32_t sourceX = ((originX + x) % levelBlocksX + levelBlocksX) % levelBlocksX;
+			memcpy(
+				destination + (static_cast<size_t>(y) * pageBlocks + x) * blockBytes,
+				&source[(static_cast<size_t>(sourceY) * levelBlocksX + sourceX) * blockBytes],
+				blockBytes);
+		}
+	}
+}
+
+bool VirtualTexture::AcquireSlot(uint32_t& slot)
+{
+	if (!m_FreeSlots.empty())
+	{
+		slot = m_FreeSlots.back();
+		m_FreeSlots.pop_back();
+		return true;
+	}
+
+	// Evict the least recently used page, unless frames in flight may still sample it
+	if (m_Lru.empty())
+	{
+		return false;
+	}
+	Page& victim = m_Pages[m_Lru.back()];
+	if (victim.LastUsedFrame + m_FramesInFlight + s_EvictionGraceFrames >= m_FrameNumber)
+	{
+		return false;
+	}
+	slot = static_cast<uint32_t>(victim.Slot);
+	victim.Slot = -1;
+	m_Lru.pop_back();
+	return true;
+}
+
+void VirtualTexture::Touch(uint32_t pageId)
+{
+	Page& page = m_Pages[pageId];
+	page.LastUsedFrame = m_FrameNumber;
+	if (page.Slot >= 0 && !page.Pinned)
+	{
+		m_Lru.splice(m_Lru.begin(), m_Lru, page.LruPosition);
+	}
+}
+
+void VirtualTexture::WritePageTable(uint32_t frame)
+{
+	PageTableHeader header{};
+	header.LevelCount = static_cast<uint32_t>(m_Levels.size());
+	header.CachePagesX = m_CachePagesX;
+	header.PageCount = static_cast<uint32_t>(m_Pages.size());
+	for (uint32_t i = 0; i < m_Levels.size(); ++i)
+	{
+		header.Levels[i][0] = m_Levels[i].Width;
+		header.Levels[i][1] = m_Levels[i].Height;
+		header.Levels[i][2] = m_Levels[i].PagesX;
+		header.Levels[i][3] = m_Levels[i].FirstPage;
+	}
+	uint8_t* data = static_cast<uint8_t*>(m_Frames[frame].PageTableData);
+	memcpy(data, &header, sizeof(header));
+
+	// Entries pack the cache slot and the level it holds. Missing pages inherit the entry of their parent,
+	// filled in from the coarsest level down, where every page is pinned
+	uint32_t* entries = reinterpret_cast<uint32_t*>(data + sizeof(header));
+	for (uint32_t i = static_cast<uint32_t>(m_Levels.size()); i-- > 0;)
+	{
+		const Level& level = m_Levels[i];
+		for (uint32_t pageId = level.FirstPage; pageId < level.FirstPage + level.PagesX * level.PagesY; ++pageId)
+		{
+			const Page& page = m_Pages[pageId];
+			if (page.Slot >= 0)
+			{
+				uint32_t slot = static_cast<uint32_t>(page.Slot);
+				entries[pageId] = slot % m_CachePagesX | slot / m_CachePagesX << 12 | i << 24;
+			}
+			else if (i + 1 < m_Levels.size())
+			{
+				const Level& parent = m_Levels[i + 1];
+				entries[pageId] = entries[parent.FirstPage + std::min(page.Y / 2, parent.PagesY - 1) * parent.PagesX + std::min(page.X / 2, parent.PagesX - 1)];
+			}
+			else
+			{
+				entries[pageId] = 0;
+			}
+		}
+	}
+}
+
+void VirtualTexture::CreateBuffer(
+	VkDeviceSize size,
+	VkBufferUsageFlags usage,
+	VkBuffer& buffer,
+	VkDeviceMemory& bufferMemory,
+	void** mappedData,
+	MemoryBudget::Category category)
+{
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = size;
+	bufferInfo.usage = usage;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	if (vkCreateBuffer(m_Device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create virtual texture buffer");
+	}
+
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(m_Device, buffer, &memRequirements);
+
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = memRequirements.size;
+	allocInfo.memoryTypeIndex = FindMemoryType(
+		memRequirements.memoryTypeBits,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	bufferMemory = m_MemoryBudget->Allocate(allocInfo, category);
+	vkBindBufferMemory(m_Device, buffer, bufferMemory, 0);
+
+	// Host accessed every frame, so they stay mapped
+	vkMapMemory(m_Device, bufferMemory, 0, size, 0, mappedData);
+}
+
+uint32_t VirtualTexture::FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties)
+{
+	VkPhysicalDeviceMemoryProperties memProperties;
+	vkGetPhysicalDeviceMemoryProperties(m_PhysicalDevice, &memProperties);
+	for (uint32_t i = 0; i < memProperties.memoryTypeCount; ++i)
+	{
+		if (typeFilter & (1 << i) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties)
+		{
+			return i;
+		}
+	}
+
+	throw std::runtime_error("Failed to find suitable memory type");
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <list>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+#include "BindlessHeap.h"
+#include "MemoryBudget.h"
+#include "TextureData.h"
+
+// Bindless indices of a virtual texture's resources for one frame, read by the fragment shader from the uniform buffer
+struct VirtualTextureIndices
+{
+	uint32_t PageTableIndex;    // Storage buffer with the level table and one entry per virtual page
+	uint32_t FeedbackIndex;     // Storage buffer with one bit per virtual page, set by the fragments that need it
+	uint32_t CacheTextureIndex;
+	uint32_t CacheSamplerIndex;
+	uint32_t Enabled;
+	uint32_t FrameIndex;        // Rotates the pixels that write feedback
+	uint32_t Padding[2];
+};
+
+// Texture split into pages of its mip chain, of which only the ones the GPU asks for are resident.
+// Resident pages live in a physical cache texture sized by a VRAM budget, the least recently used are evicted
+class VirtualTexture
+{
+public:
+	void Setup(
+		VkDevice device,
+		VkPhysicalDevice physicalDevice,
+		BindlessHeap* bindlessHeap,
+		MemoryBudget* memoryBudget,
+		uint32_t framesInFlight,
+		const TextureData& texture,
+		VkDeviceSize budget);
+	void Destroy();
+
+	// Collects the pages requested by the frame's fragments. Its submissions must have completed
+	void ReadFeedback(uint32_t frame);
+	// Uploads requested pages, rewrites the frame's page table and clears its feedback. Records outside render passes
+	void RecordUpdates(VkCommandBuffer commandBuffer, uint32_t frame);
+	// Makes the feedback written by the frame's draws visible to ReadFeedback
+	void RecordFeedbackBarrier(VkCommandBuffer commandBuffer, uint32_t frame);
+
+	VirtualTextureIndices GetShaderIndices(uint32_t frame) const;
+	uint32_t GetPageCount() const { return static_cast<uint32_t>(m_Pages.size()); }
+	uint32_t GetResidentPageCount() const { return m_CacheSlotCount - static_cast<uint32_t>(m_FreeSlots.size()); }
+	uint32_t GetUploadCount() const { return m_UploadCount; }
+
+	// Pages are square with a border of neighboring texels, so bilinear filtering never reads another page
+	static constexpr uint32_t s_PageSize = 128;
+	static constexpr uint32_t s_PageBorder = 4;
+	static constexpr uint32_t s_PageContent = s_PageSize - 2 * s_PageBorder;
+	static constexpr uint32_t s_MaxLevels = 16;
+	static constexpr uint32_t s_MaxUploadsPerFrame = 16;
+	static constexpr uint32_t s_EvictionGraceFrames = 8; // Feedback is sampled sparsely, so recently used pages are kept a while
+
+private:
+	// Matches the header of the page table buffer in virtualtexture.glsl
+	struct PageTableHeader
+	{
+		uint32_t LevelCount;
+		uint32_t CachePagesX;
+		uint32_t PageCount;
+		uint32_t Padding;
+		uint32_t Levels[s_MaxLevels][4]; // Width, height, pages along x and first page
+	};
+
+	struct Level
+	{
+		uint32_t Width;
+		uint32_t Height;
+		uint32_t PagesX;
+		uint32_t PagesY;
+		uint32_t FirstPage;
+	};
+
+	struct Page
+	{
+		uint32_t Level;
+		uint32_t X;
+		uint32_t Y;
+		int32_t Slot = -1;
+		bool Pinned = false; // Levels that fit in one page stay resident, so every lookup has a fallback
+		uint64_t LastUsedFrame = 0;
+		std::list<uint32_t>::iterator LruPosition;
+	};
+
+	struct FrameResources
+	{
+		VkBuffer PageTable;
+		VkDeviceMemory PageTableMemory;
+		void* PageTableData;
+		uint32_t PageTableIndex;
+		VkBuffer Feedback;
+		VkDeviceMemory FeedbackMemory;
+		void* FeedbackData;
+		uint32_t FeedbackIndex;
+		VkBuffer Staging;
+		VkDeviceMemory StagingMemory;
+		void* StagingData;
+		bool FeedbackPending = false;
+	};
+
+	void CopyPage(const Page& page, uint8_t* destination) const;
+	bool AcquireSlot(uint32_t& slot);
+	void Touch(uint32_t pageId);
+	void WritePageTable(uint32_t frame);
+	void CreateBuffer(
+		VkDeviceSize size,
+		VkBufferUsageFlags usage,
+		VkBuffer& buffer,
+		VkDeviceMemory& bufferMemory,
+		void** mappedData,
+		MemoryBudget::Category category);
+	uint32_t FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
+
+	VkDevice m_Device;
+	VkPhysicalDevice m_PhysicalDevice;
+	BindlessHeap* m_BindlessHeap;
+	MemoryBudget* m_MemoryBudget;
+	uint32_t m_FramesInFlight;
+	VkDeviceSize m_PageBytes;
+	VkDeviceSize m_FeedbackBytes;
+
+	// Kept in system memory, pages are copied out of it on demand
+	TextureData m_Source;
+	std::vector<Level> m_Levels;
+	std::vector<Page> m_Pages;
+	std::list<uint32_t> m_Lru; // Resident pages that may be evicted, most recently used first
+	std::vector<uint32_t> m_Requests; // Missing pages from the last feedback, coarsest first
+	uint64_t m_FrameNumber = 0;
+	uint32_t m_UploadCount = 0;
+
+	// Physical cache, a square grid of pages
+	VkImage m_CacheImage = VK_NULL_HANDLE;
+	VkDeviceMemory m_CacheMemory = VK_NULL_HANDLE;
+	VkImageView m_CacheView = VK_NULL_HANDLE;
+	VkSampler m_CacheSampler = VK_NULL_HANDLE;
+	uint32_t m_CacheTextureIndex;
+	uint32_t m_CacheSamplerIndex;
+	uint32_t m_CachePagesX;
+	uint32_t m_CacheSlotCount;
+	std::vector<uint32_t> m_FreeSlots;
+	bool m_CacheInitialized = false;
+
+	std::vector<FrameResources> m_Frames;
+};
@@ -1,8 +1,14 @@
 #include "Application.h"
 
-int main() {
+int main(int argc, char* argv[]) {
 	Application app;
 
+	// Optional side length of the instance grid, 100 gives 10000 instances
+	if (argc > 1)
+	{
+		app.SetInstanceGridSize(static_cast<uint32_t>(std::strtoul(argv[1], nullptr, 10)));
+	}
+
 	try
 	{
 		app.Run();